@@ -1,4 +1,5 @@
 require "mkmf"
+require_relative "generate_symbol_table"
 
 def detect_platform_features
   if have_func("void qsort_r(void *, size_t, size_t, int (*)(const void *, const void *, void *), void *)", "stdlib.h")
@@ -7,6 +8,8 @@ def detect_platform_features
     $defs << "-DHAVE_BSD_QSORT_R"
   end
 
+  have_library("pthread")
+
   $defs << "-DM_PI=#{Math::PI}" unless have_macro("M_PI", "math.h")
   $defs << "-DM_PI_2=#{Math::PI/2}" unless have_macro("M_PI_2", "math.h")
 end
@@ -44,7 +47,39 @@ def set_flags
   $CFLAGS << " -O3 -Wno-unused-function"
 end
 
+# The extension is only ruby417.c; the other sources are standalone tools
+# built with it from the same code, without BUILD_RUBY_EXT.
+TOOLS = { "ruby417d" => "ruby417d.c", "ruby417-locate" => "ruby417_locate.c" }
+
+def set_sources
+  $srcs = %w[ruby417.c]
+  $cleanfiles.concat(TOOLS.keys)
+end
+
+def append_tool_rules
+  File.open("Makefile", "a") do |makefile|
+    TOOLS.each do |tool, source|
+      makefile.puts <<~MAKE
+
+        all: #{tool}
+
+        #{tool}: $(srcdir)/#{source} $(srcdir)/ruby417.c $(srcdir)/ruby417/*.c $(srcdir)/ruby417/*.h
+        \t$(CC) $(INCFLAGS) $(CPPFLAGS) $(CFLAGS) -o $@ $(srcdir)/#{source} -lm -lpthread
+      MAKE
+    end
+  end
+end
+
+def generate_tables
+  print "generating symbol_table.h..."
+  generate_symbol_table("symbol_table.h")
+  puts "done"
+end
+
 detect_platform_features
 set_flags
+set_sources
+generate_tables
 check_imagemagick
 create_makefile("ruby417/ext/ruby417")
+append_tool_rules
@@ -0,0 +1,60 @@
+# Generates symbol_table.h, a lookup table classifying every 17 module pattern
+# as a PDF417 codeword or not. Run by extconf.rb; can also be run by hand, with
+# the output path as the only argument.
+
+require_relative "codeword_patterns"
+
+SYMBOL_MODULES = 17
+SYMBOL_ELEMENTS = 8
+SYMBOL_MAX_ELEMENT = 6
+SYMBOL_CODEWORDS = 929
+
+# The widths of a pattern's elements, bar first.
+def symbol_widths(pattern)
+  (SYMBOL_MODULES - 1).downto(0).map { |bit| pattern[bit] }.chunk_while { |a, b| a == b }.map(&:size)
+end
+
+# Guards against a mistyped pattern: each must be 4 bars and 4 spaces of 1 to 6
+# modules, starting with a bar, in the cluster its (E1 - E3 + E5 - E7) mod 9
+# says, and appear only once.
+def check_codeword_patterns
+  seen = {}
+  CODEWORD_PATTERNS.each_with_index do |patterns, index|
+    raise "cluster #{3*index} has #{patterns.size} codewords" unless patterns.size == SYMBOL_CODEWORDS
+
+    patterns.each_with_index do |pattern, codeword|
+      w = symbol_widths(pattern)
+      if pattern >> (SYMBOL_MODULES - 1) != 1 || w.size != SYMBOL_ELEMENTS || w.max > SYMBOL_MAX_ELEMENT ||
+         (w[0] - w[2] + w[4] - w[6]) % 9 != 3*index || seen[pattern]
+        raise format("codeword %d of cluster %d has a bad pattern, %#x", codeword, 3*index, pattern)
+      end
+      seen[pattern] = true
+    end
+  end
+end
+
+def generate_symbol_table(path)
+  check_codeword_patterns
+
+  # The first module is always dark and the last always light, so the 15 in
+  # between are enough to index by.
+  table = Array.new(1 << (SYMBOL_MODULES - 2), 0)
+  CODEWORD_PATTERNS.each_with_index do |patterns, index|
+    patterns.each_with_index do |pattern, codeword|
+      table[pattern >> 1 & 0x7FFF] = (index + 1) << 11 | codeword
+    end
+  end
+
+  File.open(path, "w") do |f|
+    f.puts "// Generated by generate_symbol_table.rb. Do not edit."
+    f.puts "//"
+    f.puts "// Indexed by the 15 interior modules of a pattern. Each entry is 0 for a"
+    f.puts "// pattern that isn't a codeword, or else holds the cluster divided by 3, plus 1,"
+    f.puts "// in bits 11 and up, and the codeword's value (0 to 928) in the bits below."
+    f.puts "static const unsigned short symbol_table[#{table.size}] = {"
+    table.each_slice(16) { |row| f.puts "  " + row.join(", ") + "," }
+    f.puts "};"
+  end
+end
+
+generate_symbol_table(ARGV[0] || "symbol_table.h") if $0 == __FILE__
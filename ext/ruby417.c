@@ -1,24 +1,119 @@
 #include "ruby417/darray.c"
 #include "ruby417/image.c"
 #include "ruby417/rectangles.c"
+#include "ruby417/morphology.c"
+#include "ruby417/decoder.c"
+#include "ruby417/reed_solomon.c"
+#include "ruby417/rectify.c"
+#include "ruby417/accounting.c"
+#include "ruby417/levels.c"
+#include "ruby417/color.c"
+#include "ruby417/shadows.c"
+#include "ruby417/saliency.c"
+#include "ruby417/gradients.c"
+#include "ruby417/scanlines.c"
+#include "ruby417/simd.c"
+#include "ruby417/cache.c"
 
 #ifdef BUILD_RUBY_EXT
 
+#include <unistd.h> // sysconf
 #include <ruby.h>
+#include <ruby/thread.h>
 
-static VALUE mRuby417, mExt;
+static VALUE mRuby417, mExt, cResultCache, eMemoryBudgetError;
 
 #define ensure_float_percentage(val, name) \
   do { \
     if (val < 0 || val > 1) rb_raise(rb_eRangeError, name " should be between 0 and 1, got %f", val); \
   } while(0)
 
-static VALUE locate_via_guards(VALUE self, VALUE im_data, VALUE width, VALUE height,
-                               VALUE area_threshold, VALUE rectangularity_threshold,
-                               VALUE angle_variation_threshold, VALUE area_variation_threshold,
-                               VALUE width_variation_threshold, VALUE height_variation_threshold,
-                               VALUE guard_aspect_min, VALUE guard_aspect_max,
-                               VALUE barcode_aspect_min, VALUE barcode_aspect_max) {
+// Native calls allocate through the accounted allocator, against an account
+// set up per call: its peak is kept for Ext.peak_memory, its budget comes from
+// Ext.memory_budget, and its outstanding bytes are reported to the garbage
+// collector once the work is done. Both settings are per thread.
+#define MEMORY_BUDGET_KEY "__ruby417_memory_budget"
+#define PEAK_MEMORY_KEY "__ruby417_peak_memory"
+
+static void begin_memory_account(struct memory_account *account) {
+  VALUE budget = rb_thread_local_aref(rb_thread_current(), rb_intern(MEMORY_BUDGET_KEY));
+
+  *account = (struct memory_account) {.budget = NIL_P(budget) ? 0 : NUM2SIZET(budget)};
+  memory_account = account;
+}
+
+static VALUE end_memory_account(VALUE arg) {
+  struct memory_account *account = (struct memory_account *) arg;
+
+  memory_account = NULL;
+  rb_thread_local_aset(rb_thread_current(), rb_intern(PEAK_MEMORY_KEY), SIZET2NUM(atomic_load(&account->peak)));
+  rb_gc_adjust_memory_usage(memory_account_flush(account));
+
+  return Qnil;
+}
+
+// Runs body with a memory account, closing it even if body raises.
+static VALUE with_memory_account(VALUE (*body)(VALUE), VALUE arg) {
+  struct memory_account account;
+  begin_memory_account(&account);
+  return rb_ensure(body, arg, end_memory_account, (VALUE) &account);
+}
+
+// Lets the garbage collector know about memory held while building results.
+static void report_memory_account(void) {
+  if (memory_account) rb_gc_adjust_memory_usage(memory_account_flush(memory_account));
+}
+
+struct accounted_call {
+  void *(*func)(void *);
+  void *arg;
+  struct memory_account *account;
+};
+
+static void *accounted_call_body(void *arg) {
+  struct accounted_call *call = arg;
+  memory_account = call->account;
+  return call->func(call->arg);
+}
+
+// Calls func without the GVL, allocating against this thread's account. Under
+// the M:N scheduler of non-main Ractors a Ruby thread can block on one native
+// thread and resume on another, so the account is carried across explicitly.
+static void call_without_gvl_accounted(void *(*func)(void *), void *arg) {
+  struct accounted_call call = {func, arg, memory_account};
+  rb_thread_call_without_gvl(accounted_call_body, &call, RUBY_UBF_IO, NULL);
+  memory_account = call.account;
+}
+
+static void raise_no_memory(struct memory_account *account) {
+  if (account && atomic_load(&account->exceeded)) {
+    rb_raise(eMemoryBudgetError, "memory budget of %zu bytes exceeded", account->budget);
+  }
+  rb_raise(rb_eNoMemError, "unable to allocate sufficient memory");
+}
+
+// Whether the guard localizer skips tiles that can't hold guards, per thread.
+#define PREFILTER_KEY "__ruby417_prefilter"
+// Whether it screens regions by their moments before fitting them exactly.
+#define FAST_FIT_KEY "__ruby417_fast_fit"
+
+static int online_processors(void) {
+  long processors = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return processors > 1 ? processors : 1;
+}
+
+// Checks the arguments shared by locate_via_guards and decode_via_guards, and
+// converts them to an image and settings for the guard localizer.
+static void guards_arguments(VALUE im_data, VALUE width, VALUE height,
+                             VALUE area_threshold, VALUE rectangularity_threshold,
+                             VALUE angle_variation_threshold, VALUE area_variation_threshold,
+                             VALUE width_variation_threshold, VALUE height_variation_threshold,
+                             VALUE guard_aspect_min, VALUE guard_aspect_max,
+                             VALUE barcode_aspect_min, VALUE barcode_aspect_max,
+                             struct image8 *image, struct pairing_settings *settings) {
   Check_Type(im_data, T_STRING);
   Check_Type(width, T_FIXNUM);
   Check_Type(height, T_FIXNUM);
@@ -56,7 +151,7 @@ static VALUE locate_via_guards(VALUE self, VALUE im_data, VALUE width, VALUE hei
   ensure_float_percentage(c_width_variation_threshold, "width variation threshold");
   ensure_float_percentage(c_height_variation_threshold, "height variation threshold");
 
-  struct pairing_settings settings = {
+  *settings = (struct pairing_settings) {
     .area_threshold = c_area_threshold,
     .rectangularity_threshold = c_rectangularity_threshold,
     .angle_variation_threshold = c_angle_variation_threshold,
@@ -66,79 +161,840 @@ static VALUE locate_via_guards(VALUE self, VALUE im_data, VALUE width, VALUE hei
     .guard_aspect_min = c_guard_aspect_min,
     .guard_aspect_max = c_guard_aspect_max,
     .barcode_aspect_min = c_barcode_aspect_min,
-    .barcode_aspect_max = c_barcode_aspect_max
+    .barcode_aspect_max = c_barcode_aspect_max,
+    .threads = online_processors(),
+    .prefilter = RTEST(rb_thread_local_aref(rb_thread_current(), rb_intern(PREFILTER_KEY))),
+    .fast_fit = RTEST(rb_thread_local_aref(rb_thread_current(), rb_intern(FAST_FIT_KEY)))
   };
 
-  struct image8 image = {
+  *image = (struct image8) {
     .width = c_width,
     .height = c_height,
     .free = NULL,
     .data = (unsigned char *) StringValuePtr(im_data)
   };
+}
 
+// Locates barcodes, and reads their codewords if decode is set. The image is
+// binarized at the middle level, and a copy closed with the given kernels is
+// what guards are located in: closing erases the narrow bars that codewords
+// are read from. With a module size, each barcode is also rectified from the
+// image itself, and the results get the symbol rows (or nil) and the
+// rectified image as [pixels, width, height] (or nil if the corners can't be
+// mapped).
+static VALUE run_guards(struct image8 *image, struct pairing_settings *settings,
+                        struct morphology_kernel *closings, int num_closings, bool decode, int module_size) {
   VALUE located_barcodes = rb_ary_new();
-  struct image32 *labeled;
-  struct darray *regions = NULL, *hull = NULL, *rects = NULL, *pairs = NULL;
-  struct rectangle *rect;
-
-  if (!(labeled=image_label_regions(&image, malloc, realloc, free)) ||
-      !(regions=image_extract_regions(&image, labeled, malloc, realloc, free)) ||
-      !(hull=darray_new(0, NULL, malloc, realloc, free)) ||
-      !(rects=darray_new(0, free, malloc, realloc, free)) ||
-      !(pairs=darray_new(0, free, malloc, realloc, free))) goto oom;
-
-  for (unsigned i = 0; i < regions->len; i++) {
-    struct region *region = darray_index(regions, i);
-
-    if (region->area >= c_area_threshold && region->boundary->len > 2) {
-      if (!boundary_convex_hull(region->boundary, hull)) goto oom;
-      if (hull->len > 2) {
-        if (!(rect = malloc(sizeof(*rect)))) goto oom;
-        hull_minimal_rectangle(hull, region->area, rect);
-        if (!darray_push(rects, rect)) {
-          free(rect);
-          goto oom;
-        }
-      }
-      hull->len = 0; // reset for reuse, no freeing necessary
+  struct image1 *binary, *closed = NULL;
+  struct darray *rects = NULL, *pairs = NULL;
+  struct symbol_matrix *matrix;
+  struct image8 *rectified;
+
+  if (!(binary=image8_binarize(image, 128, accounted_malloc, accounted_free))) goto oom;
+  if (num_closings) {
+    if (!(closed=image8_binarize(image, 128, accounted_malloc, accounted_free))) goto oom;
+    for (int k = 0; k < num_closings; k++) {
+      if (!image1_morphology(closed, MORPHOLOGY_CLOSE, &closings[k], accounted_malloc, accounted_free)) goto oom;
     }
   }
-
-  if (!pair_aligned_rectangles(&settings, rects, pairs)) goto oom;
+  if (!(rects=darray_new(0, accounted_free, accounted_malloc, accounted_realloc, accounted_free)) ||
+      !(pairs=darray_new(0, accounted_free, accounted_malloc, accounted_realloc, accounted_free)) ||
+      !image1_locate_guards(closed ? closed : binary, settings, rects, pairs)) goto oom;
+  // the closed image was only for locating
+  image1_free(closed);
+  closed = NULL;
+  report_memory_account();
 
   for (unsigned i = 0; i < pairs->len; i++) {
     struct rectangle_pair *pair = darray_index(pairs, i);
     struct barcode_corners corners;
+    bool upside_down = false;
     determine_barcode_corners(pair, &corners);
     VALUE barcode_data = rb_ary_new_from_args(9, DBL2NUM(pair->score),
                                                  INT2FIX(corners.upper_left.x), INT2FIX(corners.upper_left.y),
                                                  INT2FIX(corners.lower_left.x), INT2FIX(corners.lower_left.y),
                                                  INT2FIX(corners.lower_right.x), INT2FIX(corners.lower_right.y),
                                                  INT2FIX(corners.upper_right.x), INT2FIX(corners.upper_right.y));
+
+    if (decode) {
+      if (!(matrix=image1_read_symbol(binary, pair, &corners, accounted_malloc, accounted_free))) goto oom;
+      VALUE rows = rb_ary_new_capa(matrix->rows);
+      for (int r = 0; r < matrix->rows; r++) {
+        VALUE row = rb_ary_new_capa(matrix->columns);
+        for (int c = 0; c < matrix->columns; c++) {
+          int codeword = symbol_matrix_get(matrix, r, c);
+          rb_ary_push(row, codeword >= 0 ? INT2FIX(codeword) : Qnil);
+        }
+        rb_ary_push(rows, row);
+      }
+      upside_down = matrix->upside_down;
+      symbol_matrix_free(matrix);
+      rb_ary_push(barcode_data, rows);
+    } else if (module_size) {
+      rb_ary_push(barcode_data, Qnil);
+    }
+
+    if (module_size) {
+      // once the reading direction is known, the rectified image comes out upright
+      struct barcode_corners upright = corners;
+      if (upside_down) {
+        upright = (struct barcode_corners) {
+          .upper_left = corners.lower_right, .upper_right = corners.lower_left,
+          .lower_left = corners.upper_right, .lower_right = corners.upper_left
+        };
+      }
+      if (!(rectified=image8_rectify(image, pair, &upright, module_size, accounted_malloc, accounted_free))) goto oom;
+      if (rectified->width && rectified->height) {
+        rb_ary_push(barcode_data, rb_ary_new_from_args(3, rb_str_new((char *) rectified->data, rectified->width*rectified->height),
+                                                          INT2FIX(rectified->width), INT2FIX(rectified->height)));
+      } else {
+        rb_ary_push(barcode_data, Qnil);
+      }
+      image8_free(rectified);
+    }
+
     rb_ary_push(located_barcodes, barcode_data);
   }
 
-  image32_free(labeled);
-  darray_free(regions, true);
-  darray_free(hull, false);
+  image1_free(binary);
   darray_free(rects, true);
   darray_free(pairs, true);
   return located_barcodes;
 
 oom:
-  image32_free(labeled);
-  darray_free(regions, true);
-  darray_free(hull, false);
+  image1_free(binary);
+  image1_free(closed);
   darray_free(rects, true);
   darray_free(pairs, true);
-  rb_raise(rb_eNoMemError, "unable to allocate sufficient memory");
+  raise_no_memory(memory_account);
+  return Qnil;
+}
+
+struct guards_call {
+  struct image8 *image;
+  struct pairing_settings *settings;
+  bool close;
+  bool decode;
+  int module_size;
+};
+
+static VALUE run_guards_call(VALUE arg) {
+  struct guards_call *call = (struct guards_call *) arg;
+  // the same closings as full preprocessing
+  struct morphology_kernel closings[] = {{3, 6, true}, {7, 7, false}};
+  return run_guards(call->image, call->settings, closings, call->close ? 2 : 0, call->decode, call->module_size);
+}
+
+static VALUE run_guards_accounted(struct image8 *image, struct pairing_settings *settings, bool close,
+                                  bool decode, int module_size) {
+  struct guards_call call = {image, settings, close, decode, module_size};
+  return with_memory_account(run_guards_call, (VALUE) &call);
+}
+
+static VALUE locate_via_guards(VALUE self, VALUE im_data, VALUE width, VALUE height,
+                               VALUE area_threshold, VALUE rectangularity_threshold,
+                               VALUE angle_variation_threshold, VALUE area_variation_threshold,
+                               VALUE width_variation_threshold, VALUE height_variation_threshold,
+                               VALUE guard_aspect_min, VALUE guard_aspect_max,
+                               VALUE barcode_aspect_min, VALUE barcode_aspect_max) {
+  struct image8 image;
+  struct pairing_settings settings;
+  guards_arguments(im_data, width, height, area_threshold, rectangularity_threshold,
+                   angle_variation_threshold, area_variation_threshold,
+                   width_variation_threshold, height_variation_threshold,
+                   guard_aspect_min, guard_aspect_max, barcode_aspect_min, barcode_aspect_max,
+                   &image, &settings);
+  return run_guards_accounted(&image, &settings, false, false, 0);
+}
+
+// Like locate_via_guards, but for a grayscale image, which is binarized at the
+// middle level and, with close set, closed the way full preprocessing does
+// before locating, and each barcode also gets the codewords read from the
+// image as binarized, as rows of codewords (nil where unreadable), top row
+// first.
+static VALUE decode_via_guards(VALUE self, VALUE im_data, VALUE width, VALUE height,
+                               VALUE area_threshold, VALUE rectangularity_threshold,
+                               VALUE angle_variation_threshold, VALUE area_variation_threshold,
+                               VALUE width_variation_threshold, VALUE height_variation_threshold,
+                               VALUE guard_aspect_min, VALUE guard_aspect_max,
+                               VALUE barcode_aspect_min, VALUE barcode_aspect_max, VALUE close) {
+  struct image8 image;
+  struct pairing_settings settings;
+  guards_arguments(im_data, width, height, area_threshold, rectangularity_threshold,
+                   angle_variation_threshold, area_variation_threshold,
+                   width_variation_threshold, height_variation_threshold,
+                   guard_aspect_min, guard_aspect_max, barcode_aspect_min, barcode_aspect_max,
+                   &image, &settings);
+  return run_guards_accounted(&image, &settings, RTEST(close), true, 0);
+}
+
+// Like decode_via_guards, but each barcode gets its symbol rows only if decode
+// is set (nil otherwise), and also a straightened image of it, warped from the
+// grayscale image given, with module_size pixels per module, as [pixels,
+// width, height].
+static VALUE rectify_via_guards(int argc, VALUE *argv, VALUE self) {
+  struct image8 image;
+  struct pairing_settings settings;
+  // more arguments than a method can take one by one: the guards arguments,
+  // then module_size, decode and close
+  rb_check_arity(argc, 16, 16);
+  VALUE module_size = argv[13], decode = argv[14], close = argv[15];
+  guards_arguments(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8],
+                   argv[9], argv[10], argv[11], argv[12], &image, &settings);
+  Check_Type(module_size, T_FIXNUM);
+
+  int c_module_size = FIX2INT(module_size);
+  if (c_module_size < 1 || c_module_size > RECTIFY_MAX_MODULE_SIZE) {
+    rb_raise(rb_eRangeError, "module size should be between 1 and %i, got %i", RECTIFY_MAX_MODULE_SIZE, c_module_size);
+  }
+
+  return run_guards_accounted(&image, &settings, RTEST(close), RTEST(decode), c_module_size);
+}
+
+struct levels_call {
+  VALUE im_data;
+  struct image8 *image;
+  unsigned char *thresholds;
+  int num_levels;
+  struct morphology_kernel *closings;
+  int num_closings;
+  struct pairing_settings *settings;
+  int threads;
+  struct darray *found;
+};
+
+static void *levels_without_gvl(void *arg) {
+  struct levels_call *call = arg;
+  call->found = image8_locate_guards_levels(call->image, call->thresholds, call->num_levels,
+                                            call->closings, call->num_closings, call->settings,
+                                            call->threads, accounted_malloc, accounted_realloc, accounted_free);
+  return NULL;
+}
+
+static VALUE run_levels(VALUE arg) {
+  struct levels_call *call = (struct levels_call *) arg;
+
+  // keep the pixels in place while the GVL is released
+  rb_str_locktmp(call->im_data);
+  call_without_gvl_accounted(levels_without_gvl, call);
+  rb_str_unlocktmp(call->im_data);
+  if (!call->found) raise_no_memory(memory_account);
+  report_memory_account();
+
+  VALUE located_barcodes = rb_ary_new_capa(call->found->len);
+  for (unsigned i = 0; i < call->found->len; i++) {
+    struct located_guards *located = darray_index(call->found, i);
+    struct barcode_corners *corners = &located->corners;
+    rb_ary_push(located_barcodes, rb_ary_new_from_args(9, DBL2NUM(located->score),
+                                                          INT2FIX(corners->upper_left.x), INT2FIX(corners->upper_left.y),
+                                                          INT2FIX(corners->lower_left.x), INT2FIX(corners->lower_left.y),
+                                                          INT2FIX(corners->lower_right.x), INT2FIX(corners->lower_right.y),
+                                                          INT2FIX(corners->upper_right.x), INT2FIX(corners->upper_right.y)));
+  }
+  darray_free(call->found, true);
+
+  return located_barcodes;
+}
+
+// Like locate_via_guards, but for a grayscale image, which is binarized at each
+// of the given thresholds (0 to 255) and, with close set, closed the way full
+// preprocessing does. The levels run concurrently, outside the GVL, and a
+// barcode found at several of them is reported once, at its best score.
+static VALUE locate_via_guards_levels(VALUE self, VALUE im_data, VALUE width, VALUE height,
+                                      VALUE area_threshold, VALUE rectangularity_threshold,
+                                      VALUE angle_variation_threshold, VALUE area_variation_threshold,
+                                      VALUE width_variation_threshold, VALUE height_variation_threshold,
+                                      VALUE guard_aspect_min, VALUE guard_aspect_max,
+                                      VALUE barcode_aspect_min, VALUE barcode_aspect_max,
+                                      VALUE thresholds, VALUE close) {
+  struct image8 image;
+  struct pairing_settings settings;
+  guards_arguments(im_data, width, height, area_threshold, rectangularity_threshold,
+                   angle_variation_threshold, area_variation_threshold,
+                   width_variation_threshold, height_variation_threshold,
+                   guard_aspect_min, guard_aspect_max, barcode_aspect_min, barcode_aspect_max,
+                   &image, &settings);
+  Check_Type(thresholds, T_ARRAY);
+
+  long num_levels = RARRAY_LEN(thresholds);
+  unsigned char c_thresholds[LEVELS_MAX];
+  if (num_levels < 1 || num_levels > LEVELS_MAX) {
+    rb_raise(rb_eRangeError, "between 1 and %i thresholds are needed, got %li", LEVELS_MAX, num_levels);
+  }
+  for (long i = 0; i < num_levels; i++) {
+    VALUE threshold = rb_ary_entry(thresholds, i);
+    Check_Type(threshold, T_FIXNUM);
+    long value = FIX2LONG(threshold);
+    if (value < 0 || value > 255) rb_raise(rb_eRangeError, "thresholds should be between 0 and 255, got %li", value);
+    c_thresholds[i] = value;
+  }
+
+  // the same closings as full preprocessing
+  struct morphology_kernel closings[] = {{3, 6, true}, {7, 7, false}};
+  int processors = online_processors();
+  // the levels share the processors
+  settings.threads = processors / num_levels;
+  struct levels_call call = {
+    .im_data = im_data,
+    .image = &image,
+    .thresholds = c_thresholds,
+    .num_levels = num_levels,
+    .closings = closings,
+    .num_closings = RTEST(close) ? 2 : 0,
+    .settings = &settings,
+    .threads = processors,
+    .found = NULL
+  };
+
+  return with_memory_account(run_levels, (VALUE) &call);
+}
+
+struct gradients_call {
+  VALUE im_data;
+  struct image8 *image;
+  struct gradient_settings *settings;
+  struct darray *found;
+};
+
+static void *gradients_without_gvl(void *arg) {
+  struct gradients_call *call = arg;
+  call->found = image8_locate_gradients(call->image, call->settings, accounted_malloc, accounted_realloc, accounted_free);
+  return NULL;
+}
+
+static VALUE run_gradients(VALUE arg) {
+  struct gradients_call *call = (struct gradients_call *) arg;
+
+  rb_str_locktmp(call->im_data);
+  call_without_gvl_accounted(gradients_without_gvl, call);
+  rb_str_unlocktmp(call->im_data);
+  if (!call->found) raise_no_memory(memory_account);
+  report_memory_account();
+
+  VALUE located_barcodes = rb_ary_new_capa(call->found->len);
+  for (unsigned i = 0; i < call->found->len; i++) {
+    struct located_barcode *located = darray_index(call->found, i);
+    struct barcode_corners *corners = &located->corners;
+    rb_ary_push(located_barcodes, rb_ary_new_from_args(9, DBL2NUM(located->score),
+                                                          INT2FIX(corners->upper_left.x), INT2FIX(corners->upper_left.y),
+                                                          INT2FIX(corners->lower_left.x), INT2FIX(corners->lower_left.y),
+                                                          INT2FIX(corners->lower_right.x), INT2FIX(corners->lower_right.y),
+                                                          INT2FIX(corners->upper_right.x), INT2FIX(corners->upper_right.y)));
+  }
+  darray_free(call->found, true);
+
+  return located_barcodes;
+}
+
+// Locates barcodes in a grayscale image by the gradients of their bars rather
+// than by their guards, so a barcode needs at least area_threshold pixels and
+// a length along its rows between barcode_aspect_min and barcode_aspect_max
+// times its height (no maximum if 0). The results are like locate_via_guards'.
+static VALUE locate_via_gradients(VALUE self, VALUE im_data, VALUE width, VALUE height,
+                                  VALUE area_threshold, VALUE barcode_aspect_min, VALUE barcode_aspect_max) {
+  Check_Type(im_data, T_STRING);
+  Check_Type(width, T_FIXNUM);
+  Check_Type(height, T_FIXNUM);
+  Check_Type(area_threshold, T_FIXNUM);
+  Check_Type(barcode_aspect_min, T_FIXNUM);
+  Check_Type(barcode_aspect_max, T_FIXNUM);
+
+  int c_width  = FIX2INT(width),
+      c_height = FIX2INT(height);
+
+  if (RSTRING_LEN(im_data) != c_width*c_height) {
+    rb_raise(rb_eEOFError, "image data and dimensions (%ix%i) do not align", c_width, c_height);
+  } else if (c_width < 0 || c_height < 0) {
+    rb_raise(rb_eRangeError, "image dimensions are negative (%ix%i)", c_width, c_height);
+  }
+
+  struct image8 image = {
+    .width = c_width,
+    .height = c_height,
+    .free = NULL,
+    .data = (unsigned char *) StringValuePtr(im_data)
+  };
+  struct gradient_settings settings = {
+    .area_threshold = FIX2LONG(area_threshold),
+    .barcode_aspect_min = FIX2INT(barcode_aspect_min),
+    .barcode_aspect_max = FIX2INT(barcode_aspect_max)
+  };
+  struct gradients_call call = {
+    .im_data = im_data,
+    .image = &image,
+    .settings = &settings,
+    .found = NULL
+  };
+
+  return with_memory_account(run_gradients, (VALUE) &call);
+}
+
+struct scanlines_call {
+  VALUE im_data;
+  struct image8 *image;
+  struct scanline_settings *settings;
+  struct darray *rects, *pairs;
+  bool ok;
+};
+
+static void *scanlines_without_gvl(void *arg) {
+  struct scanlines_call *call = arg;
+  // the image is expected to be thresholded already, so any level will do
+  struct image1 *binary = image8_binarize(call->image, 128, accounted_malloc, accounted_free);
+  call->ok = binary && image1_locate_scanlines(binary, call->settings, call->rects, call->pairs);
+  image1_free(binary);
+  return NULL;
+}
+
+static VALUE run_scanlines(VALUE arg) {
+  struct scanlines_call *call = (struct scanlines_call *) arg;
+
+  if (!(call->rects=darray_new(0, accounted_free, accounted_malloc, accounted_realloc, accounted_free)) ||
+      !(call->pairs=darray_new(0, accounted_free, accounted_malloc, accounted_realloc, accounted_free))) {
+    darray_free(call->rects, true);
+    raise_no_memory(memory_account);
+  }
+  rb_str_locktmp(call->im_data);
+  call_without_gvl_accounted(scanlines_without_gvl, call);
+  rb_str_unlocktmp(call->im_data);
+  if (!call->ok) {
+    darray_free(call->rects, true);
+    darray_free(call->pairs, true);
+    raise_no_memory(memory_account);
+  }
+  report_memory_account();
+
+  VALUE located_barcodes = rb_ary_new_capa(call->pairs->len);
+  for (unsigned i = 0; i < call->pairs->len; i++) {
+    struct rectangle_pair *pair = darray_index(call->pairs, i);
+    struct barcode_corners corners;
+    determine_barcode_corners(pair, &corners);
+    rb_ary_push(located_barcodes, rb_ary_new_from_args(9, DBL2NUM(pair->score),
+                                                          INT2FIX(corners.upper_left.x), INT2FIX(corners.upper_left.y),
+                                                          INT2FIX(corners.lower_left.x), INT2FIX(corners.lower_left.y),
+                                                          INT2FIX(corners.lower_right.x), INT2FIX(corners.lower_right.y),
+                                                          INT2FIX(corners.upper_right.x), INT2FIX(corners.upper_right.y)));
+  }
+  darray_free(call->rects, true);
+  darray_free(call->pairs, true);
+
+  return located_barcodes;
+}
+
+// Locates barcodes in a thresholded image by their start and stop patterns,
+// read along every step-th row, and column too with columns set, without
+// labeling the image. The results are like locate_via_guards'.
+static VALUE locate_via_scanlines(VALUE self, VALUE im_data, VALUE width, VALUE height, VALUE step, VALUE columns) {
+  Check_Type(im_data, T_STRING);
+  Check_Type(width, T_FIXNUM);
+  Check_Type(height, T_FIXNUM);
+  Check_Type(step, T_FIXNUM);
+
+  int c_width  = FIX2INT(width),
+      c_height = FIX2INT(height),
+      c_step = FIX2INT(step);
+
+  if (RSTRING_LEN(im_data) != c_width*c_height) {
+    rb_raise(rb_eEOFError, "image data and dimensions (%ix%i) do not align", c_width, c_height);
+  } else if (c_width < 0 || c_height < 0) {
+    rb_raise(rb_eRangeError, "image dimensions are negative (%ix%i)", c_width, c_height);
+  } else if (c_step < 1) {
+    rb_raise(rb_eRangeError, "scanline step must be positive, got %i", c_step);
+  }
+
+  struct image8 image = {
+    .width = c_width,
+    .height = c_height,
+    .free = NULL,
+    .data = (unsigned char *) StringValuePtr(im_data)
+  };
+  struct scanline_settings settings = {
+    .step = c_step,
+    .columns = RTEST(columns),
+    .polarity = LABEL_DARK
+  };
+  struct scanlines_call call = {
+    .im_data = im_data,
+    .image = &image,
+    .settings = &settings
+  };
+
+  return with_memory_account(run_scanlines, (VALUE) &call);
+}
+
+static VALUE morphology(VALUE self, VALUE im_data, VALUE width, VALUE height, VALUE operation,
+                        VALUE kernel_width, VALUE kernel_height, VALUE hollow) {
+  Check_Type(im_data, T_STRING);
+  Check_Type(width, T_FIXNUM);
+  Check_Type(height, T_FIXNUM);
+  Check_Type(operation, T_SYMBOL);
+  Check_Type(kernel_width, T_FIXNUM);
+  Check_Type(kernel_height, T_FIXNUM);
+
+  int c_width  = FIX2INT(width),
+      c_height = FIX2INT(height);
+  ID c_operation = SYM2ID(operation);
+  enum morphology_operation op;
+  struct morphology_kernel kernel = {
+    .width = FIX2INT(kernel_width),
+    .height = FIX2INT(kernel_height),
+    .hollow = RTEST(hollow)
+  };
+
+  if (RSTRING_LEN(im_data) != c_width*c_height) {
+    rb_raise(rb_eEOFError, "image data and dimensions (%ix%i) do not align", c_width, c_height);
+  } else if (c_width < 0 || c_height < 0) {
+    rb_raise(rb_eRangeError, "image dimensions are negative (%ix%i)", c_width, c_height);
+  } else if (kernel.width < 1 || kernel.height < 1) {
+    rb_raise(rb_eRangeError, "kernel dimensions must be positive (%ix%i)", kernel.width, kernel.height);
+  }
+
+  if (c_operation == rb_intern("erode")) op = MORPHOLOGY_ERODE;
+  else if (c_operation == rb_intern("dilate")) op = MORPHOLOGY_DILATE;
+  else if (c_operation == rb_intern("open")) op = MORPHOLOGY_OPEN;
+  else if (c_operation == rb_intern("close")) op = MORPHOLOGY_CLOSE;
+  else rb_raise(rb_eArgError, "unknown morphology operation :%s", rb_id2name(c_operation));
+
+  VALUE result = rb_str_new(RSTRING_PTR(im_data), RSTRING_LEN(im_data));
+  struct image8 image = {
+    .width = c_width,
+    .height = c_height,
+    .free = NULL,
+    .data = (unsigned char *) RSTRING_PTR(result)
+  };
+
+  struct memory_account account;
+  begin_memory_account(&account);
+  bool ok = image_morphology(&image, op, &kernel, accounted_malloc, accounted_free);
+  end_memory_account((VALUE) &account);
+  if (!ok) raise_no_memory(&account);
+
+  return result;
+}
+
+// Converts a camera or decoded image buffer to the 8-bit grayscale the
+// localizers take, optionally normalized. Without normalizing, grayscale input
+// and the Y plane of NV12 are returned as shared substrings, without copying.
+static VALUE luma(VALUE self, VALUE data, VALUE width, VALUE height, VALUE format, VALUE normalize) {
+  Check_Type(data, T_STRING);
+  Check_Type(width, T_FIXNUM);
+  Check_Type(height, T_FIXNUM);
+  Check_Type(format, T_SYMBOL);
+
+  int c_width  = FIX2INT(width),
+      c_height = FIX2INT(height);
+  ID c_format = SYM2ID(format);
+  enum pixel_format pixel_format;
+
+  if (c_format == rb_intern("gray")) pixel_format = PIXEL_FORMAT_GRAY;
+  else if (c_format == rb_intern("rgb")) pixel_format = PIXEL_FORMAT_RGB;
+  else if (c_format == rb_intern("rgba")) pixel_format = PIXEL_FORMAT_RGBA;
+  else if (c_format == rb_intern("bgra")) pixel_format = PIXEL_FORMAT_BGRA;
+  else if (c_format == rb_intern("nv12")) pixel_format = PIXEL_FORMAT_NV12;
+  else if (c_format == rb_intern("yuyv")) pixel_format = PIXEL_FORMAT_YUYV;
+  else rb_raise(rb_eArgError, "unknown pixel format :%s", rb_id2name(c_format));
+
+  long size = pixel_format_size(pixel_format, c_width, c_height);
+  if (c_width < 0 || c_height < 0) {
+    rb_raise(rb_eRangeError, "image dimensions are negative (%ix%i)", c_width, c_height);
+  } else if (size < 0) {
+    rb_raise(rb_eRangeError, "image dimensions (%ix%i) must be even for :%s", c_width, c_height, rb_id2name(c_format));
+  } else if (RSTRING_LEN(data) != size) {
+    rb_raise(rb_eEOFError, "image data and dimensions (%ix%i) do not align", c_width, c_height);
+  }
+
+  if (!RTEST(normalize) && (pixel_format == PIXEL_FORMAT_GRAY || pixel_format == PIXEL_FORMAT_NV12)) {
+    return rb_str_subseq(data, 0, (long) c_width*c_height);
+  }
+
+  VALUE result = rb_str_new(NULL, (long) c_width*c_height);
+  struct image8 image = {
+    .width = c_width,
+    .height = c_height,
+    .free = NULL,
+    .data = (unsigned char *) RSTRING_PTR(result)
+  };
+  unsigned histogram[256];
+
+  image8_luma((unsigned char *) RSTRING_PTR(data), pixel_format, &image, RTEST(normalize) ? histogram : NULL);
+  if (RTEST(normalize)) image8_normalize(&image, histogram);
+
+  return result;
+}
+
+// Divides a grayscale image by its blurred background to even out shadows,
+// then binarizes it at threshold (0 to 255) if given, or leaves it gray if nil.
+static VALUE remove_shadows(VALUE self, VALUE im_data, VALUE width, VALUE height, VALUE threshold) {
+  Check_Type(im_data, T_STRING);
+  Check_Type(width, T_FIXNUM);
+  Check_Type(height, T_FIXNUM);
+
+  int c_width  = FIX2INT(width),
+      c_height = FIX2INT(height),
+      c_threshold = -1;
+
+  if (!NIL_P(threshold)) {
+    Check_Type(threshold, T_FIXNUM);
+    c_threshold = FIX2INT(threshold);
+  }
+
+  if (RSTRING_LEN(im_data) != c_width*c_height) {
+    rb_raise(rb_eEOFError, "image data and dimensions (%ix%i) do not align", c_width, c_height);
+  } else if (c_width < 0 || c_height < 0) {
+    rb_raise(rb_eRangeError, "image dimensions are negative (%ix%i)", c_width, c_height);
+  } else if (!NIL_P(threshold) && (c_threshold < 0 || c_threshold > 255)) {
+    rb_raise(rb_eRangeError, "threshold must be between 0 and 255, got %i", c_threshold);
+  }
+
+  VALUE result = rb_str_new(RSTRING_PTR(im_data), RSTRING_LEN(im_data));
+  struct image8 image = {
+    .width = c_width,
+    .height = c_height,
+    .free = NULL,
+    .data = (unsigned char *) RSTRING_PTR(result)
+  };
+
+  struct memory_account account;
+  begin_memory_account(&account);
+  bool ok = image8_remove_shadows(&image, c_threshold, accounted_malloc, accounted_free);
+  end_memory_account((VALUE) &account);
+  if (!ok) raise_no_memory(&account);
+
+  return result;
 }
 
+// Corrects PDF417 codewords, the last num_ec of which are for error correction.
+// Nils mark codewords that couldn't be read, which are treated as erasures.
+// Returns the corrected codewords, or nil if there are too many errors.
+static VALUE correct_codewords(VALUE self, VALUE codewords, VALUE num_ec) {
+  Check_Type(codewords, T_ARRAY);
+  Check_Type(num_ec, T_FIXNUM);
+
+  long count = RARRAY_LEN(codewords);
+  int c_num_ec = FIX2INT(num_ec), num_erasures = 0;
+  unsigned c_codewords[RS_MAX_CODEWORDS];
+  int erasures[RS_MAX_CODEWORDS];
+
+  if (count > RS_MAX_CODEWORDS) {
+    rb_raise(rb_eRangeError, "too many codewords (%li), at most %i fit in a symbol", count, RS_MAX_CODEWORDS);
+  } else if (c_num_ec < 1 || c_num_ec > RS_MAX_EC || c_num_ec >= count) {
+    rb_raise(rb_eRangeError, "invalid number of error correction codewords (%i)", c_num_ec);
+  }
+
+  for (long i = 0; i < count; i++) {
+    VALUE codeword = rb_ary_entry(codewords, i);
+    if (NIL_P(codeword)) {
+      erasures[num_erasures++] = i;
+      c_codewords[i] = 0;
+    } else {
+      Check_Type(codeword, T_FIXNUM);
+      long value = FIX2LONG(codeword);
+      if (value < 0 || value >= GF929_SIZE) rb_raise(rb_eRangeError, "codewords must be between 0 and 928, got %li", value);
+      c_codewords[i] = value;
+    }
+  }
+
+  if (num_erasures > c_num_ec || rs_correct(c_codewords, count, c_num_ec, erasures, num_erasures) < 0) return Qnil;
+
+  VALUE corrected = rb_ary_new_capa(count);
+  for (long i = 0; i < count; i++) rb_ary_push(corrected, UINT2NUM(c_codewords[i]));
+  return corrected;
+}
+
+// The budget, in bytes, for each native call on this thread, or nil for none.
+// Calls that would go over it raise MemoryBudgetError instead.
+static VALUE get_memory_budget(VALUE self) {
+  return rb_thread_local_aref(rb_thread_current(), rb_intern(MEMORY_BUDGET_KEY));
+}
+
+static VALUE set_memory_budget(VALUE self, VALUE budget) {
+  if (!NIL_P(budget) && NUM2LL(budget) <= 0) {
+    rb_raise(rb_eRangeError, "memory budget must be positive, got %lld", NUM2LL(budget));
+  }
+  return rb_thread_local_aset(rb_thread_current(), rb_intern(MEMORY_BUDGET_KEY), budget);
+}
+
+// A 64-bit digest of a string's bytes, the same in every process, for keying
+// cached results.
+static VALUE digest(VALUE self, VALUE data) {
+  Check_Type(data, T_STRING);
+  return ULL2NUM(digest64(RSTRING_PTR(data), RSTRING_LEN(data), 0));
+}
+
+// Ext::ResultCache wraps a cache file shared between processes, holding only
+// located corners and scores, as [score, x, y, ...] arrays like
+// locate_via_guards returns.
+static void free_result_cache(void *ptr) {
+  result_cache_close(ptr);
+}
+
+static size_t result_cache_memsize(const void *ptr) {
+  return ptr ? sizeof(struct result_cache) : 0;
+}
+
+static const rb_data_type_t result_cache_type = {
+  .wrap_struct_name = "Ruby417::Ext::ResultCache",
+  .function = {.dfree = free_result_cache, .dsize = result_cache_memsize},
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE result_cache_alloc(VALUE klass) {
+  return TypedData_Wrap_Struct(klass, &result_cache_type, NULL);
+}
+
+static struct result_cache *get_result_cache(VALUE self) {
+  struct result_cache *cache = rb_check_typeddata(self, &result_cache_type);
+  if (!cache) rb_raise(rb_eIOError, "result cache is closed");
+  return cache;
+}
+
+static void result_cache_key(VALUE digest, VALUE fingerprint, uint64_t key[2]) {
+  key[0] = NUM2ULL(digest);
+  key[1] = NUM2ULL(fingerprint);
+}
+
+// Opens (or creates) the cache file at path, with the given number of slots.
+static VALUE result_cache_initialize(VALUE self, VALUE path, VALUE slots) {
+  FilePathValue(path);
+  if (DATA_PTR(self)) rb_raise(rb_eArgError, "result cache is already open");
+
+  struct result_cache *cache = result_cache_open(StringValueCStr(path), NUM2ULL(slots), malloc, free);
+  if (!cache) rb_sys_fail_str(path);
+  DATA_PTR(self) = cache;
+  return self;
+}
+
+// The barcodes cached for the given digests, or nil.
+static VALUE result_cache_fetch_barcodes(VALUE self, VALUE digest, VALUE fingerprint) {
+  struct result_cache *cache = get_result_cache(self);
+  struct result_cache_barcode barcodes[RESULT_CACHE_BARCODES];
+  uint64_t key[2];
+  result_cache_key(digest, fingerprint, key);
+
+  int count = result_cache_fetch(cache, key, barcodes);
+  if (count < 0) return Qnil;
+
+  VALUE located_barcodes = rb_ary_new_capa(count);
+  for (int i = 0; i < count; i++) {
+    int32_t *c = barcodes[i].corners;
+    rb_ary_push(located_barcodes, rb_ary_new_from_args(9, DBL2NUM(barcodes[i].score),
+                                                          INT2FIX(c[0]), INT2FIX(c[1]), INT2FIX(c[2]), INT2FIX(c[3]),
+                                                          INT2FIX(c[4]), INT2FIX(c[5]), INT2FIX(c[6]), INT2FIX(c[7])));
+  }
+  return located_barcodes;
+}
+
+// Caches the barcodes, returning false if there were too many to keep.
+static VALUE result_cache_store_barcodes(VALUE self, VALUE digest, VALUE fingerprint, VALUE located_barcodes) {
+  struct result_cache *cache = get_result_cache(self);
+  struct result_cache_barcode barcodes[RESULT_CACHE_BARCODES];
+  uint64_t key[2];
+  result_cache_key(digest, fingerprint, key);
+  Check_Type(located_barcodes, T_ARRAY);
+
+  long count = RARRAY_LEN(located_barcodes);
+  if (count > RESULT_CACHE_BARCODES) return Qfalse;
+  for (long i = 0; i < count; i++) {
+    VALUE barcode = rb_ary_entry(located_barcodes, i);
+    Check_Type(barcode, T_ARRAY);
+    if (RARRAY_LEN(barcode) != 9) rb_raise(rb_eArgError, "barcodes should be a score and 8 coordinates");
+    barcodes[i].score = NUM2DBL(rb_ary_entry(barcode, 0));
+    for (int j = 0; j < 8; j++) barcodes[i].corners[j] = NUM2INT(rb_ary_entry(barcode, j+1));
+  }
+
+  return result_cache_store(cache, key, barcodes, (int) count) ? Qtrue : Qfalse;
+}
+
+// Lookups and stores by every process using the file, and its slots.
+static VALUE result_cache_stats(VALUE self) {
+  struct result_cache_header *header = get_result_cache(self)->header;
+  VALUE stats = rb_hash_new();
+  rb_hash_aset(stats, ID2SYM(rb_intern("hits")), ULL2NUM(atomic_load(&header->hits)));
+  rb_hash_aset(stats, ID2SYM(rb_intern("misses")), ULL2NUM(atomic_load(&header->misses)));
+  rb_hash_aset(stats, ID2SYM(rb_intern("stores")), ULL2NUM(atomic_load(&header->stores)));
+  rb_hash_aset(stats, ID2SYM(rb_intern("slots")), ULL2NUM(header->slots));
+  return stats;
+}
+
+static VALUE result_cache_close_file(VALUE self) {
+  result_cache_close(get_result_cache(self));
+  DATA_PTR(self) = NULL;
+  return Qnil;
+}
+
+// Whether localization on this thread first marks the tiles that could hold
+// guards, from cheap statistics, and labels only those.
+static VALUE get_prefilter(VALUE self) {
+  return RTEST(rb_thread_local_aref(rb_thread_current(), rb_intern(PREFILTER_KEY))) ? Qtrue : Qfalse;
+}
+
+static VALUE set_prefilter(VALUE self, VALUE prefilter) {
+  return rb_thread_local_aset(rb_thread_current(), rb_intern(PREFILTER_KEY), RTEST(prefilter) ? Qtrue : Qfalse);
+}
+
+// Whether localization on this thread pairs rectangles fit to the moments of
+// each region, and traces and fits exactly only the regions in those pairs.
+static VALUE get_fast_fit(VALUE self) {
+  return RTEST(rb_thread_local_aref(rb_thread_current(), rb_intern(FAST_FIT_KEY))) ? Qtrue : Qfalse;
+}
+
+static VALUE set_fast_fit(VALUE self, VALUE fast_fit) {
+  return rb_thread_local_aset(rb_thread_current(), rb_intern(FAST_FIT_KEY), RTEST(fast_fit) ? Qtrue : Qfalse);
+}
+
+// The instruction set the kernels were picked for when the library loaded, as
+// :none, :sse2, :avx2 or :avx512.
+static VALUE get_simd_level(VALUE self) {
+  return ID2SYM(rb_intern(simd_level_name(simd_current)));
+}
+
+// The most memory, in bytes, the last native call on this thread held at once,
+// or nil before any.
+static VALUE peak_memory(VALUE self) {
+  return rb_thread_local_aref(rb_thread_current(), rb_intern(PEAK_MEMORY_KEY));
+}
+
+// The only global state is set up here, before any other Ractor can start,
+// and only read after: the field tables and the kernels picked. Settings are
+// per thread, and each call's memory account is its own.
 void Init_ruby417(void) {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+  rb_ext_ractor_safe(true);
+#endif
+  gf929_init();
+  simd_init();
+
   mRuby417 = rb_define_module("Ruby417");
   mExt = rb_define_module_under(mRuby417, "Ext");
+  eMemoryBudgetError = rb_define_class_under(mRuby417, "MemoryBudgetError", rb_eNoMemError);
 
   rb_define_module_function(mExt, "locate_via_guards", locate_via_guards, 13);
+  rb_define_module_function(mExt, "decode_via_guards", decode_via_guards, 14);
+  rb_define_module_function(mExt, "rectify_via_guards", rectify_via_guards, -1);
+  rb_define_module_function(mExt, "locate_via_guards_levels", locate_via_guards_levels, 15);
+  rb_define_module_function(mExt, "locate_via_gradients", locate_via_gradients, 6);
+  rb_define_module_function(mExt, "locate_via_scanlines", locate_via_scanlines, 5);
+  rb_define_module_function(mExt, "morphology", morphology, 7);
+  rb_define_module_function(mExt, "correct_codewords", correct_codewords, 2);
+  rb_define_module_function(mExt, "luma", luma, 5);
+  rb_define_module_function(mExt, "remove_shadows", remove_shadows, 4);
+  rb_define_module_function(mExt, "memory_budget", get_memory_budget, 0);
+  rb_define_module_function(mExt, "memory_budget=", set_memory_budget, 1);
+  rb_define_module_function(mExt, "peak_memory", peak_memory, 0);
+  rb_define_module_function(mExt, "prefilter", get_prefilter, 0);
+  rb_define_module_function(mExt, "prefilter=", set_prefilter, 1);
+  rb_define_module_function(mExt, "fast_fit", get_fast_fit, 0);
+  rb_define_module_function(mExt, "fast_fit=", set_fast_fit, 1);
+  rb_define_module_function(mExt, "simd_level", get_simd_level, 0);
+  rb_define_module_function(mExt, "digest", digest, 1);
+
+  cResultCache = rb_define_class_under(mExt, "ResultCache", rb_cObject);
+  rb_define_alloc_func(cResultCache, result_cache_alloc);
+  rb_define_method(cResultCache, "initialize", result_cache_initialize, 2);
+  rb_define_method(cResultCache, "fetch", result_cache_fetch_barcodes, 2);
+  rb_define_method(cResultCache, "store", result_cache_store_barcodes, 3);
+  rb_define_method(cResultCache, "stats", result_cache_stats, 0);
+  rb_define_method(cResultCache, "close", result_cache_close_file, 0);
 }
 
 #endif
@@ -0,0 +1,78 @@
+#include <stdlib.h> // malloc, realloc, free
+#include <stdbool.h>
+#include "accounting.h"
+
+// Charges size more bytes to the account, raising its peak, unless that would
+// go over its budget.
+static bool memory_account_charge(struct memory_account *account, size_t size) {
+  size_t current = atomic_fetch_add(&account->current, size) + size,
+         peak = atomic_load(&account->peak);
+
+  if (account->budget && current > account->budget) {
+    atomic_fetch_sub(&account->current, size);
+    atomic_store(&account->exceeded, true);
+    return false;
+  }
+  while (current > peak && !atomic_compare_exchange_weak(&account->peak, &peak, current));
+  atomic_fetch_add(&account->unreported, (long) size);
+
+  return true;
+}
+
+static void memory_account_credit(struct memory_account *account, size_t size) {
+  atomic_fetch_sub(&account->current, size);
+  atomic_fetch_sub(&account->unreported, (long) size);
+}
+
+// Allocator hooks with the signatures of malloc, realloc and free, which charge
+// blocks to the current account, if any, and fail once its budget is spent.
+// Blocks are credited back to the account they were charged to, whatever the
+// thread freeing them.
+static void *accounted_malloc(size_t size) {
+  struct memory_account *account = memory_account;
+  union memory_header *header;
+
+  if (size > (size_t) -1 - sizeof(*header)) return NULL;
+  if (account && !memory_account_charge(account, size)) return NULL;
+  if (!(header = malloc(sizeof(*header) + size))) {
+    if (account) memory_account_credit(account, size);
+    return NULL;
+  }
+  header->block.size = size;
+  header->block.account = account;
+
+  return header + 1;
+}
+
+static void *accounted_realloc(void *ptr, size_t size) {
+  if (!ptr) return accounted_malloc(size);
+
+  union memory_header *header = (union memory_header *) ptr - 1, *resized;
+  struct memory_account *account = header->block.account;
+  size_t old_size = header->block.size;
+
+  if (size > (size_t) -1 - sizeof(*header)) return NULL;
+  if (account && size > old_size && !memory_account_charge(account, size - old_size)) return NULL;
+  if (!(resized = realloc(header, sizeof(*header) + size))) {
+    if (account && size > old_size) memory_account_credit(account, size - old_size);
+    return NULL;
+  }
+  if (account && size < old_size) memory_account_credit(account, old_size - size);
+  resized->block.size = size;
+
+  return resized + 1;
+}
+
+static void accounted_free(void *ptr) {
+  if (!ptr) return;
+
+  union memory_header *header = (union memory_header *) ptr - 1;
+  if (header->block.account) memory_account_credit(header->block.account, header->block.size);
+  free(header);
+}
+
+// The change in the account's outstanding bytes since the last flush, for
+// passing on to a garbage collector.
+static long memory_account_flush(struct memory_account *account) {
+  return atomic_exchange(&account->unreported, 0);
+}
@@ -0,0 +1,34 @@
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include <stddef.h> // size_t, max_align_t
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Tallies what's allocated through the accounted allocator while it's the
+// current account, from any thread. Budget is 0 for no limit.
+struct memory_account {
+  atomic_size_t current, peak;
+  size_t budget;
+  atomic_bool exceeded;
+  atomic_long unreported; // change in current since the last flush
+};
+
+// Each block starts with its size and account, keeping the block aligned.
+union memory_header {
+  struct {
+    size_t size;
+    struct memory_account *account;
+  } block;
+  max_align_t align;
+};
+
+// The account the calling thread allocates against, or NULL for none.
+static _Thread_local struct memory_account *memory_account;
+
+static void *accounted_malloc(size_t size);
+static void *accounted_realloc(void *ptr, size_t size);
+static void accounted_free(void *ptr);
+static long memory_account_flush(struct memory_account *account);
+
+#endif
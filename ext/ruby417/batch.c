@@ -0,0 +1,332 @@
+#include <stdlib.h> // NULL, malloc, realloc, free
+#include <string.h>
+#include <strings.h> // strcasecmp
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h> // open, posix_fadvise
+#include <unistd.h> // pread, close
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "levels.h"
+
+// Parses a binary PGM (P5) or PPM (P6) image of 8 bit samples, pointing pixels
+// at the samples. Returns false if the data isn't such an image.
+static bool pnm_parse(const unsigned char *data, size_t size, int *width, int *height,
+                      enum pixel_format *format, const unsigned char **pixels) {
+  long values[3];
+  size_t i = 2;
+
+  if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) return false;
+
+  for (int v = 0; v < 3; v++) {
+    // whitespace and comments, then a decimal number
+    for (;;) {
+      if (i >= size) return false;
+      if (data[i] == '#') {
+        while (i < size && data[i] != '\n') i++;
+      } else if (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n') {
+        i++;
+      } else {
+        break;
+      }
+    }
+    if (data[i] < '0' || data[i] > '9') return false;
+    for (values[v] = 0; i < size && data[i] >= '0' && data[i] <= '9'; i++) {
+      values[v] = 10*values[v] + (data[i] - '0');
+      if (values[v] > 65535) return false;
+    }
+  }
+  // a single whitespace character separates the header from the samples
+  if (i >= size || values[0] == 0 || values[1] == 0 || values[2] != 255) return false;
+  i++;
+
+  *width = values[0];
+  *height = values[1];
+  *format = data[1] == '5' ? PIXEL_FORMAT_GRAY : PIXEL_FORMAT_RGB;
+  *pixels = data + i;
+
+  return size - i >= (size_t) pixel_format_size(*format, *width, *height);
+}
+
+static bool text_reserve(struct text *text, size_t more) {
+  if (text->len + more < text->capacity) return true;
+
+  size_t capacity = text->capacity ? text->capacity : 256;
+  while (text->len + more >= capacity) capacity *= 2;
+  char *data = realloc(text->data, capacity);
+  if (!data) return false;
+  text->data = data;
+  text->capacity = capacity;
+
+  return true;
+}
+
+// Appends to the text, keeping it terminated. Returns false if out of memory.
+static bool text_printf(struct text *text, const char *format, ...) {
+  va_list args;
+  int n;
+
+  va_start(args, format);
+  n = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  if (n < 0 || !text_reserve(text, n)) return false;
+
+  va_start(args, format);
+  vsnprintf(text->data + text->len, text->capacity - text->len, format, args);
+  va_end(args);
+  text->len += n;
+
+  return true;
+}
+
+// Appends a quoted JSON string. Bytes that aren't ASCII are passed through,
+// so paths in UTF-8 come out as they are.
+static bool text_json_string(struct text *text, const char *s) {
+  if (!text_printf(text, "\"")) return false;
+
+  for (; *s; s++) {
+    unsigned char c = *s;
+    bool ok;
+    if (c == '"' || c == '\\') ok = text_printf(text, "\\%c", c);
+    else if (c == '\n') ok = text_printf(text, "\\n");
+    else if (c == '\t') ok = text_printf(text, "\\t");
+    else if (c < 0x20) ok = text_printf(text, "\\u%04x", c);
+    else ok = text_printf(text, "%c", c);
+    if (!ok) return false;
+  }
+
+  return text_printf(text, "\"");
+}
+
+static bool has_image_extension(const char *name) {
+  const char *dot = strrchr(name, '.');
+  return dot && (!strcasecmp(dot, ".pgm") || !strcasecmp(dot, ".ppm") || !strcasecmp(dot, ".pnm"));
+}
+
+static bool push_path(struct darray *paths, const char *path) {
+  char *copy = strdup(path);
+
+  if (!copy) return false;
+  if (!darray_push(paths, copy)) {
+    free(copy);
+    return false;
+  }
+
+  return true;
+}
+
+// Adds the path to the list, or if it's a directory, the PGM and PPM images
+// under it, recursively. Symbolic links to images are added, but links to
+// directories aren't followed, so a cycle can't recurse forever. Returns false
+// if out of memory; paths that can't be read are added anyway, to be reported
+// along with the results.
+static bool batch_collect(const char *path, struct darray *paths) {
+  struct stat st;
+  struct dirent *entry;
+  DIR *dir;
+  bool ok = true;
+
+  if (stat(path, &st) || !S_ISDIR(st.st_mode) || !(dir=opendir(path))) return push_path(paths, path);
+
+  while (ok && (entry=readdir(dir))) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+    size_t length = strlen(path) + strlen(entry->d_name) + 2;
+    char *child = malloc(length);
+    if (!child) {
+      ok = false;
+      break;
+    }
+    snprintf(child, length, "%s/%s", path, entry->d_name);
+    bool image = has_image_extension(entry->d_name);
+    if (!lstat(child, &st)) {
+      if (S_ISLNK(st.st_mode)) {
+        if (image && !stat(child, &st) && !S_ISDIR(st.st_mode)) ok = push_path(paths, child);
+      } else if (S_ISDIR(st.st_mode) || image) {
+        ok = batch_collect(child, paths);
+      }
+    }
+    free(child);
+  }
+  closedir(dir);
+
+  return ok;
+}
+
+// Adds each line of the list as a path, skipping empty lines. Returns false if
+// out of memory.
+static bool batch_read_list(FILE *list, struct darray *paths) {
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t n;
+  bool ok = true;
+
+  while (ok && (n=getline(&line, &capacity, list)) >= 0) {
+    while (n > 0 && (line[n-1] == '\n' || line[n-1] == '\r')) line[--n] = '\0';
+    if (n > 0) ok = push_path(paths, line);
+  }
+  free(line);
+
+  return ok && !ferror(list);
+}
+
+struct batch_job {
+  struct darray *paths;
+  struct batch_settings *settings;
+  atomic_uint *next; // path to take, shared by the workers
+  FILE *out;
+  pthread_mutex_t *out_lock;
+  struct batch_stats stats;
+};
+
+static void prefetch(const char *path) {
+#ifdef POSIX_FADV_WILLNEED
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#else
+  (void) path;
+#endif
+}
+
+// Reads the whole file into the buffer, growing it as needed. Returns the
+// size, or -1 if the file can't be read or memory runs out.
+static long read_file(const char *path, unsigned char **buffer, size_t *capacity) {
+  struct stat st;
+  long size = 0;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) goto fail;
+  if ((size_t) st.st_size > *capacity) {
+    unsigned char *grown = realloc(*buffer, st.st_size);
+    if (!grown) goto fail;
+    *buffer = grown;
+    *capacity = st.st_size;
+  }
+  while (size < st.st_size) {
+    ssize_t n = pread(fd, *buffer + size, st.st_size - size, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) goto fail;
+    size += n;
+  }
+  close(fd);
+  return size;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+// Locates barcodes in one image, formatting its line of output. Returns false
+// if out of memory even for the line.
+static bool batch_locate(struct batch_job *job, const char *path, struct daemon_workspace *ws,
+                         unsigned char **buffer, size_t *capacity, struct text *line) {
+  struct daemon_request request = job->settings->request;
+  struct darray *found = NULL;
+  const unsigned char *pixels;
+  enum pixel_format format;
+  const char *error = NULL;
+  long size = read_file(path, buffer, capacity);
+
+  job->stats.images++;
+  line->len = 0;
+  if (!text_printf(line, "{\"path\":") || !text_json_string(line, path)) return false;
+
+  if (size < 0) {
+    error = "unreadable";
+  } else if (!pnm_parse(*buffer, size, &request.width, &request.height, &format, &pixels)) {
+    error = "not a binary PGM or PPM image";
+  } else {
+    request.format = format;
+    if (job->settings->area_fraction > 0) {
+      request.area_threshold = job->settings->area_fraction * request.width * request.height;
+    }
+    if (daemon_locate(ws, &request, pixels, &found) != DAEMON_OK) error = "out of memory";
+    job->stats.bytes += size;
+  }
+
+  if (error) {
+    job->stats.failures++;
+    return text_printf(line, ",\"error\":\"%s\"}\n", error);
+  }
+
+  bool ok = text_printf(line, ",\"width\":%d,\"height\":%d,\"barcodes\":[", request.width, request.height);
+  for (unsigned i = 0; ok && i < found->len; i++) {
+    struct located_guards *located = darray_index(found, i);
+    struct barcode_corners *c = &located->corners;
+    ok = text_printf(line, "%s{\"score\":%.15g,\"corners\":[[%d,%d],[%d,%d],[%d,%d],[%d,%d]]}",
+                     i ? "," : "", located->score,
+                     c->upper_left.x, c->upper_left.y, c->lower_left.x, c->lower_left.y,
+                     c->lower_right.x, c->lower_right.y, c->upper_right.x, c->upper_right.y);
+  }
+  ok = ok && text_printf(line, "]}\n");
+  job->stats.barcodes += found->len;
+  darray_free(found, true);
+
+  return ok;
+}
+
+// Takes paths in turn until there are none left, hinting the ones a little
+// ahead, and writes each image's line as it's done.
+static void *batch_work(void *arg) {
+  struct batch_job *job = arg;
+  struct daemon_workspace ws = {0};
+  struct text line = {0};
+  unsigned char *buffer = NULL;
+  size_t capacity = 0;
+  unsigned i;
+
+  while ((i=atomic_fetch_add(job->next, 1)) < job->paths->len) {
+    if (i + BATCH_PREFETCH_DEPTH < job->paths->len) prefetch(darray_index(job->paths, i + BATCH_PREFETCH_DEPTH));
+    if (!batch_locate(job, darray_index(job->paths, i), &ws, &buffer, &capacity, &line)) {
+      job->stats.failures++;
+      continue;
+    }
+    pthread_mutex_lock(job->out_lock);
+    fwrite(line.data, 1, line.len, job->out);
+    pthread_mutex_unlock(job->out_lock);
+  }
+
+  free(ws.gray.data);
+  free(line.data);
+  free(buffer);
+  return NULL;
+}
+
+// Locates barcodes in each image on a pool of threads, each with its own
+// workspace, writing a JSON line per image to out as it's done, so in no
+// particular order. Totals go in stats. Returns false if no thread could be
+// started.
+static bool batch_run(struct darray *paths, struct batch_settings *settings, FILE *out, struct batch_stats *stats) {
+  struct batch_job jobs[BATCH_MAX_THREADS];
+  pthread_t handles[BATCH_MAX_THREADS];
+  pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+  atomic_uint next = 0;
+  int threads = settings->threads, started = 0;
+
+  if (threads > BATCH_MAX_THREADS) threads = BATCH_MAX_THREADS;
+  if (threads < 1) threads = 1;
+
+  for (unsigned i = 0; i < BATCH_PREFETCH_DEPTH && i < paths->len; i++) prefetch(darray_index(paths, i));
+  for (int t = 0; t < threads; t++) {
+    jobs[started] = (struct batch_job) {paths, settings, &next, out, &out_lock, {0}};
+    if (!pthread_create(&handles[started], NULL, batch_work, &jobs[started])) started++;
+  }
+
+  *stats = (struct batch_stats) {0};
+  for (int t = 0; t < started; t++) {
+    pthread_join(handles[t], NULL);
+    stats->images += jobs[t].stats.images;
+    stats->failures += jobs[t].stats.failures;
+    stats->barcodes += jobs[t].stats.barcodes;
+    stats->bytes += jobs[t].stats.bytes;
+  }
+  fflush(out);
+
+  return started > 0;
+}
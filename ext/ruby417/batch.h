@@ -0,0 +1,43 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h> // FILE
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "color.h"
+#include "darray.h"
+#include "daemon.h"
+
+// files whose reading is hinted to the kernel ahead of the workers
+#define BATCH_PREFETCH_DEPTH 16
+#define BATCH_MAX_THREADS 64
+
+struct batch_settings {
+  struct daemon_request request; // the format and dimensions are each image's
+  double area_fraction; // of the image, for the guard area threshold, if positive
+  int threads;
+};
+
+struct batch_stats {
+  long images, failures, barcodes;
+  long long bytes;
+};
+
+// A growing line of output.
+struct text {
+  char *data;
+  size_t len, capacity;
+};
+
+static bool pnm_parse(const unsigned char *data, size_t size, int *width, int *height,
+                      enum pixel_format *format, const unsigned char **pixels);
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+static bool text_printf(struct text *text, const char *format, ...);
+static bool text_json_string(struct text *text, const char *s);
+static bool batch_collect(const char *path, struct darray *paths);
+static bool batch_read_list(FILE *list, struct darray *paths);
+static bool batch_run(struct darray *paths, struct batch_settings *settings, FILE *out, struct batch_stats *stats);
+
+#endif
@@ -0,0 +1,243 @@
+#include <stdlib.h> // NULL, mkstemp
+#include <string.h> // memcpy, memset, strlen
+#include <errno.h>
+#include <fcntl.h> // open
+#include <signal.h> // kill
+#include <unistd.h> // close, ftruncate, getpid
+#include <stdio.h> // rename
+#include <sys/file.h> // flock
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+#define DIGEST_PRIME1 0x9e3779b185ebca87ull
+#define DIGEST_PRIME2 0xc2b2ae3d27d4eb4full
+#define DIGEST_PRIME3 0x165667b19e3779f9ull
+#define DIGEST_PRIME4 0x85ebca77c2b2ae63ull
+#define DIGEST_PRIME5 0x27d4eb2f165667c5ull
+
+static uint64_t digest_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t digest_round(uint64_t acc, uint64_t input) {
+  return digest_rotl(acc + input*DIGEST_PRIME2, 31) * DIGEST_PRIME1;
+}
+
+static uint64_t digest_read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// XXH64, which reads memory about as fast as it can be copied. Digests are of
+// little endian reads, as on every platform the cache files are shared on.
+static uint64_t digest64(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *p = data, *end = p + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    uint64_t v[4] = {seed + DIGEST_PRIME1 + DIGEST_PRIME2, seed + DIGEST_PRIME2, seed, seed - DIGEST_PRIME1};
+    for (; p + 32 <= end; p += 32) {
+      for (int i = 0; i < 4; i++) v[i] = digest_round(v[i], digest_read64(p + 8*i));
+    }
+    h = digest_rotl(v[0], 1) + digest_rotl(v[1], 7) + digest_rotl(v[2], 12) + digest_rotl(v[3], 18);
+    for (int i = 0; i < 4; i++) h = (h ^ digest_round(0, v[i])) * DIGEST_PRIME1 + DIGEST_PRIME4;
+  } else {
+    h = seed + DIGEST_PRIME5;
+  }
+  h += size;
+
+  for (; p + 8 <= end; p += 8) {
+    h = digest_rotl(h ^ digest_round(0, digest_read64(p)), 27) * DIGEST_PRIME1 + DIGEST_PRIME4;
+  }
+  if (p + 4 <= end) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    h = digest_rotl(h ^ v*DIGEST_PRIME1, 23) * DIGEST_PRIME2 + DIGEST_PRIME3;
+    p += 4;
+  }
+  for (; p < end; p++) h = digest_rotl(h ^ *p*DIGEST_PRIME5, 11) * DIGEST_PRIME1;
+
+  h ^= h >> 33;
+  h *= DIGEST_PRIME2;
+  h ^= h >> 29;
+  h *= DIGEST_PRIME3;
+  return h ^ (h >> 32);
+}
+
+static size_t result_cache_size(uint64_t slots) {
+  return sizeof(struct result_cache_header) + slots*sizeof(struct result_cache_entry);
+}
+
+// Creates an empty cache file in place of path. It's set up under another name
+// and renamed over path, so processes with the old file mapped keep it whole.
+static void *result_cache_create(const char *path, uint64_t slots, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  size_t size = result_cache_size(slots);
+  char *temporary = malloc(strlen(path) + 8);
+  void *map = MAP_FAILED;
+  int fd = -1, error;
+
+  if (!temporary) {
+    errno = ENOMEM;
+    return MAP_FAILED;
+  }
+  strcpy(temporary, path);
+  strcat(temporary, ".XXXXXX");
+  if ((fd=mkstemp(temporary)) < 0) goto fail;
+  if (fchmod(fd, 0644) || ftruncate(fd, (off_t) size) ||
+      (map=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) goto fail;
+
+  struct result_cache_header *header = map;
+  header->version = RESULT_CACHE_VERSION;
+  header->slots = slots;
+  header->magic = RESULT_CACHE_MAGIC;
+  if (rename(temporary, path)) goto fail;
+
+  close(fd);
+  free(temporary);
+  return map;
+
+fail:
+  error = errno;
+  if (map != MAP_FAILED) munmap(map, size);
+  if (fd >= 0) {
+    close(fd);
+    unlink(temporary);
+  }
+  free(temporary);
+  errno = error;
+  return MAP_FAILED;
+}
+
+// Opens the cache file at path, creating it (or starting it over, if it has a
+// different number of slots or is of another version) as needed. Returns NULL
+// with errno set on failure.
+static struct result_cache *result_cache_open(const char *path, uint64_t slots,
+                                              void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  size_t size = result_cache_size(slots);
+  struct result_cache *cache = NULL;
+  struct stat st, current;
+  void *map = MAP_FAILED;
+  int fd = -1, error;
+
+  if (slots < 1 || slots > RESULT_CACHE_MAX_SLOTS) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (!(cache=malloc(sizeof(*cache)))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // the lock keeps processes opening the file at once from each starting it
+  // over. It's held on the file opened, which another process may have
+  // replaced at path while this one waited, so then it's opened again.
+  for (;;) {
+    if ((fd=open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 || flock(fd, LOCK_EX) || fstat(fd, &st)) goto fail;
+    if (!stat(path, &current) && current.st_dev == st.st_dev && current.st_ino == st.st_ino) break;
+    close(fd);
+  }
+  if ((size_t) st.st_size == size &&
+      (map=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) goto fail;
+
+  struct result_cache_header *header = map;
+  if (map != MAP_FAILED && (header->magic != RESULT_CACHE_MAGIC || header->version != RESULT_CACHE_VERSION ||
+                            header->slots != slots)) {
+    munmap(map, size);
+    map = MAP_FAILED;
+  }
+  if (map == MAP_FAILED && (map=result_cache_create(path, slots, malloc, free)) == MAP_FAILED) goto fail;
+  // the mapping keeps the file open, and with it the lock, until unlocked
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  *cache = (struct result_cache) {
+    .size = size,
+    .header = map,
+    .entries = (struct result_cache_entry *) ((struct result_cache_header *) map + 1),
+    .free = free
+  };
+  return cache;
+
+fail:
+  error = errno;
+  if (fd >= 0) close(fd);
+  free(cache);
+  errno = error;
+  return NULL;
+}
+
+static void result_cache_close(struct result_cache *cache) {
+  if (!cache) return;
+  munmap(cache->header, cache->size);
+  cache->free(cache);
+}
+
+static struct result_cache_entry *result_cache_slot(struct result_cache *cache, const uint64_t key[2]) {
+  return cache->entries + (key[0] ^ key[1]*DIGEST_PRIME1) % cache->header->slots;
+}
+
+// Copies the barcodes cached under key, returning how many, or -1 if there's
+// no such result.
+static int result_cache_fetch(struct result_cache *cache, const uint64_t key[2], struct result_cache_barcode *barcodes) {
+  struct result_cache_entry *entry = result_cache_slot(cache, key);
+
+  // a result being written over is as good as missing
+  uint64_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire), stored[2];
+  if (sequence && !(sequence & 1)) {
+    memcpy(stored, entry->key, sizeof(stored));
+    uint32_t count = entry->count < RESULT_CACHE_BARCODES ? entry->count : RESULT_CACHE_BARCODES;
+    memcpy(barcodes, entry->barcodes, sizeof(*barcodes) * count);
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) == sequence &&
+        stored[0] == key[0] && stored[1] == key[1]) {
+      atomic_fetch_add(&cache->header->hits, 1);
+      return (int) count;
+    }
+  }
+
+  atomic_fetch_add(&cache->header->misses, 1);
+  return -1;
+}
+
+// Whether the slot is odd for good, its writer having died partway. A writer
+// that hasn't yet said who it is, or is done and about to release the slot,
+// is taken for alive.
+static bool result_cache_abandoned(struct result_cache_entry *entry, uint32_t *writer) {
+  *writer = atomic_load_explicit(&entry->writer, memory_order_relaxed);
+  return *writer && kill((pid_t) *writer, 0) && errno == ESRCH;
+}
+
+// Caches count barcodes under key, over whatever was in its slot. Returns false
+// if there are too many to keep, or another process is writing to the slot.
+static bool result_cache_store(struct result_cache *cache, const uint64_t key[2],
+                               const struct result_cache_barcode *barcodes, int count) {
+  struct result_cache_entry *entry = result_cache_slot(cache, key);
+  uint64_t sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+  uint32_t writer;
+
+  if (count < 0 || count > RESULT_CACHE_BARCODES) return false;
+  if (sequence & 1) {
+    // only one store claims the dead writer's slot, and with it claimed, the
+    // sequence is left as the writer left it, to move on past
+    if (!result_cache_abandoned(entry, &writer) ||
+        !atomic_compare_exchange_strong(&entry->writer, &writer, (uint32_t) getpid())) return false;
+    sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed) + 1;
+    atomic_store_explicit(&entry->sequence, sequence + 1, memory_order_relaxed);
+  } else {
+    if (!atomic_compare_exchange_strong(&entry->sequence, &sequence, sequence + 1)) return false;
+    atomic_store_explicit(&entry->writer, (uint32_t) getpid(), memory_order_relaxed);
+  }
+  atomic_thread_fence(memory_order_release);
+
+  memcpy(entry->key, key, sizeof(entry->key));
+  entry->count = count;
+  memcpy(entry->barcodes, barcodes, sizeof(*barcodes) * count);
+
+  atomic_store_explicit(&entry->writer, 0, memory_order_relaxed);
+  atomic_store_explicit(&entry->sequence, sequence + 2, memory_order_release);
+  atomic_fetch_add(&cache->header->stores, 1);
+  return true;
+}
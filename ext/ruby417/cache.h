@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// A cache of localization results in a memory mapped file, shared by every
+// process that opens it. Each key (a digest of the input, and one of the
+// settings) has one slot, so a newer result can evict an older one, and each
+// slot is guarded by a sequence number that's odd while it's written, so
+// readers never see half a result and never wait. A slot left odd by a writer
+// that died partway is taken over by the next store once its process is gone.
+// Slots are in host byte order.
+#define RESULT_CACHE_MAGIC 0x52343143 // "R41C"
+#define RESULT_CACHE_VERSION 2
+#define RESULT_CACHE_BARCODES 16 // results with more aren't kept
+#define RESULT_CACHE_MAX_SLOTS ((uint64_t) 1 << 24)
+
+struct result_cache_barcode {
+  double score;
+  int32_t corners[8]; // upper left, lower left, lower right, upper right
+};
+
+struct result_cache_entry {
+  _Atomic uint64_t sequence; // 0 if never written
+  uint64_t key[2];
+  uint32_t count;
+  _Atomic uint32_t writer; // the process writing the slot, 0 when not known
+  struct result_cache_barcode barcodes[RESULT_CACHE_BARCODES];
+};
+
+struct result_cache_header {
+  uint32_t magic, version;
+  uint64_t slots;
+  // of every process, for sizing the cache
+  _Atomic uint64_t hits, misses, stores;
+};
+
+struct result_cache {
+  size_t size;
+  struct result_cache_header *header;
+  struct result_cache_entry *entries;
+  void (*free)(void *ptr);
+};
+
+static uint64_t digest64(const void *data, size_t size, uint64_t seed);
+static struct result_cache *result_cache_open(const char *path, uint64_t slots,
+                                              void *(*malloc)(size_t size), void (*free)(void *ptr));
+static void result_cache_close(struct result_cache *cache);
+static int result_cache_fetch(struct result_cache *cache, const uint64_t key[2], struct result_cache_barcode *barcodes);
+static bool result_cache_store(struct result_cache *cache, const uint64_t key[2],
+                               const struct result_cache_barcode *barcodes, int count);
+
+#endif
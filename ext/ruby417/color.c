@@ -0,0 +1,122 @@
+#include <stdlib.h> // NULL
+#include <string.h> // memcpy, memset
+#include <stdbool.h>
+#include "color.h"
+#include "simd.h"
+
+// The number of bytes a buffer of the given format and size takes up, or -1 if
+// the format can't hold that size (NV12 and YUYV need even dimensions).
+static long pixel_format_size(enum pixel_format format, int width, int height) {
+  long pixels = (long) width*height;
+
+  if (width < 0 || height < 0) return -1;
+
+  switch (format) {
+    case PIXEL_FORMAT_GRAY:
+      return pixels;
+    case PIXEL_FORMAT_RGB:
+      return 3*pixels;
+    case PIXEL_FORMAT_RGBA:
+    case PIXEL_FORMAT_BGRA:
+      return 4*pixels;
+    case PIXEL_FORMAT_NV12:
+      return width % 2 || height % 2 ? -1 : pixels + pixels/2;
+    case PIXEL_FORMAT_YUYV:
+      return width % 2 ? -1 : 2*pixels;
+  }
+
+  return -1;
+}
+
+// BT.601 luma in 8 bit fixed point, whose weights sum to 256 so that gray stays
+// gray. With constant arguments, as it's always called, the loop compiles to
+// vector code for each layout.
+static inline void luma_row(const unsigned char *src, unsigned char *out, int width,
+                            const int step, const int r, const int g, const int b) {
+  for (int x = 0; x < width; x++) {
+    const unsigned char *p = src + x*step;
+    out[x] = (77*p[r] + 150*p[g] + 29*p[b] + 128) >> 8;
+  }
+}
+
+static inline void strided_row(const unsigned char *src, unsigned char *out, int width, const int step) {
+  for (int x = 0; x < width; x++) out[x] = src[x*step];
+}
+
+SIMD_INLINE void convert_row(const unsigned char *src, unsigned char *out, int width, enum pixel_format format) {
+  switch (format) {
+    case PIXEL_FORMAT_GRAY:
+    case PIXEL_FORMAT_NV12:
+      memcpy(out, src, width);
+      break;
+    case PIXEL_FORMAT_RGB:
+      luma_row(src, out, width, 3, 0, 1, 2);
+      break;
+    case PIXEL_FORMAT_RGBA:
+      luma_row(src, out, width, 4, 0, 1, 2);
+      break;
+    case PIXEL_FORMAT_BGRA:
+      luma_row(src, out, width, 4, 2, 1, 0);
+      break;
+    case PIXEL_FORMAT_YUYV:
+      strided_row(src, out, width, 2);
+      break;
+  }
+}
+
+// Converts a buffer to grayscale, a row at a time, counting the levels of each
+// row into the histogram (of 256 entries, if not NULL) while it's still in
+// cache. For the YUV formats, that's just the Y samples.
+static void image8_luma(const unsigned char *data, enum pixel_format format, struct image8 *out, unsigned *histogram) {
+  int width = out->width;
+  // bytes per pixel, of the Y plane for NV12 (whose 2x2 block is 6 bytes)
+  long step = pixel_format_size(format, 2, 2) / 4;
+
+  if (histogram) memset(histogram, 0, sizeof(*histogram)*256);
+
+  for (int y = 0; y < out->height; y++) {
+    unsigned char *row = out->data + (long) y*width;
+
+    simd.convert_row(data + step*y*width, row, width, format);
+
+    if (histogram) {
+      for (int x = 0; x < width; x++) histogram[row[x]]++;
+    }
+  }
+}
+
+// Stretches the levels linearly, given the image's histogram, clipping the
+// darkest and lightest pixels. Images with a single level are left alone.
+static void image8_normalize(struct image8 *im, const unsigned *histogram) {
+  long pixels = (long) im->width*im->height, count = 0;
+  int low = 0, high = 255;
+  unsigned char map[256];
+
+  for (; low < 255 && (count += histogram[low]) <= pixels*NORMALIZE_BLACK_FRACTION; low++);
+  count = 0;
+  for (; high > 0 && (count += histogram[high]) <= pixels*NORMALIZE_WHITE_FRACTION; high--);
+  if (high <= low) return;
+
+  for (int level = 0; level < 256; level++) {
+    int value = level <= low ? 0 : level >= high ? 255 : (255*(level - low) + (high - low)/2) / (high - low);
+    map[level] = value;
+  }
+  for (long i = 0; i < pixels; i++) im->data[i] = map[im->data[i]];
+}
+
+// Converts a buffer of the given format to a grayscale image, normalized if
+// requested. The buffer must be the size pixel_format_size gives. Returns NULL
+// if out of memory.
+static struct image8 *image8_from_pixels(const unsigned char *data, enum pixel_format format,
+                                         int width, int height, bool normalize,
+                                         void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image8 *im = image8_new(width, height, malloc, free);
+  unsigned histogram[256];
+
+  if (im) {
+    image8_luma(data, format, im, normalize ? histogram : NULL);
+    if (normalize) image8_normalize(im, histogram);
+  }
+
+  return im;
+}
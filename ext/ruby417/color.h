@@ -0,0 +1,32 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+
+// Layouts of the pixel buffers that can be converted to grayscale. NV12 is a
+// full resolution Y plane followed by interleaved, subsampled U and V; YUYV
+// interleaves Y with U and V for every pair of pixels.
+enum pixel_format {
+  PIXEL_FORMAT_GRAY,
+  PIXEL_FORMAT_RGB,
+  PIXEL_FORMAT_RGBA,
+  PIXEL_FORMAT_BGRA,
+  PIXEL_FORMAT_NV12,
+  PIXEL_FORMAT_YUYV
+};
+
+// Normalizing stretches the levels so that these fractions of the pixels end
+// up black and white, like ImageMagick's -normalize.
+#define NORMALIZE_BLACK_FRACTION 0.02
+#define NORMALIZE_WHITE_FRACTION 0.01
+
+static long pixel_format_size(enum pixel_format format, int width, int height);
+static void image8_luma(const unsigned char *data, enum pixel_format format, struct image8 *out, unsigned *histogram);
+static void image8_normalize(struct image8 *im, const unsigned *histogram);
+static struct image8 *image8_from_pixels(const unsigned char *data, enum pixel_format format,
+                                         int width, int height, bool normalize,
+                                         void *(*malloc)(size_t size), void (*free)(void *ptr));
+
+#endif
@@ -0,0 +1,370 @@
+#include <stdlib.h> // NULL, malloc, realloc, free
+#include <string.h> // memcpy, strlen
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h> // close, read, pipe, unlink
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h> // struct timeval
+#include <sys/un.h>
+#include "daemon.h"
+#include "color.h"
+#include "levels.h"
+#include "shadows.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool read_fully(int fd, void *buffer, size_t size) {
+  unsigned char *bytes = buffer;
+
+  while (size) {
+    ssize_t n = read(fd, bytes, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+static bool write_fully(int fd, const void *buffer, size_t size) {
+  const unsigned char *bytes = buffer;
+
+  while (size) {
+    ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+// Receives the byte carrying a request's pixel descriptor. Returns -1 if the
+// connection was closed, or the byte came without a descriptor or with more
+// than fit the control buffer. Any descriptors beyond the first are closed.
+static int receive_descriptor(int connection) {
+  char byte;
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int) * DAEMON_MAX_DESCRIPTORS)];
+  } control;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  struct msghdr message = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buffer,
+    .msg_controllen = sizeof(control.buffer)
+  };
+  ssize_t n;
+  int fd = -1;
+
+  while ((n=recvmsg(connection, &message, 0)) < 0 && errno == EINTR);
+  if (n <= 0) return -1;
+
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+    size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int received;
+      memcpy(&received, CMSG_DATA(c) + i*sizeof(int), sizeof(received));
+      if (fd < 0) fd = received;
+      else close(received);
+    }
+  }
+  if (message.msg_flags & MSG_CTRUNC && fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+// Converts the mapped pixels to grayscale in the workspace, preprocesses them
+// as requested and locates barcodes, as the guards localizer does at a single
+// level. Returns a daemon_status, with found set when DAEMON_OK.
+static int daemon_locate(struct daemon_workspace *ws, const struct daemon_request *request,
+                         const unsigned char *data, struct darray **found) {
+  struct pairing_settings settings = {
+    .area_threshold = request->area_threshold,
+    .rectangularity_threshold = request->rectangularity_threshold,
+    .angle_variation_threshold = request->angle_variation_threshold,
+    .area_variation_threshold = request->area_variation_threshold,
+    .width_variation_threshold = request->width_variation_threshold,
+    .height_variation_threshold = request->height_variation_threshold,
+    .guard_aspect_min = request->guard_aspect_min,
+    .guard_aspect_max = request->guard_aspect_max,
+    .barcode_aspect_min = request->barcode_aspect_min,
+    .barcode_aspect_max = request->barcode_aspect_max,
+    .threads = 1, // the workers are the parallelism
+    .polarity = LABEL_DARK,
+    .prefilter = request->flags & DAEMON_PREFILTER,
+    .fast_fit = request->flags & DAEMON_FAST_FIT
+  };
+  // the same closings as full preprocessing
+  struct morphology_kernel closings[] = {{3, 6, true}, {7, 7, false}};
+  unsigned char threshold = 128;
+  unsigned histogram[256];
+  size_t pixels = (size_t) request->width*request->height;
+  bool normalize = request->preprocessing != DAEMON_PREPROCESS_NONE,
+       full = request->preprocessing == DAEMON_PREPROCESS_FULL;
+
+  if (pixels > ws->capacity) {
+    unsigned char *gray = realloc(ws->gray.data, pixels);
+    if (!gray) return DAEMON_NO_MEMORY;
+    ws->gray.data = gray;
+    ws->capacity = pixels;
+  }
+  ws->gray.width = request->width;
+  ws->gray.height = request->height;
+
+  image8_luma(data, request->format, &ws->gray, normalize ? histogram : NULL);
+  if (normalize) image8_normalize(&ws->gray, histogram);
+  if (request->flags & DAEMON_INVERT) {
+    for (size_t i = 0; i < pixels; i++) ws->gray.data[i] = 255 - ws->gray.data[i];
+  }
+  if (full && !image8_remove_shadows(&ws->gray, threshold, malloc, free)) return DAEMON_NO_MEMORY;
+
+  *found = image8_locate_guards_levels(&ws->gray, &threshold, 1, closings, full ? 2 : 0,
+                                       &settings, 1, malloc, realloc, free);
+
+  return *found ? DAEMON_OK : DAEMON_NO_MEMORY;
+}
+
+// Serves one request on the connection. Returns false once the connection
+// should be closed: the client hung up or broke the protocol.
+static bool daemon_handle_request(int connection, struct daemon_workspace *ws) {
+  struct daemon_request request;
+  struct daemon_response response = {.magic = DAEMON_MAGIC, .status = DAEMON_BAD_REQUEST};
+  struct daemon_barcode *barcodes = NULL;
+  struct darray *found = NULL;
+  struct stat st;
+  void *pixels = MAP_FAILED;
+  long size = -1;
+  bool ok;
+  int fd = receive_descriptor(connection);
+
+  if (fd < 0) return false;
+  if (!read_fully(connection, &request, sizeof(request)) || request.magic != DAEMON_MAGIC) {
+    close(fd);
+    return false;
+  }
+
+  if (request.format <= PIXEL_FORMAT_YUYV && request.preprocessing <= DAEMON_PREPROCESS_FULL &&
+      request.width > 0 && request.height > 0) {
+    size = pixel_format_size(request.format, request.width, request.height);
+  }
+  if (size > 0 && !fstat(fd, &st) && st.st_size >= size &&
+      (pixels=mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
+    response.status = daemon_locate(ws, &request, pixels, &found);
+    munmap(pixels, size);
+  }
+  close(fd);
+
+  if (found && found->len && !(barcodes=malloc(sizeof(*barcodes) * found->len))) response.status = DAEMON_NO_MEMORY;
+  if (response.status == DAEMON_OK) {
+    response.count = found->len;
+    for (unsigned i = 0; i < found->len; i++) {
+      struct located_guards *located = darray_index(found, i);
+      struct barcode_corners *c = &located->corners;
+      barcodes[i] = (struct daemon_barcode) {
+        .score = located->score,
+        .corners = {c->upper_left.x, c->upper_left.y, c->lower_left.x, c->lower_left.y,
+                    c->lower_right.x, c->lower_right.y, c->upper_right.x, c->upper_right.y}
+      };
+    }
+  }
+
+  ok = write_fully(connection, &response, sizeof(response)) &&
+       write_fully(connection, barcodes, sizeof(*barcodes) * response.count);
+
+  free(barcodes);
+  darray_free(found, true);
+  return ok;
+}
+
+// Takes queued connections until the dispatch stops, serving one request on
+// each before handing it back to be polled, with a workspace kept for the
+// worker's lifetime.
+static void *daemon_work(void *arg) {
+  struct daemon_dispatch *dispatch = arg;
+  struct daemon_workspace ws = {0};
+
+  pthread_mutex_lock(&dispatch->lock);
+  for (;;) {
+    while (!dispatch->count && !dispatch->stopping) pthread_cond_wait(&dispatch->queued, &dispatch->lock);
+    if (dispatch->stopping) break;
+
+    struct daemon_connection *connection = &dispatch->connections[dispatch->queue[dispatch->head]];
+    dispatch->head = (dispatch->head + 1) % DAEMON_MAX_CONNECTIONS;
+    dispatch->count--;
+    pthread_mutex_unlock(&dispatch->lock);
+
+    bool keep = daemon_handle_request(connection->fd, &ws);
+
+    pthread_mutex_lock(&dispatch->lock);
+    if (keep) {
+      connection->state = DAEMON_CONNECTION_IDLE;
+      connection->active = time(NULL);
+    } else {
+      close(connection->fd);
+      connection->state = DAEMON_CONNECTION_CLOSED;
+    }
+    // a full pipe already has the dispatch awake
+    while (write(dispatch->wake[1], "", 1) < 0 && errno == EINTR);
+  }
+  pthread_mutex_unlock(&dispatch->lock);
+
+  free(ws.gray.data);
+  return NULL;
+}
+
+// Accepts a connection into a closed slot, with timeouts on its reads and
+// writes so that a stalled client can only hold a worker for so long. Returns
+// false once the listener is shut down.
+static bool daemon_accept(struct daemon_dispatch *dispatch, int listener) {
+  struct timeval timeout = {.tv_sec = DAEMON_REQUEST_TIMEOUT};
+  int fd = accept(listener, NULL, NULL);
+
+  if (fd < 0) return errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  pthread_mutex_lock(&dispatch->lock);
+  for (unsigned i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+    struct daemon_connection *connection = &dispatch->connections[i];
+    if (connection->state != DAEMON_CONNECTION_CLOSED) continue;
+    *connection = (struct daemon_connection) {fd, DAEMON_CONNECTION_IDLE, time(NULL)};
+    fd = -1;
+    break;
+  }
+  pthread_mutex_unlock(&dispatch->lock);
+  if (fd >= 0) close(fd); // only accepted while there's a slot
+
+  return true;
+}
+
+// Polls the listener and the idle connections until the listener is shut down,
+// accepting new connections, closing those idle for too long and queueing
+// readable ones for the workers.
+static void daemon_poll(struct daemon_dispatch *dispatch, int listener) {
+  struct pollfd *polled = dispatch->polled;
+  unsigned *slots = dispatch->slots;
+
+  for (;;) {
+    unsigned n = 0, live = 0;
+    time_t now = time(NULL);
+    char drained[64];
+
+    pthread_mutex_lock(&dispatch->lock);
+    for (unsigned i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+      struct daemon_connection *connection = &dispatch->connections[i];
+      if (connection->state == DAEMON_CONNECTION_IDLE && now - connection->active >= DAEMON_IDLE_TIMEOUT) {
+        close(connection->fd);
+        connection->state = DAEMON_CONNECTION_CLOSED;
+      }
+      if (connection->state == DAEMON_CONNECTION_CLOSED) continue;
+      live++;
+      if (connection->state != DAEMON_CONNECTION_IDLE) continue;
+      polled[n + 2] = (struct pollfd) {.fd = connection->fd, .events = POLLIN};
+      slots[n++] = i;
+    }
+    pthread_mutex_unlock(&dispatch->lock);
+
+    polled[0] = (struct pollfd) {.fd = dispatch->wake[0], .events = POLLIN};
+    // past the limit, new clients wait in the listener's backlog
+    polled[1] = (struct pollfd) {.fd = live < DAEMON_MAX_CONNECTIONS ? listener : -1, .events = POLLIN};
+
+    if (poll(polled, n + 2, 1000) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (polled[0].revents) while (read(dispatch->wake[0], drained, sizeof(drained)) > 0);
+    if (polled[1].revents && !daemon_accept(dispatch, listener)) break;
+
+    pthread_mutex_lock(&dispatch->lock);
+    for (unsigned i = 0; i < n; i++) {
+      if (!polled[i + 2].revents) continue;
+      dispatch->connections[slots[i]].state = DAEMON_CONNECTION_BUSY;
+      dispatch->queue[(dispatch->head + dispatch->count++) % DAEMON_MAX_CONNECTIONS] = slots[i];
+      pthread_cond_signal(&dispatch->queued);
+    }
+    pthread_mutex_unlock(&dispatch->lock);
+  }
+}
+
+// Binds a listening socket at the path, replacing whatever socket was left
+// there. Returns -1 on failure, with errno set.
+static int daemon_listen(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  int listener;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(address.sun_path, path, strlen(path) + 1);
+
+  if ((listener=socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+  unlink(path);
+  if (bind(listener, (struct sockaddr *) &address, sizeof(address)) || listen(listener, SOMAXCONN)) {
+    int error = errno;
+    close(listener);
+    errno = error;
+    return -1;
+  }
+
+  return listener;
+}
+
+// Serves the listener on a pool of worker threads, returning once the
+// listener is shut down and the workers have finished the requests they were
+// serving, with every connection closed. Returns false if no worker could be
+// started.
+static bool daemon_serve(int listener, int workers) {
+  pthread_t handles[DAEMON_MAX_WORKERS];
+  struct daemon_dispatch *dispatch = calloc(1, sizeof(*dispatch));
+  int started = 0;
+
+  if (workers > DAEMON_MAX_WORKERS) workers = DAEMON_MAX_WORKERS;
+  if (workers < 1) workers = 1;
+
+  if (!dispatch) return false;
+  if (pipe(dispatch->wake)) {
+    free(dispatch);
+    return false;
+  }
+  for (int i = 0; i < 2; i++) fcntl(dispatch->wake[i], F_SETFL, fcntl(dispatch->wake[i], F_GETFL) | O_NONBLOCK);
+  pthread_mutex_init(&dispatch->lock, NULL);
+  pthread_cond_init(&dispatch->queued, NULL);
+
+  for (int t = 0; t < workers; t++) {
+    if (!pthread_create(&handles[started], NULL, daemon_work, dispatch)) started++;
+  }
+  if (started) daemon_poll(dispatch, listener);
+
+  pthread_mutex_lock(&dispatch->lock);
+  dispatch->stopping = true;
+  pthread_cond_broadcast(&dispatch->queued);
+  pthread_mutex_unlock(&dispatch->lock);
+  for (int t = 0; t < started; t++) pthread_join(handles[t], NULL);
+
+  for (unsigned i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+    if (dispatch->connections[i].state != DAEMON_CONNECTION_CLOSED) close(dispatch->connections[i].fd);
+  }
+  close(dispatch->wake[0]);
+  close(dispatch->wake[1]);
+  pthread_cond_destroy(&dispatch->queued);
+  pthread_mutex_destroy(&dispatch->lock);
+  free(dispatch);
+
+  return started > 0;
+}
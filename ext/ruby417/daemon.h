@@ -0,0 +1,120 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h> // time_t
+#include <pthread.h>
+#include <poll.h>
+#include "image.h"
+#include "darray.h"
+#include "rectangles.h"
+
+// The daemon's protocol, over a Unix domain socket, in host byte order. For
+// each request, the client sends a single byte carrying the descriptor of a
+// shared memory file (a memfd, or a file on tmpfs) holding the pixels, then a
+// daemon_request. The daemon maps the pixels rather than copying them, and
+// answers with a daemon_response followed by count daemon_barcodes, best
+// first. Connections stay open for as many requests as the client likes, but
+// are closed once idle for DAEMON_IDLE_TIMEOUT seconds, or when a request
+// stalls for DAEMON_REQUEST_TIMEOUT seconds partway through.
+#define DAEMON_MAGIC 0x52343137 // "R417"
+#define DAEMON_MAX_WORKERS 64
+#define DAEMON_MAX_CONNECTIONS 1024
+#define DAEMON_MAX_DESCRIPTORS 4 // received with a request; more is a protocol error
+#ifndef DAEMON_IDLE_TIMEOUT
+#define DAEMON_IDLE_TIMEOUT 60
+#endif
+#ifndef DAEMON_REQUEST_TIMEOUT
+#define DAEMON_REQUEST_TIMEOUT 10
+#endif
+
+enum daemon_preprocessing {
+  DAEMON_PREPROCESS_NONE, // the pixels are binarized as they are
+  DAEMON_PREPROCESS_HALF, // normalized first
+  DAEMON_PREPROCESS_FULL  // normalized, shadows removed and features closed
+};
+
+// request flags
+#define DAEMON_INVERT 1 // for reversed symbols
+#define DAEMON_PREFILTER 2 // to skip tiles that can't hold guards
+#define DAEMON_FAST_FIT 4 // to screen regions by their moments before tracing them
+
+enum daemon_status {
+  DAEMON_OK,
+  DAEMON_BAD_REQUEST,
+  DAEMON_NO_MEMORY
+};
+
+struct daemon_request {
+  uint32_t magic;
+  uint32_t format; // enum pixel_format
+  int32_t width, height;
+  uint32_t preprocessing; // enum daemon_preprocessing
+  uint32_t flags;
+  int64_t area_threshold;
+  double rectangularity_threshold;
+  double angle_variation_threshold;
+  double area_variation_threshold;
+  double width_variation_threshold;
+  double height_variation_threshold;
+  int32_t guard_aspect_min, guard_aspect_max;
+  int32_t barcode_aspect_min, barcode_aspect_max;
+};
+
+struct daemon_response {
+  uint32_t magic;
+  uint32_t status; // enum daemon_status
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct daemon_barcode {
+  double score;
+  int32_t corners[8]; // upper left, lower left, lower right, upper right, as x, y
+};
+
+// Kept by each worker between requests, so that the grayscale buffer is only
+// reallocated when a larger image comes along.
+struct daemon_workspace {
+  struct image8 gray;
+  size_t capacity;
+};
+
+// Open connections are polled by the thread serving the listener, and each
+// that becomes readable is queued for a worker, which serves one request on it
+// and hands it back. A worker is only ever tied up by a request in progress,
+// never by a client sitting on an open connection.
+enum daemon_connection_state {
+  DAEMON_CONNECTION_CLOSED,
+  DAEMON_CONNECTION_IDLE, // polled for the next request
+  DAEMON_CONNECTION_BUSY  // queued or with a worker
+};
+
+struct daemon_connection {
+  int fd;
+  enum daemon_connection_state state;
+  time_t active; // when the last request was served, or the connection accepted
+};
+
+struct daemon_dispatch {
+  pthread_mutex_t lock;
+  pthread_cond_t queued; // signalled when a connection is queued, or on stopping
+  struct daemon_connection connections[DAEMON_MAX_CONNECTIONS];
+  unsigned queue[DAEMON_MAX_CONNECTIONS]; // a ring of busy connections waiting for a worker
+  unsigned head, count;
+  int wake[2]; // a pipe written by the workers as they hand connections back
+  bool stopping;
+  // the polling thread's own, for the wake pipe, the listener and idle connections
+  struct pollfd polled[DAEMON_MAX_CONNECTIONS + 2];
+  unsigned slots[DAEMON_MAX_CONNECTIONS];
+};
+
+static int daemon_locate(struct daemon_workspace *ws, const struct daemon_request *request,
+                         const unsigned char *data, struct darray **found);
+static bool daemon_handle_request(int connection, struct daemon_workspace *ws);
+static int daemon_listen(const char *path);
+static bool daemon_serve(int listener, int workers);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h> // NULL, possibly qsort_r
 #include <string.h> // memcpy
 #include <math.h> // log2
+#include <pthread.h>
 #include "darray.h"
 
 static struct darray *darray_new(unsigned capacity,
@@ -158,11 +159,59 @@ static void darray_msort_recurse(struct darray *read, struct darray *write,
   }
 }
 
+struct msort_job {
+  struct darray *read, *write;
+  unsigned a, b;
+  void *data;
+  int (*cmp)(const void *a, const void *b, void *data);
+  int threads;
+};
+
+// Like darray_msort_recurse, but the halves of large ranges are sorted on
+// separate threads, up to the given number. The arrays swap roles exactly as
+// they do serially, so the result is the same.
+static void *darray_msort_recurse_threaded(void *arg) {
+  struct msort_job *job = arg;
+  unsigned a = job->a, b = job->b, mid = a + (b - a) / 2;
+  pthread_t handle;
+
+  if (job->threads < 2 || b - a < DARRAY_PARALLEL_MIN) {
+    darray_msort_recurse(job->read, job->write, a, b, job->data, job->cmp);
+    return NULL;
+  }
+
+  struct msort_job left = {job->write, job->read, a, mid, job->data, job->cmp, job->threads / 2},
+                   right = {job->write, job->read, mid, b, job->data, job->cmp, job->threads - job->threads / 2};
+  bool started = !pthread_create(&handle, NULL, darray_msort_recurse_threaded, &left);
+  darray_msort_recurse_threaded(&right);
+  if (started) pthread_join(handle, NULL);
+  else darray_msort_recurse_threaded(&left);
+
+  unsigned x = a, p = a, q = mid;
+  while (x < b) {
+    if (q >= b || (p < mid && job->cmp(job->read->data[p], job->read->data[q], job->data) <= 0)) {
+      job->write->data[x++] = job->read->data[p++];
+    } else {
+      job->write->data[x++] = job->read->data[q++];
+    }
+  }
+
+  return NULL;
+}
+
 static bool darray_msort(struct darray *ary, void *data, int (*cmp)(const void *a, const void *b, void *data)) {
+  return darray_msort_threaded(ary, data, cmp, 1);
+}
+
+// A stable merge sort, on up to the given number of threads for large arrays.
+// Returns false if out of memory.
+static bool darray_msort_threaded(struct darray *ary, void *data, int (*cmp)(const void *a, const void *b, void *data),
+                                  int threads) {
   struct darray *aux = darray_dup(ary);
 
   if (aux) {
-    darray_msort_recurse(aux, ary, 0, ary->len, data, cmp);
+    struct msort_job job = {aux, ary, 0, ary->len, data, cmp, threads};
+    darray_msort_recurse_threaded(&job);
     darray_free(aux, false);
     return true;
   }
@@ -170,6 +219,75 @@ static bool darray_msort(struct darray *ary, void *data, int (*cmp)(const void *
   return false;
 }
 
+// Unsigned keys that order like the values they're made from: for integers,
+// the sign bit is flipped; for IEEE doubles, negative values have every bit
+// flipped, and the rest just the sign bit. Descending orders come from
+// complementing the key.
+static uint64_t radix_key_signed(int64_t value) {
+  return (uint64_t) value ^ (UINT64_C(1) << 63);
+}
+
+static uint64_t radix_key_double(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits & (UINT64_C(1) << 63) ? ~bits : bits | (UINT64_C(1) << 63);
+}
+
+struct radix_item {
+  uint64_t key;
+  void *elt;
+};
+
+// Sorts by the keys extracted from each element, ascending, keeping elements
+// with equal keys in order. Keys are extracted once each, then sorted a byte at
+// a time from the least significant, skipping bytes every key shares. Small
+// arrays are insertion sorted by key instead. Returns false if out of memory.
+static bool darray_radix_sort(struct darray *ary, void *data, uint64_t (*key)(const void *elt, void *data)) {
+  unsigned n = ary->len, counts[8][256] = {{0}};
+  struct radix_item small[DARRAY_RADIX_MIN], *from, *to;
+
+  if (n < DARRAY_RADIX_MIN) {
+    for (unsigned i = 0; i < n; i++) {
+      struct radix_item item = {key(ary->data[i], data), ary->data[i]};
+      unsigned t = i;
+      for (; t > 0 && small[t-1].key > item.key; t--) small[t] = small[t-1];
+      small[t] = item;
+    }
+    for (unsigned i = 0; i < n; i++) ary->data[i] = small[i].elt;
+    return true;
+  }
+
+  if (!(from = ary->malloc(2 * sizeof(*from) * n))) return false;
+  to = from + n;
+
+  for (unsigned i = 0; i < n; i++) {
+    uint64_t k = key(ary->data[i], data);
+    from[i] = (struct radix_item) {k, ary->data[i]};
+    for (int byte = 0; byte < 8; byte++) counts[byte][k >> 8*byte & 255]++;
+  }
+
+  for (int byte = 0; byte < 8; byte++) {
+    unsigned *count = counts[byte], offset = 0;
+    if (count[from[0].key >> 8*byte & 255] == n) continue;
+
+    for (int digit = 0; digit < 256; digit++) {
+      unsigned c = count[digit];
+      count[digit] = offset;
+      offset += c;
+    }
+    for (unsigned i = 0; i < n; i++) to[count[from[i].key >> 8*byte & 255]++] = from[i];
+
+    struct radix_item *tmp = from;
+    from = to;
+    to = tmp;
+  }
+
+  for (unsigned i = 0; i < n; i++) ary->data[i] = from[i].elt;
+  ary->free(from < to ? from : to);
+
+  return true;
+}
+
 #if defined(HAVE_BSD_QSORT_R) || defined(HAVE_GNU_QSORT_R)
 struct qsort_r_thunk {
   void *data;
@@ -3,6 +3,12 @@
 
 #include <stddef.h> // size_t
 #include <stdbool.h>
+#include <stdint.h>
+
+// Below this many elements, radix sorting falls back to insertion sort, and
+// merge sorting in parallel sorts each half on a single thread.
+#define DARRAY_RADIX_MIN 64
+#define DARRAY_PARALLEL_MIN 4096
 
 struct darray {
   void **data;
@@ -28,6 +34,11 @@ static void *darray_remove_fast(struct darray *ary, unsigned idx);
 static bool darray_push(struct darray *ary, void *elt);
 static void *darray_pop(struct darray *ary);
 static bool darray_msort(struct darray *ary, void *data, int (*cmp)(const void *a, const void *b, void *data));
+static bool darray_msort_threaded(struct darray *ary, void *data, int (*cmp)(const void *a, const void *b, void *data),
+                                  int threads);
+static uint64_t radix_key_signed(int64_t value);
+static uint64_t radix_key_double(double value);
+static bool darray_radix_sort(struct darray *ary, void *data, uint64_t (*key)(const void *elt, void *data));
 static void darray_qsort(struct darray *ary, void *data, int (*cmp)(const void *a, const void *b, void *data));
 
 #endif
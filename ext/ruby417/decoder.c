@@ -0,0 +1,466 @@
+#include <math.h> // ceil, floor, fabs, hypot
+#include <stdlib.h> // NULL
+#include <string.h> // memcmp, memmove, memset
+#include <stdbool.h>
+#include "decoder.h"
+#include "symbol_table.h" // generated by generate_symbol_table.rb
+
+// The start pattern, and the stop pattern without its final one module bar,
+// which isn't needed to recognize it. Both span as many modules as a symbol
+// character, so they're normalized the same way.
+static const int start_pattern[SYMBOL_ELEMENTS] = {8, 1, 1, 1, 1, 1, 1, 3},
+                 stop_pattern[SYMBOL_ELEMENTS] = {7, 1, 1, 3, 1, 1, 1, 2};
+
+// What could be read along a single scanline through the barcode.
+struct scanline {
+  int cells;
+  int cluster; // -1 if nothing useful was read
+  bool reversed, complete;
+  unsigned patterns[SYMBOL_MAX_COLUMNS];
+};
+
+// A run of consecutive scanlines that read the same cluster, i.e. a row.
+struct scanline_group {
+  int begin, end;
+  int cluster;
+};
+
+static struct symbol_matrix *symbol_matrix_new(int rows, int columns,
+                                               void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct symbol_matrix *matrix = malloc(sizeof(*matrix));
+
+  if (matrix) {
+    matrix->rows = rows;
+    matrix->columns = columns;
+    matrix->upside_down = false;
+    matrix->free = free;
+    matrix->data = malloc(sizeof(*matrix->data)*(rows*columns > 0 ? rows*columns : 1));
+
+    if (!matrix->data) {
+      free(matrix);
+      return NULL;
+    }
+    // all bits set is -1, nothing read
+    memset(matrix->data, 0xff, sizeof(*matrix->data)*rows*columns);
+  }
+
+  return matrix;
+}
+
+static void symbol_matrix_free(struct symbol_matrix *matrix) {
+  if (matrix) {
+    matrix->free(matrix->data);
+    matrix->free(matrix);
+  }
+}
+
+static int symbol_matrix_get(struct symbol_matrix *matrix, int row, int column) {
+  return matrix->data[row*matrix->columns + column];
+}
+
+// Returns the cluster (0, 3 or 6) of a symbol character's module pattern, or -1
+// if the pattern isn't a PDF417 codeword.
+static int symbol_cluster(unsigned pattern) {
+  if (pattern >> SYMBOL_MODULES || !(pattern >> (SYMBOL_MODULES-1) & 1) || pattern & 1) return -1;
+
+  int entry = symbol_table[pattern >> 1 & 0x7FFF];
+  return entry ? 3*((entry >> 11) - 1) : -1;
+}
+
+// Returns the codeword (0 to 928) a module pattern stands for, or -1 if it
+// isn't one.
+static int symbol_codeword(unsigned pattern) {
+  if (symbol_cluster(pattern) < 0) return -1;
+
+  return symbol_table[pattern >> 1 & 0x7FFF] & 0x7FF;
+}
+
+// Scales measured element widths to whole modules summing to the given total,
+// rounding each to the nearest and then nudging the ones that rounded the most
+// until the total is right. Returns false if an element would vanish.
+static bool symbol_normalize_widths(int *widths, int count, int modules, int *normalized) {
+  long total = 0;
+  int sum = 0;
+
+  for (int i = 0; i < count; i++) total += widths[i];
+  if (total <= 0) return false;
+
+  for (int i = 0; i < count; i++) {
+    normalized[i] = (2L*widths[i]*modules + total) / (2*total);
+    sum += normalized[i];
+  }
+
+  while (sum != modules) {
+    int step = sum < modules ? 1 : -1, best = -1;
+    long best_error = 0;
+
+    for (int i = 0; i < count; i++) {
+      // how far the element was rounded down, in units of 1/total modules
+      long error = step*((long) widths[i]*modules - (long) normalized[i]*total);
+      if (normalized[i] + step >= 1 && (best < 0 || error > best_error)) {
+        best = i;
+        best_error = error;
+      }
+    }
+    if (best < 0) return false;
+
+    normalized[best] += step;
+    sum += step;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (normalized[i] < 1) return false;
+  }
+
+  return true;
+}
+
+static unsigned symbol_pattern(int *modules) {
+  unsigned pattern = 0;
+
+  for (int i = 0; i < SYMBOL_ELEMENTS; i++) {
+    for (int j = 0; j < modules[i]; j++) pattern = pattern << 1 | !(i & 1);
+  }
+
+  return pattern;
+}
+
+// The value counted most, or -1 if nothing was.
+static int most_votes(const int *votes, int count) {
+  int best = -1;
+  for (int i = 0; i < count; i++) {
+    if (votes[i] && (best < 0 || votes[i] > votes[best])) best = i;
+  }
+  return best;
+}
+
+// Numbers the rows read, in the given clusters, by their row indicators (see
+// symbol_matrix), and works out how many rows the symbol has from them. A row
+// whose indicators can't be read, or disagree, is numbered from the nearest
+// numbered row before or after it, as long as its cluster fits. Rows that can't
+// be numbered get -1. Returns the number of rows in the symbol, or 0 if the
+// indicators don't give it.
+static int symbol_number_rows(struct symbol_matrix *read, const int *clusters, int *numbers) {
+  int upper[30] = {0}, lower[3] = {0}, last = read->columns - 1;
+
+  for (int r = 0; r < read->rows; r++) {
+    int k = clusters[r] / 3, left = symbol_matrix_get(read, r, 0), right = last > 0 ? symbol_matrix_get(read, r, last) : -1,
+        from_left = left >= 0 ? 3*(left/30) + k : -1, from_right = right >= 0 ? 3*(right/30) + k : -1;
+    numbers[r] = from_left < 0 || from_left == from_right ? from_right : from_right < 0 ? from_left : -1;
+    if (numbers[r] < 0) continue;
+
+    if (k == 0 && left >= 0) upper[left % 30]++;
+    if (k == 1 && right >= 0) upper[right % 30]++;
+    if (k == 1 && left >= 0) lower[left % 30 % 3]++;
+    if (k == 2 && right >= 0) lower[right % 30 % 3]++;
+  }
+
+  int high = most_votes(upper, 30), low = most_votes(lower, 3);
+  if (high < 0 || low < 0) return 0;
+  int total = 3*high + low + 1;
+
+  // each pass numbers rows from the last numbered row it passed
+  for (int pass = 0; pass < 2; pass++) {
+    int from = -1;
+    for (int i = 0; i < read->rows; i++) {
+      int r = pass ? read->rows-1-i : i;
+      if (numbers[r] >= 0) {
+        from = r;
+      } else if (from >= 0) {
+        int number = numbers[from] + (r - from);
+        if (number >= 0 && number % 3 == clusters[r] / 3) numbers[r] = number;
+      }
+    }
+  }
+  for (int r = 0; r < read->rows; r++) {
+    if (numbers[r] >= total) numbers[r] = -1;
+  }
+
+  return total;
+}
+
+static int line_samples(double x0, double y0, double x1, double y1) {
+  return (int) ceil(2*hypot(x1-x0, y1-y0)) + 1;
+}
+
+// Collects the lengths of the runs of the same color along the line from
+// (x0, y0) to (x1, y1), sampled every half pixel. Each sample takes the majority
+// of three pixels across the line, which suppresses specks without blurring the
+// edges of bars, since those run across the line too. Pixels outside of the
+// image are light. Returns the number of runs, which never exceeds
+// line_samples().
+static int image1_line_runs(struct image1 *im, double x0, double y0, double x1, double y1,
+                            int *runs, bool *first_dark) {
+  int samples = line_samples(x0, y0, x1, y1), count = 0;
+  double length = hypot(x1-x0, y1-y0),
+         dx = (x1-x0)/(samples > 1 ? samples-1 : 1),
+         dy = (y1-y0)/(samples > 1 ? samples-1 : 1),
+         nx = length > 0 ? -(y1-y0)/length : 0,
+         ny = length > 0 ? (x1-x0)/length : 0;
+  bool current = false;
+
+  for (int i = 0; i < samples; i++) {
+    double x = x0 + dx*i + 0.5, y = y0 + dy*i + 0.5;
+    int dark = 0;
+    for (int j = -1; j <= 1; j++) {
+      dark += !image1_get_with_fallback(im, (int) floor(x + nx*j), (int) floor(y + ny*j), true);
+    }
+
+    if (i == 0) *first_dark = dark >= 2;
+    if (i > 0 && (dark >= 2) == current) {
+      runs[count-1]++;
+    } else {
+      runs[count++] = 1;
+      current = dark >= 2;
+    }
+  }
+
+  return count;
+}
+
+static void reverse_runs(int *runs, int count, bool *first_dark) {
+  for (int i = 0, j = count-1; i < j; i++, j--) {
+    int tmp = runs[i];
+    runs[i] = runs[j];
+    runs[j] = tmp;
+  }
+  if (!(count & 1)) *first_dark = !*first_dark;
+}
+
+static long runs_sum(int *runs, int count) {
+  long sum = 0;
+  for (int i = 0; i < count; i++) sum += runs[i];
+  return sum;
+}
+
+// Reads the symbol characters along one scanline, from its start pattern to its
+// stop pattern. The module width comes from the start pattern and follows good
+// characters, which copes with gentle perspective. After a character that can't
+// be read, reading resumes at the bar closest to where the next one should
+// start, so a flaw costs a single cell.
+static bool scanline_read(int *runs, int count, bool first_dark, struct scanline *line) {
+  int modules[SYMBOL_ELEMENTS], pos = -1;
+  double module = 0;
+
+  line->cells = 0;
+  line->complete = false;
+
+  for (int i = first_dark ? 0 : 1; i + SYMBOL_ELEMENTS <= count; i += 2) {
+    if (symbol_normalize_widths(runs+i, SYMBOL_ELEMENTS, SYMBOL_MODULES, modules) &&
+        memcmp(modules, start_pattern, sizeof(modules)) == 0) {
+      pos = i + SYMBOL_ELEMENTS;
+      module = (double) runs_sum(runs+i, SYMBOL_ELEMENTS) / SYMBOL_MODULES;
+      break;
+    }
+  }
+  if (pos < 0) return false;
+
+  while (pos + SYMBOL_ELEMENTS <= count && line->cells < SYMBOL_MAX_COLUMNS) {
+    long width = runs_sum(runs+pos, SYMBOL_ELEMENTS);
+    bool fits = fabs(width - SYMBOL_MODULES*module) <= SYMBOL_MODULES*module/4;
+    unsigned pattern = 0;
+
+    if (fits && symbol_normalize_widths(runs+pos, SYMBOL_ELEMENTS, SYMBOL_MODULES, modules)) {
+      if (memcmp(modules, stop_pattern, sizeof(modules)) == 0) {
+        line->complete = true;
+        break;
+      }
+      pattern = symbol_pattern(modules);
+      if (symbol_cluster(pattern) < 0) pattern = 0;
+    }
+    line->patterns[line->cells++] = pattern;
+
+    if (pattern) {
+      module = (3*module + (double) width/SYMBOL_MODULES) / 4;
+      pos += SYMBOL_ELEMENTS;
+    } else {
+      double target = SYMBOL_MODULES*module, best = -1;
+      long offset = 0;
+      int next = pos + 2;
+
+      for (int j = pos; j + 1 < count; j += 2) {
+        offset += runs[j] + runs[j+1];
+        if (best >= 0 && fabs(offset - target) >= best) break;
+        best = fabs(offset - target);
+        next = j + 2;
+      }
+      pos = next;
+    }
+  }
+
+  int votes[9] = {0};
+  for (int i = 0; i < line->cells; i++) {
+    int cluster = symbol_cluster(line->patterns[i]);
+    if (cluster >= 0) votes[cluster]++;
+  }
+  line->cluster = -1;
+  for (int cluster = 0; cluster < 9; cluster += 3) {
+    if (votes[cluster] && (line->cluster < 0 || votes[cluster] > votes[line->cluster])) line->cluster = cluster;
+  }
+
+  return line->cluster >= 0;
+}
+
+// Picks the most common reading of one column among a row's scanlines.
+static unsigned group_vote(struct scanline *lines, int *order, struct scanline_group *group, int column) {
+  unsigned best = 0;
+  int best_votes = 0;
+
+  for (int a = group->begin; a < group->end; a++) {
+    struct scanline *line = &lines[order[a]];
+    if (column >= line->cells) continue;
+    unsigned pattern = line->patterns[column];
+    if (!pattern || symbol_cluster(pattern) != group->cluster) continue;
+
+    int votes = 0;
+    for (int b = a; b < group->end; b++) {
+      struct scanline *other = &lines[order[b]];
+      if (column < other->cells && other->patterns[column] == pattern) votes++;
+    }
+    if (votes > best_votes) {
+      best = pattern;
+      best_votes = votes;
+    }
+  }
+
+  return best;
+}
+
+// Reads the symbol characters of a PDF417 barcode located by its edge guards.
+// Scanlines run across the barcode from the left edge to the right one, about a
+// pixel apart, and extend past both guards, which only cover the wide bars of
+// the start and stop patterns. The barcode may be upside down, in which case
+// the scanlines find their start patterns reading backwards. PDF417 rows cycle
+// through clusters 0, 3 and 6, so the scanlines are split into rows wherever
+// their cluster changes, and each cell is voted on by its row's scanlines.
+// Groups of scanlines less than about a module wide (going by the guards) are
+// dropped, since rows are at least 3 modules tall and so much wider than that.
+// The rows read are then placed by their row indicators, so rows that couldn't
+// be read at all come out as rows of -1. Returns NULL if out of memory, and an
+// empty matrix if no barcode could be read.
+static struct symbol_matrix *image1_read_symbol(struct image1 *im, struct rectangle_pair *pair,
+                                                struct barcode_corners *corners,
+                                                void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct point *ul = &corners->upper_left, *ll = &corners->lower_left,
+               *ur = &corners->upper_right, *lr = &corners->lower_right;
+  int guard_width = pair->one->width > pair->two->width ? pair->one->width : pair->two->width,
+      guard_modules = (start_pattern[0] + stop_pattern[0]) / 2,
+      margin = 2*guard_width + 2,
+      count = (int) ceil(fmax(hypot(ll->x-ul->x, ll->y-ul->y), hypot(lr->x-ur->x, lr->y-ur->y))) + 1,
+      capacity = (int) fmax(line_samples(ul->x, ul->y, ur->x, ur->y), line_samples(ll->x, ll->y, lr->x, lr->y)) + 4*margin + 4,
+      min_lines = (int) floor((double) (pair->one->width + pair->two->width) / 2 / guard_modules + 0.5);
+  struct symbol_matrix *matrix = NULL, *read = NULL;
+  int *clusters = NULL;
+  struct scanline *lines = malloc(sizeof(*lines)*count);
+  struct scanline_group *groups = malloc(sizeof(*groups)*count);
+  int *runs = malloc(sizeof(*runs)*capacity),
+      *order = malloc(sizeof(*order)*count);
+  if (!lines || !groups || !runs || !order) goto cleanup;
+
+  int forward = 0, backward = 0;
+  for (int k = 0; k < count; k++) {
+    double t = (k + 0.5) / count,
+           x0 = ul->x + (ll->x-ul->x)*t, y0 = ul->y + (ll->y-ul->y)*t,
+           x1 = ur->x + (lr->x-ur->x)*t, y1 = ur->y + (lr->y-ur->y)*t,
+           length = hypot(x1-x0, y1-y0);
+    bool first_dark = false;
+    if (length > 0) {
+      double dx = (x1-x0)/length*margin, dy = (y1-y0)/length*margin;
+      x0 -= dx; y0 -= dy;
+      x1 += dx; y1 += dy;
+    }
+
+    int num_runs = image1_line_runs(im, x0, y0, x1, y1, runs, &first_dark);
+    lines[k].reversed = false;
+    if (!scanline_read(runs, num_runs, first_dark, &lines[k])) {
+      reverse_runs(runs, num_runs, &first_dark);
+      lines[k].reversed = scanline_read(runs, num_runs, first_dark, &lines[k]);
+      if (!lines[k].reversed) lines[k].cluster = -1;
+    }
+
+    if (lines[k].cluster >= 0) {
+      if (lines[k].reversed) backward++;
+      else forward++;
+    }
+  }
+
+  // settle on one direction, and on the most common number of cells
+  bool upside_down = backward > forward;
+  int cell_votes[2][SYMBOL_MAX_COLUMNS+1] = {{0}}, columns = 0, num_lines = 0;
+  for (int k = 0; k < count; k++) {
+    if (lines[k].cluster >= 0 && lines[k].reversed != upside_down) lines[k].cluster = -1;
+    if (lines[k].cluster >= 0) cell_votes[lines[k].complete][lines[k].cells]++;
+  }
+  for (int complete = 1; complete >= 0 && !columns; complete--) {
+    for (int cells = 1; cells <= SYMBOL_MAX_COLUMNS; cells++) {
+      if (cell_votes[complete][cells] > cell_votes[complete][columns]) columns = cells;
+    }
+  }
+
+  // group the scanlines into rows, from the top of the barcode
+  for (int k = 0; k < count; k++) {
+    int idx = upside_down ? count-1-k : k;
+    if (lines[idx].cluster >= 0) order[num_lines++] = idx;
+  }
+
+  int num_groups = 0;
+  for (int a = 0; a < num_lines; a++) {
+    int cluster = lines[order[a]].cluster;
+    if (num_groups && groups[num_groups-1].cluster == cluster) {
+      groups[num_groups-1].end = a+1;
+    } else {
+      groups[num_groups++] = (struct scanline_group) { a, a+1, cluster };
+    }
+  }
+
+  // repeatedly drop the shortest group, merging its neighbors if they match,
+  // so that stray scanlines inside a row don't break it into short pieces
+  int rows = num_groups;
+  while (rows) {
+    int shortest = 0;
+    for (int g = 1; g < rows; g++) {
+      if (groups[g].end - groups[g].begin < groups[shortest].end - groups[shortest].begin) shortest = g;
+    }
+    if (groups[shortest].end - groups[shortest].begin >= min_lines) break;
+
+    int removed = 1;
+    if (shortest > 0 && shortest < rows-1 && groups[shortest-1].cluster == groups[shortest+1].cluster) {
+      groups[shortest-1].end = groups[shortest+1].end;
+      removed = 2;
+    }
+    memmove(&groups[shortest], &groups[shortest+removed], sizeof(*groups)*(rows-shortest-removed));
+    rows -= removed;
+  }
+
+  if (!columns) rows = 0;
+  if (!(read=symbol_matrix_new(rows, columns, malloc, free)) ||
+      !(clusters=malloc(sizeof(*clusters)*2*(rows > 0 ? rows : 1)))) goto cleanup;
+  for (int r = 0; r < rows; r++) {
+    clusters[r] = groups[r].cluster;
+    for (int c = 0; c < columns; c++) {
+      unsigned pattern = group_vote(lines, order, &groups[r], c);
+      if (pattern) read->data[r*columns + c] = symbol_codeword(pattern);
+    }
+  }
+
+  // without enough readable indicators, the rows are left in the order read
+  int *numbers = clusters + rows, total = symbol_number_rows(read, clusters, numbers);
+  if (!total) {
+    matrix = read;
+    read = NULL;
+  } else if ((matrix=symbol_matrix_new(total, columns, malloc, free))) {
+    for (int r = 0; r < rows; r++) {
+      if (numbers[r] >= 0) memcpy(matrix->data + numbers[r]*columns, read->data + r*columns, sizeof(*read->data)*columns);
+    }
+  }
+  if (matrix) matrix->upside_down = upside_down;
+
+cleanup:
+  symbol_matrix_free(read);
+  free(clusters);
+  free(lines);
+  free(groups);
+  free(runs);
+  free(order);
+  return matrix;
+}
@@ -0,0 +1,47 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+#include "rectangles.h"
+
+// Every PDF417 symbol character is 17 modules wide, made of 4 bars and 4 spaces
+// that are 1 to 6 modules each.
+#define SYMBOL_MODULES 17
+#define SYMBOL_ELEMENTS 8
+#define SYMBOL_MAX_ELEMENT 6
+// in each of the three clusters
+#define SYMBOL_CODEWORDS 929
+// at most 30 data columns, plus the left and right row indicators
+#define SYMBOL_MAX_COLUMNS 32
+
+// The codewords read from a PDF417 barcode, row by row, including the left and
+// right row indicators, or -1 where nothing could be read. Row r's indicators
+// are 30*(r/3) plus, for rows in cluster 0, 3 and 6 in turn:
+//
+//   left:  (rows-1)/3, 3*ecl + (rows-1)%3, data columns - 1
+//   right: data columns - 1, (rows-1)/3, 3*ecl + (rows-1)%3
+//
+// where ecl is the error correction level.
+struct symbol_matrix {
+  int rows, columns;
+  bool upside_down; // whether the rows were read bottom to top in the image
+  void (*free)(void *ptr);
+  int *data;
+};
+
+static struct symbol_matrix *symbol_matrix_new(int rows, int columns,
+                                               void *(*malloc)(size_t size), void (*free)(void *ptr));
+static void symbol_matrix_free(struct symbol_matrix *matrix);
+static int symbol_matrix_get(struct symbol_matrix *matrix, int row, int column);
+static int symbol_cluster(unsigned pattern);
+static int symbol_codeword(unsigned pattern);
+static bool symbol_normalize_widths(int *widths, int count, int modules, int *normalized);
+static unsigned symbol_pattern(int *modules);
+static int symbol_number_rows(struct symbol_matrix *read, const int *clusters, int *numbers);
+static struct symbol_matrix *image1_read_symbol(struct image1 *im, struct rectangle_pair *pair,
+                                                struct barcode_corners *corners,
+                                                void *(*malloc)(size_t size), void (*free)(void *ptr));
+
+#endif
@@ -0,0 +1,232 @@
+#include <stdlib.h> // NULL
+#include <string.h> // memset
+#include <math.h> // sqrt, atan2, cos, sin, fabs, round, HUGE_VAL
+#include <stdbool.h>
+#include "gradients.h"
+#include "morphology.h"
+
+// Sobel gradients of a row, given the rows around it. Plain loops over the
+// row, so the compiler can vectorize them. The first and last pixels get none.
+static void sobel_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                      int width, int *gx, int *gy) {
+  gx[0] = gy[0] = gx[width-1] = gy[width-1] = 0;
+  for (int x = 1; x < width-1; x++) {
+    gx[x] = (above[x+1] + 2*row[x+1] + below[x+1]) - (above[x-1] + 2*row[x-1] + below[x-1]);
+  }
+  for (int x = 1; x < width-1; x++) {
+    gy[x] = (below[x-1] + 2*below[x] + below[x+1]) - (above[x-1] + 2*above[x] + above[x+1]);
+  }
+}
+
+// How consistently oriented the gradients summed into a structure tensor are.
+static double coherence(double jxx, double jyy, double jxy) {
+  double sum = jxx + jyy;
+  return sum > 0 ? sqrt((jxx - jyy)*(jxx - jyy) + 4*jxy*jxy) / sum : 0;
+}
+
+// Pixels with gradients in cells first to last (inclusive), along a side of n
+// pixels whose ends have none.
+static long gradient_pixels(int first, int last, int n) {
+  int from = first*GRADIENT_CELL, to = (last + 1)*GRADIENT_CELL;
+  if (from < 1) from = 1;
+  if (to > n - 1) to = n - 1;
+  return to > from ? to - from : 0;
+}
+
+static uint64_t located_key_by_score(const void *elt, void *data) {
+  (void) data;
+  return ~radix_key_double(((const struct located_barcode *) elt)->score);
+}
+
+// Locates barcodes by their bars rather than their guards, so that damaged or
+// missing guards don't matter: gradients are taken at reduced resolution and
+// summed into a structure tensor per cell, and cells with strong, parallel
+// edges, judged along with their neighbors, are marked. The map of marked
+// cells is closed, and each blob in it fit with a rectangle, whose side along
+// the gradients is the barcode's rows. Returns the barcodes best first, or NULL
+// if out of memory.
+static struct darray *image8_locate_gradients(struct image8 *im, struct gradient_settings *settings,
+                                              void *(*malloc)(size_t size),
+                                              void *(*realloc)(void *ptr, size_t new_size),
+                                              void (*free)(void *ptr)) {
+  const int factor = GRADIENT_DECIMATION, cell = GRADIENT_CELL, scale = GRADIENT_DECIMATION*GRADIENT_CELL;
+  int small_width = im->width / factor, small_height = im->height / factor;
+  int cells_x = (small_width + cell - 1) / cell, cells_y = (small_height + cell - 1) / cell;
+  unsigned char *small = NULL;
+  int *gx = NULL, *gy = NULL;
+  double *tensors = NULL, *sums = NULL;
+  struct image1 *map = NULL;
+  struct image32 *labeled = NULL;
+  struct darray *regions = NULL, *hull = NULL, *found = darray_new(0, free, malloc, realloc, free);
+  struct hull_storage storage = {0};
+  struct morphology_kernel closing = {3, 3, false};
+  struct rectangle rect;
+
+  if (!found) return NULL;
+  if (small_width < 3 || small_height < 3) return found;
+
+  if (!(small=malloc((size_t) small_width*small_height)) ||
+      !(gx=malloc(sizeof(*gx) * small_width)) || !(gy=malloc(sizeof(*gy) * small_width)) ||
+      !(tensors=malloc(sizeof(*tensors) * 3*cells_x*cells_y)) ||
+      !(map=image1_new(cells_x, cells_y, malloc, free))) goto oom;
+  memset(tensors, 0, sizeof(*tensors) * 3*cells_x*cells_y);
+  memset(map->data, 0, sizeof(*map->data) * map->stride*cells_y);
+
+  for (int sy = 0; sy < small_height; sy++) {
+    for (int sx = 0; sx < small_width; sx++) {
+      unsigned sum = 0;
+      for (int y = sy*factor; y < sy*factor + factor; y++) {
+        for (int x = sx*factor; x < sx*factor + factor; x++) sum += image8_get(im, x, y);
+      }
+      small[(long) sy*small_width + sx] = sum / (factor*factor);
+    }
+  }
+
+  // structure tensors, [gx*gx, gy*gy, gx*gy] summed over each cell
+  for (int sy = 1; sy < small_height-1; sy++) {
+    const unsigned char *row = small + (long) sy*small_width;
+    double *t = tensors + 3L*(sy/cell)*cells_x;
+    sobel_row(row - small_width, row, row + small_width, small_width, gx, gy);
+    for (int sx = 1; sx < small_width-1; sx++) {
+      double *c = t + 3*(sx/cell);
+      c[0] += gx[sx]*gx[sx];
+      c[1] += gy[sx]*gy[sx];
+      c[2] += gx[sx]*gy[sx];
+    }
+  }
+
+  for (int cy = 0; cy < cells_y; cy++) {
+    for (int cx = 0; cx < cells_x; cx++) {
+      double jxx = 0, jyy = 0, jxy = 0;
+      for (int j = cy > 0 ? cy-1 : 0; j <= cy+1 && j < cells_y; j++) {
+        for (int i = cx > 0 ? cx-1 : 0; i <= cx+1 && i < cells_x; i++) {
+          double *c = tensors + 3L*(j*cells_x + i);
+          jxx += c[0];
+          jyy += c[1];
+          jxy += c[2];
+        }
+      }
+      // the cell's own edges must be strong too, or blobs would spread a cell
+      // past the bars
+      double *own = tensors + 3L*(cy*cells_x + cx), strong = (double) GRADIENT_MIN_MAGNITUDE*GRADIENT_MIN_MAGNITUDE;
+      long pixels = gradient_pixels(cx > 0 ? cx-1 : 0, cx+1, small_width) *
+                    gradient_pixels(cy > 0 ? cy-1 : 0, cy+1, small_height),
+           own_pixels = gradient_pixels(cx, cx, small_width) * gradient_pixels(cy, cy, small_height);
+      if (own_pixels && own[0] + own[1] >= strong*own_pixels && jxx + jyy >= strong*pixels &&
+          coherence(jxx, jyy, jxy) >= GRADIENT_MIN_COHERENCE) {
+        image1_set(map, cx, cy, true);
+      }
+    }
+  }
+
+  // gaps between marked cells are closed, and the blobs labeled and fit
+  if (!image1_morphology(map, MORPHOLOGY_CLOSE, &closing, malloc, free) ||
+      !(labeled=image1_label_regions(map, LABEL_LIGHT, malloc, realloc, free)) ||
+      !(regions=image1_extract_regions(map, labeled, malloc, realloc, free)) ||
+      !(hull=darray_new(0, NULL, malloc, realloc, free))) goto oom;
+
+  // the tensors of each blob's cells, by label
+  unsigned labels = 0;
+  for (long i = 0; i < (long) cells_x*cells_y; i++) {
+    if (labeled->data[i] >= labels) labels = labeled->data[i] + 1;
+  }
+  if (!(sums=malloc(sizeof(*sums) * 3*labels))) goto oom;
+  memset(sums, 0, sizeof(*sums) * 3*labels);
+  for (long i = 0; i < (long) cells_x*cells_y; i++) {
+    for (int k = 0; k < 3; k++) sums[3*labeled->data[i] + k] += tensors[3*i + k];
+  }
+
+  for (unsigned i = 0; i < regions->len; i++) {
+    struct region *region = darray_index(regions, i);
+    struct point *start = &region->boundary.start;
+    double *tensor = sums + 3*image32_get(labeled, start->x, start->y);
+
+    if (region->area*scale*scale < settings->area_threshold || region->boundary.len <= 2) continue;
+    if (!boundary_convex_hull(&region->boundary, hull, &storage)) goto oom;
+    if (hull->len <= 2) {
+      hull->len = 0;
+      continue;
+    }
+    hull_minimal_rectangle(hull, region->area, &rect);
+
+    // the rectangle's extent along its sides, in cells, measured from the hull
+    // for a center finer than a cell
+    double ox = cos(rect.orientation), oy = sin(rect.orientation),
+           min[2] = {HUGE_VAL, HUGE_VAL}, max[2] = {-HUGE_VAL, -HUGE_VAL};
+    for (unsigned j = 0; j < hull->len; j++) {
+      struct point *p = darray_index(hull, j);
+      double along[2] = {p->x*ox + p->y*oy, p->y*ox - p->x*oy};
+      for (int k = 0; k < 2; k++) {
+        if (along[k] < min[k]) min[k] = along[k];
+        if (along[k] > max[k]) max[k] = along[k];
+      }
+    }
+    hull->len = 0;
+
+    // the rows run along the blob's mean gradient, whichever side of the
+    // rectangle that's closer to. Cells at the ends of the bars are marked
+    // from edges at their sides, so the extent between the centers of the
+    // outermost cells is closest to the barcode's.
+    double gradient = atan2(2*tensor[2], tensor[0] - tensor[1]) / 2;
+    bool along_width = fabs(cos(gradient - rect.orientation)) >= sqrt(0.5);
+    double length = (along_width ? max[0] - min[0] : max[1] - min[1]) * scale,
+           thickness = (along_width ? max[1] - min[1] : max[0] - min[0]) * scale,
+           mid[2] = {(min[0] + max[0]) / 2, (min[1] + max[1]) / 2},
+           cx = (mid[0]*ox - mid[1]*oy + 0.5) * scale,
+           cy = (mid[0]*oy + mid[1]*ox + 0.5) * scale,
+           ux = along_width ? ox : -oy, uy = along_width ? oy : ox;
+    // read left to right, or downwards when upright
+    if (ux < -1e-9 || (ux < 1e-9 && uy < 0)) {
+      ux = -ux;
+      uy = -uy;
+    }
+    if (length*thickness < settings->area_threshold ||
+        length < settings->barcode_aspect_min*thickness ||
+        (settings->barcode_aspect_max > 0 && length > settings->barcode_aspect_max*thickness)) continue;
+
+    double ax = ux*length/2, ay = uy*length/2, bx = -uy*thickness/2, by = ux*thickness/2,
+           fill = (double) region->area / ((max[0] - min[0] + 1) * (max[1] - min[1] + 1));
+    struct located_barcode *located = malloc(sizeof(*located));
+    if (!located) goto oom;
+    *located = (struct located_barcode) {
+      .corners = {
+        .upper_left = {(int) round(cx - ax - bx), (int) round(cy - ay - by)},
+        .upper_right = {(int) round(cx + ax - bx), (int) round(cy + ay - by)},
+        .lower_left = {(int) round(cx - ax + bx), (int) round(cy - ay + by)},
+        .lower_right = {(int) round(cx + ax + bx), (int) round(cy + ay + by)}
+      },
+      .score = coherence(tensor[0], tensor[1], tensor[2]) * (fill < 1 ? fill : 1)
+    };
+    if (!darray_push(found, located)) {
+      free(located);
+      goto oom;
+    }
+  }
+  if (!darray_radix_sort(found, NULL, located_key_by_score)) goto oom;
+
+  free(small);
+  free(gx);
+  free(gy);
+  free(tensors);
+  free(sums);
+  image1_free(map);
+  image32_free(labeled);
+  darray_free(regions, true);
+  darray_free(hull, false);
+  free(storage.points);
+  return found;
+
+oom:
+  free(small);
+  free(gx);
+  free(gy);
+  free(tensors);
+  free(sums);
+  image1_free(map);
+  image32_free(labeled);
+  darray_free(regions, true);
+  darray_free(hull, false);
+  free(storage.points);
+  darray_free(found, true);
+  return NULL;
+}
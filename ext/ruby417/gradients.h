@@ -0,0 +1,38 @@
+#ifndef GRADIENTS_H
+#define GRADIENTS_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+#include "darray.h"
+#include "rectangles.h"
+
+// Gradients are taken at half resolution, and judged over cells of 4x4 of
+// those pixels, each with its neighbors, so 24x24 pixels at full resolution.
+#define GRADIENT_DECIMATION 2
+#define GRADIENT_CELL 4
+// cells whose mean Sobel magnitude (at most 4*255) is under this are flat
+#define GRADIENT_MIN_MAGNITUDE 60
+// 0 for edges in every direction, 1 for edges all parallel, like bars
+#define GRADIENT_MIN_COHERENCE 0.7
+
+// A barcode found by the gradient localizer.
+struct located_barcode {
+  struct barcode_corners corners;
+  double score; // coherence of its cells, times how much of its rectangle they fill
+};
+
+struct gradient_settings {
+  long area_threshold; // in pixels, of the barcode
+  int barcode_aspect_min, barcode_aspect_max; // length along the rows over height
+};
+
+static void sobel_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                      int width, int *gx, int *gy);
+static double coherence(double jxx, double jyy, double jxy);
+static struct darray *image8_locate_gradients(struct image8 *im, struct gradient_settings *settings,
+                                              void *(*malloc)(size_t size),
+                                              void *(*realloc)(void *ptr, size_t new_size),
+                                              void (*free)(void *ptr));
+
+#endif
@@ -1,7 +1,9 @@
 #include <math.h> // sin, cos
-#include <stdlib.h> // NULL
+#include <stdlib.h> // abs, NULL
+#include <string.h> // memset
 #include <stdbool.h>
 #include "image.h"
+#include "simd.h"
 
 static struct image8 *image8_new(int width, int height, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
   struct image8 *im = malloc(sizeof(*im));
@@ -10,7 +12,7 @@ static struct image8 *image8_new(int width, int height, void *(*malloc)(size_t s
     im->width = width;
     im->height = height;
     im->free = free;
-    im->data = malloc(sizeof(*im->data)*width*height);
+    im->data = malloc(sizeof(*im->data)*(width*height > 0 ? width*height : 1));
 
     if (!im->data) {
       free(im);
@@ -87,6 +89,98 @@ static unsigned image32_get_with_fallback(struct image32 *im, int x, int y, unsi
   return fallback;
 }
 
+static struct image1 *image1_new(int width, int height, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image1 *im = malloc(sizeof(*im));
+
+  if (im) {
+    im->width = width;
+    im->height = height;
+    im->stride = (width + 63) / 64;
+    im->free = free;
+    im->data = malloc(sizeof(*im->data)*im->stride*height);
+
+    if (!im->data) {
+      free(im);
+      return NULL;
+    }
+  }
+
+  return im;
+}
+
+static void image1_free(struct image1 *im) {
+  if (im) {
+    im->free(im->data);
+    im->free(im);
+  }
+}
+
+static void image1_set(struct image1 *im, int x, int y, bool val) {
+  if (x >= 0 && x < im->width && y >= 0 && y < im->height) {
+    uint64_t *word = &im->data[(long) im->stride*y + x/64];
+    if (val) *word |= (uint64_t) 1 << (x & 63);
+    else *word &= ~((uint64_t) 1 << (x & 63));
+  }
+}
+
+static bool image1_get(struct image1 *im, int x, int y) {
+  return (im->data[(long) im->stride*y + x/64] >> (x & 63)) & 1;
+}
+
+static bool image1_get_with_fallback(struct image1 *im, int x, int y, bool fallback) {
+  if (x >= 0 && x < im->width && y >= 0 && y < im->height) {
+    return image1_get(im, x, y);
+  }
+  return fallback;
+}
+
+// Returns the end (exclusive) of the run of same-colored pixels that contains
+// (x, y), by skipping over whole words until one contains a color change.
+static int image1_run_end(struct image1 *im, int x, int y) {
+  uint64_t *row = im->data + (long) im->stride*y,
+           flip = image1_get(im, x, y) ? ~(uint64_t) 0 : 0,
+           word = (row[x/64] ^ flip) & (~(uint64_t) 0 << (x & 63));
+  int i = x/64;
+
+  while (!word) {
+    if (++i == im->stride) return im->width;
+    word = row[i] ^ flip;
+  }
+
+  int end = i*64 + __builtin_ctzll(word);
+  return end < im->width ? end : im->width;
+}
+
+SIMD_INLINE void binarize_row(const unsigned char *src, uint64_t *dst, int width, unsigned char threshold) {
+  for (int i = 0; i*64 < width; i++) {
+    int n = (width - i*64 < 64) ? width - i*64 : 64;
+    uint64_t word = 0;
+    for (int b = 0; b < n; b++) word |= (uint64_t) (src[i*64+b] >= threshold) << b;
+    dst[i] = word;
+  }
+}
+
+static struct image1 *image8_binarize(struct image8 *im, unsigned char threshold,
+                                      void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image1 *out = image1_new(im->width, im->height, malloc, free);
+
+  if (out) {
+    for (int y = 0; y < im->height; y++) {
+      simd.binarize_row(im->data + (long) im->width*y, out->data + (long) out->stride*y, im->width, threshold);
+    }
+  }
+
+  return out;
+}
+
+static void image1_unpack(struct image1 *im, struct image8 *out) {
+  for (int y = 0; y < im->height; y++) {
+    uint64_t *src = im->data + (long) im->stride*y;
+    unsigned char *dst = out->data + (long) out->width*y;
+    for (int x = 0; x < im->width; x++) dst[x] = (src[x/64] >> (x & 63)) & 1 ? 255 : 0;
+  }
+}
+
 static struct point *point_new(int x, int y, void *(*malloc)(size_t size)) {
   struct point *pt = malloc(sizeof(*pt));
   if (pt) {
@@ -102,6 +196,102 @@ static void point_rotate(struct point *p, struct point *origin, double angle, st
   out->y = (int) round(origin->y+(x-origin->x)*sin(angle)+(y-origin->y)*cos(angle));
 }
 
+// Offsets of the neighbors of a pixel, clockwise from the right.
+static const int neighbor_offsets[8][2] = {
+  { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+};
+
+// The neighbor at offset (dx, dy), indexed by 3*(dy+1) + dx+1, or -1 for the
+// pixel itself.
+static const int neighbor_directions[9] = { 5, 6, 7, 4, -1, 0, 3, 2, 1 };
+
+static void boundary_init(struct boundary *boundary, void *(*realloc)(void *ptr, size_t new_size), void (*free)(void *ptr)) {
+  *boundary = (struct boundary) {.realloc = realloc, .free = free};
+}
+
+// Empties the boundary, keeping its codes' memory for reuse.
+static void boundary_clear(struct boundary *boundary) {
+  boundary->len = 0;
+  boundary->nibbles = 0;
+}
+
+static void boundary_release(struct boundary *boundary) {
+  boundary->free(boundary->codes);
+  boundary->codes = NULL;
+  boundary->capacity = 0;
+  boundary_clear(boundary);
+}
+
+static void boundary_put_nibble(struct boundary *boundary, unsigned nibble) {
+  unsigned char *byte = boundary->codes + boundary->nibbles/2;
+  *byte = boundary->nibbles & 1 ? (*byte & 0x0f) | nibble << 4 : nibble;
+  boundary->nibbles++;
+}
+
+// Appends a point, as a step from the last one. The boundary is unchanged if
+// there's no memory for it.
+static bool boundary_push(struct boundary *boundary, int x, int y) {
+  if (!boundary->len) {
+    boundary->start = boundary->last = (struct point) {x, y};
+    boundary->len = 1;
+    return true;
+  }
+
+  int dx = x - boundary->last.x, dy = y - boundary->last.y,
+      direction = abs(dx) <= 1 && abs(dy) <= 1 ? neighbor_directions[3*(dy+1) + dx+1] : -1;
+  size_t needed = (boundary->nibbles + (direction < 0 ? 17 : 1) + 1) / 2;
+
+  if (needed > boundary->capacity) {
+    size_t capacity = boundary->capacity ? 2*boundary->capacity : 8;
+    if (capacity < needed) capacity = needed;
+    unsigned char *codes = boundary->realloc(boundary->codes, capacity);
+    if (!codes) return false;
+    boundary->codes = codes;
+    boundary->capacity = capacity;
+  }
+
+  if (direction >= 0) {
+    boundary_put_nibble(boundary, (unsigned) direction);
+  } else {
+    boundary_put_nibble(boundary, BOUNDARY_JUMP);
+    for (int i = 0; i < 8; i++) boundary_put_nibble(boundary, ((unsigned) x >> 4*i) & 0xf);
+    for (int i = 0; i < 8; i++) boundary_put_nibble(boundary, ((unsigned) y >> 4*i) & 0xf);
+  }
+  boundary->last = (struct point) {x, y};
+  boundary->len++;
+  return true;
+}
+
+static void boundary_iterate(const struct boundary *boundary, struct boundary_iterator *it) {
+  *it = (struct boundary_iterator) {.boundary = boundary, .point = boundary->start};
+}
+
+static unsigned boundary_get_nibble(struct boundary_iterator *it) {
+  unsigned char byte = it->boundary->codes[it->nibble/2];
+  return (it->nibble++ & 1 ? byte >> 4 : byte) & 0xf;
+}
+
+// Gives the next point of the boundary, or returns false past the last one.
+static bool boundary_next(struct boundary_iterator *it, struct point *point) {
+  if (it->index >= it->boundary->len) return false;
+
+  if (it->index++ > 0) {
+    unsigned code = boundary_get_nibble(it);
+    if (code < BOUNDARY_JUMP) {
+      it->point.x += neighbor_offsets[code][0];
+      it->point.y += neighbor_offsets[code][1];
+    } else {
+      unsigned x = 0, y = 0;
+      for (int i = 0; i < 8; i++) x |= boundary_get_nibble(it) << 4*i;
+      for (int i = 0; i < 8; i++) y |= boundary_get_nibble(it) << 4*i;
+      it->point = (struct point) {(int) x, (int) y};
+    }
+  }
+
+  *point = it->point;
+  return true;
+}
+
 static struct region *region_new(void *(*malloc)(size_t size),
                                  void *(*realloc)(void *ptr, size_t new_size),
                                  void (*free)(void *ptr)) {
@@ -110,28 +300,15 @@ static struct region *region_new(void *(*malloc)(size_t size),
     reg->cx = 0;
     reg->cy = 0;
     reg->area = 0;
-    reg->boundary = darray_new(16, free, malloc, realloc, free);
-
-    if (!reg->boundary) {
-      free(reg);
-      return NULL;
-    }
+    boundary_init(&reg->boundary, realloc, free);
   }
   return reg;
 }
 
-static void region_shallow_free(struct region *reg) {
-  if (reg) {
-    void (*free)(void *ptr) = reg->boundary->free;
-    darray_free(reg->boundary, false);
-    free(reg);
-  }
-}
-
 static void region_free(struct region *reg) {
   if (reg) {
-    void (*free)(void *ptr) = reg->boundary->free;
-    darray_free(reg->boundary, true);
+    void (*free)(void *ptr) = reg->boundary.free;
+    boundary_release(&reg->boundary);
     free(reg);
   }
 }
@@ -225,24 +402,16 @@ static bool is_contour_pixel(struct image8 *im, int x, int y, unsigned char targ
          target != image8_get_with_fallback(im, x, y+1, ~target);
 }
 
-static bool image_follow_contour(struct image8 *im, struct darray *boundary, int start_x, int start_y) {
+static bool image_follow_contour(struct image8 *im, struct boundary *boundary, int start_x, int start_y) {
   static const int RIGHT = 0, DOWN = 1, LEFT = 2, UP = 3;
-  struct point* point = NULL;
   unsigned char target = image8_get(im, start_x, start_y);
   int direction = DOWN, x = start_x, y = start_y;
   do {
     unsigned char color = image8_get_with_fallback(im, x, y, ~target);
 
     if (color == target) {
-      if ((!point || x != point->x || y != point->y) && is_contour_pixel(im, x, y, target)) {
-        point = point_new(x, y, boundary->malloc);
-        if (!point || !darray_push(boundary, point)) {
-          if (boundary->eltfree) boundary->eltfree(point);
-          else boundary->free(point);
-
-          return false;
-        }
-      }
+      if ((!boundary->len || x != boundary->last.x || y != boundary->last.y) && is_contour_pixel(im, x, y, target) &&
+          !boundary_push(boundary, x, y)) return false;
       direction = (direction - 1) & 3; // left turn
     } else {
       direction = (direction + 1) & 3; // right turn
@@ -257,6 +426,110 @@ static bool image_follow_contour(struct image8 *im, struct darray *boundary, int
   return true;
 }
 
+// Computes the neighborhood code of every pixel, which has bit i set if the
+// pixel's i-th neighbor (see neighbor_offsets) is the same color as it. The
+// code image has a one pixel border of zeros, so pixel (x, y) is at (x+1, y+1).
+static struct image8 *image8_neighborhood(struct image8 *im, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image8 *codes = image8_new(im->width+2, im->height+2, malloc, free);
+  if (!codes) return NULL;
+
+  memset(codes->data, 0, (size_t) codes->width*codes->height);
+
+  for (int y = 0; y < im->height; y++) {
+    for (int x = 0; x < im->width; x++) {
+      unsigned char color = image8_get(im, x, y), code = 0;
+      for (int i = 0; i < 8; i++) {
+        code |= (image8_get_with_fallback(im, x+neighbor_offsets[i][0], y+neighbor_offsets[i][1], ~color) == color) << i;
+      }
+      image8_set(codes, x+1, y+1, code);
+    }
+  }
+
+  return codes;
+}
+
+// Spreads the bits of a byte into the lowest bits of the bytes of a word.
+static uint64_t spread_byte(uint64_t b) {
+  b = (b | b << 28) & 0x0000000f0000000full;
+  b = (b | b << 14) & 0x0003000300030003ull;
+  return (b | b << 7) & 0x0101010101010101ull;
+}
+
+// Returns word i of the given row shifted so that each bit holds the pixel dx
+// to its right, or zero if the row is outside the image.
+static uint64_t image1_shifted_word(struct image1 *im, int y, int i, int dx) {
+  if (y < 0 || y >= im->height) return 0;
+  uint64_t *row = im->data + (long) im->stride*y;
+  if (dx > 0) return (row[i] >> 1) | (i+1 < im->stride ? row[i+1] << 63 : 0);
+  if (dx < 0) return (row[i] << 1) | (i > 0 ? row[i-1] >> 63 : 0);
+  return row[i];
+}
+
+// Computes the neighborhood codes of row y, comparing 64 pixels with each
+// neighbor at a time.
+SIMD_INLINE void neighborhood_row(struct image1 *im, int y, unsigned char *dst) {
+  for (int i = 0; i < im->stride; i++) {
+    uint64_t center = im->data[(long) im->stride*y + i], same[8];
+
+    for (int n = 0; n < 8; n++) {
+      int dx = neighbor_offsets[n][0], ny = y + neighbor_offsets[n][1];
+      uint64_t valid = (ny >= 0 && ny < im->height) ? ~(uint64_t) 0 : 0;
+      if (dx < 0 && i == 0) valid &= ~(uint64_t) 1;
+      if (dx > 0 && i == (im->width-1)/64) valid &= ~((uint64_t) 1 << ((im->width-1) & 63));
+      same[n] = ~(center ^ image1_shifted_word(im, ny, i, dx)) & valid;
+    }
+
+    for (int g = 0; g < 8 && i*64 + g*8 < im->width; g++) {
+      uint64_t bytes = 0;
+      for (int n = 0; n < 8; n++) bytes |= spread_byte((same[n] >> g*8) & 0xff) << n;
+      for (int b = 0; b < 8 && i*64 + g*8 + b < im->width; b++) dst[i*64 + g*8 + b] = bytes >> b*8;
+    }
+  }
+}
+
+// Computes the same neighborhood codes as image8_neighborhood.
+static struct image8 *image1_neighborhood(struct image1 *im, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image8 *codes = image8_new(im->width+2, im->height+2, malloc, free);
+  if (!codes) return NULL;
+
+  memset(codes->data, 0, (size_t) codes->width*codes->height);
+
+  for (int y = 0; y < im->height; y++) {
+    simd.neighborhood_row(im, y, codes->data + (long) codes->width*(y+1) + 1);
+  }
+
+  return codes;
+}
+
+// Follows a contour in the same way as image_follow_contour, but over the
+// neighborhood codes of the image. Starting from a boundary pixel facing in
+// direction d, the walk either turns left onto neighbor 2d-2, or turns back right
+// onto neighbor 2d-1 or 2d, or goes around and returns to the same pixel, and
+// which of these happens depends only on those three bits of the pixel's code.
+// So each step is a table lookup and moves directly to the next boundary pixel.
+static bool neighborhood_follow_contour(struct image8 *codes, struct boundary *boundary, int start_x, int start_y) {
+  static const int DOWN = 1;
+  // index of the first set bit among the three neighbors, or 3 if none are set
+  static const int moves[8] = { 3, 0, 1, 0, 2, 0, 1, 0 };
+  int direction = DOWN, x = start_x, y = start_y;
+  do {
+    unsigned code = codes->data[(long) codes->width*(y+1) + x+1];
+
+    if ((!boundary->len || x != boundary->last.x || y != boundary->last.y) && (code & 0x55) != 0x55 &&
+        !boundary_push(boundary, x, y)) return false;
+
+    int first = (2*direction + 6) & 7,
+        move = moves[((code | code << 8) >> first) & 7];
+    if (move < 3) {
+      x += neighbor_offsets[(first + move) & 7][0];
+      y += neighbor_offsets[(first + move) & 7][1];
+    }
+    direction = (direction + move - 1) & 3;
+  } while (x != start_x || y != start_y);
+
+  return true;
+}
+
 static void region_free_wrapper(void *ptr) {
   region_free((struct region *) ptr);
 }
@@ -267,52 +540,273 @@ static struct darray *image_extract_regions(struct image8 *image,
                                             void *(*realloc)(void *ptr, size_t new_size),
                                             void (*free)(void *ptr)) {
   struct darray *regions = darray_new(16, region_free_wrapper, malloc, realloc, free);
+  struct image8 *codes = image8_neighborhood(image, malloc, free);
+  if (!regions || !codes) goto oom;
 
-  if (regions) {
-    for (int y = 0; y < labeled->height; y++) {
-      for (int x = 0; x < labeled->width; x++) {
-        unsigned label = image32_get(labeled, x, y);
-        struct region *region = darray_index(regions, label);
+  for (int y = 0; y < labeled->height; y++) {
+    for (int x = 0; x < labeled->width; x++) {
+      unsigned label = image32_get(labeled, x, y);
+      struct region *region = darray_index(regions, label);
 
-        if (!region) {
-          for (unsigned z = regions->len; z <= label; z++) {
-            if (!darray_push(regions, NULL)) goto oom;
-          }
+      if (!region) {
+        for (unsigned z = regions->len; z <= label; z++) {
+          if (!darray_push(regions, NULL)) goto oom;
+        }
 
-          if ((region=region_new(malloc, realloc, free))) {
-            darray_index_set(regions, label, region);
+        if ((region=region_new(malloc, realloc, free))) {
+          darray_index_set(regions, label, region);
 
-            if (!image_follow_contour(image, region->boundary, x, y)) {
-              goto oom;
-            }
-          } else {
+          if (!neighborhood_follow_contour(codes, &region->boundary, x, y)) {
             goto oom;
           }
+        } else {
+          goto oom;
+        }
+      }
+
+      region->area++;
+      region->cx += x;
+      region->cy += y;
+    }
+  }
+
+  unsigned i = 0;
+  while (i < regions->len) {
+    struct region *region = darray_index(regions, i);
+
+    if (region) {
+      region->cx /= region->area;
+      region->cy /= region->area;
+      ++i;
+    } else {
+      darray_remove_fast(regions, i);
+    }
+  }
+
+  image8_free(codes);
+  return regions;
+
+oom:
+  image8_free(codes);
+  darray_free(regions, true);
+  return NULL;
+}
+
+SIMD_INLINE void relabel(unsigned *labels, long n, const unsigned *roots) {
+  for (long z = 0; z < n; z++) labels[z] = roots[labels[z]];
+}
+
+struct label_run {
+  int start, end;
+  unsigned label;
+  bool color;
+};
+
+// Labels 4-connected regions a run at a time. Every run of same-colored pixels
+// in a row is found with image1_run_end and joined to the overlapping runs of
+// the same color in the previous row, so the union-find work is proportional to
+// the number of runs rather than the number of pixels. Runs of the color the
+// polarity excludes get label 0 and take no part in the union-find at all.
+static struct image32 *image1_label_regions(struct image1 *im, enum label_polarity polarity,
+                                            void *(*malloc)(size_t size),
+                                            void *(*realloc)(void *ptr, size_t new_size),
+                                            void (*free)(void *ptr)) {
+  struct image32 *labeled = image32_new(im->width, im->height, malloc, free);
+  struct darray *equivs = darray_new(128, NULL, malloc, realloc, free);
+  struct label_run *prev = malloc(sizeof(*prev) * (im->width + 1)),
+                   *cur = malloc(sizeof(*cur) * (im->width + 1));
+  unsigned *roots = NULL;
+  if (!labeled || !equivs || !prev || !cur) goto oom;
+
+  unsigned current_label = 1;
+  int prev_len = 0;
+  for (int y = 0; y < im->height; y++) {
+    unsigned *row = labeled->data + (long) im->width*y;
+    int cur_len = 0, j = 0;
+
+    for (int x = 0; x < im->width;) {
+      int end = image1_run_end(im, x, y);
+      bool color = image1_get(im, x, y);
+      unsigned label = 0;
+
+      // set bits are light
+      if ((polarity == LABEL_DARK && color) || (polarity == LABEL_LIGHT && !color)) {
+        for (; x < end; x++) row[x] = 0;
+        continue;
+      }
+
+      while (j < prev_len && prev[j].end <= x) j++;
+      for (int k = j; k < prev_len && prev[k].start < end; k++) {
+        if (prev[k].color != color) continue;
+        if (!label) {
+          label = prev[k].label;
+        } else if (label != prev[k].label && !uf_union(equivs, label, prev[k].label)) {
+          goto oom;
         }
+      }
 
-        region->area++;
-        region->cx += x;
-        region->cy += y;
+      if (!label) {
+        label = current_label++;
+        if (!uf_union(equivs, label, label)) goto oom;
       }
+
+      cur[cur_len++] = (struct label_run) { .start = x, .end = end, .label = label, .color = color };
+      for (; x < end; x++) row[x] = label;
     }
 
-    unsigned i = 0;
-    while (i < regions->len) {
-      struct region *region = darray_index(regions, i);
+    struct label_run *tmp = prev;
+    prev = cur;
+    cur = tmp;
+    prev_len = cur_len;
+  }
 
-      if (region) {
-        region->cx /= region->area;
-        region->cy /= region->area;
-        ++i;
-      } else {
-        darray_remove_fast(regions, i);
+  if (!(roots=malloc(sizeof(*roots) * current_label))) goto oom;
+  for (unsigned z = 0; z < current_label; z++) {
+    long root = uf_find(equivs, z);
+    roots[z] = root > 0 ? (unsigned) root : z;
+  }
+  simd.relabel(labeled->data, (long) im->width*im->height, roots);
+
+  free(roots);
+  free(prev);
+  free(cur);
+  darray_free(equivs, false);
+  return labeled;
+
+oom:
+  free(prev);
+  free(cur);
+  darray_free(equivs, false);
+  image32_free(labeled);
+  return NULL;
+}
+
+// Since every pixel in a run has the same label, the regions can be accumulated
+// a run at a time, reading a single label per run. Unlabeled runs are skipped.
+static struct darray *image1_extract_regions(struct image1 *image,
+                                             struct image32 *labeled,
+                                             void *(*malloc)(size_t size),
+                                             void *(*realloc)(void *ptr, size_t new_size),
+                                             void (*free)(void *ptr)) {
+  struct darray *regions = darray_new(16, region_free_wrapper, malloc, realloc, free);
+  struct image8 *codes = image1_neighborhood(image, malloc, free);
+  if (!regions || !codes) goto oom;
+
+  for (int y = 0; y < labeled->height; y++) {
+    for (int x = 0; x < labeled->width;) {
+      int end = image1_run_end(image, x, y);
+      unsigned label = image32_get(labeled, x, y);
+      struct region *region = darray_index(regions, label);
+
+      if (!label) {
+        x = end;
+        continue;
+      } else if (!region) {
+        for (unsigned z = regions->len; z <= label; z++) {
+          if (!darray_push(regions, NULL)) goto oom;
+        }
+
+        if ((region=region_new(malloc, realloc, free))) {
+          darray_index_set(regions, label, region);
+
+          if (!neighborhood_follow_contour(codes, &region->boundary, x, y)) {
+            goto oom;
+          }
+        } else {
+          goto oom;
+        }
       }
+
+      region->area += end - x;
+      region->cx += (long) (x + end - 1) * (end - x) / 2;
+      region->cy += (long) y * (end - x);
+      x = end;
     }
   }
 
+  unsigned i = 0;
+  while (i < regions->len) {
+    struct region *region = darray_index(regions, i);
+
+    if (region) {
+      region->cx /= region->area;
+      region->cy /= region->area;
+      ++i;
+    } else {
+      darray_remove_fast(regions, i);
+    }
+  }
+
+  image8_free(codes);
   return regions;
 
 oom:
+  image8_free(codes);
   darray_free(regions, true);
   return NULL;
 }
+
+// Like image1_extract_regions, but only sums the moments of each region, a run
+// at a time, without tracing any contours.
+static struct darray *image1_extract_moments(struct image1 *image,
+                                             struct image32 *labeled,
+                                             void *(*malloc)(size_t size),
+                                             void *(*realloc)(void *ptr, size_t new_size),
+                                             void (*free)(void *ptr)) {
+  struct darray *moments = darray_new(16, free, malloc, realloc, free);
+  if (!moments) return NULL;
+
+  for (int y = 0; y < labeled->height; y++) {
+    for (int x = 0; x < labeled->width;) {
+      int end = image1_run_end(image, x, y);
+      unsigned label = image32_get(labeled, x, y);
+      struct region_moments *m = darray_index(moments, label);
+
+      if (!label) {
+        x = end;
+        continue;
+      } else if (!m) {
+        for (unsigned z = moments->len; z <= label; z++) {
+          if (!darray_push(moments, NULL)) goto oom;
+        }
+        if (!(m=malloc(sizeof(*m)))) goto oom;
+        *m = (struct region_moments) {.start = {x, y}};
+        darray_index_set(moments, label, m);
+      }
+
+      // sums of x and x^2 over the run, in closed form
+      long n = end - x;
+      double sx = (double) (x + end - 1) * n / 2,
+             sxx = ((double) (end-1)*end*(2L*end-1) - (double) (x-1)*x*(2L*x-1)) / 6;
+      m->area += n;
+      m->cx += sx;
+      m->cy += (double) y*n;
+      m->mxx += sxx;
+      m->myy += (double) y*y*n;
+      m->mxy += y*sx;
+      x = end;
+    }
+  }
+
+  unsigned i = 0;
+  while (i < moments->len) {
+    struct region_moments *m = darray_index(moments, i);
+
+    if (m) {
+      m->cx /= m->area;
+      m->cy /= m->area;
+      m->mxx = m->mxx/m->area - m->cx*m->cx + 1.0/12;
+      m->myy = m->myy/m->area - m->cy*m->cy + 1.0/12;
+      m->mxy = m->mxy/m->area - m->cx*m->cy;
+      ++i;
+    } else {
+      darray_remove_fast(moments, i);
+    }
+  }
+
+  return moments;
+
+oom:
+  darray_free(moments, true);
+  return NULL;
+}
@@ -2,6 +2,7 @@
 #define IMAGE_H
 
 #include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
 
 struct image8 {
   int width;
@@ -17,16 +18,66 @@ struct image32 {
   unsigned *data;
 };
 
+// A binary image, packed 64 pixels per word. Bit x%64 of word x/64 in a row
+// holds pixel x, and bits past the right edge of the image are unspecified.
+struct image1 {
+  int width;
+  int height;
+  int stride; // words per row
+  void (*free)(void *ptr);
+  uint64_t *data;
+};
+
 struct point {
   int x, y;
 };
 
+// Which pixels of a binary image labeling builds regions from. Guards are
+// dark, so by default light pixels are background and left unlabeled.
+enum label_polarity {
+  LABEL_DARK,
+  LABEL_LIGHT, // for reversed symbols
+  LABEL_BOTH
+};
+
+// A contour as its first point and a Freeman chain code, a nibble per step
+// from one point to the next (see neighbor_offsets), so a traced boundary takes
+// half a byte a pixel. A step that isn't to a neighbor is BOUNDARY_JUMP followed
+// by the point's coordinates, 16 nibbles of them. Nibbles are packed low first.
+#define BOUNDARY_JUMP 8
+
+struct boundary {
+  unsigned len; // points
+  struct point start, last;
+  size_t nibbles, capacity; // capacity in bytes
+  unsigned char *codes;
+  void *(*realloc)(void *ptr, size_t new_size);
+  void (*free)(void *ptr);
+};
+
+// Walks a boundary's points in order, decoding one step at a time.
+struct boundary_iterator {
+  const struct boundary *boundary;
+  unsigned index; // of the next point
+  size_t nibble;
+  struct point point;
+};
+
 struct region {
-  struct darray *boundary;
+  struct boundary boundary;
   long cx, cy;
   long area;
 };
 
+// A region's first and second moments, without its boundary. The second
+// moments are central, and count each pixel as a unit square.
+struct region_moments {
+  long area;
+  double cx, cy;
+  double mxx, myy, mxy;
+  struct point start; // the region's first pixel, where tracing its contour starts
+};
+
 
 static struct image8 *image8_new(int width, int height, void *(*malloc)(size_t size), void (*free)(void *ptr));
 static void image8_free(struct image8 *im);
@@ -40,22 +91,54 @@ static void image32_set(struct image32 *im, int x, int y, unsigned val);
 static unsigned image32_get(struct image32 *im, int x, int y);
 static unsigned image32_get_with_fallback(struct image32 *im, int x, int y, unsigned fallback);
 
+static struct image1 *image1_new(int width, int height, void *(*malloc)(size_t size), void (*free)(void *ptr));
+static void image1_free(struct image1 *im);
+static void image1_set(struct image1 *im, int x, int y, bool val);
+static bool image1_get(struct image1 *im, int x, int y);
+static bool image1_get_with_fallback(struct image1 *im, int x, int y, bool fallback);
+static int image1_run_end(struct image1 *im, int x, int y);
+static struct image1 *image8_binarize(struct image8 *im, unsigned char threshold,
+                                      void *(*malloc)(size_t size), void (*free)(void *ptr));
+static void image1_unpack(struct image1 *im, struct image8 *out);
+
 static struct point *point_new(int x, int y, void *(*malloc)(size_t size));
 static void point_rotate(struct point *p, struct point *origin, double angle, struct point *out);
+static void boundary_init(struct boundary *boundary, void *(*realloc)(void *ptr, size_t new_size), void (*free)(void *ptr));
+static void boundary_clear(struct boundary *boundary);
+static void boundary_release(struct boundary *boundary);
+static bool boundary_push(struct boundary *boundary, int x, int y);
+static void boundary_iterate(const struct boundary *boundary, struct boundary_iterator *it);
+static bool boundary_next(struct boundary_iterator *it, struct point *point);
 static struct region *region_new(void *(*malloc)(size_t size),
                                  void *(*realloc)(void *ptr, size_t new_size),
                                  void (*free)(void *ptr));
-static void region_shallow_free(struct region *reg);
 static void region_free(struct region *reg);
 static struct image32 *image_label_regions(struct image8 *im,
                                            void *(*malloc)(size_t size),
                                            void *(*realloc)(void *ptr, size_t new_size),
                                            void (*free)(void *ptr));
-static bool image_follow_contour(struct image8 *im, struct darray *boundary, int start_x, int start_y);
+static bool image_follow_contour(struct image8 *im, struct boundary *boundary, int start_x, int start_y);
+static struct image8 *image8_neighborhood(struct image8 *im, void *(*malloc)(size_t size), void (*free)(void *ptr));
+static struct image8 *image1_neighborhood(struct image1 *im, void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool neighborhood_follow_contour(struct image8 *codes, struct boundary *boundary, int start_x, int start_y);
 static struct darray *image_extract_regions(struct image8 *image,
                                             struct image32 *labeled,
                                             void *(*malloc)(size_t size),
                                             void *(*realloc)(void *ptr, size_t new_size),
                                             void (*free)(void *ptr));
+static struct image32 *image1_label_regions(struct image1 *im, enum label_polarity polarity,
+                                            void *(*malloc)(size_t size),
+                                            void *(*realloc)(void *ptr, size_t new_size),
+                                            void (*free)(void *ptr));
+static struct darray *image1_extract_regions(struct image1 *image,
+                                             struct image32 *labeled,
+                                             void *(*malloc)(size_t size),
+                                             void *(*realloc)(void *ptr, size_t new_size),
+                                             void (*free)(void *ptr));
+static struct darray *image1_extract_moments(struct image1 *image,
+                                             struct image32 *labeled,
+                                             void *(*malloc)(size_t size),
+                                             void *(*realloc)(void *ptr, size_t new_size),
+                                             void (*free)(void *ptr));
 
 #endif
@@ -0,0 +1,190 @@
+#include <stdlib.h> // NULL
+#include <stdbool.h>
+#include <pthread.h>
+#include "levels.h"
+#include "accounting.h"
+
+// Whether a point is inside the quadrilateral, taking the corners in order
+// around it, either way.
+static bool corners_contain(struct barcode_corners *c, double x, double y) {
+  struct point *ring[4] = {&c->upper_left, &c->upper_right, &c->lower_right, &c->lower_left};
+  int positive = 0, negative = 0;
+
+  for (int i = 0; i < 4; i++) {
+    struct point *p = ring[i], *q = ring[(i+1) % 4];
+    double cross = (double) (q->x - p->x)*(y - p->y) - (double) (q->y - p->y)*(x - p->x);
+    if (cross > 0) positive++;
+    if (cross < 0) negative++;
+  }
+
+  return !positive || !negative;
+}
+
+// Two barcodes are taken to be the same one if either's center is inside the
+// other.
+static bool located_guards_overlap(struct located_guards *a, struct located_guards *b) {
+  struct barcode_corners *ca = &a->corners, *cb = &b->corners;
+  double ax = (ca->upper_left.x + ca->upper_right.x + ca->lower_left.x + ca->lower_right.x) / 4.0,
+         ay = (ca->upper_left.y + ca->upper_right.y + ca->lower_left.y + ca->lower_right.y) / 4.0,
+         bx = (cb->upper_left.x + cb->upper_right.x + cb->lower_left.x + cb->lower_right.x) / 4.0,
+         by = (cb->upper_left.y + cb->upper_right.y + cb->lower_left.y + cb->lower_right.y) / 4.0;
+
+  return corners_contain(cb, ax, ay) || corners_contain(ca, bx, by);
+}
+
+static int located_cmp_by_score(const void *a, const void *b, void *ctx) {
+  (void) ctx;
+  double sa = ((struct located_guards *) a)->score, sb = ((struct located_guards *) b)->score;
+  return (sa < sb) - (sa > sb);
+}
+
+// Sorts barcodes by score, best first, on up to the given number of threads,
+// and drops every one that overlaps a better one. The sort is stable, so ties
+// go to the earlier level. Returns false if out of memory.
+static bool located_guards_merge(struct darray *found, int threads) {
+  unsigned kept = 0;
+
+  if (!darray_msort_threaded(found, NULL, located_cmp_by_score, threads)) return false;
+
+  for (unsigned i = 0; i < found->len; i++) {
+    struct located_guards *candidate = darray_index(found, i);
+    bool duplicate = false;
+
+    for (unsigned j = 0; j < kept && !duplicate; j++) {
+      duplicate = located_guards_overlap(darray_index(found, j), candidate);
+    }
+    if (duplicate) {
+      if (found->eltfree) found->eltfree(candidate);
+    } else {
+      darray_index_set(found, kept++, candidate);
+    }
+  }
+  found->len = kept;
+
+  return true;
+}
+
+struct levels_job {
+  struct image8 *im;
+  const unsigned char *thresholds;
+  int num_levels;
+  struct morphology_kernel *closings;
+  int num_closings;
+  struct pairing_settings *settings;
+  int first, step; // the levels this job handles
+  struct darray *found;
+  struct memory_account *account; // the caller's, for the threads to allocate against
+  bool ok;
+};
+
+// Binarizes at each of the job's levels, closes the binary image and locates
+// guards in it, collecting whatever is found.
+static void *levels_run(void *arg) {
+  struct levels_job *job = arg;
+  struct darray *found = job->found;
+  struct image1 *binary = NULL;
+  struct darray *rects = NULL, *pairs = NULL;
+
+  memory_account = job->account;
+  job->ok = false;
+  for (int level = job->first; level < job->num_levels; level += job->step) {
+    if (!(binary=image8_binarize(job->im, job->thresholds[level], found->malloc, found->free)) ||
+        !(rects=darray_new(0, found->free, found->malloc, found->realloc, found->free)) ||
+        !(pairs=darray_new(0, found->free, found->malloc, found->realloc, found->free))) goto cleanup;
+    for (int k = 0; k < job->num_closings; k++) {
+      if (!image1_morphology(binary, MORPHOLOGY_CLOSE, &job->closings[k], found->malloc, found->free)) goto cleanup;
+    }
+    if (!image1_locate_guards(binary, job->settings, rects, pairs)) goto cleanup;
+
+    for (unsigned i = 0; i < pairs->len; i++) {
+      struct located_guards *located = found->malloc(sizeof(*located));
+      if (!located) goto cleanup;
+      struct rectangle_pair *pair = darray_index(pairs, i);
+      determine_barcode_corners(pair, &located->corners);
+      located->score = pair->score;
+      located->level = level;
+      if (!darray_push(found, located)) {
+        found->free(located);
+        goto cleanup;
+      }
+    }
+
+    image1_free(binary);
+    darray_free(rects, true);
+    darray_free(pairs, true);
+    binary = NULL;
+    rects = pairs = NULL;
+  }
+  job->ok = true;
+
+cleanup:
+  image1_free(binary);
+  darray_free(rects, true);
+  darray_free(pairs, true);
+  return NULL;
+}
+
+// Locates barcodes at several threshold levels of a grayscale image, each
+// binarized image closed with the given kernels in turn, and merges what's
+// found: barcodes seen at several levels are kept once, at their best score.
+// Levels are spread over up to the given number of threads, each with its own
+// results, which are concatenated in level order before merging, so the result
+// doesn't depend on the number of threads. The allocator must be thread safe
+// with more than one thread; the threads allocate against the caller's memory
+// account. Returns NULL if out of memory.
+static struct darray *image8_locate_guards_levels(struct image8 *im, const unsigned char *thresholds, int num_levels,
+                                                  struct morphology_kernel *closings, int num_closings,
+                                                  struct pairing_settings *settings, int threads,
+                                                  void *(*malloc)(size_t size),
+                                                  void *(*realloc)(void *ptr, size_t new_size),
+                                                  void (*free)(void *ptr)) {
+  struct levels_job jobs[LEVELS_MAX_THREADS];
+  pthread_t handles[LEVELS_MAX_THREADS] = {0};
+  bool started[LEVELS_MAX_THREADS] = {false}, ok = true;
+  unsigned cursors[LEVELS_MAX_THREADS] = {0};
+  struct darray *found = darray_new(0, free, malloc, realloc, free), *level_found = NULL;
+
+  if (!found) return NULL;
+  if (num_levels > LEVELS_MAX) num_levels = LEVELS_MAX;
+  if (threads > LEVELS_MAX_THREADS) threads = LEVELS_MAX_THREADS;
+  if (threads > num_levels) threads = num_levels;
+  if (threads < 1) threads = 1;
+
+  for (int t = 0; t < threads; t++) {
+    jobs[t] = (struct levels_job) { im, thresholds, num_levels, closings, num_closings, settings, t, threads, NULL, memory_account, false };
+    if (!(jobs[t].found=darray_new(0, free, malloc, realloc, free))) ok = false;
+  }
+  // the calling thread takes the first job; if a thread can't be started, its
+  // job is run here afterwards
+  for (int t = 1; t < threads && ok; t++) started[t] = !pthread_create(&handles[t], NULL, levels_run, &jobs[t]);
+  if (ok) levels_run(&jobs[0]);
+  for (int t = 1; t < threads; t++) {
+    if (started[t]) pthread_join(handles[t], NULL);
+    else if (ok) levels_run(&jobs[t]);
+  }
+  for (int t = 0; t < threads; t++) ok = ok && jobs[t].ok;
+  if (!ok) goto oom;
+
+  // interleave the jobs' results back into level order; each job's are in
+  // order already
+  for (int level = 0; level < num_levels; level++) {
+    level_found = jobs[level % threads].found;
+    unsigned *cursor = &cursors[level % threads];
+    for (; *cursor < level_found->len; ++*cursor) {
+      struct located_guards *located = darray_index(level_found, *cursor);
+      if (located->level != level) break;
+      if (!darray_push(found, located)) goto oom;
+      darray_index_set(level_found, *cursor, NULL);
+    }
+  }
+  // the level threads are done, so the merge gets all of them
+  if (!located_guards_merge(found, threads)) goto oom;
+
+  for (int t = 0; t < threads; t++) darray_free(jobs[t].found, true);
+  return found;
+
+oom:
+  for (int t = 0; t < threads; t++) darray_free(jobs[t].found, true);
+  darray_free(found, true);
+  return NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef LEVELS_H
+#define LEVELS_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+#include "darray.h"
+#include "rectangles.h"
+#include "morphology.h"
+
+#define LEVELS_MAX 64
+#define LEVELS_MAX_THREADS 16
+
+// A barcode found by the guard localizer at one of several threshold levels.
+struct located_guards {
+  struct barcode_corners corners;
+  double score;
+  int level; // index of the threshold it was found at
+};
+
+static bool located_guards_overlap(struct located_guards *a, struct located_guards *b);
+static bool located_guards_merge(struct darray *found, int threads);
+static struct darray *image8_locate_guards_levels(struct image8 *im, const unsigned char *thresholds, int num_levels,
+                                                  struct morphology_kernel *closings, int num_closings,
+                                                  struct pairing_settings *settings, int threads,
+                                                  void *(*malloc)(size_t size),
+                                                  void *(*realloc)(void *ptr, size_t new_size),
+                                                  void (*free)(void *ptr));
+
+#endif
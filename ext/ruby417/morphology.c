@@ -0,0 +1,329 @@
+#include <stdlib.h> // NULL
+#include <string.h> // memcpy, memset
+#include "morphology.h"
+#include "simd.h"
+
+// All of the operations here are separable, so a w by h kernel is applied as a
+// horizontal pass of length w followed by a vertical pass of length h. Each pass
+// uses the van Herk/Gil-Werman algorithm, which splits the line into blocks of
+// length k and computes a running min/max forward and backward within each
+// block. Any window of length k then spans at most two blocks, so its min/max
+// is a single comparison of the backward value at its start and the forward
+// value at its end, regardless of k.
+//
+// Binary images (where every pixel is 0 or 255) are packed into an image1, so
+// that min and max become AND and OR over 64 pixels at a time.
+
+static unsigned char morph_op(unsigned char a, unsigned char b, bool max) {
+  if (max) return a > b ? a : b;
+  return a < b ? a : b;
+}
+
+static uint64_t morph_op64(uint64_t a, uint64_t b, bool max) {
+  return max ? a | b : a & b;
+}
+
+// The same, over whole rows, with the choice of op outside the loops so that
+// each vectorizes.
+SIMD_INLINE void morph_rows(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n, bool max) {
+  if (max) {
+    for (int x = 0; x < n; x++) dst[x] = a[x] > b[x] ? a[x] : b[x];
+  } else {
+    for (int x = 0; x < n; x++) dst[x] = a[x] < b[x] ? a[x] : b[x];
+  }
+}
+
+SIMD_INLINE void morph_words(uint64_t *dst, const uint64_t *a, const uint64_t *b, int n, bool max) {
+  if (max) {
+    for (int i = 0; i < n; i++) dst[i] = a[i] | b[i];
+  } else {
+    for (int i = 0; i < n; i++) dst[i] = a[i] & b[i];
+  }
+}
+
+static bool image8_is_binary(struct image8 *im) {
+  long size = (long) im->width*im->height;
+  for (long i = 0; i < size; i++) {
+    if (im->data[i] != 0 && im->data[i] != 255) return false;
+  }
+  return true;
+}
+
+// Rounds the length of a padded line, n+k-1, up to a multiple of k.
+static int vhgw_padded_length(int n, int k) {
+  return (n + 2*k - 2) / k * k;
+}
+
+// Computes line[x] = op(line[x-lo], ..., line[x-lo+k-1]) in place, treating
+// pixels outside the line as the identity of op. The work buffer must hold
+// three padded lengths.
+static void vhgw_line(unsigned char *line, int n, int k, int lo, bool max, unsigned char *work) {
+  int m = vhgw_padded_length(n, k);
+  unsigned char *pad = work, *g = work + m, *h = work + 2*m;
+
+  memset(pad, max ? 0 : 255, m);
+  memcpy(pad + lo, line, n);
+
+  for (int b = 0; b < m; b += k) {
+    g[b] = pad[b];
+    for (int p = b+1; p < b+k; p++) g[p] = morph_op(g[p-1], pad[p], max);
+    h[b+k-1] = pad[b+k-1];
+    for (int p = b+k-2; p >= b; p--) h[p] = morph_op(h[p+1], pad[p], max);
+  }
+
+  simd.morph_rows(line, h, g + k-1, n, max);
+}
+
+// The hollow version only looks at the two ends of the window.
+static void hollow_line(unsigned char *line, int n, int k, int lo, bool max, unsigned char *work) {
+  unsigned char *pad = work;
+
+  memset(pad, max ? 0 : 255, n+k-1);
+  memcpy(pad + lo, line, n);
+
+  simd.morph_rows(line, pad, pad + k-1, n, max);
+}
+
+// Applies the van Herk/Gil-Werman algorithm down the columns of the image, a
+// whole row at a time. The work buffer must hold two padded lengths of rows plus
+// one additional row.
+static void vhgw_columns(struct image8 *im, int k, int lo, bool max, unsigned char *work) {
+  int w = im->width, m = vhgw_padded_length(im->height, k);
+  unsigned char *identity = work, *g = work + w, *h = work + w + (long) m*w;
+
+  memset(identity, max ? 0 : 255, w);
+
+  for (int b = 0; b < m; b += k) {
+    for (int p = b; p < b+k; p++) {
+      int y = p - lo;
+      unsigned char *src = (y >= 0 && y < im->height) ? im->data + (long) y*w : identity,
+                    *gp = g + (long) p*w;
+      if (p == b) memcpy(gp, src, w);
+      else simd.morph_rows(gp, gp - w, src, w, max);
+    }
+
+    for (int p = b+k-1; p >= b; p--) {
+      int y = p - lo;
+      unsigned char *src = (y >= 0 && y < im->height) ? im->data + (long) y*w : identity,
+                    *hp = h + (long) p*w;
+      if (p == b+k-1) memcpy(hp, src, w);
+      else simd.morph_rows(hp, hp + w, src, w, max);
+    }
+  }
+
+  for (int y = 0; y < im->height; y++) {
+    simd.morph_rows(im->data + (long) y*w, h + (long) y*w, g + (long) (y+k-1)*w, w, max);
+  }
+}
+
+static bool image_morph_gray(struct image8 *im, struct morphology_kernel *kernel, bool max,
+                             void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  int kw = kernel->width, kh = kernel->height;
+  size_t row_work = 3*(size_t) vhgw_padded_length(im->width, kw),
+         col_work = (2*(size_t) vhgw_padded_length(im->height, kh) + 1) * im->width;
+  unsigned char *work = malloc(row_work > col_work ? row_work : col_work);
+  if (!work) return false;
+
+  if (kw > 1) {
+    // dilation reflects the kernel, so that closing and opening are exact for even sizes
+    int lo = max ? kw/2 : (kw-1)/2;
+    for (int y = 0; y < im->height; y++) {
+      unsigned char *line = im->data + (long) y*im->width;
+      if (kernel->hollow) hollow_line(line, im->width, kw, lo, max, work);
+      else vhgw_line(line, im->width, kw, lo, max, work);
+    }
+  }
+
+  if (kh > 1) vhgw_columns(im, kh, max ? kh/2 : (kh-1)/2, max, work);
+
+  free(work);
+  return true;
+}
+
+// Returns the 64 bits of a packed row starting at the given bit offset, which
+// may be negative. Words outside [-margin, words+margin) are the identity.
+static uint64_t packed_bits_at(uint64_t *row, int words, int margin, long bit, uint64_t identity) {
+  long q = bit >> 6;
+  int r = bit & 63;
+  uint64_t lo = (q >= -margin && q < words+margin) ? row[q] : identity;
+  if (r == 0) return lo;
+  uint64_t hi = (q+1 >= -margin && q+1 < words+margin) ? row[q+1] : identity;
+  return (lo >> r) | (hi << (64 - r));
+}
+
+// Horizontal pass over one packed row. The row is stored with margin words of
+// padding on either side, so that windows hanging off the left edge see the
+// identity. Each doubling step extends every window from span to 2*span pixels
+// with a single shift and AND/OR per word, and two overlapping windows of the
+// largest span cover the full kernel.
+static void packed_row(uint64_t *row, uint64_t *out, int words, int margin, int k, int lo,
+                       bool hollow, bool max) {
+  uint64_t identity = max ? 0 : ~(uint64_t) 0;
+  long span = 1;
+
+  if (!hollow) {
+    for (; span*2 <= k; span *= 2) {
+      for (int i = -margin; i < words+margin; i++) {
+        row[i] = morph_op64(row[i], packed_bits_at(row, words, margin, (long) i*64 + span, identity), max);
+      }
+    }
+  }
+
+  for (int i = 0; i < words; i++) {
+    long start = (long) i*64 - lo;
+    out[i] = morph_op64(packed_bits_at(row, words, margin, start, identity),
+                        packed_bits_at(row, words, margin, start + k - span, identity), max);
+  }
+}
+
+static bool image1_morph(struct image1 *im, struct morphology_kernel *kernel, bool max,
+                         void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  if (im->width <= 0 || im->height <= 0 || kernel->width < 1 || kernel->height < 1) return true;
+
+  int kw = kernel->width, kh = kernel->height, w = im->width, h = im->height,
+      words = im->stride, margin = (kw + 63) / 64, m = vhgw_padded_length(h, kh);
+  uint64_t identity = max ? 0 : ~(uint64_t) 0, tail_mask = (w & 63) ? ~(uint64_t) 0 << (w & 63) : 0;
+  uint64_t *row = malloc(sizeof(*row) * (size_t) (words + 2*margin)),
+           *g = malloc(sizeof(*g) * (size_t) words*m),
+           *hh = malloc(sizeof(*hh) * (size_t) words*m);
+
+  if (!row || !g || !hh) {
+    free(row);
+    free(g);
+    free(hh);
+    return false;
+  }
+
+  if (kw > 1) {
+    int lo = max ? kw/2 : (kw-1)/2;
+
+    for (int y = 0; y < h; y++) {
+      uint64_t *src = im->data + (long) y*words, *padded = row + margin;
+
+      for (int i = 0; i < margin; i++) row[i] = row[words+margin+i] = identity;
+      memcpy(padded, src, sizeof(*src) * words);
+      // pixels past the right edge are the identity
+      padded[words-1] = (padded[words-1] & ~tail_mask) | (identity & tail_mask);
+      packed_row(padded, src, words, margin, kw, lo, kernel->hollow, max);
+    }
+  }
+
+  if (kh > 1) {
+    int lo = max ? kh/2 : (kh-1)/2;
+
+    for (int b = 0; b < m; b += kh) {
+      // rows outside the image are the identity, and leave the running value as it was
+      for (int p = b; p < b+kh; p++) {
+        int y = p - lo;
+        uint64_t *gp = g + (long) p*words, *src = im->data + (long) y*words;
+        if (y < 0 || y >= h) {
+          if (p == b) for (int i = 0; i < words; i++) gp[i] = identity;
+          else memcpy(gp, gp - words, sizeof(*gp) * words);
+        } else if (p == b) {
+          memcpy(gp, src, sizeof(*gp) * words);
+        } else {
+          simd.morph_words(gp, gp - words, src, words, max);
+        }
+      }
+
+      for (int p = b+kh-1; p >= b; p--) {
+        int y = p - lo;
+        uint64_t *hp = hh + (long) p*words, *src = im->data + (long) y*words;
+        if (y < 0 || y >= h) {
+          if (p == b+kh-1) for (int i = 0; i < words; i++) hp[i] = identity;
+          else memcpy(hp, hp + words, sizeof(*hp) * words);
+        } else if (p == b+kh-1) {
+          memcpy(hp, src, sizeof(*hp) * words);
+        } else {
+          simd.morph_words(hp, hp + words, src, words, max);
+        }
+      }
+    }
+
+    for (int y = 0; y < h; y++) {
+      simd.morph_words(im->data + (long) y*words, hh + (long) y*words, g + (long) (y+kh-1)*words, words, max);
+    }
+  }
+
+  free(row);
+  free(g);
+  free(hh);
+  return true;
+}
+
+static bool image_morph_binary(struct image8 *im, struct morphology_kernel *kernel, bool max,
+                               void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct image1 *bits = image8_binarize(im, 128, malloc, free);
+
+  if (!bits || !image1_morph(bits, kernel, max, malloc, free)) {
+    image1_free(bits);
+    return false;
+  }
+
+  image1_unpack(bits, im);
+  image1_free(bits);
+  return true;
+}
+
+static bool image_morph(struct image8 *im, struct morphology_kernel *kernel, bool max,
+                        void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  if (im->width <= 0 || im->height <= 0 || kernel->width < 1 || kernel->height < 1) {
+    return true;
+  } else if (image8_is_binary(im)) {
+    return image_morph_binary(im, kernel, max, malloc, free);
+  } else {
+    return image_morph_gray(im, kernel, max, malloc, free);
+  }
+}
+
+static bool image_erode(struct image8 *im, struct morphology_kernel *kernel,
+                        void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  return image_morph(im, kernel, false, malloc, free);
+}
+
+static bool image_dilate(struct image8 *im, struct morphology_kernel *kernel,
+                         void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  return image_morph(im, kernel, true, malloc, free);
+}
+
+static bool image_morphology(struct image8 *im, enum morphology_operation op,
+                             struct morphology_kernel *kernel,
+                             void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  switch (op) {
+    case MORPHOLOGY_ERODE:
+      return image_erode(im, kernel, malloc, free);
+    case MORPHOLOGY_DILATE:
+      return image_dilate(im, kernel, malloc, free);
+    case MORPHOLOGY_OPEN:
+      return image_erode(im, kernel, malloc, free) && image_dilate(im, kernel, malloc, free);
+    case MORPHOLOGY_CLOSE:
+      return image_dilate(im, kernel, malloc, free) && image_erode(im, kernel, malloc, free);
+  }
+  return false;
+}
+
+static bool image1_erode(struct image1 *im, struct morphology_kernel *kernel,
+                         void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  return image1_morph(im, kernel, false, malloc, free);
+}
+
+static bool image1_dilate(struct image1 *im, struct morphology_kernel *kernel,
+                          void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  return image1_morph(im, kernel, true, malloc, free);
+}
+
+static bool image1_morphology(struct image1 *im, enum morphology_operation op,
+                              struct morphology_kernel *kernel,
+                              void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  switch (op) {
+    case MORPHOLOGY_ERODE:
+      return image1_erode(im, kernel, malloc, free);
+    case MORPHOLOGY_DILATE:
+      return image1_dilate(im, kernel, malloc, free);
+    case MORPHOLOGY_OPEN:
+      return image1_erode(im, kernel, malloc, free) && image1_dilate(im, kernel, malloc, free);
+    case MORPHOLOGY_CLOSE:
+      return image1_dilate(im, kernel, malloc, free) && image1_erode(im, kernel, malloc, free);
+  }
+  return false;
+}
@@ -0,0 +1,38 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+
+enum morphology_operation {
+  MORPHOLOGY_ERODE,
+  MORPHOLOGY_DILATE,
+  MORPHOLOGY_OPEN,
+  MORPHOLOGY_CLOSE
+};
+
+// A rectangular structuring element. A hollow kernel includes only its leftmost
+// and rightmost columns, like ImageMagick's "3x6: 1,-,1 1,-,1 ...".
+struct morphology_kernel {
+  int width, height;
+  bool hollow;
+};
+
+static bool image8_is_binary(struct image8 *im);
+static bool image_erode(struct image8 *im, struct morphology_kernel *kernel,
+                        void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool image_dilate(struct image8 *im, struct morphology_kernel *kernel,
+                         void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool image_morphology(struct image8 *im, enum morphology_operation op,
+                             struct morphology_kernel *kernel,
+                             void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool image1_erode(struct image1 *im, struct morphology_kernel *kernel,
+                         void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool image1_dilate(struct image1 *im, struct morphology_kernel *kernel,
+                          void *(*malloc)(size_t size), void (*free)(void *ptr));
+static bool image1_morphology(struct image1 *im, enum morphology_operation op,
+                              struct morphology_kernel *kernel,
+                              void *(*malloc)(size_t size), void (*free)(void *ptr));
+
+#endif
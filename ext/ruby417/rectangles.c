@@ -1,6 +1,10 @@
 #include <math.h> // sin, cos, atan2, round, sqrt, hypot, M_PI, M_PI_2
-#include <stdlib.h> // abs, NULL
+#include <stdlib.h> // abs, labs, NULL
+#include <string.h> // memcpy
+#include <pthread.h>
 #include "rectangles.h"
+#include "accounting.h"
+#include "saliency.h"
 
 static long vec_dot(struct point *a, struct point *b, struct point *c, struct point *d) {
   return (long) (b->x-a->x)*(d->x-c->x) +  (long) (b->y-a->y)*(d->y-c->y);
@@ -10,20 +14,41 @@ static long vec_cross(struct point *a, struct point *b, struct point *c, struct
   return (long) (b->x-a->x)*(d->y-c->y) - (long) (b->y-a->y)*(d->x-c->x);
 }
 
-static bool boundary_convex_hull(struct darray *boundary, struct darray *hull) {
-  if (boundary->len > 0) {
-    // Since (by construction) it is the left-most point with the highest y-value,
-    // the first point in the boundary is also in the convex hull.
-    if (!darray_push(hull, darray_index(boundary, 0))) return false;
+// Pushes a copy of p onto the hull, which is built as a stack, so its i-th
+// element is always the storage's i-th point.
+static bool hull_push(struct darray *hull, struct hull_storage *storage, struct point p) {
+  if (hull->len >= storage->capacity) {
+    unsigned capacity = storage->capacity ? 2*storage->capacity : 16;
+    struct point *points = hull->realloc(storage->points, sizeof(*points) * capacity);
+    if (!points) return false;
+    storage->points = points;
+    storage->capacity = capacity;
+    for (unsigned i = 0; i < hull->len; i++) darray_index_set(hull, i, &points[i]);
+  }
 
-    for (unsigned i = 1; i <= boundary->len; i++) {
-      struct point *p = darray_index(boundary, i % boundary->len);
-      while (hull->len > 1 && vec_cross(darray_index(hull, hull->len-1), darray_index(hull, hull->len-2), darray_index(hull, hull->len-1), p) >= 0) {
-        darray_pop(hull);
-      }
+  storage->points[hull->len] = p;
+  return darray_push(hull, &storage->points[hull->len]);
+}
 
-      if (i < boundary->len && !darray_push(hull, p)) return false;
+// Builds the hull of an empty hull from the boundary, decoding its chain code
+// as it goes rather than materializing its points.
+static bool boundary_convex_hull(const struct boundary *boundary, struct darray *hull, struct hull_storage *storage) {
+  struct boundary_iterator it;
+  struct point p;
+
+  boundary_iterate(boundary, &it);
+  // Since (by construction) it is the left-most point with the highest y-value,
+  // the first point in the boundary is also in the convex hull.
+  if (!boundary_next(&it, &p)) return true;
+  if (!hull_push(hull, storage, p)) return false;
+
+  for (bool more = true; more;) {
+    if (!(more=boundary_next(&it, &p))) p = boundary->start;
+    while (hull->len > 1 && vec_cross(darray_index(hull, hull->len-1), darray_index(hull, hull->len-2), darray_index(hull, hull->len-1), &p) >= 0) {
+      darray_pop(hull);
     }
+
+    if (more && !hull_push(hull, storage, p)) return false;
   }
 
   return true;
@@ -55,9 +80,80 @@ static void determine_fourth_point(struct point *p1, struct point *p2, struct po
   }
 }
 
+// Returns true if every hull point strictly between indices a and c lies within
+// tolerance of the line through them. Works with squared distances scaled by
+// |ac|^2, so it needs only integer cross products and no division.
+static bool hull_chord_within(struct darray *hull, unsigned a, unsigned c, double tolerance) {
+  struct point *p = hull_wrap_index(hull, a), *q = hull_wrap_index(hull, c);
+  double limit = tolerance*tolerance*vec_dot(p, q, p, q);
+
+  for (unsigned j = a+1; j < c; j++) {
+    double cross = vec_cross(p, q, p, hull_wrap_index(hull, j));
+    if (cross*cross > limit) return false;
+  }
+
+  return true;
+}
+
+// Removes hull vertices that are within tolerance of the chord joining the
+// surrounding kept vertices. Large, slightly ragged shapes have hulls with many
+// nearly collinear points, and this reduces them to roughly one vertex per side
+// while moving no edge more than tolerance. The first point is always kept, and
+// the hull is left alone if fewer than three points would remain.
+static void hull_simplify(struct darray *hull, double tolerance) {
+  if (hull->len <= 3) return;
+
+  for (int pass = 0; pass < 2; pass++) {
+    unsigned a = 0, kept = 1;
+
+    for (unsigned c = 2; c <= hull->len; c++) {
+      if (!hull_chord_within(hull, a, c, tolerance)) {
+        if (pass == 1) darray_index_set(hull, kept, darray_index(hull, c-1));
+        kept++;
+        a = c-1;
+      }
+    }
+
+    if (kept < 3) return;
+    if (pass == 1) hull->len = kept;
+  }
+}
+
+// Determines the dimensions of the rectangle with one side along the given hull
+// edge. If the edge is vertical or horizontal, the scenario must be handled
+// separately to avoid division by zero. The +1's are needed (I think) to
+// counter the fencepost issue between discrete pixels and the true geometric
+// distance.
+// Note: The width dimension is along the orientation vector.
+// RectangleDetection::Rectangle#normalize! relies on this.
+static void hull_caliper_dimensions(struct darray *hull, unsigned base_idx, unsigned leftmost_idx,
+                                    unsigned altitude_idx, unsigned rightmost_idx,
+                                    double *width, double *height) {
+  struct point *left_base_point  = hull_wrap_index(hull, base_idx),
+               *right_base_point = hull_wrap_index(hull, base_idx+1);
+
+  if (left_base_point->x == right_base_point->x) {
+    *width  = abs(hull_wrap_index(hull, rightmost_idx)->y - hull_wrap_index(hull, leftmost_idx)->y)+1;
+    *height = abs(hull_wrap_index(hull, altitude_idx)->x - left_base_point->x)+1;
+  } else if (left_base_point->y == right_base_point->y) {
+    *width  = abs(hull_wrap_index(hull, rightmost_idx)->x - hull_wrap_index(hull, leftmost_idx)->x)+1;
+    *height = abs(hull_wrap_index(hull, altitude_idx)->y - left_base_point->y)+1;
+  } else {
+    double slope = (double) (left_base_point->y - right_base_point->y) / (left_base_point->x - right_base_point->x);
+    *width = line_distance(hull_wrap_index(hull, leftmost_idx), hull_wrap_index(hull, rightmost_idx), -1/slope)+1;
+    *height = line_distance(left_base_point, hull_wrap_index(hull, altitude_idx), slope)+1;
+  }
+}
+
+// Finds the minimum area bounding rectangle with rotating calipers. The search
+// itself uses only integer dot and cross products, plus one square root per edge
+// to compare areas: projected onto an edge of length l, the calipers span W/l by
+// H/l, where W and H are integers. Trigonometry is only needed once the best edge
+// is known.
 static void hull_minimal_rectangle(struct darray *hull, long fill, struct rectangle *rect) {
-  double min_area = -1, slope, width, height;
+  double min_area = -1, width, height;
   unsigned base_idx = 0, leftmost_idx = base_idx, altitude_idx = 0, rightmost_idx = 0;
+  unsigned best_base = 0, best_leftmost = 0, best_altitude = 0, best_rightmost = 0;
   struct point *left_base_point, *right_base_point;
 
   while (base_idx < hull->len) {
@@ -76,71 +172,71 @@ static void hull_minimal_rectangle(struct darray *hull, long fill, struct rectan
     if(rightmost_idx == 0) rightmost_idx = altitude_idx;
     while (vec_dot(left_base_point, right_base_point, hull_wrap_index(hull, rightmost_idx), hull_wrap_index(hull, rightmost_idx+1)) < 0) ++rightmost_idx;
 
-    // Determine the dimensions described by these points. If the edge is vertical
-    // or horizontal, the scenario must be handled separately to avoid division by zero.
-    // The +1's are needed (I think) to counter the fencepost issue between discrete
-    // pixels and the true geometric distance.
-    // Note: The width dimension is along the orientation vector.
-    // RectangleDetection::Rectangle#normalize! relies on this.
-    if (left_base_point->x == right_base_point->x) {
-      width  = abs(hull_wrap_index(hull, rightmost_idx)->y - hull_wrap_index(hull, leftmost_idx)->y)+1;
-      height = abs(hull_wrap_index(hull, altitude_idx)->x - left_base_point->x)+1;
-    } else if (left_base_point->y == right_base_point->y) {
-      width  = abs(hull_wrap_index(hull, rightmost_idx)->x - hull_wrap_index(hull, leftmost_idx)->x)+1;
-      height = abs(hull_wrap_index(hull, altitude_idx)->y - left_base_point->y)+1;
-    } else {
-      slope = (double) (left_base_point->y - right_base_point->y) / (left_base_point->x - right_base_point->x);
-      width = line_distance(hull_wrap_index(hull, leftmost_idx), hull_wrap_index(hull, rightmost_idx), -1/slope)+1;
-      height = line_distance(left_base_point, hull_wrap_index(hull, altitude_idx), slope)+1;
+    long span = labs(vec_dot(left_base_point, right_base_point, hull_wrap_index(hull, rightmost_idx), hull_wrap_index(hull, leftmost_idx))),
+         altitude = labs(vec_cross(left_base_point, right_base_point, left_base_point, hull_wrap_index(hull, altitude_idx)));
+    double length = sqrt((double) vec_dot(left_base_point, right_base_point, left_base_point, right_base_point)),
+           area = (span + length) * (altitude + length) / (length * length);
+
+    // the relative margin keeps the first of several equally small edges, as
+    // the exact products would
+    if (length > 0 && (area < min_area*(1-1e-9) || min_area < 0)) {
+      best_base = base_idx;
+      best_leftmost = leftmost_idx;
+      best_altitude = altitude_idx;
+      best_rightmost = rightmost_idx;
+      min_area = area;
     }
 
-    if (width*height < min_area || min_area < 0) {
-      struct point upper_left, upper_right;
-      double orientation = atan2(right_base_point->y - left_base_point->y, right_base_point->x - left_base_point->x);
-
-      // use two corner pixels along the base side to determine the rect's center
-      determine_fourth_point(left_base_point, right_base_point, hull_wrap_index(hull, leftmost_idx), &upper_left);
-      determine_fourth_point(left_base_point, right_base_point, hull_wrap_index(hull, rightmost_idx), &upper_right);
-      rect->cx = (int) (upper_left.x + upper_right.x - sin(orientation)*height) / 2;
-      rect->cy = (int) (upper_left.y + upper_right.y + cos(orientation)*height) / 2;
-      rect->fill = fill;
-
-      // normalize the orientation to be between 0 and pi/2
-      if (orientation < 0) orientation += M_PI;
-      if (orientation < M_PI_2) {
-        rect->orientation = orientation;
-        rect->width = (int) width;
-        rect->height = (int) height;
-      } else {
-        rect->orientation = orientation - M_PI_2;
-        rect->width = (int) height;
-        rect->height = (int) width;
-      }
-
-      // normalize again so that height >= width, orientation is between 0 and pi, and
-      // the orientation is along the width
-      if (rect->width > rect->height) {
-        int tmp = rect->width;
-        rect->width = rect->height;
-        rect->height = tmp;
-        rect->orientation += M_PI_2;
-      }
+    ++base_idx;
+  }
 
-      min_area = width*height;
-    }
+  if (min_area < 0) return;
+
+  struct point upper_left, upper_right;
+  left_base_point  = hull_wrap_index(hull, best_base);
+  right_base_point = hull_wrap_index(hull, best_base+1);
+  hull_caliper_dimensions(hull, best_base, best_leftmost, best_altitude, best_rightmost, &width, &height);
+  double orientation = atan2(right_base_point->y - left_base_point->y, right_base_point->x - left_base_point->x);
+
+  // use two corner pixels along the base side to determine the rect's center
+  determine_fourth_point(left_base_point, right_base_point, hull_wrap_index(hull, best_leftmost), &upper_left);
+  determine_fourth_point(left_base_point, right_base_point, hull_wrap_index(hull, best_rightmost), &upper_right);
+  rect->cx = (int) (upper_left.x + upper_right.x - sin(orientation)*height) / 2;
+  rect->cy = (int) (upper_left.y + upper_right.y + cos(orientation)*height) / 2;
+  rect->fill = fill;
+
+  // normalize the orientation to be between 0 and pi/2
+  if (orientation < 0) orientation += M_PI;
+  if (orientation < M_PI_2) {
+    rect->orientation = orientation;
+    rect->width = (int) width;
+    rect->height = (int) height;
+  } else {
+    rect->orientation = orientation - M_PI_2;
+    rect->width = (int) height;
+    rect->height = (int) width;
+  }
 
-    ++base_idx;
+  // normalize again so that height >= width, orientation is between 0 and pi, and
+  // the orientation is along the width
+  if (rect->width > rect->height) {
+    int tmp = rect->width;
+    rect->width = rect->height;
+    rect->height = tmp;
+    rect->orientation += M_PI_2;
   }
 }
 
-static int rect_cmp_by_area(const void *a, const void *b, void *ctx) {
+// smallest first
+static uint64_t rect_key_by_area(const void *rect, void *ctx) {
   (void) ctx;
-  return ((struct rectangle*) a)->fill - ((struct rectangle*) b)->fill;
+  return radix_key_signed(((struct rectangle *) rect)->fill);
 }
 
-static int pair_cmp_by_score(const void *a, const void *b, void *ctx) {
+// best first
+static uint64_t pair_key_by_score(const void *pair, void *ctx) {
   (void) ctx;
-  return ((struct rectangle_pair*) a)->score < ((struct rectangle_pair*) b)->score ? 1 : -1;
+  return ~radix_key_double(((struct rectangle_pair *) pair)->score);
 }
 
 static bool rect_qualifies(struct pairing_settings *settings, struct rectangle *rect) {
@@ -194,34 +290,107 @@ static double score_rect_pair(struct rectangle *one, struct rectangle *two) {
   return rectangularity_score * area_variation_score * dimension_diff_score * angle_variation_score * joining_angle_score * guard_aspect_score * guard_area_score * barcode_aspect_score;
 }
 
-static bool pair_aligned_rectangles(struct pairing_settings *settings, struct darray *rects, struct darray *pairs) {
-  darray_qsort(rects, NULL, rect_cmp_by_area);
+// Pairs each of the job's rectangles with every later one, recording how many
+// pairs each yields, so that the jobs' pairs can be put back in serial order.
+static void *pairing_run(void *arg) {
+  struct pairing_job *job = arg;
+  struct darray *rects = job->rects, *pairs = job->pairs;
 
-  for (unsigned i = 0; (long) i < (long) rects->len-1; i++) {
+  memory_account = job->account;
+  job->ok = false;
+  for (unsigned i = job->first; (long) i < (long) rects->len-1; i += job->step) {
     struct rectangle *one = darray_index(rects, i);
-    if (!rect_qualifies(settings, one)) continue;
+    unsigned before = pairs->len;
+    if (!rect_qualifies(job->settings, one)) {
+      job->counts[i] = 0;
+      continue;
+    }
 
     for (unsigned j = i+1; j < rects->len; j++) {
       struct rectangle *two = darray_index(rects, j);
 
-      if (rect_pair_qualifies(settings, one, two)) {
+      if (rect_pair_qualifies(job->settings, one, two)) {
         struct rectangle_pair *pair = pairs->malloc(sizeof(*pair));
-        if (!pair) return false;
+        if (!pair) return NULL;
         pair->one = one;
         pair->two = two;
         pair->score = score_rect_pair(one, two);
 
         if (!darray_push(pairs, pair)) {
           pairs->free(pair);
-          return false;
+          return NULL;
         }
       }
     }
+    job->counts[i] = pairs->len - before;
   }
+  job->ok = true;
 
-  darray_qsort(pairs, NULL, pair_cmp_by_score);
+  return NULL;
+}
 
-  return true;
+// Pairs up rectangles that could be the two guards of a barcode, best first,
+// ties in the order they're found.
+// With settings->threads, rectangles are dealt out to that many threads in
+// turn, each collecting pairs in its own array, and the arrays are merged back
+// in the order a single thread finds them before sorting, so the result doesn't
+// depend on the number of threads. The allocator must then be thread safe.
+static bool pair_aligned_rectangles(struct pairing_settings *settings, struct darray *rects, struct darray *pairs) {
+  struct pairing_job jobs[PAIRING_MAX_THREADS];
+  pthread_t handles[PAIRING_MAX_THREADS] = {0};
+  bool started[PAIRING_MAX_THREADS] = {false}, ok = true;
+  unsigned cursors[PAIRING_MAX_THREADS] = {0};
+  int threads = settings->threads;
+  unsigned *counts;
+
+  if (!darray_radix_sort(rects, NULL, rect_key_by_area)) return false;
+
+  if (threads > (int) (rects->len / PAIRING_MIN_RECTS_PER_THREAD)) threads = rects->len / PAIRING_MIN_RECTS_PER_THREAD;
+  if (threads > PAIRING_MAX_THREADS) threads = PAIRING_MAX_THREADS;
+  if (threads < 1) threads = 1;
+
+  if (!(counts = pairs->malloc(sizeof(*counts) * (rects->len + 1)))) return false;
+
+  if (threads == 1) {
+    // straight into pairs
+    jobs[0] = (struct pairing_job) { settings, rects, 0, 1, pairs, counts, memory_account, false };
+    pairing_run(&jobs[0]);
+    pairs->free(counts);
+    return jobs[0].ok && darray_radix_sort(pairs, NULL, pair_key_by_score);
+  }
+
+  for (int t = 0; t < threads; t++) {
+    jobs[t] = (struct pairing_job) { settings, rects, t, threads, NULL, counts, memory_account, false };
+    if (!(jobs[t].pairs=darray_new(0, pairs->eltfree, pairs->malloc, pairs->realloc, pairs->free))) ok = false;
+  }
+  // as with levels, the calling thread takes the first job and any whose
+  // thread couldn't be started
+  for (int t = 1; t < threads && ok; t++) started[t] = !pthread_create(&handles[t], NULL, pairing_run, &jobs[t]);
+  if (ok) pairing_run(&jobs[0]);
+  for (int t = 1; t < threads; t++) {
+    if (started[t]) pthread_join(handles[t], NULL);
+    else if (ok) pairing_run(&jobs[t]);
+  }
+  for (int t = 0; t < threads; t++) ok = ok && jobs[t].ok;
+  if (!ok) goto oom;
+
+  for (unsigned i = 0; (long) i < (long) rects->len-1; i++) {
+    struct darray *job_pairs = jobs[i % threads].pairs;
+    unsigned *cursor = &cursors[i % threads];
+    for (unsigned end = *cursor + counts[i]; *cursor < end; ++*cursor) {
+      if (!darray_push(pairs, darray_index(job_pairs, *cursor))) goto oom;
+      darray_index_set(job_pairs, *cursor, NULL);
+    }
+  }
+
+  for (int t = 0; t < threads; t++) darray_free(jobs[t].pairs, true);
+  pairs->free(counts);
+  return darray_radix_sort(pairs, NULL, pair_key_by_score);
+
+oom:
+  for (int t = 0; t < threads; t++) darray_free(jobs[t].pairs, true);
+  pairs->free(counts);
+  return false;
 }
 
 static int min_point_by_coords(struct point *points, int count, int k, int l) {
@@ -274,3 +443,188 @@ static void determine_barcode_corners(struct rectangle_pair *pair, struct barcod
   corners->lower_left = rect_points[min_point_by_coords(transformed, 8, 1, -1)];
   corners->lower_right = rect_points[min_point_by_coords(transformed, 8, -1, -1)];
 }
+
+// The shortest guard the settings allow is sqrt(aspect*area) tall; runs half
+// that long mark the tiles that could hold one.
+static int saliency_min_run(struct pairing_settings *settings) {
+  int aspect = settings->guard_aspect_min > 1 ? settings->guard_aspect_min : 1;
+  int run = (int) (sqrt((double) aspect*settings->area_threshold) / 2);
+  return run > SALIENCY_MIN_RUN ? run : SALIENCY_MIN_RUN;
+}
+
+// The rectangle with the same second moments as a region: a uniform w by h
+// rectangle has variances of w^2/12 and h^2/12 along its sides. Its fill is the
+// region's area, so the ratio of area to box stands in for rectangularity.
+static void moments_rectangle(struct region_moments *moments, struct rectangle *rect) {
+  double mean = (moments->mxx + moments->myy) / 2,
+         spread = hypot((moments->mxx - moments->myy) / 2, moments->mxy),
+         major = mean + spread, minor = mean - spread > 0 ? mean - spread : 0,
+         // the orientation is along the width, across the major axis
+         orientation = atan2(2*moments->mxy, moments->mxx - moments->myy) / 2 + M_PI_2;
+
+  if (orientation < 0) orientation += M_PI;
+  if (orientation >= M_PI) orientation -= M_PI;
+  *rect = (struct rectangle) {
+    .cx = (int) round(moments->cx),
+    .cy = (int) round(moments->cy),
+    .width = (int) round(sqrt(12*minor)),
+    .height = (int) round(sqrt(12*major)),
+    .fill = moments->area,
+    .orientation = orientation
+  };
+}
+
+// Pairs rectangles fit to the moments of each large enough region, and then
+// traces and fits exactly only the regions in those pairs, pairing them again
+// into rects and pairs. Moments are summed without tracing anything, so on a
+// busy image most contours are never followed.
+static bool image1_pair_screened(struct image1 *im, struct image32 *labeled, struct pairing_settings *settings,
+                                 struct darray *rects, struct darray *pairs) {
+  struct darray *moments = NULL, *screened = NULL, *screened_pairs = NULL, *hull = NULL;
+  struct hull_storage storage = {0};
+  struct boundary boundary;
+  struct image8 *codes = NULL;
+  bool ok = false;
+
+  boundary_init(&boundary, rects->realloc, rects->free);
+  if (!(moments=image1_extract_moments(im, labeled, rects->malloc, rects->realloc, rects->free)) ||
+      !(screened=darray_new(0, rects->free, rects->malloc, rects->realloc, rects->free)) ||
+      !(screened_pairs=darray_new(0, rects->free, rects->malloc, rects->realloc, rects->free))) goto done;
+
+  for (unsigned i = 0; i < moments->len; i++) {
+    struct region_moments *m = darray_index(moments, i);
+    if (m->area < settings->area_threshold) continue;
+
+    struct screened_rectangle *s = rects->malloc(sizeof(*s));
+    if (!s) goto done;
+    moments_rectangle(m, &s->rect);
+    s->moments = m;
+    s->exact = NULL;
+    s->traced = false;
+    if (!darray_push(screened, s)) {
+      rects->free(s);
+      goto done;
+    }
+  }
+  if (!pair_aligned_rectangles(settings, screened, screened_pairs)) goto done;
+  if (!screened_pairs->len) {
+    ok = true;
+    goto done;
+  }
+
+  if (!(codes=image1_neighborhood(im, rects->malloc, rects->free)) ||
+      !(hull=darray_new(0, NULL, rects->malloc, rects->realloc, rects->free))) goto done;
+  for (unsigned i = 0; i < screened_pairs->len; i++) {
+    struct rectangle_pair *pair = darray_index(screened_pairs, i);
+    struct screened_rectangle *both[2] = {(struct screened_rectangle *) pair->one, (struct screened_rectangle *) pair->two};
+
+    for (int j = 0; j < 2; j++) {
+      struct screened_rectangle *s = both[j];
+      if (s->traced) continue;
+      s->traced = true;
+
+      boundary_clear(&boundary);
+      if (!neighborhood_follow_contour(codes, &boundary, s->moments->start.x, s->moments->start.y)) goto done;
+      if (boundary.len > 2) {
+        if (!boundary_convex_hull(&boundary, hull, &storage)) goto done;
+        if (hull->len > HULL_SIMPLIFY_MIN_POINTS) hull_simplify(hull, HULL_SIMPLIFY_TOLERANCE);
+        if (hull->len > 2) {
+          if (!(s->exact=rects->malloc(sizeof(*s->exact)))) goto done;
+          hull_minimal_rectangle(hull, s->moments->area, s->exact);
+          if (!darray_push(rects, s->exact)) {
+            rects->free(s->exact);
+            goto done;
+          }
+        }
+        hull->len = 0;
+      }
+    }
+  }
+  ok = pair_aligned_rectangles(settings, rects, pairs);
+
+done:
+  image8_free(codes);
+  boundary_release(&boundary);
+  rects->free(storage.points);
+  darray_free(hull, false);
+  darray_free(screened_pairs, true);
+  darray_free(screened, true);
+  darray_free(moments, true);
+  return ok;
+}
+
+// Locates edge guard pairs in a binary image: labels its regions, fits a
+// rectangle to the hull of each large enough one and pairs the rectangles up.
+// The pairs point into rects. Allocation goes through the rects' allocators.
+static bool image1_locate_guards(struct image1 *im, struct pairing_settings *settings,
+                                 struct darray *rects, struct darray *pairs) {
+  struct image32 *labeled = NULL;
+  struct darray *regions = NULL, *hull = NULL;
+  struct hull_storage storage = {0};
+  struct saliency *saliency = NULL;
+  struct image1 *masked = NULL;
+  struct rectangle *rect;
+
+  // with the prefilter, only tiles that could hold guards (and a margin) are
+  // labeled, traced and paired, the rest being filled with background
+  if (settings->prefilter && settings->polarity != LABEL_BOTH) {
+    if (!(saliency=image1_saliency(im, settings->polarity, saliency_min_run(settings), rects->malloc, rects->free)) ||
+        !(masked=image1_new(im->width, im->height, rects->malloc, rects->free))) goto oom;
+    memcpy(masked->data, im->data, sizeof(*im->data) * im->stride*im->height);
+    bool any = image1_mask_unsalient(masked, saliency, settings->polarity == LABEL_DARK) > 0;
+    saliency_free(saliency);
+    saliency = NULL;
+    if (!any) {
+      image1_free(masked);
+      return true;
+    }
+    im = masked;
+  }
+
+  if (!(labeled=image1_label_regions(im, settings->polarity, rects->malloc, rects->realloc, rects->free))) goto oom;
+  if (settings->fast_fit) {
+    if (!image1_pair_screened(im, labeled, settings, rects, pairs)) goto oom;
+    image32_free(labeled);
+    image1_free(masked);
+    return true;
+  }
+  if (!(regions=image1_extract_regions(im, labeled, rects->malloc, rects->realloc, rects->free)) ||
+      !(hull=darray_new(0, NULL, rects->malloc, rects->realloc, rects->free))) goto oom;
+
+  for (unsigned i = 0; i < regions->len; i++) {
+    struct region *region = darray_index(regions, i);
+
+    if (region->area >= settings->area_threshold && region->boundary.len > 2) {
+      if (!boundary_convex_hull(&region->boundary, hull, &storage)) goto oom;
+      // small hulls are cheap already, and simplifying them costs a pixel or so
+      if (hull->len > HULL_SIMPLIFY_MIN_POINTS) hull_simplify(hull, HULL_SIMPLIFY_TOLERANCE);
+      if (hull->len > 2) {
+        if (!(rect = rects->malloc(sizeof(*rect)))) goto oom;
+        hull_minimal_rectangle(hull, region->area, rect);
+        if (!darray_push(rects, rect)) {
+          rects->free(rect);
+          goto oom;
+        }
+      }
+      hull->len = 0; // reset for reuse, no freeing necessary
+    }
+  }
+
+  if (!pair_aligned_rectangles(settings, rects, pairs)) goto oom;
+
+  image32_free(labeled);
+  darray_free(regions, true);
+  darray_free(hull, false);
+  rects->free(storage.points);
+  image1_free(masked);
+  return true;
+
+oom:
+  saliency_free(saliency);
+  image1_free(masked);
+  image32_free(labeled);
+  darray_free(regions, true);
+  darray_free(hull, false);
+  rects->free(storage.points);
+  return false;
+}
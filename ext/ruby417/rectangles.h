@@ -5,6 +5,22 @@
 #include "image.h"
 #include "darray.h"
 
+// hulls with more points than this are simplified before fitting rectangles
+#define HULL_SIMPLIFY_MIN_POINTS 32
+#define HULL_SIMPLIFY_TOLERANCE 0.5
+
+// pairing only spreads over threads with at least this many rectangles each
+#define PAIRING_MIN_RECTS_PER_THREAD 128
+#define PAIRING_MAX_THREADS 64
+
+// The points a hull built from a boundary points to, since the boundary only
+// holds chain codes. It's reused from hull to hull, and freed with the hull's
+// free.
+struct hull_storage {
+  struct point *points;
+  unsigned capacity;
+};
+
 struct rectangle {
   int cx, cy;
   int width, height;
@@ -27,6 +43,29 @@ struct pairing_settings {
   double height_variation_threshold;
   int guard_aspect_min, guard_aspect_max;
   int barcode_aspect_min, barcode_aspect_max;
+  int threads; // to pair rectangles on, 0 or 1 for the calling thread alone
+  enum label_polarity polarity; // of the guards
+  bool prefilter; // to skip tiles that can't hold guards, see saliency.h
+  bool fast_fit; // to screen regions with rectangles from their moments, see image1_pair_screened
+};
+
+// A rectangle fit to a region's moments, and the exact one fit to its hull once
+// the region turns out to pair up.
+struct screened_rectangle {
+  struct rectangle rect; // first, so that it passes for a rectangle
+  struct region_moments *moments;
+  struct rectangle *exact;
+  bool traced;
+};
+
+struct pairing_job {
+  struct pairing_settings *settings;
+  struct darray *rects;
+  int first, step; // the rectangles this job pairs up with later ones
+  struct darray *pairs;
+  unsigned *counts; // pairs found for each rectangle
+  struct memory_account *account;
+  bool ok;
 };
 
 struct barcode_corners {
@@ -36,9 +75,13 @@ struct barcode_corners {
   struct point lower_right;
 };
 
-static bool boundary_convex_hull(struct darray *boundary, struct darray *hull);
+static bool boundary_convex_hull(const struct boundary *boundary, struct darray *hull, struct hull_storage *storage);
+static void hull_simplify(struct darray *hull, double tolerance);
 static void hull_minimal_rectangle(struct darray *hull, long fill, struct rectangle *rect);
+static void moments_rectangle(struct region_moments *moments, struct rectangle *rect);
 static bool pair_aligned_rectangles(struct pairing_settings *settings, struct darray *rects, struct darray *pairs);
 static void determine_barcode_corners(struct rectangle_pair *pair, struct barcode_corners *corners);
+static bool image1_locate_guards(struct image1 *im, struct pairing_settings *settings,
+                                 struct darray *rects, struct darray *pairs);
 
 #endif
@@ -0,0 +1,158 @@
+#include <math.h> // floor, hypot
+#include <stdlib.h> // NULL
+#include <stdbool.h>
+#include "rectify.h"
+#include "decoder.h"
+
+// Finds the mapping taking (0, 0), (width, 0), (width, height) and (0, height)
+// to the upper left, upper right, lower right and lower left corners, using
+// Heckbert's closed form for the unit square. Returns false if the corners
+// don't make a convex quadrilateral.
+static bool homography_from_corners(struct barcode_corners *corners, double width, double height,
+                                    struct homography *h) {
+  double x0 = corners->upper_left.x, y0 = corners->upper_left.y,
+         x1 = corners->upper_right.x, y1 = corners->upper_right.y,
+         x2 = corners->lower_right.x, y2 = corners->lower_right.y,
+         x3 = corners->lower_left.x, y3 = corners->lower_left.y,
+         dx1 = x1 - x2, dx2 = x3 - x2, dx3 = x0 - x1 + x2 - x3,
+         dy1 = y1 - y2, dy2 = y3 - y2, dy3 = y0 - y1 + y2 - y3,
+         det = dx1*dy2 - dx2*dy1, g = 0, k = 0;
+
+  if (width <= 0 || height <= 0 || det == 0) return false;
+  if (dx3 != 0 || dy3 != 0) {
+    g = (dx3*dy2 - dx2*dy3) / det;
+    k = (dx1*dy3 - dx3*dy1) / det;
+  }
+  // the denominator is linear, so it's positive inside if it is at the corners
+  if (1 + g <= 0 || 1 + k <= 0 || 1 + g + k <= 0) return false;
+
+  *h = (struct homography) {{
+    {(x1 - x0 + g*x1) / width, (x3 - x0 + k*x3) / height, x0},
+    {(y1 - y0 + g*y1) / width, (y3 - y0 + k*y3) / height, y0},
+    {g / width, k / height, 1}
+  }};
+
+  return true;
+}
+
+static void homography_apply(struct homography *h, double u, double v, double *x, double *y) {
+  double w = h->m[2][0]*u + h->m[2][1]*v + h->m[2][2];
+
+  *x = (h->m[0][0]*u + h->m[0][1]*v + h->m[0][2]) / w;
+  *y = (h->m[1][0]*u + h->m[1][1]*v + h->m[1][2]) / w;
+}
+
+// Bilinear interpolation near or past the edges of the image, which is taken to
+// be light outside.
+static unsigned char image8_sample_with_fallback(struct image8 *im, float x, float y) {
+  if (!(x > -1 && y > -1 && x < im->width && y < im->height)) return 255;
+
+  int x0 = (int) floor(x), y0 = (int) floor(y);
+  float fx = x - x0, fy = y - y0,
+        top = image8_get_with_fallback(im, x0, y0, 255)*(1-fx) + image8_get_with_fallback(im, x0+1, y0, 255)*fx,
+        bottom = image8_get_with_fallback(im, x0, y0+1, 255)*(1-fx) + image8_get_with_fallback(im, x0+1, y0+1, 255)*fx;
+
+  return (unsigned char) (top*(1-fy) + bottom*fy + 0.5f);
+}
+
+// Fills the output image by sampling the input at the mapped centers of its
+// pixels, which sit step modules apart starting from (u0, v0). The mapping must
+// be defined (have a positive denominator) over the whole output. Each row is
+// done in two passes: first the source coordinates, a branch-free loop over
+// independent lanes that compilers vectorize, then the bilinear lookups, in 8
+// bit fixed point. Returns false if out of memory.
+static bool image8_warp(struct image8 *im, struct homography *h, double u0, double v0, double step,
+                        struct image8 *out, void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  float *xs = malloc(sizeof(*xs)*(out->width > 0 ? out->width : 1)),
+        *ys = malloc(sizeof(*ys)*(out->width > 0 ? out->width : 1));
+  if (!xs || !ys) {
+    free(xs);
+    free(ys);
+    return false;
+  }
+
+  float a = h->m[0][0], b = h->m[1][0], c = h->m[2][0], fstep = step;
+  for (int j = 0; j < out->height; j++) {
+    double v = v0 + (j + 0.5)*step;
+    float fu0 = u0 + 0.5*step,
+          bx = h->m[0][1]*v + h->m[0][2], by = h->m[1][1]*v + h->m[1][2], bw = h->m[2][1]*v + h->m[2][2];
+
+    for (int i = 0; i < out->width; i++) {
+      float u = fu0 + i*fstep, w = c*u + bw;
+      xs[i] = (a*u + bx) / w;
+      ys[i] = (b*u + by) / w;
+    }
+
+    unsigned char *row = out->data + j*out->width;
+    for (int i = 0; i < out->width; i++) {
+      float x = xs[i], y = ys[i];
+      int x0 = (int) x, y0 = (int) y;
+
+      if (x >= 0 && y >= 0 && x0 < im->width-1 && y0 < im->height-1) {
+        const unsigned char *p = im->data + y0*im->width + x0;
+        unsigned fx = (unsigned) ((x - x0)*256), fy = (unsigned) ((y - y0)*256),
+                 top = p[0]*(256-fx) + p[1]*fx,
+                 bottom = p[im->width]*(256-fx) + p[im->width+1]*fx;
+        row[i] = (top*(256-fy) + bottom*fy + 32768) >> 16;
+      } else {
+        row[i] = image8_sample_with_fallback(im, x, y);
+      }
+    }
+  }
+
+  free(xs);
+  free(ys);
+  return true;
+}
+
+// Straightens the barcode between the corners into an image with module_size
+// pixels per module, module n of the symbol spanning the nth module_size
+// columns (after the margin). The guards give the module width: they cover the
+// 8 and 7 module wide bars of the start and stop patterns. That's enough to
+// round the span between the corners to a whole number of symbol characters, so
+// perspective and localization errors don't accumulate across the barcode. The
+// height is rounded to whole modules. Returns NULL if out of memory, and an
+// empty image if the corners can't be mapped.
+static struct image8 *image8_rectify(struct image8 *im, struct rectangle_pair *pair,
+                                     struct barcode_corners *corners, int module_size,
+                                     void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  struct point *ul = &corners->upper_left, *ll = &corners->lower_left,
+               *ur = &corners->upper_right, *lr = &corners->lower_right;
+  double module = (pair->one->width + pair->two->width) / 15.0,
+         across = (hypot(ur->x-ul->x, ur->y-ul->y) + hypot(lr->x-ll->x, lr->y-ll->y)) / 2 + 1,
+         down = (hypot(ll->x-ul->x, ll->y-ul->y) + hypot(lr->x-ur->x, lr->y-ur->y)) / 2 + 1;
+  struct homography h;
+
+  if (module <= 0) return image8_new(0, 0, malloc, free);
+
+  // the start pattern and the stop pattern's wide bar, and the cells between
+  int cells = (int) floor((across/module - SYMBOL_MODULES - 7) / SYMBOL_MODULES + 0.5),
+      modules_down = (int) floor(down/module + 0.5);
+  if (cells < 1) cells = 1;
+  if (cells > SYMBOL_MAX_COLUMNS) cells = SYMBOL_MAX_COLUMNS;
+  if (modules_down < 1) modules_down = 1;
+  int modules_across = SYMBOL_MODULES*(cells+1) + 7;
+
+  // the corners are the outermost pixels, a pixel short of the far edges
+  if (!homography_from_corners(corners, modules_across - 1/module, modules_down - 1/module, &h)) {
+    return image8_new(0, 0, malloc, free);
+  }
+  double extents[4][2] = {
+    {-RECTIFY_SIDE_MODULES, -RECTIFY_QUIET_MODULES},
+    {modules_across + RECTIFY_SIDE_MODULES, -RECTIFY_QUIET_MODULES},
+    {-RECTIFY_SIDE_MODULES, modules_down + RECTIFY_QUIET_MODULES},
+    {modules_across + RECTIFY_SIDE_MODULES, modules_down + RECTIFY_QUIET_MODULES}
+  };
+  for (int i = 0; i < 4; i++) {
+    if (h.m[2][0]*extents[i][0] + h.m[2][1]*extents[i][1] + h.m[2][2] <= 0) return image8_new(0, 0, malloc, free);
+  }
+
+  struct image8 *out = image8_new((modules_across + 2*RECTIFY_SIDE_MODULES)*module_size,
+                                  (modules_down + 2*RECTIFY_QUIET_MODULES)*module_size, malloc, free);
+  if (out && !image8_warp(im, &h, -RECTIFY_SIDE_MODULES, -RECTIFY_QUIET_MODULES, 1.0/module_size, out, malloc, free)) {
+    image8_free(out);
+    return NULL;
+  }
+
+  return out;
+}
@@ -0,0 +1,30 @@
+#ifndef RECTIFY_H
+#define RECTIFY_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+#include "rectangles.h"
+
+// The corners only reach the wide bar of the stop pattern, so rectified images
+// extend past them on both sides by the rest of the stop pattern (the barcode
+// may be upside down), and by a quiet zone above and below.
+#define RECTIFY_SIDE_MODULES 11
+#define RECTIFY_QUIET_MODULES 2
+#define RECTIFY_MAX_MODULE_SIZE 16
+
+// A projective mapping from barcode coordinates, in modules, to image pixels.
+struct homography {
+  double m[3][3];
+};
+
+static bool homography_from_corners(struct barcode_corners *corners, double width, double height,
+                                    struct homography *h);
+static void homography_apply(struct homography *h, double u, double v, double *x, double *y);
+static bool image8_warp(struct image8 *im, struct homography *h, double u0, double v0, double step,
+                        struct image8 *out, void *(*malloc)(size_t size), void (*free)(void *ptr));
+static struct image8 *image8_rectify(struct image8 *im, struct rectangle_pair *pair,
+                                     struct barcode_corners *corners, int module_size,
+                                     void *(*malloc)(size_t size), void (*free)(void *ptr));
+
+#endif
@@ -0,0 +1,199 @@
+#include <string.h> // memcpy, memmove
+#include <stdbool.h>
+#include "reed_solomon.h"
+
+// Antilogarithms repeat once so that products can index them without reducing
+// the sum of the logarithms.
+static unsigned short gf929_exp[2*(GF929_SIZE-1)], gf929_log[GF929_SIZE];
+
+// Fills in the log and antilog tables. Must be called before anything else here.
+static void gf929_init(void) {
+  unsigned x = 1;
+
+  for (int i = 0; i < GF929_SIZE-1; i++) {
+    gf929_exp[i] = gf929_exp[i + GF929_SIZE-1] = x;
+    gf929_log[x] = i;
+    x = x*GF929_GENERATOR % GF929_SIZE;
+  }
+}
+
+static unsigned gf929_mul(unsigned a, unsigned b) {
+  return a && b ? gf929_exp[gf929_log[a] + gf929_log[b]] : 0;
+}
+
+static unsigned gf929_inv(unsigned a) {
+  return gf929_exp[(GF929_SIZE-1 - gf929_log[a]) % (GF929_SIZE-1)];
+}
+
+static unsigned gf929_add(unsigned a, unsigned b) {
+  unsigned sum = a + b;
+  return sum >= GF929_SIZE ? sum - GF929_SIZE : sum;
+}
+
+static unsigned gf929_sub(unsigned a, unsigned b) {
+  return a >= b ? a - b : a + GF929_SIZE - b;
+}
+
+// Evaluates a polynomial, lowest coefficient first, at 3^power.
+static unsigned gf929_poly_eval(const unsigned *poly, int degree, int power) {
+  unsigned sum = 0, point = gf929_exp[power % (GF929_SIZE-1)];
+
+  for (int i = degree; i >= 0; i--) sum = gf929_add(gf929_mul(sum, point), poly[i]);
+
+  return sum;
+}
+
+// Evaluates a polynomial, highest coefficient first, at many points at once.
+// All points advance together through the coefficients, so the inner loop is
+// plain integer arithmetic over independent lanes, which compilers vectorize.
+// Products of two elements fit in 32 bits.
+static void gf929_poly_eval_many(const unsigned *coefficients, int count,
+                                 const unsigned *points, int num_points, unsigned *out) {
+  for (int j = 0; j < num_points; j++) out[j] = 0;
+
+  for (int i = 0; i < count; i++) {
+    unsigned coefficient = coefficients[i];
+    for (int j = 0; j < num_points; j++) {
+      out[j] = (out[j]*points[j] + coefficient) % GF929_SIZE;
+    }
+  }
+}
+
+// Evaluates the received codewords, as a polynomial with the first codeword
+// highest, at 3^1 through 3^num_ec.
+static void rs_syndromes(const unsigned *codewords, int count, int num_ec, unsigned *syndromes) {
+  unsigned roots[RS_MAX_EC];
+
+  for (int j = 0; j < num_ec; j++) roots[j] = gf929_exp[j+1];
+  gf929_poly_eval_many(codewords, count, roots, num_ec, syndromes);
+}
+
+// Computes the error correction codewords to append to the data codewords: the
+// negated remainder of dividing the data, shifted up by num_ec, by the generator
+// polynomial (x - 3)(x - 3^2)...(x - 3^num_ec).
+static bool rs_encode(const unsigned *data, int count, int num_ec, unsigned *ec) {
+  unsigned generator[RS_MAX_EC+1] = {1};
+
+  if (num_ec < 1 || num_ec > RS_MAX_EC || count < 1 || count + num_ec > RS_MAX_CODEWORDS) return false;
+
+  for (int i = 1; i <= num_ec; i++) {
+    unsigned root = gf929_exp[i];
+    generator[i] = generator[i-1];
+    for (int j = i-1; j > 0; j--) generator[j] = gf929_sub(generator[j-1], gf929_mul(root, generator[j]));
+    generator[0] = gf929_sub(0, gf929_mul(root, generator[0]));
+  }
+
+  // the remainder, highest coefficient first
+  for (int j = 0; j < num_ec; j++) ec[j] = 0;
+  for (int i = 0; i < count; i++) {
+    unsigned factor = gf929_add(data[i], ec[0]);
+    for (int j = 0; j < num_ec-1; j++) ec[j] = gf929_sub(ec[j+1], gf929_mul(factor, generator[num_ec-1-j]));
+    ec[num_ec-1] = gf929_sub(0, gf929_mul(factor, generator[0]));
+  }
+  for (int j = 0; j < num_ec; j++) ec[j] = gf929_sub(0, ec[j]);
+
+  return true;
+}
+
+// Corrects errors and erasures (codewords known to be unreliable, by index) in
+// place, as long as twice the errors plus the erasures don't exceed num_ec.
+// Berlekamp-Massey finds the error locator, starting from the erasure locator,
+// Chien search finds its roots and Forney's formula the error values. Returns
+// the number of codewords changed, or -1 if the codewords can't be corrected, in
+// which case they are left alone.
+static int rs_correct(unsigned *codewords, int count, int num_ec, const int *erasures, int num_erasures) {
+  unsigned syndromes[RS_MAX_EC], locator[RS_MAX_EC+1] = {1}, previous[RS_MAX_EC+1],
+           updated[RS_MAX_EC+1], reversed[RS_MAX_EC+1], evaluator[RS_MAX_EC], values[RS_MAX_EC],
+           points[RS_MAX_CODEWORDS], roots[RS_MAX_CODEWORDS];
+  int positions[RS_MAX_EC], degree = 0, found = 0, changed = 0;
+  bool clean = true;
+
+  if (num_ec < 1 || num_ec > RS_MAX_EC || count <= num_ec || count > RS_MAX_CODEWORDS ||
+      num_erasures < 0 || num_erasures > num_ec) return -1;
+  for (int e = 0; e < num_erasures; e++) {
+    if (erasures[e] < 0 || erasures[e] >= count) return -1;
+  }
+
+  rs_syndromes(codewords, count, num_ec, syndromes);
+  for (int j = 0; j < num_ec; j++) clean = clean && !syndromes[j];
+  if (clean) return 0;
+
+  // erasure locator: the product of (1 - X x) over the erased positions X
+  for (int e = 0; e < num_erasures; e++) {
+    unsigned position = gf929_exp[count-1 - erasures[e]];
+    locator[++degree] = 0;
+    for (int j = degree; j > 0; j--) locator[j] = gf929_sub(locator[j], gf929_mul(position, locator[j-1]));
+  }
+  memcpy(previous, locator, sizeof(*locator)*(degree+1));
+  for (int j = degree+1; j <= num_ec; j++) locator[j] = previous[j] = 0;
+
+  for (int r = num_erasures; r < num_ec; r++) {
+    unsigned discrepancy = 0;
+    for (int j = 0; j <= degree && j <= r; j++) {
+      discrepancy = gf929_add(discrepancy, gf929_mul(locator[j], syndromes[r-j]));
+    }
+
+    // previous is kept multiplied by x as the iterations go, so neither
+    // polynomial reaches past x^(r+1) yet
+    int limit = r+1 < num_ec ? r+1 : num_ec;
+    memmove(previous+1, previous, sizeof(*previous)*limit);
+    previous[0] = 0;
+    if (!discrepancy) continue;
+
+    for (int j = 0; j <= limit; j++) updated[j] = gf929_sub(locator[j], gf929_mul(discrepancy, previous[j]));
+    if (2*degree <= r + num_erasures) {
+      unsigned inverse = gf929_inv(discrepancy);
+      for (int j = 0; j <= limit; j++) previous[j] = gf929_mul(locator[j], inverse);
+      degree = r + 1 + num_erasures - degree;
+    }
+    memcpy(locator, updated, sizeof(*locator)*(limit+1));
+  }
+  if (2*degree - num_erasures > num_ec || degree > count) return -1;
+
+  for (int i = 0; i < num_ec; i++) {
+    evaluator[i] = 0;
+    for (int j = 0; j <= degree && j <= i; j++) {
+      evaluator[i] = gf929_add(evaluator[i], gf929_mul(locator[j], syndromes[i-j]));
+    }
+  }
+
+  // Chien search, evaluating the locator at every inverse position at once; the
+  // codeword at index i sits at 3^(count-1-i)
+  for (int j = 0; j <= degree; j++) reversed[j] = locator[degree-j];
+  for (int i = 0; i < count; i++) points[i] = gf929_exp[GF929_SIZE-1 - (count-1 - i)];
+  gf929_poly_eval_many(reversed, degree+1, points, count, roots);
+
+  for (int i = 0; i < count; i++) {
+    if (roots[i]) continue;
+    int power = GF929_SIZE-1 - (count-1 - i);
+
+    // Forney: the value is -evaluator/locator' at the inverse position
+    unsigned derivative = 0;
+    for (int j = degree; j >= 1; j--) {
+      derivative = gf929_add(gf929_mul(derivative, points[i]), gf929_mul(j, locator[j]));
+    }
+    if (!derivative || found == degree) return -1;
+
+    positions[found] = i;
+    values[found++] = gf929_mul(gf929_poly_eval(evaluator, num_ec-1, power), gf929_inv(derivative));
+  }
+  if (found != degree) return -1;
+
+  // error values are negated, so adding them corrects the codewords
+  for (int f = 0; f < found; f++) {
+    if (values[f]) changed++;
+    codewords[positions[f]] = gf929_add(codewords[positions[f]], values[f]);
+  }
+
+  rs_syndromes(codewords, count, num_ec, syndromes);
+  for (int j = 0; j < num_ec; j++) {
+    if (syndromes[j]) {
+      for (int f = 0; f < found; f++) {
+        codewords[positions[f]] = gf929_sub(codewords[positions[f]], values[f]);
+      }
+      return -1;
+    }
+  }
+
+  return changed;
+}
@@ -0,0 +1,21 @@
+#ifndef REED_SOLOMON_H
+#define REED_SOLOMON_H
+
+#include <stdbool.h>
+
+// PDF417 error correction works over the integers mod 929, with 3 as the
+// primitive element. A symbol holds at most 928 codewords, up to 512 of which
+// are for error correction.
+#define GF929_SIZE 929
+#define GF929_GENERATOR 3
+#define RS_MAX_CODEWORDS 928
+#define RS_MAX_EC 512
+
+static void gf929_init(void);
+static unsigned gf929_mul(unsigned a, unsigned b);
+static unsigned gf929_inv(unsigned a);
+static void rs_syndromes(const unsigned *codewords, int count, int num_ec, unsigned *syndromes);
+static bool rs_encode(const unsigned *data, int count, int num_ec, unsigned *ec);
+static int rs_correct(unsigned *codewords, int count, int num_ec, const int *erasures, int num_erasures);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdlib.h> // NULL
+#include <string.h> // memset
+#include <stdbool.h>
+#include "saliency.h"
+
+static void saliency_free(struct saliency *s) {
+  if (s) {
+    s->free(s->dark);
+    s->free(s->transitions);
+    s->free(s->runs);
+    s->free(s->salient);
+    s->free(s);
+  }
+}
+
+// Sums a table over tiles tx0 to tx1 and ty0 to ty1 (exclusive), clipped to
+// the grid.
+static long saliency_sum(const struct saliency *s, const long *table, int tx0, int ty0, int tx1, int ty1) {
+  int columns = s->tiles_x + 1;
+
+  if (tx0 < 0) tx0 = 0;
+  if (ty0 < 0) ty0 = 0;
+  if (tx1 > s->tiles_x) tx1 = s->tiles_x;
+  if (ty1 > s->tiles_y) ty1 = s->tiles_y;
+  if (tx0 >= tx1 || ty0 >= ty1) return 0;
+
+  return table[(long) ty1*columns + tx1] - table[(long) ty0*columns + tx1] -
+         table[(long) ty1*columns + tx0] + table[(long) ty0*columns + tx0];
+}
+
+static void summed_area(long *table, int tiles_x, int tiles_y) {
+  int columns = tiles_x + 1;
+
+  for (int ty = 1; ty <= tiles_y; ty++) {
+    for (int tx = 1; tx <= tiles_x; tx++) {
+      long i = (long) ty*columns + tx;
+      table[i] += table[i - 1] + table[i - columns] - table[i - columns - 1];
+    }
+  }
+}
+
+// Gathers each tile's statistics in a single pass over the image, keeping the
+// length of the run of guard pixels ending at each pixel vertically,
+// horizontally and along both diagonals, whose steps are longer, so their runs
+// need fewer. A tile could hold guards if it has long runs, and its
+// neighborhood has some transitions and some background; it's kept along with
+// the tiles around it. Returns NULL if out of memory.
+static struct saliency *image1_saliency(struct image1 *im, enum label_polarity polarity, int min_run,
+                                        void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  int width = im->width, height = im->height, diagonal_run = (min_run*181 + 255) / 256; // 1/sqrt(2)
+  int tiles_x = (width + SALIENCY_TILE - 1) / SALIENCY_TILE, tiles_y = (height + SALIENCY_TILE - 1) / SALIENCY_TILE;
+  size_t cells = (size_t) (tiles_x + 1)*(tiles_y + 1), counters = width + 2;
+  uint64_t flip = polarity == LABEL_LIGHT ? 0 : ~(uint64_t) 0; // so that guard pixels are set
+  unsigned *vertical = NULL, *right = NULL, *left = NULL, *next_right = NULL, *next_left = NULL;
+  bool *candidates = NULL;
+  struct saliency *s = malloc(sizeof(*s));
+
+  if (!s) return NULL;
+  *s = (struct saliency) {.tiles_x = tiles_x, .tiles_y = tiles_y, .free = free};
+  if (!(s->dark=malloc(sizeof(*s->dark) * cells)) ||
+      !(s->transitions=malloc(sizeof(*s->transitions) * cells)) ||
+      !(s->runs=malloc(sizeof(*s->runs) * cells)) ||
+      !(s->salient=malloc(sizeof(*s->salient) * tiles_x*tiles_y + 1)) ||
+      !(candidates=malloc(sizeof(*candidates) * tiles_x*tiles_y + 1))) goto oom;
+  // diagonal counters are padded by one each side, so neighbors always exist
+  if (!(vertical=malloc(sizeof(*vertical) * counters)) ||
+      !(right=malloc(sizeof(*right) * counters)) || !(left=malloc(sizeof(*left) * counters)) ||
+      !(next_right=malloc(sizeof(*next_right) * counters)) ||
+      !(next_left=malloc(sizeof(*next_left) * counters))) goto oom;
+  memset(s->dark, 0, sizeof(*s->dark) * cells);
+  memset(s->transitions, 0, sizeof(*s->transitions) * cells);
+  memset(s->runs, 0, sizeof(*s->runs) * cells);
+  memset(vertical, 0, sizeof(*vertical) * counters);
+  memset(right, 0, sizeof(*right) * counters);
+  memset(left, 0, sizeof(*left) * counters);
+  next_right[0] = next_right[width+1] = next_left[0] = next_left[width+1] = 0;
+
+  for (int y = 0; y < height; y++) {
+    const uint64_t *row = im->data + (long) im->stride*y;
+    long *dark = s->dark + (long) (y/SALIENCY_TILE + 1)*(tiles_x + 1) + 1,
+         *transitions = s->transitions + (dark - s->dark),
+         *runs = s->runs + (dark - s->dark);
+    unsigned horizontal = 0;
+    bool previous = false;
+
+    for (int i = 0; i < im->stride; i++) {
+      int n = width - i*64 < 64 ? width - i*64 : 64;
+      uint64_t word = (row[i] ^ flip) & (n < 64 ? ((uint64_t) 1 << n) - 1 : ~(uint64_t) 0);
+
+      // background words only end runs
+      if (!word) {
+        transitions[i] += previous;
+        previous = false;
+        horizontal = 0;
+        memset(vertical + i*64, 0, sizeof(*vertical) * n);
+        memset(next_right + i*64 + 1, 0, sizeof(*next_right) * n);
+        memset(next_left + i*64 + 1, 0, sizeof(*next_left) * n);
+        continue;
+      }
+
+      dark[i] += __builtin_popcountll(word);
+      for (int b = 0; b < n; b++) {
+        int x = i*64 + b;
+        bool on = (word >> b) & 1;
+        transitions[i] += x > 0 && on != previous;
+        previous = on;
+        if (on) {
+          vertical[x]++;
+          horizontal++;
+          next_right[x+1] = right[x] + 1;
+          next_left[x+1] = left[x+2] + 1;
+          runs[i] += vertical[x] >= (unsigned) min_run || horizontal >= (unsigned) min_run ||
+                     next_right[x+1] >= (unsigned) diagonal_run || next_left[x+1] >= (unsigned) diagonal_run;
+        } else {
+          vertical[x] = horizontal = next_right[x+1] = next_left[x+1] = 0;
+        }
+      }
+    }
+
+    unsigned *swap = right;
+    right = next_right;
+    next_right = swap;
+    swap = left;
+    left = next_left;
+    next_left = swap;
+  }
+
+  summed_area(s->dark, tiles_x, tiles_y);
+  summed_area(s->transitions, tiles_x, tiles_y);
+  summed_area(s->runs, tiles_x, tiles_y);
+
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      int x0 = (tx - 1)*SALIENCY_TILE, y0 = (ty - 1)*SALIENCY_TILE,
+          x1 = (tx + 2)*SALIENCY_TILE, y1 = (ty + 2)*SALIENCY_TILE;
+      long pixels = (long) ((x1 < width ? x1 : width) - (x0 > 0 ? x0 : 0)) *
+                    ((y1 < height ? y1 : height) - (y0 > 0 ? y0 : 0));
+      candidates[ty*tiles_x + tx] =
+        saliency_sum(s, s->runs, tx, ty, tx+1, ty+1) > 0 &&
+        saliency_sum(s, s->transitions, tx-1, ty-1, tx+2, ty+2) >= SALIENCY_MIN_TRANSITIONS*pixels &&
+        saliency_sum(s, s->dark, tx-1, ty-1, tx+2, ty+2) <= SALIENCY_MAX_DARK*pixels;
+    }
+  }
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      bool salient = false;
+      for (int j = ty - SALIENCY_MARGIN; j <= ty + SALIENCY_MARGIN && !salient; j++) {
+        for (int i = tx - SALIENCY_MARGIN; i <= tx + SALIENCY_MARGIN && !salient; i++) {
+          salient = j >= 0 && j < tiles_y && i >= 0 && i < tiles_x && candidates[j*tiles_x + i];
+        }
+      }
+      s->salient[ty*tiles_x + tx] = salient;
+    }
+  }
+
+  free(vertical);
+  free(right);
+  free(left);
+  free(next_right);
+  free(next_left);
+  free(candidates);
+  return s;
+
+oom:
+  free(vertical);
+  free(right);
+  free(left);
+  free(next_right);
+  free(next_left);
+  free(candidates);
+  saliency_free(s);
+  return NULL;
+}
+
+// Fills the tiles that can't hold guards with the background color (fill), in
+// place, so labeling passes over them as single runs. Returns the number of
+// tiles left as they were.
+static long image1_mask_unsalient(struct image1 *im, const struct saliency *s, bool fill) {
+  uint64_t background = fill ? ~(uint64_t) 0 : 0;
+  long kept = 0;
+
+  for (int ty = 0; ty < s->tiles_y; ty++) {
+    int y1 = (ty + 1)*SALIENCY_TILE < im->height ? (ty + 1)*SALIENCY_TILE : im->height;
+    for (int tx = 0; tx < s->tiles_x; tx++) {
+      if (s->salient[ty*s->tiles_x + tx]) {
+        kept++;
+        continue;
+      }
+      for (int y = ty*SALIENCY_TILE; y < y1; y++) im->data[(long) im->stride*y + tx] = background;
+    }
+  }
+
+  return kept;
+}
@@ -0,0 +1,37 @@
+#ifndef SALIENCY_H
+#define SALIENCY_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+
+// Tiles are a word of a binary image wide, so masking one is storing words.
+#define SALIENCY_TILE 64
+// tiles kept around each one that could hold a guard
+#define SALIENCY_MARGIN 1
+// runs of guard pixels at least this long mark a tile, whatever the guards' size
+#define SALIENCY_MIN_RUN 4
+// a tile's neighborhood (itself and the tiles around it) must have at least
+// this many horizontal transitions per pixel, to skip smooth blots,
+// and at most this many guard pixels, to skip solid areas
+#define SALIENCY_MIN_TRANSITIONS 0.002
+#define SALIENCY_MAX_DARK 0.9
+
+// Per tile statistics, as summed-area tables over the grid of tiles, so that
+// any block of tiles sums in constant time.
+struct saliency {
+  int tiles_x, tiles_y;
+  long *dark; // guard colored pixels
+  long *transitions; // horizontal color changes
+  long *runs; // pixels at least min_run into a run of guard pixels, in any of 4 directions
+  bool *salient; // tiles that could hold guards, margin included
+  void (*free)(void *ptr);
+};
+
+static struct saliency *image1_saliency(struct image1 *im, enum label_polarity polarity, int min_run,
+                                        void *(*malloc)(size_t size), void (*free)(void *ptr));
+static void saliency_free(struct saliency *s);
+static long saliency_sum(const struct saliency *s, const long *table, int tx0, int ty0, int tx1, int ty1);
+static long image1_mask_unsalient(struct image1 *im, const struct saliency *s, bool fill);
+
+#endif
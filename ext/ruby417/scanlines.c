@@ -0,0 +1,307 @@
+#include <stdlib.h> // NULL
+#include <math.h> // fabs, hypot, sin, cos
+#include <stdbool.h>
+#include "scanlines.h"
+#include "decoder.h"
+
+static struct scanline_cluster *scanline_cluster_new(enum scanline_pattern pattern, bool reversed, bool vertical,
+                                                     void *(*malloc)(size_t size),
+                                                     void *(*realloc)(void *ptr, size_t new_size),
+                                                     void (*free)(void *ptr)) {
+  struct scanline_cluster *cluster = malloc(sizeof(*cluster));
+  if (cluster) {
+    *cluster = (struct scanline_cluster) {.pattern = pattern, .reversed = reversed, .vertical = vertical};
+    if (!(cluster->hits=darray_new(4, free, malloc, realloc, free))) {
+      free(cluster);
+      return NULL;
+    }
+  }
+  return cluster;
+}
+
+static void scanline_cluster_free(void *ptr) {
+  struct scanline_cluster *cluster = ptr;
+  if (cluster) {
+    void (*free)(void *ptr) = cluster->hits->free;
+    darray_free(cluster->hits, true);
+    free(cluster);
+  }
+}
+
+// Run-length encodes a row (or a column, if vertical) into positions, the start
+// of each run followed by the end of the last, and returns the number of runs.
+// Rows go a word at a time.
+static int scanline_runs(struct image1 *im, bool vertical, int line, bool light_bars, int *positions, bool *first_bar) {
+  int n = 0, length = vertical ? im->height : im->width;
+  if (!length) return 0;
+
+  if (vertical) {
+    bool previous = image1_get(im, line, 0);
+    *first_bar = previous == light_bars;
+    positions[n++] = 0;
+    for (int y = 1; y < length; y++) {
+      bool light = image1_get(im, line, y);
+      if (light != previous) {
+        positions[n++] = y;
+        previous = light;
+      }
+    }
+  } else {
+    *first_bar = image1_get(im, 0, line) == light_bars;
+    for (int x = 0; x < length; x = image1_run_end(im, x, line)) positions[n++] = x;
+  }
+  positions[n] = length;
+  return n;
+}
+
+// Whether the runs from k on have the widths of the pattern, read forwards or
+// backwards, at some module width, which is set if so. The stop pattern's
+// final bar is left out, as when decoding.
+static bool runs_match(const int *positions, int k, enum scanline_pattern pattern, bool reversed, double *module) {
+  const int *widths = pattern == SCANLINE_START ? start_pattern : stop_pattern;
+  double m = (double) (positions[k+SYMBOL_ELEMENTS] - positions[k]) / SYMBOL_MODULES;
+  if (m < 1) return false;
+
+  for (int i = 0; i < SYMBOL_ELEMENTS; i++) {
+    int expected = widths[reversed ? SYMBOL_ELEMENTS-1-i : i], width = positions[k+i+1] - positions[k+i];
+    if (fabs(width - expected*m) > SCANLINE_TOLERANCE*m + 1) return false;
+  }
+  *module = m;
+  return true;
+}
+
+// Adds a hit to a cluster on the last few scanlines that it lines up with, or
+// to a new one. Guards at up to 45 degrees from the scanlines' normal drift by
+// at most a pixel per line.
+static bool cluster_hit(struct darray *clusters, struct darray *open, struct scanline_hit *hit,
+                        enum scanline_pattern pattern, bool reversed, bool vertical, double module) {
+  struct scanline_cluster *cluster = NULL;
+  for (unsigned i = 0; i < open->len && !cluster; i++) {
+    struct scanline_cluster *candidate = darray_index(open, i);
+    struct scanline_hit *last = darray_index(candidate->hits, candidate->hits->len - 1);
+    double mean = candidate->module / candidate->hits->len;
+    if (candidate->pattern == pattern && candidate->reversed == reversed && last->line < hit->line &&
+        abs(hit->begin - last->begin) <= hit->line - last->line + 2*mean &&
+        module < 1.5*mean && mean < 1.5*module) {
+      cluster = candidate;
+    }
+  }
+
+  if (!cluster) {
+    if (!(cluster=scanline_cluster_new(pattern, reversed, vertical, clusters->malloc, clusters->realloc, clusters->free))) {
+      return false;
+    }
+    if (!darray_push(clusters, cluster)) {
+      scanline_cluster_free(cluster);
+      return false;
+    }
+    if (!darray_push(open, cluster)) return false;
+    cluster->first_line = hit->line;
+  }
+
+  struct scanline_hit *copy = clusters->malloc(sizeof(*copy));
+  if (!copy) return false;
+  *copy = *hit;
+  if (!darray_push(cluster->hits, copy)) {
+    clusters->free(copy);
+    return false;
+  }
+  cluster->last_line = hit->line;
+  cluster->module += module;
+  return true;
+}
+
+// Fits a rectangle to a cluster's hits, which reach halfway to the scanlines
+// around them, through the hull of their ends, traced in the same order as a
+// region's boundary.
+static bool cluster_fit(struct scanline_cluster *cluster, struct image1 *im, int step,
+                        struct point *points, struct boundary *boundary, struct darray *hull,
+                        struct hull_storage *storage) {
+  unsigned n = cluster->hits->len;
+  int limit = (cluster->vertical ? im->width : im->height) - 1;
+  long fill = 0;
+
+  boundary_clear(boundary);
+  hull->len = 0;
+  for (unsigned i = 0; i < n; i++) {
+    struct scanline_hit *hit = darray_index(cluster->hits, i);
+    int line = hit->line;
+    if (i == 0) line = line - step/2 > 0 ? line - step/2 : 0;
+    if (i == n-1) line = line + step/2 < limit ? line + step/2 : limit;
+    // the near end of each hit, in order, then the far ends in reverse
+    points[i] = cluster->vertical ? (struct point) {line, hit->begin} : (struct point) {hit->begin, line};
+    points[2*n-1-i] = cluster->vertical ? (struct point) {line, hit->end - 1} : (struct point) {hit->end - 1, line};
+    fill += (long) (hit->end - hit->begin) * step;
+  }
+
+  // clockwise from the top left, as contours are followed
+  if (!boundary_push(boundary, points[0].x, points[0].y)) return false;
+  if (cluster->vertical) {
+    for (unsigned i = 1; i < 2*n; i++) if (!boundary_push(boundary, points[i].x, points[i].y)) return false;
+  } else {
+    for (unsigned i = 2*n-1; i >= 1; i--) if (!boundary_push(boundary, points[i].x, points[i].y)) return false;
+  }
+
+  if (!boundary_convex_hull(boundary, hull, storage)) return false;
+  if (hull->len > 2) hull_minimal_rectangle(hull, fill, &cluster->rect);
+  return true;
+}
+
+// How well a start and a stop cluster make up one barcode, from 0 (not at all)
+// to 1 (both hit on every scanline along guards of the same length).
+static double cluster_pair_score(struct scanline_cluster *start, struct scanline_cluster *stop, int step) {
+  struct rectangle *one = &start->rect, *two = &stop->rect;
+  double start_module = start->module / start->hits->len, stop_module = stop->module / stop->hits->len,
+         one_length = one->width > one->height ? one->width : one->height,
+         two_length = two->width > two->height ? two->width : two->height,
+         // along the start guard
+         gx = one->height >= one->width ? -sin(one->orientation) : cos(one->orientation),
+         gy = one->height >= one->width ? cos(one->orientation) : sin(one->orientation),
+         dx = two->cx - one->cx, dy = two->cy - one->cy, distance = hypot(dx, dy);
+  int start_lines = (start->last_line - start->first_line) / step + 1,
+      stop_lines = (stop->last_line - stop->first_line) / step + 1;
+
+  if (start->vertical != stop->vertical || start->reversed != stop->reversed || distance == 0) return 0;
+  if (start_module > 1.5*stop_module || stop_module > 1.5*start_module) return 0;
+  if (one_length > 1.5*two_length || two_length > 1.5*one_length) return 0;
+  // the guards face each other across the rows, start first when read forwards
+  if (fabs(dx*gx + dy*gy) > SCANLINE_MAX_SKEW*distance) return 0;
+  if (start->reversed != ((start->vertical ? dy : dx) < 0)) return 0;
+
+  double score = (double) (start->hits->len + stop->hits->len) / (start_lines + stop_lines) *
+                 (one_length < two_length ? one_length / two_length : two_length / one_length);
+  return score < 1 ? score : 1;
+}
+
+// Locates barcodes without labeling: scans every step-th row (and column, if
+// set) for start and stop patterns, clusters their hits into guards, fits each
+// with a rectangle, and pairs each start guard with its best stop guard. The
+// rectangles and pairs are as from image1_locate_guards, so the corners come
+// from determine_barcode_corners. Allocation goes through the rects'
+// allocators.
+static bool image1_locate_scanlines(struct image1 *im, struct scanline_settings *settings,
+                                    struct darray *rects, struct darray *pairs) {
+  void *(*malloc)(size_t size) = rects->malloc;
+  void *(*realloc)(void *ptr, size_t new_size) = rects->realloc;
+  void (*free)(void *ptr) = rects->free;
+  int step = settings->step > 0 ? settings->step : SCANLINE_STEP,
+      longest = im->width > im->height ? im->width : im->height;
+  bool light_bars = settings->polarity == LABEL_LIGHT;
+  int *positions = NULL;
+  struct point *points = NULL;
+  struct darray *clusters = NULL, *open = NULL, *hull = NULL;
+  struct hull_storage storage = {0};
+  struct boundary boundary;
+  unsigned most_hits = 0;
+
+  boundary_init(&boundary, realloc, free);
+
+  if (!(positions=malloc(sizeof(*positions) * (longest + 2))) ||
+      !(clusters=darray_new(0, scanline_cluster_free, malloc, realloc, free)) ||
+      !(open=darray_new(0, NULL, malloc, realloc, free))) goto oom;
+
+  for (int vertical = 0; vertical <= settings->columns; vertical++) {
+    int lines = vertical ? im->width : im->height;
+    open->len = 0;
+
+    for (int line = step/2; line < lines; line += step) {
+      bool first_bar;
+      int runs = scanline_runs(im, vertical, line, light_bars, positions, &first_bar);
+
+      // clusters not hit for a while are complete
+      unsigned kept = 0;
+      for (unsigned i = 0; i < open->len; i++) {
+        struct scanline_cluster *cluster = darray_index(open, i);
+        if (line - cluster->last_line <= (SCANLINE_MAX_GAP + 1)*step) darray_index_set(open, kept++, cluster);
+      }
+      open->len = kept;
+
+      for (int k = 0; k + SYMBOL_ELEMENTS <= runs; k++) {
+        // forwards, both patterns start with a bar, backwards with a space
+        bool reversed = first_bar == (k & 1);
+        double module;
+        struct scanline_hit hit = {.line = line, .begin = positions[k], .end = positions[k+SYMBOL_ELEMENTS]};
+
+        for (int pattern = SCANLINE_START; pattern <= SCANLINE_STOP; pattern++) {
+          if (runs_match(positions, k, pattern, reversed, &module)) {
+            if (!cluster_hit(clusters, open, &hit, pattern, reversed, vertical, module)) goto oom;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < clusters->len; i++) {
+    struct scanline_cluster *cluster = darray_index(clusters, i);
+    if (cluster->hits->len > most_hits) most_hits = cluster->hits->len;
+  }
+  if (!(points=malloc(sizeof(*points) * (2*most_hits + 1))) ||
+      !(hull=darray_new(0, NULL, malloc, realloc, free))) goto oom;
+
+  // only clusters long enough to be guards are fit
+  unsigned kept = 0;
+  for (unsigned i = 0; i < clusters->len; i++) {
+    struct scanline_cluster *cluster = darray_index(clusters, i);
+    cluster->rect.width = 0;
+    if (cluster->hits->len >= SCANLINE_MIN_HITS) {
+      if (!cluster_fit(cluster, im, step, points, &boundary, hull, &storage)) goto oom;
+    }
+    if (cluster->rect.width > 0) {
+      darray_index_set(clusters, i, darray_index(clusters, kept));
+      darray_index_set(clusters, kept++, cluster);
+    }
+  }
+
+  for (unsigned i = 0; i < kept; i++) {
+    struct scanline_cluster *start = darray_index(clusters, i), *best = NULL;
+    double best_score = 0;
+    if (start->pattern != SCANLINE_START) continue;
+
+    for (unsigned j = 0; j < kept; j++) {
+      struct scanline_cluster *stop = darray_index(clusters, j);
+      double score;
+      if (stop->pattern == SCANLINE_STOP && (score=cluster_pair_score(start, stop, step)) > best_score) {
+        best = stop;
+        best_score = score;
+      }
+    }
+    if (!best) continue;
+
+    // the guard further right first, so the corners come out the same way up
+    // as the guard localizer's
+    bool swap = best->rect.cx > start->rect.cx;
+    struct rectangle *one = malloc(sizeof(*one)), *two = malloc(sizeof(*two));
+    struct rectangle_pair *pair = malloc(sizeof(*pair));
+    if (one) *one = swap ? best->rect : start->rect;
+    if (two) *two = swap ? start->rect : best->rect;
+    if (pair) *pair = (struct rectangle_pair) {.one = one, .two = two, .score = best_score};
+    bool pushed_one = one && darray_push(rects, one), pushed_two = pushed_one && two && darray_push(rects, two);
+    if (!pushed_one || !pushed_two || !pair || !darray_push(pairs, pair)) {
+      if (!pushed_one) free(one);
+      if (!pushed_two) free(two);
+      free(pair);
+      goto oom;
+    }
+  }
+  if (!darray_radix_sort(pairs, NULL, pair_key_by_score)) goto oom;
+
+  free(positions);
+  free(points);
+  darray_free(clusters, true);
+  darray_free(open, false);
+  boundary_release(&boundary);
+  darray_free(hull, false);
+  free(storage.points);
+  return true;
+
+oom:
+  free(positions);
+  free(points);
+  darray_free(clusters, true);
+  darray_free(open, false);
+  boundary_release(&boundary);
+  darray_free(hull, false);
+  free(storage.points);
+  return false;
+}
@@ -0,0 +1,55 @@
+#ifndef SCANLINES_H
+#define SCANLINES_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+#include "darray.h"
+#include "rectangles.h"
+
+// rows (or columns) between scanlines
+#define SCANLINE_STEP 8
+// a run may be off from its share of the pattern by this many modules, plus a
+// pixel for rounding
+#define SCANLINE_TOLERANCE 0.5
+// hits on consecutive scanlines that make a guard, and scanlines that may be
+// missed in between
+#define SCANLINE_MIN_HITS 3
+#define SCANLINE_MAX_GAP 2
+// how far off square to each other a start and a stop guard may be, as the
+// cosine of the angle between the start guard and the line to the stop guard
+#define SCANLINE_MAX_SKEW 0.2
+
+enum scanline_pattern {
+  SCANLINE_START, // 8-1-1-1-1-1-1-3, bar first
+  SCANLINE_STOP // 7-1-1-3-1-1-1-2(-1)
+};
+
+struct scanline_settings {
+  int step; // rows between scanlines, SCANLINE_STEP if 0
+  bool columns; // to scan columns too, for barcodes closer to upright than level
+  enum label_polarity polarity; // of the bars, LABEL_DARK or LABEL_LIGHT
+};
+
+// A start or stop pattern on one scanline, between begin and end along it.
+struct scanline_hit {
+  int line, begin, end;
+};
+
+// Hits of the same pattern, read the same way, on nearby scanlines.
+struct scanline_cluster {
+  enum scanline_pattern pattern;
+  bool reversed; // read right to left (or bottom to top)
+  bool vertical; // found on columns
+  int first_line, last_line;
+  double module; // mean width of a module
+  struct darray *hits;
+  struct rectangle rect; // fit to the hits once complete
+};
+
+static int scanline_runs(struct image1 *im, bool vertical, int line, bool light_bars, int *positions, bool *first_bar);
+static bool runs_match(const int *positions, int k, enum scanline_pattern pattern, bool reversed, double *module);
+static bool image1_locate_scanlines(struct image1 *im, struct scanline_settings *settings,
+                                    struct darray *rects, struct darray *pairs);
+
+#endif
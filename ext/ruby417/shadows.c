@@ -0,0 +1,143 @@
+#include <stdlib.h> // NULL
+#include <math.h> // sqrt, floor
+#include <stdbool.h>
+#include "shadows.h"
+
+// Widths of the boxes whose successive application approximates a Gaussian of
+// the given sigma, after Kovesi: odd widths, the narrower ones first.
+static void gaussian_boxes(double sigma, int passes, int *widths) {
+  double variance = 12*sigma*sigma;
+  int lower = (int) floor(sqrt(variance/passes + 1));
+
+  if (lower % 2 == 0) lower--;
+  int narrower = (int) floor((variance - passes*lower*lower - 4*passes*lower - 3*passes) / (-4*lower - 4) + 0.5);
+
+  for (int i = 0; i < passes; i++) widths[i] = i < narrower ? lower : lower + 2;
+}
+
+// Averages a box of odd width around each of n values, stride apart, with a
+// running sum, so the cost doesn't depend on the width. Values past the ends
+// repeat the nearest one.
+static void box_blur_line(const unsigned *src, unsigned *dst, int n, long stride, int width) {
+  int radius = width / 2;
+  unsigned sum = (radius + 1) * src[0];
+
+  for (int i = 1; i <= radius; i++) sum += src[(i < n ? i : n-1) * stride];
+  for (int i = 0; i < n; i++) {
+    int add = i + radius + 1, drop = i - radius;
+    dst[i*stride] = (sum + width/2) / width;
+    sum += src[(add < n ? add : n-1) * stride];
+    sum -= src[(drop > 0 ? drop : 0) * stride];
+  }
+}
+
+// Divides the image by an estimate of its background, evening out shadows and
+// uneven lighting. The background is the image averaged down, blurred and
+// scaled back up bilinearly, in 8.8 fixed point. With a threshold (0 to 255),
+// the quotient is binarized in the same pass, to 255 where it's at least the
+// threshold and 0 otherwise, without dividing at all. A negative threshold
+// leaves the quotient as gray levels. Returns false if out of memory.
+static bool image8_remove_shadows(struct image8 *im, int threshold,
+                                  void *(*malloc)(size_t size), void (*free)(void *ptr)) {
+  const int factor = SHADOW_DECIMATION;
+  int width = im->width, height = im->height;
+  int small_width = (width + factor - 1) / factor, small_height = (height + factor - 1) / factor;
+  long small_size = (long) small_width*small_height;
+  unsigned *small = NULL, *blurred = NULL, *row_background = NULL, *background = NULL;
+  int *columns = NULL, *column_weights = NULL;
+  int boxes[SHADOW_BOX_PASSES];
+
+  if (width == 0 || height == 0) return true;
+
+  if (!(small = malloc(sizeof(*small) * small_size))) goto oom;
+  if (!(blurred = malloc(sizeof(*blurred) * small_size))) goto oom;
+  if (!(row_background = malloc(sizeof(*row_background) * small_width))) goto oom;
+  if (!(background = malloc(sizeof(*background) * width))) goto oom;
+  if (!(columns = malloc(sizeof(*columns) * width))) goto oom;
+  if (!(column_weights = malloc(sizeof(*column_weights) * width))) goto oom;
+
+  // averaged down, blocks at the edges being partial
+  for (int sy = 0; sy < small_height; sy++) {
+    for (int sx = 0; sx < small_width; sx++) {
+      unsigned sum = 0, count = 0;
+      for (int y = sy*factor; y < sy*factor + factor && y < height; y++) {
+        for (int x = sx*factor; x < sx*factor + factor && x < width; x++, count++) {
+          sum += image8_get(im, x, y);
+        }
+      }
+      small[(long) sy*small_width + sx] = (256*sum + count/2) / count;
+    }
+  }
+
+  // blurred along rows then columns, ending up back in small
+  gaussian_boxes(SHADOW_SIGMA, SHADOW_BOX_PASSES, boxes);
+  for (int pass = 0; pass < SHADOW_BOX_PASSES; pass++) {
+    for (int sy = 0; sy < small_height; sy++) {
+      long offset = (long) sy*small_width;
+      box_blur_line(small + offset, blurred + offset, small_width, 1, boxes[pass]);
+    }
+    for (int sx = 0; sx < small_width; sx++) {
+      box_blur_line(blurred + sx, small + sx, small_height, small_width, boxes[pass]);
+    }
+  }
+
+  // the small pixels sit at the centers of their blocks
+  for (int x = 0; x < width; x++) {
+    int position = (2*x + 1 - factor) * 128 / factor;
+    if (position < 0) position = 0;
+    if (position > (small_width - 1) * 256) position = (small_width - 1) * 256;
+    columns[x] = position >> 8;
+    column_weights[x] = position & 255;
+  }
+
+  for (int y = 0; y < height; y++) {
+    unsigned char *row = im->data + (long) y*width;
+    int position = (2*y + 1 - factor) * 128 / factor;
+    if (position < 0) position = 0;
+    if (position > (small_height - 1) * 256) position = (small_height - 1) * 256;
+    int sy = position >> 8, weight = position & 255;
+    const unsigned *above = small + (long) sy*small_width,
+                   *below = weight ? above + small_width : above;
+
+    for (int sx = 0; sx < small_width; sx++) {
+      row_background[sx] = (above[sx]*(256 - weight) + below[sx]*weight + 128) >> 8;
+    }
+    for (int x = 0; x < width; x++) {
+      int sx = columns[x], w = column_weights[x];
+      unsigned right = w ? row_background[sx + 1] : row_background[sx],
+               level = (row_background[sx]*(256 - w) + right*w + 128) >> 8;
+      // a black background divides like a nearly black one, so that black
+      // stays black, whether binarized or not
+      background[x] = level ? level : 1;
+    }
+
+    // quotient of 255*pixel/background >= threshold, cross multiplied
+    if (threshold >= 0) {
+      for (int x = 0; x < width; x++) {
+        row[x] = 65280u*row[x] >= (unsigned) threshold*background[x] ? 255 : 0;
+      }
+    } else {
+      for (int x = 0; x < width; x++) {
+        float quotient = 65280.0f*row[x] / (float) background[x];
+        row[x] = quotient < 255 ? (unsigned char) (quotient + 0.5f) : 255;
+      }
+    }
+  }
+
+  free(small);
+  free(blurred);
+  free(row_background);
+  free(background);
+  free(columns);
+  free(column_weights);
+  return true;
+
+oom:
+  free(small);
+  free(blurred);
+  free(row_background);
+  free(background);
+  free(columns);
+  free(column_weights);
+  return false;
+}
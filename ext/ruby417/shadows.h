@@ -0,0 +1,20 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include "image.h"
+
+// The background is estimated like ImageMagick's "-sample 25% -blur 30x10
+// -resize 400%": at a quarter of the resolution, blurred with a sigma of 10
+// there (40 at full resolution).
+#define SHADOW_DECIMATION 4
+#define SHADOW_SIGMA 10.0
+#define SHADOW_BOX_PASSES 3
+
+static void gaussian_boxes(double sigma, int passes, int *widths);
+static void box_blur_line(const unsigned *src, unsigned *dst, int n, long stride, int width);
+static bool image8_remove_shadows(struct image8 *im, int threshold,
+                                  void *(*malloc)(size_t size), void (*free)(void *ptr));
+
+#endif
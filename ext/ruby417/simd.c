@@ -0,0 +1,142 @@
+#include <stdlib.h> // getenv
+#include <string.h> // strcmp
+#include "simd.h"
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Each kernel's body, compiled as is and, on x86, for AVX2 and AVX-512.
+// binarize_row has hand written variants instead.
+#define SIMD_PLAIN(name, params, args) \
+  static void name##_plain params { name args; }
+#if SIMD_X86
+#define SIMD_VARIANTS(name, params, args) \
+  SIMD_PLAIN(name, params, args) \
+  SIMD_TARGET_AVX2 static void name##_avx2 params { name args; } \
+  SIMD_TARGET_AVX512 static void name##_avx512 params { name args; }
+#else
+#define SIMD_VARIANTS SIMD_PLAIN
+#endif
+
+SIMD_PLAIN(binarize_row, (const unsigned char *src, uint64_t *dst, int width, unsigned char threshold),
+           (src, dst, width, threshold))
+SIMD_VARIANTS(convert_row, (const unsigned char *src, unsigned char *out, int width, enum pixel_format format),
+              (src, out, width, format))
+SIMD_VARIANTS(morph_rows, (unsigned char *dst, const unsigned char *a, const unsigned char *b, int n, bool max),
+              (dst, a, b, n, max))
+SIMD_VARIANTS(morph_words, (uint64_t *dst, const uint64_t *a, const uint64_t *b, int n, bool max),
+              (dst, a, b, n, max))
+SIMD_VARIANTS(relabel, (unsigned *labels, long n, const unsigned *roots), (labels, n, roots))
+SIMD_VARIANTS(neighborhood_row, (struct image1 *im, int y, unsigned char *dst), (im, y, dst))
+
+#if SIMD_X86
+// Compilers don't turn the bit packing of binarize_row into vector compares
+// and byte masks on their own, so each level does that explicitly for whole
+// words, leaving the last partial word to the plain loop. x >= t is max(x, t) == x.
+static void binarize_row_sse2(const unsigned char *src, uint64_t *dst, int width, unsigned char threshold) {
+  __m128i t = _mm_set1_epi8((char) threshold);
+  int i = 0;
+
+  for (; (i+1)*64 <= width; i++) {
+    uint64_t word = 0;
+    for (int b = 0; b < 4; b++) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (src + i*64 + b*16));
+      word |= (uint64_t) (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, t), v)) << b*16;
+    }
+    dst[i] = word;
+  }
+  if (i*64 < width) binarize_row(src + i*64, dst + i, width - i*64, threshold);
+}
+
+SIMD_TARGET_AVX2 static void binarize_row_avx2(const unsigned char *src, uint64_t *dst, int width,
+                                               unsigned char threshold) {
+  __m256i t = _mm256_set1_epi8((char) threshold);
+  int i = 0;
+
+  for (; (i+1)*64 <= width; i++) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *) (src + i*64)),
+            hi = _mm256_loadu_si256((const __m256i *) (src + i*64 + 32));
+    uint32_t low = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(lo, t), lo)),
+             high = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(hi, t), hi));
+    dst[i] = (uint64_t) high << 32 | low;
+  }
+  if (i*64 < width) binarize_row(src + i*64, dst + i, width - i*64, threshold);
+}
+
+SIMD_TARGET_AVX512 static void binarize_row_avx512(const unsigned char *src, uint64_t *dst, int width,
+                                                   unsigned char threshold) {
+  __m512i t = _mm512_set1_epi8((char) threshold);
+  int i = 0;
+
+  for (; (i+1)*64 <= width; i++) {
+    dst[i] = _mm512_cmpge_epu8_mask(_mm512_loadu_si512((const void *) (src + i*64)), t);
+  }
+  if (i*64 < width) binarize_row(src + i*64, dst + i, width - i*64, threshold);
+}
+#endif
+
+static struct simd_kernels simd = {
+  binarize_row_plain, convert_row_plain, morph_rows_plain, morph_words_plain, relabel_plain, neighborhood_row_plain
+};
+static enum simd_level simd_current = SIMD_NONE;
+
+static const char *simd_level_name(enum simd_level level) {
+  static const char *names[] = {"none", "sse2", "avx2", "avx512"};
+  return names[level];
+}
+
+static enum simd_level simd_supported_level(void) {
+#if SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  return SIMD_SSE2;
+#else
+  return SIMD_NONE;
+#endif
+}
+
+// Switches to the kernels of the given level, which the processor must support.
+static void simd_select(enum simd_level level) {
+  simd = (struct simd_kernels) {
+    binarize_row_plain, convert_row_plain, morph_rows_plain, morph_words_plain, relabel_plain, neighborhood_row_plain
+  };
+#if SIMD_X86
+  switch (level) {
+    case SIMD_NONE:
+      break;
+    case SIMD_SSE2:
+      // the plain kernels are already SSE2, which every x86-64 processor has
+      simd.binarize_row = binarize_row_sse2;
+      break;
+    case SIMD_AVX2:
+      simd = (struct simd_kernels) {
+        binarize_row_avx2, convert_row_avx2, morph_rows_avx2, morph_words_avx2, relabel_avx2, neighborhood_row_avx2
+      };
+      break;
+    case SIMD_AVX512:
+      simd = (struct simd_kernels) {
+        binarize_row_avx512, convert_row_avx512, morph_rows_avx512, morph_words_avx512, relabel_avx512,
+        neighborhood_row_avx512
+      };
+      break;
+  }
+#endif
+  simd_current = level;
+}
+
+// Picks the best kernels the processor supports, or those of the level named
+// by SIMD_ENV if lower. Returns the level picked.
+static enum simd_level simd_init(void) {
+  enum simd_level level = simd_supported_level();
+  const char *forced = getenv(SIMD_ENV);
+
+  if (forced) {
+    for (enum simd_level l = SIMD_NONE; l <= SIMD_AVX512; l++) {
+      if (!strcmp(forced, simd_level_name(l)) && l < level) level = l;
+    }
+  }
+
+  simd_select(level);
+  return level;
+}
@@ -0,0 +1,59 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h> // uint64_t
+#include <stdbool.h>
+#include "image.h"
+#include "color.h"
+
+// The hot row kernels are built once for each of these instruction sets, and
+// the best one the processor supports is picked when the library loads. The
+// environment variable forces a lower level (none, sse2, avx2 or avx512), for
+// benchmarking and debugging; a level the processor lacks falls back to the
+// best it has.
+#define SIMD_ENV "RUBY417_SIMD"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86 1
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define SIMD_X86 0
+#endif
+
+// Kernel bodies are inlined into each variant, so the compiler vectorizes them
+// for its instruction set.
+#define SIMD_INLINE static inline __attribute__((always_inline))
+
+enum simd_level {
+  SIMD_NONE, // plain C, as compiled
+  SIMD_SSE2,
+  SIMD_AVX2,
+  SIMD_AVX512 // with AVX-512BW
+};
+
+struct simd_kernels {
+  // packs the pixels of a row that are at least threshold into bits
+  void (*binarize_row)(const unsigned char *src, uint64_t *dst, int width, unsigned char threshold);
+  // converts a row of the given format to gray
+  void (*convert_row)(const unsigned char *src, unsigned char *out, int width, enum pixel_format format);
+  // dst[x] = max (or min) of a[x] and b[x], for gray and packed binary rows
+  void (*morph_rows)(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n, bool max);
+  void (*morph_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b, int n, bool max);
+  // replaces each label with its root
+  void (*relabel)(unsigned *labels, long n, const unsigned *roots);
+  // the neighborhood codes of row y, into dst
+  void (*neighborhood_row)(struct image1 *im, int y, unsigned char *dst);
+};
+
+// The kernels in use, plain C until simd_init picks others. Set once, before
+// any other thread runs, and only read after.
+static struct simd_kernels simd;
+static enum simd_level simd_current;
+
+static const char *simd_level_name(enum simd_level level);
+static enum simd_level simd_supported_level(void);
+static void simd_select(enum simd_level level);
+static enum simd_level simd_init(void);
+
+#endif
@@ -0,0 +1,131 @@
+// A standalone batch localizer, built alongside the extension:
+//
+//   ruby417-locate [-j THREADS] [-p none|half|full] [-s lax|basic|strict] [-r] [-f]
+//                  [-m] [-l LIST] [PATH...]
+//
+// Locates barcodes in binary PGM and PPM images, given as paths, directories
+// (searched recursively, without following links to directories) or lists of
+// paths, one per line, read from stdin when nothing else is given. Writes a
+// JSON line per image, and the totals to stderr when done. -f skips the tiles
+// of each image that can't hold guards, and -m screens regions by their
+// moments before tracing them.
+#undef BUILD_RUBY_EXT
+#include <stdio.h>
+#include <stdlib.h> // strtol
+#include <string.h>
+#include <time.h>
+#include <unistd.h> // getopt, sysconf
+#include "ruby417.c"
+#include "ruby417/daemon.c"
+#include "ruby417/batch.c"
+
+// Configuration's settings for each strictness.
+static const struct {
+  const char *name;
+  double area_fraction, rectangularity, angle, area_variation, width_variation, height_variation;
+  int guard_aspect_min, guard_aspect_max, barcode_aspect_min, barcode_aspect_max;
+} strictnesses[] = {
+  {"lax", 0.0003, 0.5, M_PI/8, 0.5, 0.5, 0.2, 2, 50, 1, 20},
+  {"basic", 0.0007, 0.8, M_PI/16, 0.4, 0.3, 0.1, 3, 40, 2, 10},
+  {"strict", 0.001, 0.9, M_PI/32, 0.2, 0.2, 0.05, 3, 40, 3, 10}
+};
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-j THREADS] [-p none|half|full] [-s lax|basic|strict] [-r] [-f] [-m] [-l LIST] [PATH...]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  struct darray *paths = darray_new(0, free, malloc, realloc, free);
+  struct batch_settings settings = {.threads = 1};
+  struct batch_stats stats;
+  struct timespec start, end;
+  int strictness = 1, preprocessing = DAEMON_PREPROCESS_FULL, flags = 0, option;
+  bool listed = false;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  settings.threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (!paths) goto oom;
+
+  while ((option=getopt(argc, argv, "j:p:s:rfml:")) != -1) {
+    switch (option) {
+      case 'j':
+        if ((settings.threads=strtol(optarg, NULL, 10)) < 1) usage(argv[0]);
+        break;
+      case 'p':
+        if (!strcmp(optarg, "none")) preprocessing = DAEMON_PREPROCESS_NONE;
+        else if (!strcmp(optarg, "half")) preprocessing = DAEMON_PREPROCESS_HALF;
+        else if (!strcmp(optarg, "full")) preprocessing = DAEMON_PREPROCESS_FULL;
+        else usage(argv[0]);
+        break;
+      case 's':
+        for (strictness = 0; strictness < 3 && strcmp(optarg, strictnesses[strictness].name); strictness++);
+        if (strictness == 3) usage(argv[0]);
+        break;
+      case 'r':
+        flags |= DAEMON_INVERT;
+        break;
+      case 'f':
+        flags |= DAEMON_PREFILTER;
+        break;
+      case 'm':
+        flags |= DAEMON_FAST_FIT;
+        break;
+      case 'l': {
+        FILE *list = strcmp(optarg, "-") ? fopen(optarg, "r") : stdin;
+        if (!list) {
+          fprintf(stderr, "%s: unable to open %s\n", argv[0], optarg);
+          return 1;
+        }
+        if (!batch_read_list(list, paths)) goto oom;
+        if (list != stdin) fclose(list);
+        listed = true;
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    if (!batch_collect(argv[i], paths)) goto oom;
+  }
+  if (optind == argc && !listed && !batch_read_list(stdin, paths)) goto oom;
+
+  simd_init();
+  settings.request = (struct daemon_request) {
+    .magic = DAEMON_MAGIC,
+    .preprocessing = preprocessing,
+    .flags = flags,
+    .rectangularity_threshold = strictnesses[strictness].rectangularity,
+    .angle_variation_threshold = strictnesses[strictness].angle,
+    .area_variation_threshold = strictnesses[strictness].area_variation,
+    .width_variation_threshold = strictnesses[strictness].width_variation,
+    .height_variation_threshold = strictnesses[strictness].height_variation,
+    .guard_aspect_min = strictnesses[strictness].guard_aspect_min,
+    .guard_aspect_max = strictnesses[strictness].guard_aspect_max,
+    .barcode_aspect_min = strictnesses[strictness].barcode_aspect_min,
+    .barcode_aspect_max = strictnesses[strictness].barcode_aspect_max
+  };
+  settings.area_fraction = strictnesses[strictness].area_fraction;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!batch_run(paths, &settings, stdout, &stats)) {
+    fprintf(stderr, "%s: unable to start workers\n", argv[0]);
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  if (seconds <= 0) seconds = 1e-9;
+  fprintf(stderr, "%ld images (%ld failed), %ld barcodes in %.2fs: %.1f images/s, %.1f MB/s\n",
+          stats.images, stats.failures, stats.barcodes, seconds,
+          stats.images / seconds, stats.bytes / seconds / 1e6);
+
+  darray_free(paths, true);
+  return 0;
+
+oom:
+  fprintf(stderr, "%s: out of memory\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,42 @@
+// A standalone localization daemon, built alongside the extension:
+//
+//   ruby417d SOCKET_PATH [WORKERS]
+//
+// See ruby417/daemon.h for the protocol, and Ruby417::Localization::Client.
+#undef BUILD_RUBY_EXT
+#include <stdio.h>
+#include <stdlib.h> // strtol
+#include <string.h> // strerror
+#include <errno.h>
+#include <unistd.h> // sysconf
+#include "ruby417.c"
+#include "ruby417/daemon.c"
+
+int main(int argc, char **argv) {
+  long workers = 1;
+  int listener;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s SOCKET_PATH [WORKERS]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 3 && (workers=strtol(argv[2], NULL, 10)) < 1) {
+    fprintf(stderr, "%s: workers should be a positive number, got %s\n", argv[0], argv[2]);
+    return 2;
+  }
+
+  simd_init();
+  if ((listener=daemon_listen(argv[1])) < 0) {
+    fprintf(stderr, "%s: unable to listen on %s: %s\n", argv[0], argv[1], strerror(errno));
+    return 1;
+  }
+  if (!daemon_serve(listener, workers > DAEMON_MAX_WORKERS ? DAEMON_MAX_WORKERS : (int) workers)) {
+    fprintf(stderr, "%s: unable to start workers\n", argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
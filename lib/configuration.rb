@@ -2,16 +2,63 @@ module Ruby417
   class Configuration
     extend Utils::AttrMethods
 
-    attr_accessor_with_default :localization_method, :guards # (perhaps :hough, :morphology in the future)
+    attr_accessor_with_default :localization_method, :guards # or :morphology, :scanlines (perhaps :hough in the future)
 
     attr_accessor_with_default :localization_strictness, :basic # :lax, :strict
 
     attr_accessor_with_default :localization_preprocessing, :full # :none, :half, :full
 
+    # Thresholds (0 to 1) to binarize at, concurrently, instead of ImageMagick's
+    # single 50% threshold, e.g. [0.35, 0.5, 0.65] for uneven lighting.
+    attr_accessor_with_default :localization_thresholds, nil
+
+    # Whether barcodes are printed dark on light, or reversed (:light).
+    attr_accessor_with_default :localization_polarity, :dark
+
+    # Whether to label only the tiles of the image that could hold guards, as
+    # judged from cheap statistics (long runs of dark pixels), skipping most of
+    # a page of text. Guards much thinner than they're tall, at angles between
+    # the vertical, horizontal and diagonals, can be missed.
+    attr_accessor_with_default :localization_prefilter, false
+
+    # How guards are fit with rectangles: :exact traces every region's contour
+    # and fits its convex hull, :fast pairs rectangles fit to each region's
+    # moments first, and fits exactly only the regions in those pairs.
+    attr_accessor_with_default :localization_fitting, :exact
+
+    # Rows (and columns) between the scanlines Localization::Scanlines reads,
+    # and whether it reads columns as well, for barcodes closer to upright.
+    attr_accessor_with_default :localization_scanline_step, 8
+    attr_accessor_with_default :localization_scanline_columns, true
+
+    attr_accessor_with_default :rectified_module_size, 3 # pixels per module, 1 to 16
+
+    # Bytes each native call may allocate at once before giving up with
+    # MemoryBudgetError, or nil for no limit.
+    attr_accessor_with_default :memory_budget, nil
+
+    # Every setting localization results depend on, as a string, for caching
+    # them.
+    def localization_fingerprint
+      settings = self.class.public_instance_methods(false).grep(/\Alocalization_\w+\z/)
+      settings.select { |s| method(s).arity.zero? && s != :localization_fingerprint }.sort
+              .push(:rectified_module_size).map { |s| "#{s}=#{public_send(s).inspect}" }.join(";")
+    end
+
     attr_accessor_with_calc :localization_guard_area_threshold do
       { lax: 0.0003, basic: 0.0007, strict: 0.001 }[localization_strictness]
     end
 
+    # The guard area threshold in pixels for an image of the given size, the
+    # configured one being a fraction of the image's area if under 1.
+    def localization_guard_area(width, height)
+      if localization_guard_area_threshold.between?(0, 1)
+        (localization_guard_area_threshold * width * height).to_i
+      else
+        localization_guard_area_threshold
+      end
+    end
+
     attr_accessor_with_calc :localization_guard_aspect do
       { lax: 2..50, basic: 3..40, strict: 3..40 }[localization_strictness]
     end
@@ -42,12 +89,25 @@ module Ruby417
   end
 
   class << self
+    # Other Ractors can only read the configuration once it's shared, with
+    # share_configuration.
     def configuration
       @configuration ||= Configuration.new
+    rescue Ractor::IsolationError
+      raise Ractor::IsolationError, "call Ruby417.share_configuration before localizing in other Ractors"
     end
 
     def configure
       yield configuration
     end
+
+    # Deeply freezes the configuration, so that every Ractor can use it, e.g.
+    # to localize images in parallel with Localization::Guards#run_pixels. It
+    # can't be changed after, but can be replaced from the main Ractor.
+    def share_configuration
+      @configuration = Ractor.make_shareable(configuration)
+    end
+
+    attr_writer :configuration
   end
 end
@@ -0,0 +1,88 @@
+module Ruby417
+  module Localization
+    # Results of localization kept by a digest of the input and of the settings
+    # that affect them, for pipelines that see the same images again (retries,
+    # re-exports, duplicate uploads). The most recently used results are kept
+    # in memory, and with a path, located corners and scores are also kept in a
+    # file shared by every process that opens it, surviving restarts.
+    #
+    #   cache = Ruby417::Localization::Cache.new(capacity: 512, path: "/var/cache/ruby417")
+    #   scanner = Ruby417::Localization::Guards.new(config, cache: cache)
+    #
+    # Counting the hits and misses helps size it.
+    class Cache
+      attr_reader :capacity, :hits, :disk_hits, :misses
+
+      def initialize(capacity: 1024, path: nil, disk_slots: 65_536)
+        @capacity = capacity
+        @entries = {}
+        @disk = path && Ruby417::Ext::ResultCache.new(path, disk_slots)
+        @hits = @disk_hits = @misses = 0
+        @lock = Mutex.new
+      end
+
+      # The barcodes cached under key ([digest of the input, digest of the
+      # settings]), or else those the block locates, which are cached. Only
+      # persisted results go to the file, since it can't hold decoded symbols or
+      # rectified images. The cache keeps copies of its own, so callers are free
+      # to change the barcodes they get.
+      def fetch(key, persist: true)
+        barcodes = @lock.synchronize do
+          if (barcodes = @entries.delete(key))
+            @hits += 1
+            @entries[key] = barcodes
+          elsif persist && @disk && (data = @disk.fetch(*key))
+            @disk_hits += 1
+            remember(key, data.map { |d| barcode(d) })
+          end
+        end
+        return barcodes.map(&:dup) if barcodes
+
+        barcodes = yield
+        @lock.synchronize do
+          @misses += 1
+          @disk.store(*key, barcodes.map { |b| corners(b) }) if persist && @disk
+          remember(key, barcodes.map(&:dup))
+        end
+        barcodes
+      end
+
+      def size
+        @lock.synchronize { @entries.size }
+      end
+
+      # The counts of this cache, and those of the file across every process.
+      def stats
+        @lock.synchronize do
+          {hits: hits, disk_hits: disk_hits, misses: misses, size: @entries.size, disk: @disk&.stats}
+        end
+      end
+
+      def clear
+        @lock.synchronize { @entries.clear }
+      end
+
+      def close
+        @disk&.close
+        @disk = nil
+      end
+
+      private
+
+      def remember(key, barcodes)
+        @entries[key] = barcodes.freeze
+        @entries.shift while @entries.size > capacity
+        barcodes
+      end
+
+      def barcode(data)
+        LocatedBarcode.new(data[0], *data[1..].each_slice(2).map { |x, y| Point.new(x, y) })
+      end
+
+      def corners(barcode)
+        points = [barcode.upper_left, barcode.lower_left, barcode.lower_right, barcode.upper_right]
+        [barcode.score, *points.flat_map { |p| [p.x, p.y] }]
+      end
+    end
+  end
+end
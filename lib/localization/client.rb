@@ -0,0 +1,153 @@
+require "mini_magick"
+require "socket"
+require "tmpdir"
+
+module Ruby417
+  module Localization
+    # Locates barcodes through a ruby417d daemon, built alongside the extension
+    # (see ext/ruby417/daemon.h), instead of in process. Pixels are handed over
+    # in a shared memory file that the daemon maps, rather than copied over the
+    # socket, and the connection is kept open between runs, reopened once the
+    # daemon has closed it for being idle. Like Guards, but only locating, and
+    # at a single threshold. A client isn't thread safe; give each thread its
+    # own.
+    class Client
+      class Error < StandardError; end
+      class Disconnected < Error; end
+      private_constant :Disconnected
+
+      MAGIC = 0x52343137
+      REQUEST = "LLllLLqdddddllll".freeze
+      RESPONSE = "LLLL".freeze
+      RESPONSE_SIZE = 16
+      BARCODE = "dl8".freeze
+      BARCODE_SIZE = 40
+
+      INVERT = 1
+      PREFILTER = 2
+      FAST_FIT = 4
+
+      FORMATS = %i[gray rgb rgba bgra nv12 yuyv].freeze
+      PREPROCESSING = %i[none half full].freeze
+      STATUSES = [nil, "bad request".freeze, "out of memory".freeze].freeze
+
+      # tmpfs, where there is one, so the pixels never touch a disk
+      SHARED_MEMORY_DIR = (File.directory?("/dev/shm") ? "/dev/shm" : Dir.tmpdir).freeze
+
+      attr_reader :socket_path, :config
+
+      def initialize(socket_path, config=Ruby417.configuration)
+        @socket_path = socket_path
+        @config = config
+      end
+
+      # Decoding the image file is still ImageMagick's; preprocessing is the
+      # daemon's.
+      def run(path)
+        image = MiniMagick::Image.open(path)
+        pixels = MiniMagick::Tool::Convert.new.yield_self do |convert|
+          convert << path
+          convert.colorspace "Gray"
+          convert.depth 8
+          convert << "gray:-"
+
+          MiniMagick::Shell.new.run(convert.command)
+        end.first
+
+        run_pixels(pixels, image.width, image.height)
+      end
+
+      # Like Guards#run_pixels, for the same formats.
+      def run_pixels(data, width, height, format: :gray)
+        raise ArgumentError, "unknown pixel format #{format.inspect}" unless FORMATS.include?(format)
+        if config.localization_thresholds
+          raise ArgumentError, "the daemon binarizes at a single threshold"
+        end
+
+        # the daemon closes idle connections, so one kept from an earlier run
+        # may have gone stale; requests are safe to send again on a new one
+        reused = !@socket.nil?
+        begin
+          exchange(data, width, height, format)
+        rescue Disconnected
+          raise Error, "lost the connection to #{socket_path}" unless reused
+          reused = false
+          retry
+        end
+      end
+
+      def close
+        @socket&.close
+        @shared_memory&.close
+        @socket = @shared_memory = nil
+      end
+
+      private
+
+      def exchange(data, width, height, format)
+        shared_memory.truncate(0)
+        shared_memory.pwrite(data, 0)
+        socket.send_io(shared_memory)
+        socket.write(request(width, height, format).pack(REQUEST))
+
+        magic, status, count = read(RESPONSE_SIZE).unpack(RESPONSE)
+        raise Error, "unexpected response from #{socket_path}" unless magic == MAGIC
+        raise NoMemoryError, "daemon out of memory" if STATUSES[status] == "out of memory"
+        raise Error, "daemon refused the request: #{STATUSES[status] || status}" if status != 0
+
+        read(BARCODE_SIZE * count).unpack(BARCODE * count).each_slice(9).map do |score, *corners|
+          points = corners.each_slice(2).map { |x, y| Point.new(x, y) }
+          LocatedBarcode.new(score, *points)
+        end
+      rescue Errno::EPIPE, Errno::ECONNRESET
+        close
+        raise Disconnected
+      end
+
+      def socket
+        @socket ||= UNIXSocket.new(socket_path)
+      end
+
+      # Reused between runs, and never linked into the file system, so nothing
+      # is left behind.
+      def shared_memory
+        @shared_memory ||= if defined?(File::TMPFILE)
+          File.open(SHARED_MEMORY_DIR, File::RDWR | File::TMPFILE, 0600)
+        else
+          path = File.join(SHARED_MEMORY_DIR, "ruby417-#{Process.pid}-#{object_id}")
+          File.open(path, File::RDWR | File::CREAT | File::EXCL, 0600).tap { File.unlink(path) }
+        end
+      end
+
+      def request(width, height, format)
+        [
+          MAGIC,
+          FORMATS.index(format),
+          width, height,
+          PREPROCESSING.index(config.localization_preprocessing),
+          (config.localization_polarity == :light ? INVERT : 0) | (config.localization_prefilter ? PREFILTER : 0) |
+            (config.localization_fitting == :fast ? FAST_FIT : 0),
+          config.localization_guard_area(width, height),
+          config.localization_guard_rectangularity_threshold,
+          config.localization_angle_variation_threshold,
+          config.localization_guard_area_variation_threshold,
+          config.localization_guard_width_variation_threshold,
+          config.localization_guard_height_variation_threshold,
+          config.localization_guard_aspect.min,
+          config.localization_guard_aspect.max,
+          config.localization_barcode_aspect.min,
+          config.localization_barcode_aspect.max
+        ]
+      end
+
+      def read(size)
+        data = socket.read(size)
+        if data.nil? || data.bytesize < size
+          close
+          raise Disconnected
+        end
+        data
+      end
+    end
+  end
+end
@@ -8,25 +8,93 @@ module Ruby417
     # truncated barcodes (which have only the left edge guard) or barcodes with
     # severely damaged edge guards.
     class Guards
-      attr_reader :config
+      attr_reader :config, :cache
 
-      def initialize(config=Ruby417.configuration)
+      # With a Localization::Cache, images seen before aren't localized again.
+      def initialize(config=Ruby417.configuration, cache: nil)
         @config = config
+        @cache = cache
       end
 
-      def run(path)
-        image = MiniMagick::Image.open(path)
-        pixels = preprocess_image(path)
+      # With decode set, the codewords of each barcode are read as well, in the
+      # same native call, from the image as thresholded but not closed, since
+      # closing erases the narrow bars. With rectify set, each barcode also
+      # comes with a straightened grayscale image of itself, warped from the
+      # preprocessed image before thresholding.
+      #
+      # With localization_thresholds configured, the grayscale image is
+      # binarized at each threshold natively, on as many threads, and barcodes
+      # found at several are reported once. Decoding and rectifying aren't
+      # available that way.
+      def run(path, decode: false, rectify: false)
+        check_options(decode, rectify)
+        Ruby417::Ext.memory_budget = config.memory_budget
+        Ruby417::Ext.prefilter = config.localization_prefilter
+        Ruby417::Ext.fast_fit = config.localization_fitting == :fast
 
-        if config.localization_guard_area_threshold.between?(0, 1)
-          guard_area_threshold = (config.localization_guard_area_threshold * image.width * image.height).to_i
-        else
-          guard_area_threshold = config.localization_guard_area_threshold
+        cached(cache && File.binread(path), decode, rectify) do
+          image = MiniMagick::Image.open(path)
+          pixels = preprocess_image(path, image.width, image.height, threshold: threshold_first?(decode, rectify))
+
+          locate(pixels, image.width, image.height, decode, rectify)
         end
+      end
+
+      # Like run, but for an image already in memory, such as a camera frame:
+      # packed :gray, :rgb, :rgba or :bgra pixels, or a :nv12 or :yuyv frame.
+      # Preprocessing is done entirely natively.
+      def run_pixels(data, width, height, format: :gray, decode: false, rectify: false)
+        check_options(decode, rectify)
+        Ruby417::Ext.memory_budget = config.memory_budget
+        Ruby417::Ext.prefilter = config.localization_prefilter
+        Ruby417::Ext.fast_fit = config.localization_fitting == :fast
+
+        cached(cache && data, decode, rectify, width, height, format) do
+          pixels = Ruby417::Ext.luma(data, width, height, format, config.localization_preprocessing != :none)
+          pixels = invert(pixels) if config.localization_polarity == :light
+          if config.localization_preprocessing == :full
+            pixels = remove_shadows(pixels, width, height, threshold: threshold_first?(decode, rectify))
+          end
+
+          locate(pixels, width, height, decode, rectify)
+        end
+      end
 
-        barcode_data = Ruby417::Ext.locate_via_guards(
-          pixels, image.width, image.height,
-          guard_area_threshold,
+      # The most memory, in bytes, held at once by the native localization call
+      # of the last run on this thread.
+      def peak_memory
+        Ruby417::Ext.peak_memory
+      end
+
+      # Looks the results up in the cache, if there is one, by the input's bytes
+      # and everything else they depend on.
+      def cached(data, decode, rectify, *details)
+        return yield unless cache
+
+        settings = [self.class.name, config.localization_fingerprint, decode, rectify, *details].join(":")
+        key = [Ruby417::Ext.digest(data), Ruby417::Ext.digest(settings)]
+        cache.fetch(key, persist: !decode && !rectify) { yield }
+      end
+
+      # Whether preprocessing thresholds the image, rather than leaving that to
+      # the native call: at several levels, or to keep the gray levels for
+      # rectifying and the narrow bars for decoding.
+      def threshold_first?(decode, rectify)
+        !(config.localization_thresholds || decode || rectify)
+      end
+
+      def check_options(decode, rectify)
+        if config.localization_thresholds && (decode || rectify)
+          raise ArgumentError, "decoding and rectifying need a single threshold"
+        end
+      end
+
+      def locate(pixels, width, height, decode, rectify)
+        thresholds = config.localization_thresholds
+
+        arguments = [
+          pixels, width, height,
+          config.localization_guard_area(width, height),
           config.localization_guard_rectangularity_threshold,
           config.localization_angle_variation_threshold,
           config.localization_guard_area_variation_threshold,
@@ -36,7 +104,19 @@ module Ruby417
           config.localization_guard_aspect.max,
           config.localization_barcode_aspect.min,
           config.localization_barcode_aspect.max
-        )
+        ]
+
+        close = config.localization_preprocessing == :full
+        barcode_data = if thresholds
+          levels = thresholds.map { |t| (t * 255).round }
+          Ruby417::Ext.locate_via_guards_levels(*arguments, levels, close)
+        elsif rectify
+          Ruby417::Ext.rectify_via_guards(*arguments, config.rectified_module_size, decode, close)
+        elsif decode
+          Ruby417::Ext.decode_via_guards(*arguments, close)
+        else
+          Ruby417::Ext.locate_via_guards(*arguments)
+        end
 
         barcode_data.map do |data|
           LocatedBarcode.new(
@@ -44,14 +124,17 @@ module Ruby417
             Point.new(data[1], data[2]),
             Point.new(data[3], data[4]),
             Point.new(data[5], data[6]),
-            Point.new(data[7], data[8])
+            Point.new(data[7], data[8]),
+            data[9],
+            data[10] && RectifiedImage.new(*data[10])
           )
         end
       end
 
-      # Perform preprocessing and get image pixel data
-      def preprocess_image(path)
-        MiniMagick::Tool::Convert.new.yield_self do |convert|
+      # Perform preprocessing and get image pixel data. Without threshold, the
+      # image is left in grayscale, and closing it is left to the caller.
+      def preprocess_image(path, width, height, threshold: true)
+        pixels = MiniMagick::Tool::Convert.new.yield_self do |convert|
           convert << path
 
           if config.localization_preprocessing != :none
@@ -59,24 +142,8 @@ module Ruby417
             convert.colorspace "Gray"
             convert.normalize
 
-            if config.localization_preprocessing == :full
-              # try to reduce shadows (based on https://legacy.imagemagick.org/Usage/compose/#divide)
-              convert.stack do |stack|
-                convert.clone 0
-                convert.sample "25%"
-                convert.blur "30x10"
-                convert.resize "400%"
-              end
-              convert.compose "DivideSrc"
-              convert.composite
-
-              # remove short vertical features
-              convert.morphology "Close", "3x6: 1,-,1 1,-,1 1,-,1 1,-,1 1,-,1 1,-,1"
-              # remove small features and flaws
-              convert.morphology "Close:3", "Square:1"
-            end
-
-            convert.threshold "50%"
+            # full preprocessing thresholds natively, after removing shadows
+            convert.threshold "50%" if threshold && config.localization_preprocessing == :half
           end
 
           convert.depth 8
@@ -84,6 +151,41 @@ module Ruby417
 
           MiniMagick::Shell.new.run(convert.command)
         end.first
+        pixels = invert(pixels) if config.localization_polarity == :light
+
+        if config.localization_preprocessing == :full
+          pixels = remove_shadows(pixels, width, height, threshold: threshold)
+        end
+
+        pixels
+      end
+
+      # Divides the image by its blurred background, like ImageMagick's divide
+      # composition (https://legacy.imagemagick.org/Usage/compose/#divide), but
+      # natively and fused with thresholding. Morphology commutes with
+      # thresholding, so features are closed on the binary image afterwards.
+      def remove_shadows(pixels, width, height, threshold: true)
+        pixels = Ruby417::Ext.remove_shadows(pixels, width, height, threshold ? 128 : nil)
+        threshold ? close_features(pixels, width, height) : pixels
+      end
+
+      BYTES = (0..255).map(&:chr).join.b.freeze
+      # String#tr has no descending ranges, so the inverse is spelled out, with
+      # the characters it treats specially escaped
+      INVERTED_BYTES = BYTES.reverse.gsub(/[\-\\^]/n) { "\\#{$&}" }.freeze
+
+      # Reversed symbols are inverted up front, so that the guards are dark like
+      # everything downstream expects. The native labeler only builds regions
+      # from dark pixels.
+      def invert(pixels)
+        pixels.tr("\x00-\xff".b, INVERTED_BYTES)
+      end
+
+      def close_features(pixels, width, height)
+        # remove short vertical features
+        pixels = Ruby417::Ext.morphology(pixels, width, height, :close, 3, 6, true)
+        # remove small features and flaws (equivalent to Close:3 Square:1)
+        Ruby417::Ext.morphology(pixels, width, height, :close, 7, 7, false)
       end
     end
   end
@@ -1,2 +1,6 @@
 require_relative "located_barcode"
 require_relative "guards"
+require_relative "morphology"
+require_relative "scanlines"
+require_relative "client"
+require_relative "cache"
@@ -3,12 +3,34 @@ module Ruby417
     class LocatedBarcode
       attr_reader :upper_left, :lower_left, :lower_right, :upper_right, :score
 
-      def initialize(score, upper_left, lower_left, lower_right, upper_right)
+      # Rows of codewords (0 to 928), top row first and including the left and
+      # right row indicators, if the barcode was decoded, with nil where one
+      # couldn't be read. Rows are placed by their indicators, so a row that
+      # couldn't be read at all is a row of nils. The data and error correction
+      # codewords can go straight to Ruby417::Ext.correct_codewords.
+      attr_reader :symbols
+
+      # A straightened image of the barcode, if it was rectified.
+      attr_reader :rectified
+
+      def initialize(score, upper_left, lower_left, lower_right, upper_right, symbols=nil, rectified=nil)
         @upper_left  = upper_left
         @lower_left  = lower_left
         @lower_right = lower_right
         @upper_right = upper_right
         @score = score
+        @symbols = symbols
+        @rectified = rectified
+      end
+
+      # Copies are deep, so changing a copy's corners or symbols leaves the
+      # original as it was.
+      def initialize_copy(other)
+        super
+        @upper_left, @lower_left, @lower_right, @upper_right =
+          [upper_left, lower_left, lower_right, upper_right].map(&:dup)
+        @symbols = symbols&.map(&:dup)
+        @rectified = rectified&.dup
       end
 
       def width
@@ -20,6 +42,25 @@ module Ruby417
       end
     end
 
+    # 8-bit grayscale pixels, warped from the preprocessed image before it was
+    # thresholded, row by row, with the barcode's start pattern on the left when
+    # it's known which way up the barcode is (i.e. it was decoded).
+    # Module n spans columns module_size*(n + 11) and on, the 11 modules on
+    # either side leaving room for the rest of the stop pattern, and the
+    # barcode starts 2 modules from the top.
+    class RectifiedImage
+      attr_reader :pixels, :width, :height
+
+      def initialize(pixels, width, height)
+        @pixels, @width, @height = pixels, width, height
+      end
+
+      def initialize_copy(other)
+        super
+        @pixels = pixels.dup
+      end
+    end
+
     class Point
       attr_accessor :x, :y
 
@@ -0,0 +1,62 @@
+require "mini_magick"
+
+module Ruby417
+  module Localization
+    # This method finds the bars themselves rather than the edge guards: it
+    # marks the parts of the image with strong, parallel edges, closes them
+    # into blobs and fits each with a rectangle. It works at a quarter of the
+    # resolution, so it is fast, and it handles truncated barcodes and damaged
+    # guards. But its corners are only good to within several pixels, and
+    # anything else with long parallel edges, like ruled lines, is found too.
+    class Morphology
+      attr_reader :config
+
+      def initialize(config=Ruby417.configuration)
+        @config = config
+      end
+
+      def run(path)
+        Ruby417::Ext.memory_budget = config.memory_budget
+
+        image = MiniMagick::Image.open(path)
+        pixels = MiniMagick::Tool::Convert.new.yield_self do |convert|
+          convert << path
+          convert.colorspace "Gray"
+          convert.normalize if config.localization_preprocessing != :none
+          convert.depth 8
+          convert << "gray:-"
+
+          MiniMagick::Shell.new.run(convert.command)
+        end.first
+
+        locate(pixels, image.width, image.height)
+      end
+
+      # Like Guards#run_pixels, for the same formats. Gradients don't depend on
+      # polarity, so reversed barcodes are found without inverting.
+      def run_pixels(data, width, height, format: :gray)
+        Ruby417::Ext.memory_budget = config.memory_budget
+
+        pixels = Ruby417::Ext.luma(data, width, height, format, config.localization_preprocessing != :none)
+        locate(pixels, width, height)
+      end
+
+      def peak_memory
+        Ruby417::Ext.peak_memory
+      end
+
+      # A barcode is taken to be at least a few times the area of a guard.
+      def locate(pixels, width, height)
+        Ruby417::Ext.locate_via_gradients(
+          pixels, width, height,
+          4 * config.localization_guard_area(width, height),
+          config.localization_barcode_aspect.min,
+          config.localization_barcode_aspect.max
+        ).map do |score, *corners|
+          points = corners.each_slice(2).map { |x, y| Point.new(x, y) }
+          LocatedBarcode.new(score, *points)
+        end
+      end
+    end
+  end
+end
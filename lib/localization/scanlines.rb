@@ -0,0 +1,32 @@
+require_relative "guards"
+
+module Ruby417
+  module Localization
+    # This method reads the start and stop patterns along every few rows (and
+    # columns) of the thresholded image, and fits guards to where they line up,
+    # without labeling the image at all. It is much faster than Guards when a
+    # barcode is there, but its modules must be a few pixels wide to be read
+    # on a single scanline, and both patterns must be intact.
+    class Scanlines < Guards
+      def check_options(decode, rectify)
+        raise ArgumentError, "scanline localization only locates" if decode || rectify
+      end
+
+      def locate(pixels, width, height, _decode, _rectify)
+        Ruby417::Ext.locate_via_scanlines(
+          pixels, width, height,
+          config.localization_scanline_step,
+          config.localization_scanline_columns
+        ).map do |score, *corners|
+          points = corners.each_slice(2).map { |x, y| Point.new(x, y) }
+          LocatedBarcode.new(score, *points)
+        end
+      end
+
+      # Closing would fill the narrow spaces of the patterns.
+      def close_features(pixels, _width, _height)
+        pixels
+      end
+    end
+  end
+end
@@ -2,10 +2,10 @@ module Ruby417
   module Utils
     module AttrMethods
       def attr_reader_with_default(option, default)
-        define_method(option) do
+        define_method(option, &shareable(proc do
           val = instance_variable_get("@#{option}")
           val.nil? ? default : val
-        end
+        end))
       end
 
       def attr_accessor_with_default(option, default)
@@ -14,16 +14,25 @@ module Ruby417
       end
 
       def attr_reader_with_calc(option, &block)
-        define_method(option) do
+        block = shareable(block)
+        define_method(option, &shareable(proc do
           val = instance_variable_get("@#{option}")
           val.nil? ? instance_exec(&block) : val
-        end
+        end))
       end
 
       def attr_accessor_with_calc(option, &block)
         attr_writer option
         attr_reader_with_calc option, &block
       end
+
+      private
+
+      # Methods defined from plain blocks can only be called in the Ractor that
+      # defined them.
+      def shareable(block)
+        defined?(Ractor) ? Ractor.make_shareable(block) : block
+      end
     end
   end
 end
@@ -1,5 +1,6 @@
 require "spec_helper"
 require "open3"
+require "tmpdir"
 
 RSpec.describe Ext do
   describe ".locate_via_guards" do
@@ -15,6 +16,320 @@ RSpec.describe Ext do
     end
   end
 
+  describe ".decode_via_guards" do
+    let(:args) { [File.read("spec/fixtures/256x256_assorted_rectangles.raw"), 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    it "locates the same barcodes and appends the symbol rows read from each" do
+      located = Ext.locate_via_guards(*args)
+      decoded = Ext.decode_via_guards(*args, false)
+
+      expect(decoded.map { |code| code[0..8] }).to eq(located)
+      # plain rectangles have no start or stop patterns to read
+      expect(decoded.map(&:last)).to all(eq([]))
+    end
+
+    it "locates in the image closed as full preprocessing does" do
+      closed = Ext.morphology(Ext.morphology(args[0], 256, 256, :close, 3, 6, true), 256, 256, :close, 7, 7, false)
+      located = Ext.locate_via_guards(closed, *args[1..])
+
+      expect(Ext.decode_via_guards(*args, true).map { |code| code[0..8] }).to eq(located)
+    end
+  end
+
+  describe ".rectify_via_guards" do
+    let(:args) { [File.read("spec/fixtures/256x256_assorted_rectangles.raw"), 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    it "locates the same barcodes and appends a straightened image of each" do
+      located = Ext.locate_via_guards(*args)
+      rectified = Ext.rectify_via_guards(*args, 3, false, false)
+
+      expect(rectified.map { |code| code[0..8] }).to eq(located)
+      expect(rectified.map { |code| code[9] }).to all(be_nil)
+      rectified.each do |code|
+        pixels, width, height = code[10]
+        expect(pixels.bytesize).to eq(width*height)
+        expect([width % 3, height % 3]).to eq([0, 0])
+      end
+    end
+
+    it "rejects module sizes out of range" do
+      expect { Ext.rectify_via_guards(*args, 0, false, false) }.to raise_error(RangeError)
+      expect { Ext.rectify_via_guards(*args, 17, false, false) }.to raise_error(RangeError)
+    end
+  end
+
+  describe ".locate_via_guards_levels" do
+    let(:args) { [File.read("spec/fixtures/256x256_assorted_rectangles.raw"), 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    it "reports barcodes found at several thresholds once" do
+      located = Ext.locate_via_guards(*args)
+
+      expect(Ext.locate_via_guards_levels(*args, [128], false)).to eq(located)
+      expect(Ext.locate_via_guards_levels(*args, [64, 128, 192], false)).to eq(located)
+    end
+
+    it "rejects thresholds out of range" do
+      expect { Ext.locate_via_guards_levels(*args, [], false) }.to raise_error(RangeError)
+      expect { Ext.locate_via_guards_levels(*args, [256], false) }.to raise_error(RangeError)
+    end
+  end
+
+  describe ".locate_via_gradients" do
+    # a 240x80 field of bars, from (80, 110) to (320, 190), on light paper
+    let(:width) { 400 }
+    let(:height) { 300 }
+    let(:pixels) do
+      (0...height).flat_map do |y|
+        (0...width).map { |x| x >= 80 && x < 320 && y >= 110 && y < 190 && (x - 80) / 6 * 7 % 3 == 0 ? 20 : 230 }
+      end.pack("C*")
+    end
+
+    it "locates fields of bars from their gradients" do
+      located = Ext.locate_via_gradients(pixels, width, height, 4000, 1, 10)
+
+      expect(located.length).to eq(1)
+      score, *corners = located.first
+      expect(score).to be_between(0.5, 1)
+      [80, 110, 80, 190, 320, 190, 320, 110].zip(corners).each do |expected, actual|
+        expect(actual).to be_within(16).of(expected)
+      end
+    end
+
+    it "leaves out fields too small or too long" do
+      expect(Ext.locate_via_gradients(pixels, width, height, 40_000, 1, 10)).to be_empty
+      expect(Ext.locate_via_gradients(pixels, width, height, 4000, 1, 2)).to be_empty
+    end
+
+    it "rejects mismatched sizes" do
+      expect { Ext.locate_via_gradients("abc", 2, 2, 100, 1, 10) }.to raise_error(EOFError)
+    end
+  end
+
+  describe ".locate_via_scanlines" do
+    # the start pattern, five codewords and the stop pattern, 3 pixels a
+    # module, from (70, 55) to (430, 145)
+    let(:elements) { [8, 1, 1, 1, 1, 1, 1, 3, 3, 1, 1, 2, 4, 1, 2, 3, 1, 2, 5, 1, 1, 3, 2, 2, 2, 3, 1, 1, 3, 2, 4, 1,
+                      4, 1, 2, 2, 1, 1, 1, 5, 1, 1, 3, 4, 2, 2, 1, 3, 7, 1, 1, 3, 1, 1, 1, 2, 1] }
+    let(:row) do
+      [255] * 70 + elements.each_with_index.flat_map { |e, i| [i.even? ? 0 : 255] * (3*e) } + [255] * 70
+    end
+    let(:pixels) { (0...200).flat_map { |y| y >= 55 && y < 145 ? row : [255] * 500 }.pack("C*") }
+
+    it "locates barcodes by their start and stop patterns" do
+      located = Ext.locate_via_scanlines(pixels, 500, 200, 8, true)
+
+      expect(located.length).to eq(1)
+      score, *corners = located.first
+      expect(score).to be_between(0.5, 1)
+      [70, 55, 70, 145, 430, 145, 430, 55].zip(corners).each do |expected, actual|
+        expect(actual).to be_within(8).of(expected)
+      end
+    end
+
+    it "rejects steps that aren't positive" do
+      expect { Ext.locate_via_scanlines(pixels, 500, 200, 0, true) }.to raise_error(RangeError)
+    end
+  end
+
+  describe ".morphology" do
+    let(:data) { File.read("spec/fixtures/32x32_solitary_circle.raw") }
+
+    it "fills small dark flaws when closing" do
+      flawed = data.dup
+      flawed.setbyte(2*32+2, 0)
+      closed = Ext.morphology(flawed, 32, 32, :close, 3, 3, false)
+
+      expect(closed.bytesize).to eq(data.bytesize)
+      expect(closed.getbyte(2*32+2)).to eq(data.getbyte(2*32+2))
+      expect(flawed.getbyte(2*32+2)).to eq(0)
+    end
+
+    it "rejects unknown operations" do
+      expect { Ext.morphology(data, 32, 32, :smudge, 3, 3, false) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe ".luma" do
+    it "converts color pixels to gray" do
+      rgb = [255, 0, 0, 0, 255, 0, 0, 0, 255, 10, 20, 30].pack("C*")
+      bgra = [0, 0, 255, 9, 0, 255, 0, 9, 255, 0, 0, 9, 30, 20, 10, 9].pack("C*")
+
+      expect(Ext.luma(rgb, 2, 2, :rgb, false).bytes).to eq([77, 149, 29, 18])
+      expect(Ext.luma(bgra, 2, 2, :bgra, false).bytes).to eq([77, 149, 29, 18])
+    end
+
+    it "takes the luma of YUV frames" do
+      expect(Ext.luma("abcdef", 2, 2, :nv12, false)).to eq("abcd")
+      expect(Ext.luma("aXbYcXdY", 2, 2, :yuyv, false)).to eq("abcd")
+    end
+
+    it "normalizes while converting" do
+      gray = (100...200).map { |v| v.chr * 10 }.join
+      normalized = Ext.luma(gray, 10, 100, :gray, true).bytes
+
+      expect(normalized.minmax).to eq([0, 255])
+      expect(normalized).to eq(normalized.sort)
+    end
+
+    it "rejects unknown formats and odd sizes" do
+      expect { Ext.luma("abc", 1, 1, :cmyk, false) }.to raise_error(ArgumentError)
+      expect { Ext.luma("abcdef", 1, 2, :nv12, false) }.to raise_error(RangeError)
+      expect { Ext.luma("abc", 2, 2, :gray, false) }.to raise_error(EOFError)
+    end
+  end
+
+  describe ".remove_shadows" do
+    # dark bars every 30 pixels on paper that darkens from left to right
+    let(:width) { 240 }
+    let(:height) { 40 }
+    let(:pixels) do
+      (0...height).flat_map do |y|
+        (0...width).map { |x| paper = 240 - x/2; x % 30 < 6 ? paper/4 : paper }
+      end.pack("C*")
+    end
+
+    it "binarizes against the background" do
+      row = Ext.remove_shadows(pixels, width, height, 128).bytes[20*width, width]
+      expect(row).to eq((0...width).map { |x| x % 30 < 6 ? 0 : 255 })
+    end
+
+    it "leaves the quotient gray without a threshold" do
+      divided = Ext.remove_shadows(pixels, width, height, nil).bytes
+      expect(divided[20*width + 15]).to be > 200
+      expect(divided[20*width + width - 15]).to be > 200
+    end
+
+    it "rejects bad thresholds and sizes" do
+      expect { Ext.remove_shadows(pixels, width, height, 256) }.to raise_error(RangeError)
+      expect { Ext.remove_shadows("abc", 2, 2, nil) }.to raise_error(EOFError)
+    end
+  end
+
+  describe ".correct_codewords" do
+    # the example from the PDF417 specification, at error correction level 1
+    let(:codewords) { [5, 453, 178, 121, 239, 452, 327, 657, 619] }
+
+    it "corrects errors and erasures" do
+      damaged = codewords.dup
+      damaged[1] = 0
+      damaged[6] = nil
+      damaged[7] = nil
+
+      expect(Ext.correct_codewords(damaged, 4)).to eq(codewords)
+    end
+
+    it "gives up when there are too many errors" do
+      expect(Ext.correct_codewords([nil, nil, nil, 1] + codewords[4..], 4)).to be_nil
+    end
+
+    it "rejects values that aren't codewords" do
+      expect { Ext.correct_codewords(codewords + [929], 4) }.to raise_error(RangeError)
+    end
+  end
+
+  describe ".memory_budget" do
+    let(:data) { File.binread("spec/fixtures/256x256_assorted_rectangles.raw") }
+    let(:arguments) { [data, 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    after { Ext.memory_budget = nil }
+
+    it "records the peak memory of each call" do
+      Ext.locate_via_guards(*arguments)
+      expect(Ext.peak_memory).to be > 256*256/8
+    end
+
+    it "fails calls that would go over it" do
+      Ext.memory_budget = 10_000
+      expect { Ext.locate_via_guards(*arguments) }.to raise_error(Ruby417::MemoryBudgetError)
+      expect { Ext.locate_via_guards_levels(*arguments, [128], true) }.to raise_error(NoMemoryError)
+      expect(Ext.peak_memory).to be <= 10_000
+    end
+
+    it "is kept per thread" do
+      Ext.memory_budget = 10_000
+      expect(Thread.new { Ext.memory_budget }.value).to be_nil
+      expect { Ext.memory_budget = 0 }.to raise_error(RangeError)
+    end
+  end
+
+  describe ".prefilter" do
+    let(:pixels) { File.binread("spec/fixtures/256x256_assorted_rectangles.raw") }
+    let(:arguments) { [pixels, 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    after { Ext.prefilter = false }
+
+    it "finds the same barcodes, skipping blank tiles" do
+      expected = Ext.locate_via_guards(*arguments)
+      Ext.prefilter = true
+      expect(Ext.prefilter).to be true
+      expect(Ext.locate_via_guards(*arguments)).to eq(expected)
+    end
+
+    it "is kept per thread" do
+      Ext.prefilter = true
+      expect(Thread.new { Ext.prefilter }.value).to be false
+    end
+  end
+
+  describe ".fast_fit" do
+    let(:pixels) { File.binread("spec/fixtures/256x256_assorted_rectangles.raw") }
+    let(:arguments) { [pixels, 256, 256, 100, 0.8, 0.314, 0.5, 0.4, 0.3, 3, 50, 0, 10] }
+
+    after { Ext.fast_fit = false }
+
+    it "finds the same barcodes, tracing only the paired regions" do
+      expected = Ext.locate_via_guards(*arguments)
+      Ext.fast_fit = true
+      expect(Ext.fast_fit).to be true
+      expect(Ext.locate_via_guards(*arguments)).to eq(expected)
+    end
+
+    it "is kept per thread" do
+      Ext.fast_fit = true
+      expect(Thread.new { Ext.fast_fit }.value).to be false
+    end
+  end
+
+  describe ".simd_level" do
+    it "names the instruction set the kernels were picked for" do
+      expect(%i[none sse2 avx2 avx512]).to include(Ext.simd_level)
+    end
+
+    it "can be forced lower from the environment" do
+      script = "require 'ruby417/ext/ruby417'; print Ruby417::Ext.simd_level"
+      output, status = Open3.capture2({ "RUBY417_SIMD" => "none" }, RbConfig.ruby, "-I#{$LOAD_PATH.join(File::PATH_SEPARATOR)}", "-e", script)
+      expect(status).to be_success
+      expect(output).to eq("none")
+    end
+  end
+
+  describe ".digest" do
+    it "gives the same 64 bit digest in every process" do
+      expect(Ext.digest("abc")).to eq(0x44bc2cf5ad770999)
+      expect(Ext.digest("abd")).not_to eq(Ext.digest("abc"))
+    end
+  end
+
+  describe Ext::ResultCache do
+    it "keeps located barcodes in a file" do
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "results")
+        barcodes = [[0.5, 1, 2, 3, 4, 5, 6, 7, 8]]
+        cache = Ext::ResultCache.new(path, 16)
+
+        expect(cache.fetch(1, 2)).to be_nil
+        expect(cache.store(1, 2, barcodes)).to be true
+        expect(cache.store(1, 3, barcodes * 17)).to be false
+        expect(Ext::ResultCache.new(path, 16).fetch(1, 2)).to eq(barcodes)
+        expect(cache.stats).to eq(hits: 1, misses: 1, stores: 1, slots: 16)
+
+        cache.close
+        expect { cache.fetch(1, 2) }.to raise_error(IOError)
+        expect { Ext::ResultCache.new(path, 0) }.to raise_error(Errno::EINVAL)
+      end
+    end
+  end
+
   describe "C tests" do
     it "run successfully" do
       expect(Open3.capture2e("#{__dir__}/run_suite.sh").last).to be_success
@@ -12,16 +12,36 @@ egcc () {
 base_dir="$(dirname $0)/../.."
 source_dir="$base_dir/ext"
 test_dir="$base_dir/spec/ext"
+table_dir="$(mktemp -d)"
+trap 'rm -rf "$table_dir"' EXIT
 status=0
 
+echo "Generating tables..."
+ruby $source_dir/generate_symbol_table.rb $table_dir/symbol_table.h || error "Table generation failed"
+
 echo "Checking source..."
-egcc $source_dir/ruby417.c -Wall -Wextra -fsyntax-only
+egcc $source_dir/ruby417.c -Wall -Wextra -fsyntax-only -I$table_dir
 
 echo "Compiling..."
-flags="-Wall -Wextra -Wno-unused-function -g -lm -I$source_dir"
+flags="-Wall -Wextra -Wno-unused-function -g -lm -pthread -I$source_dir -I$table_dir"
 egcc $test_dir/test_darray.c $flags -o $test_dir/exec_test_darray
 egcc $test_dir/test_image.c $flags -o $test_dir/exec_test_image
 egcc $test_dir/test_rectangles.c $flags -o $test_dir/exec_test_rectangles
+egcc $test_dir/test_morphology.c $flags -o $test_dir/exec_test_morphology
+egcc $test_dir/test_decoder.c $flags -o $test_dir/exec_test_decoder
+egcc $test_dir/test_reed_solomon.c $flags -o $test_dir/exec_test_reed_solomon
+egcc $test_dir/test_rectify.c $flags -o $test_dir/exec_test_rectify
+egcc $test_dir/test_levels.c $flags -o $test_dir/exec_test_levels
+egcc $test_dir/test_color.c $flags -o $test_dir/exec_test_color
+egcc $test_dir/test_shadows.c $flags -o $test_dir/exec_test_shadows
+egcc $test_dir/test_accounting.c $flags -o $test_dir/exec_test_accounting
+egcc $test_dir/test_saliency.c $flags -o $test_dir/exec_test_saliency
+egcc $test_dir/test_gradients.c $flags -o $test_dir/exec_test_gradients
+egcc $test_dir/test_scanlines.c $flags -o $test_dir/exec_test_scanlines
+egcc $test_dir/test_simd.c $flags -o $test_dir/exec_test_simd
+egcc $test_dir/test_cache.c $flags -o $test_dir/exec_test_cache
+egcc $test_dir/test_daemon.c $flags -o $test_dir/exec_test_daemon
+egcc $test_dir/test_batch.c $flags -o $test_dir/exec_test_batch
 
 echo "Running tests..."
 pushd $test_dir > /dev/null
@@ -43,6 +43,8 @@ void run_tests(unsigned count, void (**tests)(void)) {
   int seed = time(0);
   fprintf(stderr, "Randomized with seed %i\n", seed);
   srand(seed);
+  // the kernels the extension would pick, or those forced by the environment
+  simd_init();
 
   while (count) {
     int idx = rand() % count;
@@ -0,0 +1,103 @@
+#include "spec_helper.h"
+
+void test_accounted_allocator(void) {
+  fprintf(stderr, "Testing accounted allocator...");
+
+  struct memory_account account = {0};
+  memory_account = &account;
+
+  char *a = accounted_malloc(100), *b = accounted_malloc(50);
+  assert(a && b && (uintptr_t) a % _Alignof(max_align_t) == 0);
+  memset(a, 1, 100);
+  assert(account.current == 150 && account.peak == 150);
+
+  // growing and shrinking keep the contents
+  assert((a = accounted_realloc(a, 1000)) && a[99] == 1);
+  assert(account.current == 1050 && account.peak == 1050);
+  assert((a = accounted_realloc(a, 10)) && a[9] == 1);
+  assert(account.current == 60 && account.peak == 1050);
+
+  accounted_free(a);
+  accounted_free(b);
+  accounted_free(NULL);
+  assert(account.current == 0 && account.peak == 1050);
+  assert(memory_account_flush(&account) == 0);
+
+  // blocks outside an account are left alone, even when freed inside one
+  memory_account = NULL;
+  a = accounted_malloc(10);
+  memory_account = &account;
+  b = accounted_malloc(20);
+  assert(memory_account_flush(&account) == 20);
+  accounted_free(a);
+  accounted_free(b);
+  assert(account.current == 0 && memory_account_flush(&account) == -20);
+
+  memory_account = NULL;
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_memory_budget(void) {
+  fprintf(stderr, "Testing memory budget...");
+
+  struct memory_account account = {.budget = 1000};
+  memory_account = &account;
+
+  char *a = accounted_malloc(600), *b;
+  assert(a && !account.exceeded);
+  assert(!accounted_malloc(500) && account.exceeded);
+  // a failed allocation isn't charged, and a failed realloc leaves the block
+  assert(account.current == 600 && account.peak == 600);
+  assert(!accounted_realloc(a, 1200) && account.current == 600);
+  assert((b = accounted_malloc(400)) && account.current == 1000);
+  accounted_free(b);
+  assert((a = accounted_realloc(a, 900)) && account.peak == 1000);
+  accounted_free(a);
+  assert(account.current == 0);
+
+  // the localizer runs up to its budget and cleanly fails
+  struct image8 *im = image8_new(300, 200, malloc, free);
+  memset(im->data, 255, im->width*im->height);
+  struct pairing_settings settings = {
+    .area_threshold = 100,
+    .rectangularity_threshold = 0.8,
+    .angle_variation_threshold = 0.314,
+    .area_variation_threshold = 0.5,
+    .width_variation_threshold = 0.4,
+    .height_variation_threshold = 0.3,
+    .guard_aspect_min = 3,
+    .guard_aspect_max = 50,
+    .barcode_aspect_min = 0,
+    .barcode_aspect_max = 10
+  };
+  unsigned char thresholds[] = {64, 128, 192};
+  struct darray *found;
+
+  account = (struct memory_account) {0};
+  found = image8_locate_guards_levels(im, thresholds, 3, NULL, 0, &settings, 3,
+                                      accounted_malloc, accounted_realloc, accounted_free);
+  assert(found);
+  darray_free(found, true);
+  size_t peak = account.peak;
+  assert(peak > 0 && account.current == 0);
+
+  account = (struct memory_account) {.budget = peak/2};
+  found = image8_locate_guards_levels(im, thresholds, 3, NULL, 0, &settings, 3,
+                                      accounted_malloc, accounted_realloc, accounted_free);
+  assert(!found && account.exceeded && account.current == 0 && account.peak <= peak/2);
+
+  image8_free(im);
+  memory_account = NULL;
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_accounted_allocator,
+    test_memory_budget
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,182 @@
+#include "spec_helper.h"
+#include "ruby417/daemon.c"
+#include "ruby417/batch.c"
+
+static void write_file(const char *path, const char *header, const unsigned char *data, size_t size) {
+  FILE *f = fopen(path, "wb");
+  assert(f);
+  fputs(header, f);
+  if (size) fwrite(data, 1, size, f);
+  fclose(f);
+}
+
+void test_pnm_parse(void) {
+  fprintf(stderr, "Testing pnm_parse...");
+
+  int width, height;
+  enum pixel_format format;
+  const unsigned char *pixels;
+  const char gray[] = "P5\n# a comment\n3 2 # another\n255\nabcdef";
+  assert(pnm_parse((const unsigned char *) gray, strlen(gray), &width, &height, &format, &pixels));
+  assert(width == 3 && height == 2 && format == PIXEL_FORMAT_GRAY && !memcmp(pixels, "abcdef", 6));
+
+  // the samples may start with whitespace
+  const char color[] = "P6 1 2 255\n\n\n\n\n\n\n";
+  assert(pnm_parse((const unsigned char *) color, strlen(color), &width, &height, &format, &pixels));
+  assert(width == 1 && height == 2 && format == PIXEL_FORMAT_RGB && pixels[0] == '\n');
+
+  const char *bad[] = {
+    "P5\n3 2\n255\nabcde", // short
+    "P2\n1 1\n255\n1", // ASCII
+    "P5\n1 1\n65535\nab", // 16 bit
+    "P5\n0 1\n255\n",
+    "P5\n1 1",
+    ""
+  };
+  for (int i = 0; i < 6; i++) {
+    assert(!pnm_parse((const unsigned char *) bad[i], strlen(bad[i]), &width, &height, &format, &pixels));
+  }
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_text_json_string(void) {
+  fprintf(stderr, "Testing text_json_string...");
+
+  struct text text = {0};
+  assert(text_json_string(&text, "a \"b\"\\c\nd\x01/\xc3\xa9"));
+  assert(!strcmp(text.data, "\"a \\\"b\\\"\\\\c\\nd\\u0001/\xc3\xa9\""));
+
+  // growing past the first allocation
+  text.len = 0;
+  for (int i = 0; i < 1000; i++) assert(text_printf(&text, "%d,", i));
+  assert(text.len == strlen(text.data) && !strncmp(text.data + text.len - 4, "999,", 4));
+  free(text.data);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_batch_collect(void) {
+  fprintf(stderr, "Testing batch_collect...");
+
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[128];
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/sub", dir);
+  assert(!mkdir(path, 0700));
+  sprintf(path, "%s/sub/a.pgm", dir);
+  write_file(path, "P5\n1 1\n255\n", (const unsigned char *) "a", 1);
+
+  // a link back up is a cycle, not followed; a link to an image is kept, one
+  // to a directory with an image's name or to nothing isn't
+  sprintf(path, "%s/sub/loop", dir);
+  assert(!symlink("..", path));
+  sprintf(path, "%s/sub/b.pgm", dir);
+  assert(!symlink("a.pgm", path));
+  sprintf(path, "%s/c.pgm", dir);
+  assert(!symlink("sub", path));
+  sprintf(path, "%s/d.pgm", dir);
+  assert(!symlink("nonexistent.pgm", path));
+
+  struct darray *paths = darray_new(0, free, malloc, realloc, free);
+  assert(batch_collect(dir, paths));
+  assert(paths->len == 2);
+  for (unsigned i = 0; i < paths->len; i++) {
+    const char *name = strrchr(darray_index(paths, i), '/') + 1;
+    assert(!strcmp(name, "a.pgm") || !strcmp(name, "b.pgm"));
+    assert(strstr(darray_index(paths, i), "/sub/"));
+  }
+
+  darray_free(paths, true);
+  sprintf(path, "rm -r %s", dir);
+  assert(!system(path));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_batch_run(void) {
+  fprintf(stderr, "Testing batch_run...");
+
+  int width = 256, height = 256;
+  unsigned char *data = (unsigned char *) load_fixture_data("256x256_assorted_rectangles.raw", width*height);
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[128];
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/sub", dir);
+  assert(!mkdir(path, 0700));
+  sprintf(path, "%s/sub/a.pgm", dir);
+  write_file(path, "P5\n256 256\n255\n", data, width*height);
+  sprintf(path, "%s/b.pnm", dir);
+  write_file(path, "P5 256 256 255\n", data, width*height);
+  sprintf(path, "%s/c.pgm", dir);
+  write_file(path, "not an image", NULL, 0);
+  sprintf(path, "%s/d.txt", dir);
+  write_file(path, "skipped", NULL, 0);
+
+  // directories are searched for images; lists are taken as they are
+  struct darray *paths = darray_new(0, free, malloc, realloc, free);
+  assert(batch_collect(dir, paths));
+  assert(paths->len == 3);
+  FILE *list = tmpfile();
+  fprintf(list, "%s/b.pnm\r\n\n/nonexistent\n", dir);
+  rewind(list);
+  assert(batch_read_list(list, paths));
+  fclose(list);
+  assert(paths->len == 5 && !strcmp(darray_index(paths, 4), "/nonexistent"));
+
+  struct batch_settings settings = {
+    .request = {
+      .magic = DAEMON_MAGIC,
+      .area_threshold = 100,
+      .rectangularity_threshold = 0.8,
+      .angle_variation_threshold = 0.314,
+      .area_variation_threshold = 0.5,
+      .width_variation_threshold = 0.4,
+      .height_variation_threshold = 0.3,
+      .guard_aspect_min = 3,
+      .guard_aspect_max = 50,
+      .barcode_aspect_min = 0,
+      .barcode_aspect_max = 10
+    },
+    .threads = 3
+  };
+  struct batch_stats stats;
+  FILE *out = tmpfile();
+  assert(batch_run(paths, &settings, out, &stats));
+  assert(stats.images == 5 && stats.failures == 2 && stats.barcodes == 6);
+  assert(stats.bytes == 3 * (width*height + 15));
+
+  // a line per image, in whatever order they were done
+  char line[1024];
+  int lines = 0, located = 0;
+  rewind(out);
+  while (fgets(line, sizeof(line), out)) {
+    lines++;
+    assert(line[strlen(line) - 1] == '\n');
+    if (strstr(line, "\"barcodes\":")) {
+      located++;
+      assert(strstr(line, "\"width\":256,\"height\":256"));
+      assert(strstr(line, "{\"score\":0.628771097313666,\"corners\":[[21,19],[15,111],[164,124],[166,28]]}"));
+    } else {
+      assert(strstr(line, "\"error\":"));
+    }
+  }
+  assert(lines == 5 && located == 3);
+  fclose(out);
+
+  darray_free(paths, true);
+  sprintf(path, "rm -r %s", dir);
+  assert(!system(path));
+  free(data);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_pnm_parse,
+    test_text_json_string,
+    test_batch_collect,
+    test_batch_run
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,146 @@
+#include "spec_helper.h"
+#include <sys/wait.h>
+
+void test_digest64(void) {
+  fprintf(stderr, "Testing digest64...");
+
+  // XXH64's own test vectors, through every tail length and the 32 byte stripes
+  const char *text = "Nobody inspects the spammish repetition";
+  assert(digest64("", 0, 0) == 0xef46db3751d8e999ull);
+  assert(digest64("a", 1, 0) == 0xd24ec4f1a98c6e5bull);
+  assert(digest64("abc", 3, 0) == 0x44bc2cf5ad770999ull);
+  assert(digest64(text, strlen(text), 0) == 0xfbcea83c8a378bf1ull);
+  assert(digest64("abc", 3, 1) != digest64("abc", 3, 0));
+
+  fprintf(stderr, "PASS\n");
+}
+
+static struct result_cache_barcode barcode_for(int i) {
+  return (struct result_cache_barcode) {.score = i / 10.0, .corners = {i, i+1, i+2, i+3, i+4, i+5, i+6, i+7}};
+}
+
+void test_result_cache(void) {
+  fprintf(stderr, "Testing result cache...");
+
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[64];
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/results", dir);
+
+  struct result_cache *cache, *other;
+  struct result_cache_barcode barcodes[RESULT_CACHE_BARCODES + 1], fetched[RESULT_CACHE_BARCODES];
+  for (int i = 0; i <= RESULT_CACHE_BARCODES; i++) barcodes[i] = barcode_for(i);
+  uint64_t key[2] = {digest64("image", 5, 0), digest64("settings", 8, 0)}, other_key[2] = {key[0], key[1] + 1};
+
+  assert(!result_cache_open(path, 0, malloc, free) && errno == EINVAL);
+  assert(!result_cache_open("/nonexistent/results", 16, malloc, free) && errno == ENOENT);
+  set_allocation_success_chance(0.5);
+  while (!(cache=result_cache_open(path, 16, xmalloc, xfree)));
+
+  assert(result_cache_fetch(cache, key, fetched) == -1);
+  assert(result_cache_store(cache, key, barcodes, 3));
+  assert(result_cache_fetch(cache, key, fetched) == 3);
+  assert(!memcmp(fetched, barcodes, sizeof(*barcodes) * 3));
+  assert(result_cache_fetch(cache, other_key, fetched) == -1);
+  // no barcodes is a result too, and too many aren't kept
+  assert(result_cache_store(cache, other_key, barcodes, 0) && result_cache_fetch(cache, other_key, fetched) == 0);
+  assert(!result_cache_store(cache, key, barcodes, RESULT_CACHE_BARCODES + 1));
+
+  // other processes see the same file, and its counts
+  assert((other=result_cache_open(path, 16, malloc, free)));
+  assert(result_cache_fetch(other, key, fetched) == 3);
+  assert(other->header->hits == 3 && other->header->misses == 2 && other->header->stores == 2);
+
+  // a slot being written reads as missing, and can't be written by another
+  struct result_cache_entry *entry = result_cache_slot(cache, key);
+  entry->sequence++;
+  assert(result_cache_fetch(other, key, fetched) == -1);
+  assert(!result_cache_store(other, key, barcodes, 1));
+  entry->sequence++;
+  assert(result_cache_fetch(other, key, fetched) == 3);
+
+  // unless its writer died partway, when the next store takes it over
+  pid_t child = fork();
+  if (!child) _exit(0);
+  assert(child > 0 && waitpid(child, NULL, 0) == child);
+  entry->sequence++;
+  entry->writer = getpid();
+  assert(!result_cache_store(other, key, barcodes, 1));
+  entry->writer = child;
+  assert(result_cache_store(other, key, barcodes, 1));
+  assert(!(entry->sequence & 1) && !entry->writer);
+  assert(result_cache_fetch(cache, key, fetched) == 1);
+  assert(result_cache_store(other, key, barcodes, 3));
+  result_cache_close(other);
+
+  // opening with another size starts over, leaving the old file to those with it open
+  assert((other=result_cache_open(path, 32, malloc, free)));
+  assert(other->header->slots == 32 && result_cache_fetch(other, key, fetched) == -1);
+  assert(result_cache_fetch(cache, key, fetched) == 3);
+  result_cache_close(other);
+
+  result_cache_close(cache);
+  assert_mem_clean();
+  unlink(path);
+  rmdir(dir);
+
+  fprintf(stderr, "PASS\n");
+}
+
+struct opening {
+  const char *path;
+  struct result_cache *cache;
+};
+
+static void *open_cache(void *arg) {
+  struct opening *opening = arg;
+  opening->cache = result_cache_open(opening->path, 16, malloc, free);
+  return NULL;
+}
+
+void test_result_cache_replaced(void) {
+  fprintf(stderr, "Testing result cache replaced while opening...");
+
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[64];
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/results", dir);
+  struct result_cache *cache = result_cache_open(path, 16, malloc, free);
+  assert(cache);
+  result_cache_close(cache);
+
+  // another process starting the file over while this one waits for the lock
+  int fd = open(path, O_RDWR);
+  assert(fd >= 0 && !flock(fd, LOCK_EX));
+  struct opening opening = {path, NULL};
+  pthread_t opener;
+  assert(!pthread_create(&opener, NULL, open_cache, &opening));
+  usleep(20000);
+  void *map = result_cache_create(path, 16, malloc, free);
+  assert(map != MAP_FAILED);
+  munmap(map, result_cache_size(16));
+  close(fd);
+  pthread_join(opener, NULL);
+
+  // ends up with the file that's there now, shared with everyone else
+  struct result_cache_barcode barcodes[1] = {barcode_for(1)}, fetched[RESULT_CACHE_BARCODES];
+  uint64_t key[2] = {1, 2};
+  assert(opening.cache && result_cache_store(opening.cache, key, barcodes, 1));
+  assert((cache=result_cache_open(path, 16, malloc, free)));
+  assert(result_cache_fetch(cache, key, fetched) == 1);
+  result_cache_close(cache);
+  result_cache_close(opening.cache);
+
+  unlink(path);
+  rmdir(dir);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_digest64,
+    test_result_cache,
+    test_result_cache_replaced
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
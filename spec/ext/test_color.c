@@ -0,0 +1,131 @@
+#include "spec_helper.h"
+
+// Expands gray levels into a buffer of the given format, with the color
+// channels (or chroma) set to values that shouldn't matter.
+static unsigned char *pack_pixels(const unsigned char *gray, int width, int height, enum pixel_format format) {
+  unsigned char *data = malloc(pixel_format_size(format, width, height));
+  long pixels = (long) width*height;
+
+  for (long i = 0; i < pixels; i++) {
+    switch (format) {
+      case PIXEL_FORMAT_GRAY:
+      case PIXEL_FORMAT_NV12:
+        data[i] = gray[i];
+        break;
+      case PIXEL_FORMAT_RGB:
+        memset(data + 3*i, gray[i], 3);
+        break;
+      case PIXEL_FORMAT_RGBA:
+      case PIXEL_FORMAT_BGRA:
+        memset(data + 4*i, gray[i], 3);
+        data[4*i + 3] = rand();
+        break;
+      case PIXEL_FORMAT_YUYV:
+        data[2*i] = gray[i];
+        data[2*i + 1] = rand();
+        break;
+    }
+  }
+  if (format == PIXEL_FORMAT_NV12) {
+    for (long i = pixels; i < pixels + pixels/2; i++) data[i] = rand();
+  }
+
+  return data;
+}
+
+void test_pixel_format_size(void) {
+  fprintf(stderr, "Testing pixel_format_size...");
+
+  assert(pixel_format_size(PIXEL_FORMAT_GRAY, 10, 6) == 60);
+  assert(pixel_format_size(PIXEL_FORMAT_RGB, 10, 6) == 180);
+  assert(pixel_format_size(PIXEL_FORMAT_RGBA, 10, 6) == 240);
+  assert(pixel_format_size(PIXEL_FORMAT_BGRA, 10, 6) == 240);
+  assert(pixel_format_size(PIXEL_FORMAT_NV12, 10, 6) == 90);
+  assert(pixel_format_size(PIXEL_FORMAT_YUYV, 10, 6) == 120);
+  assert(pixel_format_size(PIXEL_FORMAT_YUYV, 10, 5) == 100);
+  assert(pixel_format_size(PIXEL_FORMAT_NV12, 10, 5) == -1);
+  assert(pixel_format_size(PIXEL_FORMAT_YUYV, 9, 6) == -1);
+  assert(pixel_format_size(PIXEL_FORMAT_GRAY, -1, 6) == -1);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_from_pixels(void) {
+  fprintf(stderr, "Testing image8_from_pixels...");
+
+  int width = 38, height = 12;
+  unsigned char gray[38*12];
+  for (int i = 0; i < width*height; i++) gray[i] = rand();
+
+  // gray stays gray in every format
+  enum pixel_format formats[] = {
+    PIXEL_FORMAT_GRAY, PIXEL_FORMAT_RGB, PIXEL_FORMAT_RGBA,
+    PIXEL_FORMAT_BGRA, PIXEL_FORMAT_NV12, PIXEL_FORMAT_YUYV
+  };
+  for (int f = 0; f < 6; f++) {
+    unsigned char *data = pack_pixels(gray, width, height, formats[f]);
+    struct image8 *im;
+    while (!(im=image8_from_pixels(data, formats[f], width, height, false, xmalloc, xfree)));
+    assert(im->width == width && im->height == height);
+    assert(memcmp(im->data, gray, width*height) == 0);
+    image8_free(im);
+    free(data);
+  }
+
+  // BT.601 weights, with red and blue swapped for BGRA
+  unsigned char rgb[] = {255, 0, 0, 0, 255, 0, 0, 0, 255, 10, 20, 30},
+                bgra[] = {0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 0, 30, 20, 10, 0};
+  struct image8 *im;
+  while (!(im=image8_from_pixels(rgb, PIXEL_FORMAT_RGB, 4, 1, false, xmalloc, xfree)));
+  assert(im->data[0] == 77 && im->data[1] == 149 && im->data[2] == 29 && im->data[3] == 18);
+  image8_free(im);
+  while (!(im=image8_from_pixels(bgra, PIXEL_FORMAT_BGRA, 4, 1, false, xmalloc, xfree)));
+  assert(im->data[0] == 77 && im->data[1] == 149 && im->data[2] == 29 && im->data[3] == 18);
+  image8_free(im);
+
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_normalize(void) {
+  fprintf(stderr, "Testing image8_normalize...");
+
+  // levels 100 to 199, a row of each
+  int width = 50, height = 100;
+  unsigned char gray[50*100];
+  for (int y = 0; y < height; y++) memset(gray + y*width, 100 + y, width);
+
+  unsigned char *data = pack_pixels(gray, width, height, PIXEL_FORMAT_RGBA);
+  struct image8 *im;
+  while (!(im=image8_from_pixels(data, PIXEL_FORMAT_RGBA, width, height, true, xmalloc, xfree)));
+  // the darkest 2% and the lightest 1% are clipped, and the rest stretched
+  assert(image8_get(im, 0, 0) == 0 && image8_get(im, 0, 2) == 0);
+  assert(image8_get(im, 0, 98) == 255 && image8_get(im, 0, 99) == 255);
+  for (int y = 3; y < 98; y++) {
+    assert(image8_get(im, 0, y) > image8_get(im, 0, y-1));
+    assert(image8_get(im, 0, y) == image8_get(im, width-1, y));
+  }
+  image8_free(im);
+  free(data);
+
+  // a single level has nothing to stretch
+  memset(gray, 77, sizeof(gray));
+  while (!(im=image8_from_pixels(gray, PIXEL_FORMAT_GRAY, width, height, true, xmalloc, xfree)));
+  assert(memcmp(im->data, gray, width*height) == 0);
+  image8_free(im);
+
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_pixel_format_size,
+    test_image8_from_pixels,
+    test_image8_normalize
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,289 @@
+#include "spec_helper.h"
+#include <dirent.h>
+// short enough to watch them expire
+#define DAEMON_IDLE_TIMEOUT 2
+#define DAEMON_REQUEST_TIMEOUT 1
+#include "ruby417/daemon.c"
+
+static struct daemon_request request_for(int width, int height, enum daemon_preprocessing preprocessing) {
+  return (struct daemon_request) {
+    .magic = DAEMON_MAGIC,
+    .format = PIXEL_FORMAT_GRAY,
+    .width = width,
+    .height = height,
+    .preprocessing = preprocessing,
+    .area_threshold = 100,
+    .rectangularity_threshold = 0.8,
+    .angle_variation_threshold = 0.314,
+    .area_variation_threshold = 0.5,
+    .width_variation_threshold = 0.4,
+    .height_variation_threshold = 0.3,
+    .guard_aspect_min = 3,
+    .guard_aspect_max = 50,
+    .barcode_aspect_min = 0,
+    .barcode_aspect_max = 10
+  };
+}
+
+// A shared memory file holding the pixels, as clients pass them.
+static int shared_pixels(const unsigned char *data, size_t size) {
+  FILE *f = tmpfile();
+  assert(f && fwrite(data, 1, size, f) == size && !fflush(f));
+  int fd = dup(fileno(f));
+  fclose(f);
+  return fd;
+}
+
+static void send_descriptors(int connection, const int *fds, int count) {
+  char byte = 0;
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int) * 16)];
+  } control = {0};
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  struct msghdr message = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = count ? control.buffer : NULL,
+    .msg_controllen = count ? CMSG_SPACE(sizeof(int) * count) : 0
+  };
+  if (count) {
+    struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * count);
+  }
+  assert(sendmsg(connection, &message, 0) == 1);
+}
+
+static void send_descriptor(int connection, int fd) {
+  send_descriptors(connection, &fd, 1);
+}
+
+static int open_descriptors(void) {
+  DIR *dir = opendir("/proc/self/fd");
+  int count = 0;
+  assert(dir);
+  while (readdir(dir)) count++;
+  closedir(dir);
+  return count;
+}
+
+static int connect_to(const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  strcpy(address.sun_path, path);
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(!connect(connection, (struct sockaddr *) &address, sizeof(address)));
+  return connection;
+}
+
+// Sends a request and reads back the response, returning the barcodes.
+static struct daemon_barcode *round_trip(int connection, int fd, struct daemon_request *request,
+                                         struct daemon_response *response) {
+  send_descriptor(connection, fd);
+  assert(write_fully(connection, request, sizeof(*request)));
+  assert(read_fully(connection, response, sizeof(*response)));
+  assert(response->magic == DAEMON_MAGIC);
+
+  struct daemon_barcode *barcodes = malloc(sizeof(*barcodes) * (response->count + 1));
+  assert(read_fully(connection, barcodes, sizeof(*barcodes) * response->count));
+  return barcodes;
+}
+
+static void *serve(void *arg) {
+  assert(daemon_serve(*(int *) arg, 2));
+  return NULL;
+}
+
+void test_daemon_listen(void) {
+  fprintf(stderr, "Testing daemon_listen...");
+
+  char path[200];
+  memset(path, 'x', sizeof(path) - 1);
+  path[sizeof(path) - 1] = '\0';
+  assert(daemon_listen(path) == -1 && errno == ENAMETOOLONG);
+  assert(daemon_listen("/nonexistent/ruby417.sock") == -1);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_receive_descriptor(void) {
+  fprintf(stderr, "Testing receive_descriptor...");
+
+  int pair[2], fds[DAEMON_MAX_DESCRIPTORS + 2], fd, before;
+  assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+  for (int i = 0; i < DAEMON_MAX_DESCRIPTORS + 2; i++) assert((fds[i]=open("/dev/null", O_RDONLY)) >= 0);
+  before = open_descriptors();
+
+  // the first is kept and the rest closed
+  send_descriptors(pair[0], fds, 3);
+  assert((fd=receive_descriptor(pair[1])) >= 0);
+  close(fd);
+  assert(open_descriptors() == before);
+
+  // more than fit are refused, none left open
+  send_descriptors(pair[0], fds, DAEMON_MAX_DESCRIPTORS + 2);
+  assert(receive_descriptor(pair[1]) == -1);
+  assert(open_descriptors() == before);
+
+  // as is a byte without any, or a closed connection
+  send_descriptors(pair[0], NULL, 0);
+  assert(receive_descriptor(pair[1]) == -1);
+  close(pair[0]);
+  assert(receive_descriptor(pair[1]) == -1);
+
+  close(pair[1]);
+  for (int i = 0; i < DAEMON_MAX_DESCRIPTORS + 2; i++) close(fds[i]);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_daemon_round_trip(void) {
+  fprintf(stderr, "Testing daemon round trip...");
+
+  int width = 256, height = 256;
+  unsigned char *data = (unsigned char *) load_fixture_data("256x256_assorted_rectangles.raw", width*height),
+                *inverted = malloc(width*height);
+  for (int i = 0; i < width*height; i++) inverted[i] = 255 - data[i];
+
+  // what the extension finds in process
+  struct daemon_request request = request_for(width, height, DAEMON_PREPROCESS_NONE);
+  struct daemon_workspace ws = {0};
+  struct darray *expected = NULL;
+  assert(daemon_locate(&ws, &request, data, &expected) == DAEMON_OK);
+  assert(expected->len > 0);
+  free(ws.gray.data);
+
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[64];
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/daemon.sock", dir);
+  int listener = daemon_listen(path);
+  assert(listener >= 0);
+  pthread_t server;
+  assert(!pthread_create(&server, NULL, serve, &listener));
+
+  int connection = connect_to(path);
+
+  int fd = shared_pixels(data, width*height), inverted_fd = shared_pixels(inverted, width*height);
+  struct daemon_response response;
+  struct daemon_barcode *barcodes;
+
+  // several requests over the one connection, reversed ones inverted first,
+  // and the prefilter keeping every guard
+  for (int i = 0; i < 4; i++) {
+    request.flags = i == 2 ? DAEMON_INVERT : i == 3 ? DAEMON_PREFILTER : 0;
+    barcodes = round_trip(connection, i == 2 ? inverted_fd : fd, &request, &response);
+    assert(response.status == DAEMON_OK && response.count == expected->len);
+    for (unsigned j = 0; j < response.count; j++) {
+      struct located_guards *located = darray_index(expected, j);
+      struct barcode_corners *c = &located->corners;
+      int corners[8] = {c->upper_left.x, c->upper_left.y, c->lower_left.x, c->lower_left.y,
+                        c->lower_right.x, c->lower_right.y, c->upper_right.x, c->upper_right.y};
+      assert(barcodes[j].score == located->score);
+      assert(!memcmp(barcodes[j].corners, corners, sizeof(corners)));
+    }
+    free(barcodes);
+  }
+
+  // requests that don't fit the pixels are refused without dropping the connection
+  struct daemon_request bad = request_for(width, height + 1, DAEMON_PREPROCESS_FULL);
+  barcodes = round_trip(connection, fd, &bad, &response);
+  assert(response.status == DAEMON_BAD_REQUEST && response.count == 0);
+  free(barcodes);
+  bad = request_for(width, height, DAEMON_PREPROCESS_NONE);
+  bad.format = 99;
+  barcodes = round_trip(connection, fd, &bad, &response);
+  assert(response.status == DAEMON_BAD_REQUEST && response.count == 0);
+  free(barcodes);
+
+  // full preprocessing works on the same image
+  request = request_for(width, height, DAEMON_PREPROCESS_FULL);
+  barcodes = round_trip(connection, fd, &request, &response);
+  assert(response.status == DAEMON_OK);
+  free(barcodes);
+
+  close(fd);
+  close(inverted_fd);
+  close(connection);
+  shutdown(listener, SHUT_RDWR);
+  pthread_join(server, NULL);
+  close(listener);
+  unlink(path);
+  rmdir(dir);
+
+  darray_free(expected, true);
+  free(data);
+  free(inverted);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_daemon_dispatch(void) {
+  fprintf(stderr, "Testing daemon dispatch...");
+
+  int width = 256, height = 256;
+  unsigned char *data = (unsigned char *) load_fixture_data("256x256_assorted_rectangles.raw", width*height);
+  struct daemon_request request = request_for(width, height, DAEMON_PREPROCESS_NONE);
+  struct daemon_response response;
+  struct daemon_barcode *barcodes;
+  char dir[] = "/tmp/ruby417_test_XXXXXX", path[64], byte;
+  assert(mkdtemp(dir));
+  sprintf(path, "%s/daemon.sock", dir);
+  int listener = daemon_listen(path);
+  assert(listener >= 0);
+  pthread_t server;
+  assert(!pthread_create(&server, NULL, serve, &listener));
+  int fd = shared_pixels(data, width*height);
+
+  // more open connections than the two workers, one silent and one stalled
+  // partway through a request, don't keep the others waiting
+  int silent = connect_to(path), stalled = connect_to(path), connections[3];
+  send_descriptor(stalled, fd);
+  assert(write_fully(stalled, &request, sizeof(request) / 2));
+  for (int i = 0; i < 3; i++) connections[i] = connect_to(path);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 2; i >= 0; i--) {
+      barcodes = round_trip(connections[i], fd, &request, &response);
+      assert(response.status == DAEMON_OK && response.count > 0);
+      free(barcodes);
+    }
+  }
+
+  // the stalled request times out, and idle connections are closed in time
+  time_t start = time(NULL);
+  assert(read(stalled, &byte, 1) == 0);
+  assert(read(silent, &byte, 1) == 0);
+  for (int i = 0; i < 3; i++) assert(read(connections[i], &byte, 1) == 0);
+  assert(time(NULL) - start <= DAEMON_IDLE_TIMEOUT + 2);
+  close(silent);
+  close(stalled);
+  for (int i = 0; i < 3; i++) close(connections[i]);
+
+  // while new ones are still served
+  connections[0] = connect_to(path);
+  barcodes = round_trip(connections[0], fd, &request, &response);
+  assert(response.status == DAEMON_OK);
+  free(barcodes);
+  close(connections[0]);
+  close(fd);
+  shutdown(listener, SHUT_RDWR);
+  pthread_join(server, NULL);
+  close(listener);
+  unlink(path);
+  rmdir(dir);
+  free(data);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_daemon_listen,
+    test_receive_descriptor,
+    test_daemon_round_trip,
+    test_daemon_dispatch
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
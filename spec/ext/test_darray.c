@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <math.h>
 #include "spec_helper.h"
 
 static struct darray *new_test_array(unsigned length, ...) {
@@ -198,6 +199,11 @@ int cmp(const void *a, const void *b, void *data) {
   return ((long) a - (long) b) * (long) data;
 }
 
+// compares only the bits above the lowest 16
+int cmp_high(const void *a, const void *b, void *data) {
+  return (((long) a >> 16) - ((long) b >> 16)) * (long) data;
+}
+
 void test_darray_msort(void) {
   fprintf(stderr, "Testing darray_msort...");
 
@@ -258,6 +264,109 @@ void test_darray_qsort(void) {
   fprintf(stderr, "PASS\n");
 }
 
+void test_darray_msort_threaded(void) {
+  fprintf(stderr, "Testing darray_msort_threaded...");
+
+  // large enough to be split, and sorted by value alone, so ties show whether
+  // it's stable
+  struct darray *ary, *serial;
+  while (!(ary=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
+  for (long i = 0; i < 20000; i++) {
+    while (!darray_push(ary, (void *) ((rand() % 500) << 16 | i)));
+  }
+  while (!(serial=darray_dup(ary)));
+
+  while (!darray_msort(serial, (void *) 1l, cmp_high));
+  for (int threads = 2; threads <= 8; threads *= 2) {
+    struct darray *threaded;
+    while (!(threaded=darray_dup(ary)));
+    while (!darray_msort_threaded(threaded, (void *) 1l, cmp_high, threads));
+    assert_darray_eq(threaded, serial);
+    darray_free(threaded, false);
+  }
+  for (unsigned i = 1; i < serial->len; i++) {
+    long a = (long) darray_index(serial, i-1), b = (long) darray_index(serial, i);
+    assert(a >> 16 < b >> 16 || (a >> 16 == b >> 16 && a < b));
+  }
+
+  darray_free(serial, false);
+  darray_free(ary, false);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+static uint64_t key_signed(const void *elt, void *data) {
+  return radix_key_signed((long) elt * (long) data);
+}
+
+// elements point at doubles
+static uint64_t key_double(const void *elt, void *data) {
+  (void) data;
+  return radix_key_double(*(const double *) elt);
+}
+
+void test_radix_keys(void) {
+  fprintf(stderr, "Testing radix keys...");
+
+  int64_t ints[] = {INT64_MIN, -70000, -1, 0, 1, 255, 256, 70000, INT64_MAX};
+  for (int i = 1; i < 9; i++) assert(radix_key_signed(ints[i-1]) < radix_key_signed(ints[i]));
+
+  double doubles[] = {-INFINITY, -1e300, -2.5, -1e-300, 0, 1e-300, 0.25, 0.5, 1, 1e300, INFINITY};
+  for (int i = 1; i < 11; i++) assert(radix_key_double(doubles[i-1]) < radix_key_double(doubles[i]));
+  assert(radix_key_double(-0.0) <= radix_key_double(0.0));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_darray_radix_sort(void) {
+  fprintf(stderr, "Testing darray_radix_sort...");
+
+  struct darray *ary = new_test_array(0);
+  while (!darray_radix_sort(ary, (void *) 1l, key_signed));
+  assert(ary->len == 0);
+  darray_free(ary, true);
+
+  // small arrays are insertion sorted
+  ary = new_test_array(5, 5, -3, 2, -70000, 70000);
+  while (!darray_radix_sort(ary, (void *) 1l, key_signed));
+  assert_darray_vals(ary, -70000, -3, 2, 5, 70000);
+  while (!darray_radix_sort(ary, (void *) -1l, key_signed));
+  assert_darray_vals(ary, 70000, 5, 2, -3, -70000);
+  darray_free(ary, true);
+
+  // large ones radix sorted, agreeing with a merge sort, ties included
+  struct darray *sorted;
+  while (!(ary=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
+  for (int i = 0; i < 5000; i++) {
+    long value = (rand() % 2000 - 1000) * (i % 3 ? 1 : 100000);
+    while (!darray_push(ary, (void *) value));
+  }
+  while (!(sorted=darray_dup(ary)));
+  while (!darray_msort(sorted, (void *) 1l, cmp));
+  while (!darray_radix_sort(ary, (void *) 1l, key_signed));
+  assert_darray_eq(ary, sorted);
+  darray_free(sorted, false);
+  darray_free(ary, false);
+
+  // doubles, with equal keys staying in order
+  double values[300];
+  while (!(ary=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
+  for (int i = 0; i < 300; i++) {
+    values[i] = (rand() % 50 - 25) / 7.0;
+    while (!darray_push(ary, &values[i]));
+  }
+  while (!darray_radix_sort(ary, NULL, key_double));
+  for (unsigned i = 1; i < ary->len; i++) {
+    double *a = darray_index(ary, i-1), *b = darray_index(ary, i);
+    assert(*a < *b || (*a == *b && a < b));
+  }
+  darray_free(ary, false);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
 int main(void) {
   void (*(tests[]))(void) = {
     test_darray_new,
@@ -270,7 +379,10 @@ int main(void) {
     test_darray_pop,
     test_darray_remove_fast,
     test_darray_msort,
-    test_darray_qsort
+    test_darray_qsort,
+    test_darray_msort_threaded,
+    test_radix_keys,
+    test_darray_radix_sort
   };
   int num = sizeof(tests) / sizeof(tests[0]);
   run_tests(num, tests);
@@ -0,0 +1,269 @@
+#include "spec_helper.h"
+
+// every pattern of 4 bars and 4 spaces with a cluster's parity, which includes
+// many that aren't codewords
+static unsigned cluster_patterns[9][4000];
+static int cluster_sizes[9];
+
+static void enumerate_patterns(int *modules, int element, int remaining) {
+  if (element == SYMBOL_ELEMENTS) {
+    int cluster = (modules[0] - modules[2] + modules[4] - modules[6] + 9) % 9;
+    if (!remaining && cluster % 3 == 0) cluster_patterns[cluster][cluster_sizes[cluster]++] = symbol_pattern(modules);
+    return;
+  }
+  for (int width = 1; width <= SYMBOL_MAX_ELEMENT && width <= remaining; width++) {
+    modules[element] = width;
+    enumerate_patterns(modules, element+1, remaining-width);
+  }
+}
+
+// the pattern of each codeword, by cluster
+static unsigned codeword_patterns[9][SYMBOL_CODEWORDS];
+
+static void collect_codewords(void) {
+  for (unsigned pattern = 0; pattern < 1 << SYMBOL_MODULES; pattern++) {
+    int cluster = symbol_cluster(pattern);
+    if (cluster >= 0) codeword_patterns[cluster][symbol_codeword(pattern)] = pattern;
+  }
+}
+
+// Row indicators as the standard has them (see symbol_matrix), for error
+// correction level 2, and arbitrary codewords between them.
+static int test_codeword(int row, int column, int rows, int cells) {
+  int k = row % 3, base = 30*(row/3),
+      indicators[3] = {(rows-1)/3, 3*2 + (rows-1)%3, cells-3};
+  if (column == 0) return base + indicators[k];
+  if (column == cells-1) return base + indicators[(k+2) % 3];
+  return (row*31 + column*17) % SYMBOL_CODEWORDS;
+}
+
+// Draws a synthetic barcode with the given number of rows and cells per row
+// (row indicators included), rotated by angle about the image center, leaving
+// out row blank (if it's in the barcode). Rows are 3 modules tall. Fills in the
+// corners and guards the way the localizer would find them: around the wide
+// bars of the start and stop patterns.
+static struct image1 *draw_symbol(int rows, int cells, int module, double angle, int blank,
+                                  struct barcode_corners *corners, struct rectangle *guards) {
+  int symbol_width = SYMBOL_MODULES*(cells+2) + 1, row_height = 3*module,
+      width = symbol_width*module*fabs(cos(angle)) + rows*row_height*fabs(sin(angle)) + 60,
+      height = symbol_width*module*fabs(sin(angle)) + rows*row_height*fabs(cos(angle)) + 60;
+  unsigned char *modules = calloc(symbol_width*rows, 1);
+
+  for (int r = 0; r < rows; r++) {
+    unsigned char *row = modules + r*symbol_width;
+    int x = 0;
+    if (r == blank) continue;
+    unsigned start = 0x1FEA8, stop = 0x1FD14; // 81111113 and 7113111 2(1)
+    for (int bit = SYMBOL_MODULES-1; bit >= 0; bit--) row[x++] = start >> bit & 1;
+    for (int c = 0; c < cells; c++) {
+      unsigned pattern = codeword_patterns[(r % 3) * 3][test_codeword(r, c, rows, cells)];
+      for (int bit = SYMBOL_MODULES-1; bit >= 0; bit--) row[x++] = pattern >> bit & 1;
+    }
+    for (int bit = SYMBOL_MODULES-1; bit >= 0; bit--) row[x++] = stop >> bit & 1;
+    row[x] = 1;
+  }
+
+  struct image1 *im;
+  while (!(im=image1_new(width, height, xmalloc, xfree)));
+  double cx = width/2.0, cy = height/2.0, ox = cx - symbol_width*module/2.0, oy = cy - rows*row_height/2.0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // map back into the unrotated symbol
+      double sx = cos(angle)*(x-cx) + sin(angle)*(y-cy) + cx - ox,
+             sy = -sin(angle)*(x-cx) + cos(angle)*(y-cy) + cy - oy;
+      int mx = (int) floor(sx/module), my = (int) floor(sy/row_height);
+      bool dark = sx >= 0 && sy >= 0 && mx < symbol_width && my < rows && modules[my*symbol_width + mx];
+      image1_set(im, x, y, !dark);
+    }
+  }
+  free(modules);
+
+  // outer corners of both wide bars, in symbol coordinates
+  int stop_right = (SYMBOL_MODULES*(cells+1) + 7)*module - 1;
+  double points[4][2] = {{0, 0}, {0, rows*row_height-1}, {stop_right, 0}, {stop_right, rows*row_height-1}};
+  struct point mapped[4];
+  for (int i = 0; i < 4; i++) {
+    double px = points[i][0] + ox - cx, py = points[i][1] + oy - cy;
+    mapped[i].x = (int) floor(cos(angle)*px - sin(angle)*py + cx + 0.5);
+    mapped[i].y = (int) floor(sin(angle)*px + cos(angle)*py + cy + 0.5);
+  }
+  bool flipped = cos(angle) < 0;
+  corners->upper_left = mapped[flipped ? 3 : 0];
+  corners->lower_left = mapped[flipped ? 2 : 1];
+  corners->upper_right = mapped[flipped ? 1 : 2];
+  corners->lower_right = mapped[flipped ? 0 : 3];
+  guards[0] = (struct rectangle) { .width = 8*module, .height = rows*row_height };
+  guards[1] = (struct rectangle) { .width = 7*module, .height = rows*row_height };
+
+  return im;
+}
+
+static void assert_reads_symbol(int rows, int cells, int module, double angle, int blank) {
+  struct barcode_corners corners;
+  struct rectangle guards[2];
+  struct rectangle_pair pair = { &guards[0], &guards[1], 1.0 };
+  struct image1 *im = draw_symbol(rows, cells, module, angle, blank, &corners, guards);
+  struct symbol_matrix *matrix;
+
+  while (!(matrix=image1_read_symbol(im, &pair, &corners, xmalloc, xfree)));
+  assert(matrix->rows == rows && matrix->columns == cells);
+  assert(matrix->upside_down == (cos(angle) < 0));
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cells; c++) {
+      assert(symbol_matrix_get(matrix, r, c) == (r == blank ? -1 : test_codeword(r, c, rows, cells)));
+    }
+  }
+
+  symbol_matrix_free(matrix);
+  image1_free(im);
+}
+
+void test_symbol_cluster(void) {
+  fprintf(stderr, "Testing symbol_cluster...");
+
+  // (E1 - E3 + E5 - E7) mod 9 picks the cluster
+  assert(symbol_cluster(symbol_pattern((int[]) {3, 1, 1, 1, 1, 1, 3, 6})) == 0);
+  assert(symbol_cluster(symbol_pattern((int[]) {5, 1, 1, 1, 1, 1, 2, 5})) == 3);
+  assert(symbol_cluster(symbol_pattern((int[]) {1, 2, 4, 2, 1, 2, 1, 4})) == 6);
+  assert(symbol_cluster(symbol_pattern((int[]) {2, 2, 1, 1, 1, 1, 3, 6})) == -1);
+  // but not every pattern with a cluster's parity is a codeword
+  assert(symbol_cluster(symbol_pattern((int[]) {1, 1, 1, 1, 2, 5, 2, 4})) == -1);
+  // the start pattern has an 8 module bar, and malformed patterns
+  assert(symbol_cluster(0x1FEA8) == -1);
+  assert(symbol_cluster(0x1FFFE) == -1);
+  assert(symbol_cluster(0x1D5C1) == -1);
+  assert(symbol_cluster(0) == -1);
+
+  // exactly 929 codewords in each cluster, all with its parity
+  int valid[9] = {0};
+  for (unsigned pattern = 0; pattern < 1 << SYMBOL_MODULES; pattern++) {
+    int cluster = symbol_cluster(pattern);
+    if (cluster >= 0) valid[cluster]++;
+  }
+  for (int cluster = 0; cluster < 9; cluster++) assert(valid[cluster] == (cluster % 3 ? 0 : SYMBOL_CODEWORDS));
+  for (int cluster = 0; cluster < 9; cluster += 3) {
+    int found = 0;
+    for (int i = 0; i < cluster_sizes[cluster]; i++) found += symbol_cluster(cluster_patterns[cluster][i]) == cluster;
+    assert(found == SYMBOL_CODEWORDS);
+  }
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_symbol_codeword(void) {
+  fprintf(stderr, "Testing symbol_codeword...");
+
+  // from the first and last columns of the standard's tables
+  assert(symbol_codeword(0x1D5C0) == 0);
+  assert(symbol_codeword(0x1F560) == 0);
+  assert(symbol_codeword(0x1ABE0) == 0);
+  assert(symbol_codeword(0x1EAF0) == 1);
+  assert(symbol_codeword(0x1BEF4) == 928);
+  assert(symbol_codeword(0x13F26) == 928);
+  assert(symbol_codeword(0x1C7EA) == 928);
+  assert(symbol_cluster(0x1F560) == 3 && symbol_cluster(0x1C7EA) == 6);
+
+  // each cluster has every codeword once
+  for (int cluster = 0; cluster < 9; cluster += 3) {
+    for (int codeword = 0; codeword < SYMBOL_CODEWORDS; codeword++) {
+      unsigned pattern = codeword_patterns[cluster][codeword];
+      assert(pattern && symbol_codeword(pattern) == codeword);
+    }
+  }
+  assert(symbol_codeword(0x1FEA8) == -1);
+  assert(symbol_codeword(0) == -1);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_symbol_normalize_widths(void) {
+  fprintf(stderr, "Testing symbol_normalize_widths...");
+
+  int normalized[SYMBOL_ELEMENTS];
+  int exact[] = {24, 3, 3, 3, 3, 3, 3, 9},
+      blurred[] = {25, 2, 4, 3, 3, 2, 3, 10},
+      stretched[] = {9, 3, 3, 9, 3, 3, 5, 5},
+      empty[] = {0, 0, 0, 0, 0, 0, 0, 0};
+  assert(symbol_normalize_widths(exact, SYMBOL_ELEMENTS, SYMBOL_MODULES, normalized));
+  assert(memcmp(normalized, (int[]) {8, 1, 1, 1, 1, 1, 1, 3}, sizeof(normalized)) == 0);
+  assert(symbol_normalize_widths(blurred, SYMBOL_ELEMENTS, SYMBOL_MODULES, normalized));
+  assert(memcmp(normalized, (int[]) {8, 1, 1, 1, 1, 1, 1, 3}, sizeof(normalized)) == 0);
+  assert(symbol_normalize_widths(stretched, SYMBOL_ELEMENTS, SYMBOL_MODULES, normalized));
+  int sum = 0;
+  for (int i = 0; i < SYMBOL_ELEMENTS; i++) sum += normalized[i];
+  assert(sum == SYMBOL_MODULES);
+  assert(!symbol_normalize_widths(empty, SYMBOL_ELEMENTS, SYMBOL_MODULES, normalized));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_symbol_number_rows(void) {
+  fprintf(stderr, "Testing symbol_number_rows...");
+
+  // rows 0, 1, 2 and 4 of a 5 row symbol, with row 2's indicators unreadable
+  // and row 1's disagreeing
+  int clusters[] = {0, 3, 6, 3}, rows[] = {0, 1, 2, 4}, numbers[4];
+  struct symbol_matrix *read;
+  while (!(read=symbol_matrix_new(4, 3, xmalloc, xfree)));
+  for (int i = 0; i < 4; i++) {
+    if (i == 2) continue;
+    read->data[3*i] = test_codeword(rows[i], 0, 5, 3);
+    read->data[3*i + 2] = test_codeword(rows[i], 2, 5, 3);
+  }
+  read->data[5] = test_codeword(4, 2, 5, 3);
+  assert(symbol_number_rows(read, clusters, numbers) == 5);
+  assert(!memcmp(numbers, rows, sizeof(numbers)));
+
+  // no indicators, no numbers
+  memset(read->data, 0xff, sizeof(*read->data)*12);
+  assert(symbol_number_rows(read, clusters, numbers) == 0);
+  symbol_matrix_free(read);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_read_symbol(void) {
+  fprintf(stderr, "Testing image1_read_symbol...");
+
+  assert_reads_symbol(6, 5, 3, 0, -1);
+  assert_reads_symbol(9, 4, 4, 0.12, -1);
+  assert_reads_symbol(12, 7, 3, M_PI, -1);
+  assert_reads_symbol(7, 3, 4, M_PI - 0.2, -1);
+  // a row that can't be read keeps its place
+  assert_reads_symbol(7, 5, 3, 0, 2);
+  assert_reads_symbol(8, 4, 4, M_PI, 4);
+  assert_mem_clean();
+
+  // nothing to read
+  struct barcode_corners corners = {{10, 10}, {90, 10}, {10, 40}, {90, 40}};
+  struct rectangle guard = { .width = 8, .height = 30 };
+  struct rectangle_pair pair = { &guard, &guard, 1.0 };
+  struct image1 *im;
+  struct symbol_matrix *matrix;
+  while (!(im=image1_new(100, 50, xmalloc, xfree)));
+  memset(im->data, 0xFF, sizeof(*im->data)*im->stride*im->height);
+  while (!(matrix=image1_read_symbol(im, &pair, &corners, xmalloc, xfree)));
+  assert(matrix->rows == 0 && matrix->columns == 0);
+  symbol_matrix_free(matrix);
+  image1_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  int modules[SYMBOL_ELEMENTS];
+  enumerate_patterns(modules, 0, SYMBOL_MODULES);
+  collect_codewords();
+
+  void (*(tests[]))(void) = {
+    test_symbol_cluster,
+    test_symbol_codeword,
+    test_symbol_normalize_widths,
+    test_symbol_number_rows,
+    test_image1_read_symbol
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,119 @@
+#include "spec_helper.h"
+
+static struct gradient_settings settings = {
+  .area_threshold = 4000,
+  .barcode_aspect_min = 1,
+  .barcode_aspect_max = 10
+};
+
+// A light page with a 240x80 field of vertical bars, centered on (cx, cy) and
+// rotated by angle, and a paragraph of letters below it.
+static struct image8 *page(double cx, double cy, double angle) {
+  int width = 480, height = 480;
+  struct image8 *im = image8_new(width, height, malloc, free);
+  memset(im->data, 230, width*height);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      double dx = x - cx, dy = y - cy,
+             u = dx*cos(angle) + dy*sin(angle), v = -dx*sin(angle) + dy*cos(angle);
+      if (fabs(u) < 120 && fabs(v) < 40 && ((int) floor((u + 120) / 6) * 7) % 3 == 0) {
+        image8_set(im, x, y, 20);
+      }
+    }
+  }
+  for (int y = 400; y < 470; y += 12) {
+    for (int x = 20; x < 460; x += 7) {
+      for (int j = y; j < y+8; j++) {
+        image8_set(im, x, j, 20);
+        image8_set(im, x+3, j, 20);
+      }
+      for (int i = x; i < x+4; i++) image8_set(im, i, y + (x/7 % 2)*7, 20);
+    }
+  }
+  return im;
+}
+
+static bool near(struct point *p, double x, double y) {
+  return fabs(p->x - x) <= 16 && fabs(p->y - y) <= 16;
+}
+
+void test_sobel_row(void) {
+  fprintf(stderr, "Testing sobel_row...");
+
+  unsigned char above[] = {0, 0, 0, 100, 100}, row[] = {0, 0, 0, 100, 100}, below[] = {0, 0, 100, 100, 100};
+  int gx[5], gy[5];
+  sobel_row(above, row, below, 5, gx, gy);
+  assert(gx[0] == 0 && gy[0] == 0 && gx[4] == 0 && gy[4] == 0);
+  assert(gx[1] == 100 && gx[2] == 400 && gx[3] == 300);
+  assert(gy[1] == 100 && gy[2] == 200 && gy[3] == 100);
+
+  // parallel edges are coherent, crossing ones aren't
+  assert(coherence(100, 0, 0) == 1);
+  assert(coherence(50, 50, 50) == 1);
+  assert(coherence(50, 50, 0) == 0);
+  assert(coherence(0, 0, 0) == 0);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_locate_gradients(void) {
+  fprintf(stderr, "Testing image8_locate_gradients...");
+
+  // level, the rows run left to right
+  struct image8 *im = page(200, 150, 0);
+  struct darray *found;
+  set_allocation_success_chance(0.998);
+  while (!(found=image8_locate_gradients(im, &settings, xmalloc, xrealloc, xfree)));
+  set_allocation_success_chance(0.5);
+  assert(found->len == 1);
+  struct located_barcode *located = darray_index(found, 0);
+  assert(located->score > 0.5 && located->score <= 1);
+  assert(near(&located->corners.upper_left, 80, 110));
+  assert(near(&located->corners.upper_right, 320, 110));
+  assert(near(&located->corners.lower_left, 80, 190));
+  assert(near(&located->corners.lower_right, 320, 190));
+  darray_free(found, true);
+  image8_free(im);
+  assert_mem_clean();
+
+  // rotated a quarter turn, the rows run downwards
+  im = page(200, 190, M_PI_2);
+  found = image8_locate_gradients(im, &settings, malloc, realloc, free);
+  assert(found->len == 1);
+  located = darray_index(found, 0);
+  assert(near(&located->corners.upper_left, 240, 70));
+  assert(near(&located->corners.lower_right, 160, 310));
+  darray_free(found, true);
+  image8_free(im);
+
+  // and at an angle
+  im = page(240, 200, M_PI/6);
+  found = image8_locate_gradients(im, &settings, malloc, realloc, free);
+  assert(found->len == 1);
+  located = darray_index(found, 0);
+  double ux = cos(M_PI/6)*120, uy = sin(M_PI/6)*120, vx = -sin(M_PI/6)*40, vy = cos(M_PI/6)*40;
+  assert(near(&located->corners.upper_left, 240 - ux - vx, 200 - uy - vy));
+  assert(near(&located->corners.lower_right, 240 + ux + vx, 200 + uy + vy));
+  darray_free(found, true);
+  image8_free(im);
+
+  // blank and tiny images have none
+  im = image8_new(100, 3, malloc, free);
+  memset(im->data, 255, 300);
+  found = image8_locate_gradients(im, &settings, malloc, realloc, free);
+  assert(found->len == 0);
+  darray_free(found, true);
+  image8_free(im);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_sobel_row,
+    test_image8_locate_gradients
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
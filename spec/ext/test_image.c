@@ -80,6 +80,88 @@ void test_image32_usage(void) {
   fprintf(stderr, "PASS\n");
 }
 
+void test_image1_new(void) {
+  fprintf(stderr, "Testing image1_new...");
+
+  struct image1 *im;
+  while(!(im=image1_new(65, 20, xmalloc, xfree)));
+  assert(im->width == 65);
+  assert(im->height == 20);
+  assert(im->stride == 2);
+  image1_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_usage(void) {
+  fprintf(stderr, "Testing image1 usage...");
+
+  struct image1 *im;
+  while(!(im=image1_new(100, 20, calloc1, xfree)));
+  assert(!image1_get(im, 0, 0));
+  assert(!image1_get(im, 99, 0));
+  assert(!image1_get(im, 64, 5));
+  image1_set(im, 0, 0, true);
+  image1_set(im, 99, 0, true);
+  image1_set(im, 64, 5, true);
+  image1_set(im, 63, 5, true);
+  image1_set(im, 63, 5, false);
+  image1_set(im, 2000, 5, true); // should catch out of bounds
+  assert(image1_get(im, 0, 0));
+  assert(image1_get(im, 99, 0));
+  assert(image1_get(im, 64, 5));
+  assert(!image1_get(im, 63, 5));
+  assert(!image1_get(im, 65, 5));
+  assert(image1_get_with_fallback(im, 64, 5, false));
+  assert(image1_get_with_fallback(im, 2000, 5, true));
+  assert(!image1_get_with_fallback(im, -1, 0, false));
+  image1_free(im);
+  image1_free(NULL);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_run_end(void) {
+  fprintf(stderr, "Testing image1_run_end...");
+
+  struct image1 *im;
+  while(!(im=image1_new(150, 2, calloc1, xfree)));
+  for (int x = 3; x < 140; x++) image1_set(im, x, 1, true);
+  assert(image1_run_end(im, 0, 0) == 150);
+  assert(image1_run_end(im, 149, 0) == 150);
+  assert(image1_run_end(im, 0, 1) == 3);
+  assert(image1_run_end(im, 3, 1) == 140);
+  assert(image1_run_end(im, 70, 1) == 140);
+  assert(image1_run_end(im, 140, 1) == 150);
+  image1_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_binarize(void) {
+  fprintf(stderr, "Testing image8_binarize...");
+
+  struct image8 *im = load_image_fixture("32x32_solitary_circle.raw"), *unpacked;
+  struct image1 *binary;
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  while (!(unpacked=image8_new(32, 32, xmalloc, xfree)));
+  image1_unpack(binary, unpacked);
+  for (int y = 0; y < 32; y++) {
+    for (int x = 0; x < 32; x++) {
+      assert(image1_get(binary, x, y) == (image8_get(im, x, y) >= 128));
+      assert(image8_get(unpacked, x, y) == (image1_get(binary, x, y) ? 255 : 0));
+    }
+  }
+  image8_free(im);
+  image8_free(unpacked);
+  image1_free(binary);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
 
 void test_point_new(void) {
   fprintf(stderr, "Testing point_new...");
@@ -116,25 +198,51 @@ void test_region_new(void) {
   assert(reg->cx == 0);
   assert(reg->cy == 0);
   assert(reg->area == 0);
-  assert(reg->boundary);
-  assert(reg->boundary->len == 0);
-  assert(reg->boundary->capacity > 0);
-  assert(reg->boundary->capacity < 64);
+  assert(reg->boundary.len == 0);
+  assert(!reg->boundary.codes);
   region_free(reg);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
 }
 
-void test_region_shallow_free(void) {
-  fprintf(stderr, "Testing region_shallow_free...");
+void test_boundary(void) {
+  fprintf(stderr, "Testing boundary...");
 
-  struct point p1 = {4, 3}, p2 = {0, 19};
-  struct region *reg;
-  while(!(reg=region_new(xmalloc, xrealloc, xfree)));
-  while(!darray_push(reg->boundary, &p1));
-  while(!darray_push(reg->boundary, &p2));
-  region_shallow_free(reg);
+  // a step to each neighbor, staying put, and jumps, even to negative coordinates
+  struct point points[] = {
+    {4, 3}, {5, 3}, {6, 4}, {6, 5}, {5, 6}, {4, 6}, {3, 5}, {3, 4}, {4, 3},
+    {4, 3}, {0, 19}, {-7, 100000}, {-6, 99999}
+  };
+  int num = sizeof(points) / sizeof(points[0]);
+  struct boundary boundary;
+  boundary_init(&boundary, xrealloc, xfree);
+  for (int i = 0; i < num; i++) {
+    while (!boundary_push(&boundary, points[i].x, points[i].y)) assert(boundary.len == (unsigned) i);
+  }
+  assert(boundary.len == (unsigned) num);
+  assert(boundary.nibbles == 8 + 3*17 + 1);
+
+  struct boundary_iterator it;
+  struct point p;
+  boundary_iterate(&boundary, &it);
+  for (int i = 0; i < num; i++) {
+    assert(boundary_next(&it, &p));
+    assert(p.x == points[i].x && p.y == points[i].y);
+  }
+  assert(!boundary_next(&it, &p));
+
+  // cleared, its memory is reused
+  unsigned char *codes = boundary.codes;
+  boundary_clear(&boundary);
+  while (!boundary_push(&boundary, 1, 1));
+  while (!boundary_push(&boundary, 1, 2));
+  assert(boundary.len == 2 && boundary.codes == codes);
+  boundary_iterate(&boundary, &it);
+  assert(boundary_next(&it, &p) && boundary_next(&it, &p) && p.x == 1 && p.y == 2 && !boundary_next(&it, &p));
+
+  boundary_release(&boundary);
+  assert(boundary.len == 0 && !boundary.codes);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
@@ -143,13 +251,10 @@ void test_region_shallow_free(void) {
 void test_region_free(void) {
   fprintf(stderr, "Testing region_free...");
 
-  struct point *p1, *p2;
-  while(!(p1=point_new(4, 3, xmalloc)));
-  while(!(p2=point_new(0, 19, xmalloc)));
   struct region *reg;
   while(!(reg=region_new(xmalloc, xrealloc, xfree)));
-  while(!darray_push(reg->boundary, p1));
-  while(!darray_push(reg->boundary, p2));
+  while(!boundary_push(&reg->boundary, 4, 3));
+  while(!boundary_push(&reg->boundary, 0, 19));
   region_free(reg);
   assert_mem_clean();
 
@@ -214,18 +319,16 @@ void test_image_follow_contour(void) {
   fprintf(stderr, "Testing image_follow_contour...");
 
   struct image8 *im = load_image_fixture("32x32_solitary_circle.raw");
-  struct darray *boundary;
-  while(!(boundary=darray_new(32, xfree, xmalloc, xrealloc, xfree)));
+  struct boundary boundary;
+  boundary_init(&boundary, xrealloc, xfree);
   set_allocation_success_chance(0.85);
-  while(!image_follow_contour(im, boundary, 15, 8)) {
-    // reset boundary array
-    for (unsigned i=0; i<boundary->len; i++) boundary->eltfree(darray_index(boundary, i));
-    boundary->len = 0;
-  }
+  while(!image_follow_contour(im, &boundary, 15, 8)) boundary_clear(&boundary);
   set_allocation_success_chance(0.5);
-  assert(boundary->len == 40);
+  assert(boundary.len == 40);
+  // every step is to a neighbor
+  assert(boundary.nibbles == 39);
   image8_free(im);
-  darray_free(boundary, true);
+  boundary_release(&boundary);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
@@ -246,16 +349,16 @@ void test_image_extract_regions(void) {
                 *r2 = darray_index(regions, 1),
                 *r3 = darray_index(regions, 2),
                 *r4 = darray_index(regions, 3);
-  assert(r1->boundary->len == 418);
+  assert(r1->boundary.len == 418);
   assert(r1->area == 7011);
   assert(r1->cx == 142 && r1->cy == 207);
-  assert(r2->boundary->len == (256-1)*4);
+  assert(r2->boundary.len == (256-1)*4);
   assert(r2->area == 256*256-7011-7341-1914);
   assert(r2->cx == 121 && r2->cy == 123);
-  assert(r3->boundary->len == 352);
+  assert(r3->boundary.len == 352);
   assert(r3->area == 7341);
   assert(r3->cx == 173 && r3->cy == 96);
-  assert(r4->boundary->len == 129);
+  assert(r4->boundary.len == 129);
   assert(r4->area == 1914);
   assert(r4->cx == 60 && r4->cy == 60);
   image8_free(im);
@@ -266,21 +369,258 @@ void test_image_extract_regions(void) {
   fprintf(stderr, "PASS\n");
 }
 
+void test_image1_label_regions(void) {
+  fprintf(stderr, "Testing image1_label_regions...");
+
+  struct image8 *im = load_image_fixture("32x32_complex_regions.raw");
+  struct image1 *binary;
+  struct image32 *expected, *labeled;
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  image1_unpack(binary, im);
+  while (!(expected=image_label_regions(im, xmalloc, xrealloc, xfree)));
+  while (!(labeled=image1_label_regions(binary, LABEL_BOTH, xmalloc, xrealloc, xfree)));
+  // the labels themselves may differ, but they must partition the image identically
+  for (int i = 0; i < 32*32; i++) {
+    for (int j = 0; j < 32*32; j++) {
+      assert((expected->data[i] == expected->data[j]) == (labeled->data[i] == labeled->data[j]));
+    }
+  }
+  image8_free(im);
+  image1_free(binary);
+  image32_free(expected);
+  image32_free(labeled);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_label_regions_polarity(void) {
+  fprintf(stderr, "Testing image1_label_regions with polarity...");
+
+  struct image8 *im = load_image_fixture("32x32_complex_regions.raw");
+  struct image1 *binary;
+  struct image32 *both, *dark, *light;
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  while (!(both=image1_label_regions(binary, LABEL_BOTH, xmalloc, xrealloc, xfree)));
+  while (!(dark=image1_label_regions(binary, LABEL_DARK, xmalloc, xrealloc, xfree)));
+  while (!(light=image1_label_regions(binary, LABEL_LIGHT, xmalloc, xrealloc, xfree)));
+  // pixels of the other color are left unlabeled, and the rest are partitioned
+  // as when labeling both
+  for (int i = 0; i < 32*32; i++) {
+    bool is_light = image1_get(binary, i % 32, i / 32);
+    assert((dark->data[i] == 0) == is_light && (light->data[i] == 0) == !is_light);
+    for (int j = 0; j < 32*32; j++) {
+      struct image32 *labeled = is_light ? light : dark;
+      if (labeled->data[j] == 0) continue;
+      assert((both->data[i] == both->data[j]) == (labeled->data[i] == labeled->data[j]));
+    }
+  }
+  image8_free(im);
+  image1_free(binary);
+  image32_free(both);
+  image32_free(dark);
+  image32_free(light);
+
+  // and only the regions of that color are extracted
+  im = load_image_fixture("256x256_assorted_polygons.raw");
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  struct darray *regions[3];
+  enum label_polarity polarities[] = {LABEL_BOTH, LABEL_DARK, LABEL_LIGHT};
+  set_allocation_success_chance(0.998);
+  for (int p = 0; p < 3; p++) {
+    struct image32 *labeled;
+    while (!(labeled=image1_label_regions(binary, polarities[p], xmalloc, xrealloc, xfree)));
+    while (!(regions[p]=image1_extract_regions(binary, labeled, xmalloc, xrealloc, xfree)));
+    image32_free(labeled);
+  }
+  set_allocation_success_chance(0.5);
+  assert(regions[1]->len > 0 && regions[2]->len > 0);
+  assert(regions[1]->len + regions[2]->len == regions[0]->len);
+  for (int p = 1; p < 3; p++) {
+    for (unsigned i = 0; i < regions[p]->len; i++) {
+      struct region *r = darray_index(regions[p], i);
+      struct point *first = &r->boundary.start;
+      bool is_light = image1_get(binary, first->x, first->y);
+      assert(is_light == (polarities[p] == LABEL_LIGHT));
+      int matches = 0;
+      for (unsigned j = 0; j < regions[0]->len; j++) {
+        struct region *s = darray_index(regions[0], j);
+        matches += s->area == r->area && s->cx == r->cx && s->cy == r->cy && s->boundary.len == r->boundary.len;
+      }
+      assert(matches == 1);
+    }
+  }
+  for (int p = 0; p < 3; p++) darray_free(regions[p], true);
+  image8_free(im);
+  image1_free(binary);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image_neighborhood(void) {
+  fprintf(stderr, "Testing image8_neighborhood and image1_neighborhood...");
+
+  struct image8 *im = load_image_fixture("32x32_complex_regions.raw"), *codes8, *codes1;
+  struct image1 *binary;
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  image1_unpack(binary, im);
+  while (!(codes8=image8_neighborhood(im, xmalloc, xfree)));
+  while (!(codes1=image1_neighborhood(binary, xmalloc, xfree)));
+  assert(codes8->width == 34 && codes8->height == 34);
+  for (int y = -1; y <= 32; y++) {
+    for (int x = -1; x <= 32; x++) {
+      unsigned char code = image8_get(codes8, x+1, y+1);
+      assert(code == image8_get(codes1, x+1, y+1));
+      if (x < 0 || x >= 32 || y < 0 || y >= 32) {
+        assert(code == 0);
+        continue;
+      }
+      for (int i = 0; i < 8; i++) {
+        int nx = x + neighbor_offsets[i][0], ny = y + neighbor_offsets[i][1];
+        bool same = image8_get_with_fallback(im, nx, ny, ~image8_get(im, x, y)) == image8_get(im, x, y);
+        assert(((code >> i) & 1) == same);
+      }
+    }
+  }
+  image8_free(im);
+  image8_free(codes8);
+  image8_free(codes1);
+  image1_free(binary);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_neighborhood_follow_contour(void) {
+  fprintf(stderr, "Testing neighborhood_follow_contour...");
+
+  struct image8 *im = load_image_fixture("256x256_convex_hull_M.raw"), *codes;
+  struct boundary expected, boundary;
+  boundary_init(&expected, xrealloc, xfree);
+  boundary_init(&boundary, xrealloc, xfree);
+  while (!(codes=image8_neighborhood(im, xmalloc, xfree)));
+  set_allocation_success_chance(0.999);
+  for (int y = 0; y < 256; y += 17) {
+    for (int x = 0; x < 256; x += 13) {
+      boundary_clear(&expected);
+      boundary_clear(&boundary);
+      while (!image_follow_contour(im, &expected, x, y)) boundary_clear(&expected);
+      while (!neighborhood_follow_contour(codes, &boundary, x, y)) boundary_clear(&boundary);
+      assert(boundary.len == expected.len && boundary.nibbles == expected.nibbles);
+      assert(!memcmp(&boundary.start, &expected.start, sizeof(boundary.start)));
+      assert(!memcmp(boundary.codes, expected.codes, boundary.nibbles/2));
+      if (boundary.nibbles & 1) assert(!((boundary.codes[boundary.nibbles/2] ^ expected.codes[boundary.nibbles/2]) & 0xf));
+    }
+  }
+  set_allocation_success_chance(0.5);
+  image8_free(im);
+  image8_free(codes);
+  boundary_release(&expected);
+  boundary_release(&boundary);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_extract_regions(void) {
+  fprintf(stderr, "Testing image1_extract_regions...");
+
+  struct image8 *im = load_image_fixture("256x256_assorted_polygons.raw");
+  struct image1 *binary;
+  struct image32 *labeled;
+  struct darray *regions;
+  while (!(binary=image8_binarize(im, 128, xmalloc, xfree)));
+  while (!(labeled=image1_label_regions(binary, LABEL_BOTH, xmalloc, xrealloc, xfree)));
+  set_allocation_success_chance(0.998);
+  while (!(regions=image1_extract_regions(binary, labeled, xmalloc, xrealloc, xfree)));
+  set_allocation_success_chance(0.5);
+  assert(regions->len == 4);
+  int found = 0;
+  for (unsigned i = 0; i < regions->len; i++) {
+    struct region *r = darray_index(regions, i);
+    if (r->area == 7011) found++, assert(r->boundary.len == 418 && r->cx == 142 && r->cy == 207);
+    if (r->area == 256*256-7011-7341-1914) found++, assert(r->boundary.len == (256-1)*4 && r->cx == 121 && r->cy == 123);
+    if (r->area == 7341) found++, assert(r->boundary.len == 352 && r->cx == 173 && r->cy == 96);
+    if (r->area == 1914) found++, assert(r->boundary.len == 129 && r->cx == 60 && r->cy == 60);
+    // a tenth of what a pointer to a point per boundary pixel took
+    assert(r->boundary.capacity*10 < r->boundary.len*(sizeof(struct point) + sizeof(void *)));
+  }
+  assert(found == 4);
+  image8_free(im);
+  image1_free(binary);
+  image32_free(labeled);
+  darray_free(regions, true);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_extract_moments(void) {
+  fprintf(stderr, "Testing image1_extract_moments...");
+
+  // a 20x60 bar and a diagonal line of 10 pixels, on a light background
+  struct image8 *im = image8_new(100, 100, malloc, free);
+  memset(im->data, 255, 100*100);
+  for (int y = 20; y < 80; y++) {
+    for (int x = 10; x < 30; x++) image8_set(im, x, y, 0);
+  }
+  for (int i = 0; i < 10; i++) {
+    image8_set(im, 50+i, 50+i, 0);
+    image8_set(im, 51+i, 50+i, 0);
+  }
+  struct image1 *binary = image8_binarize(im, 128, malloc, free);
+  struct image32 *labeled = image1_label_regions(binary, LABEL_DARK, malloc, realloc, free);
+  struct darray *moments;
+  while (!(moments=image1_extract_moments(binary, labeled, xmalloc, xrealloc, xfree)));
+  assert(moments->len == 2);
+
+  for (unsigned i = 0; i < moments->len; i++) {
+    struct region_moments *m = darray_index(moments, i);
+    if (m->area == 20*60) {
+      assert(m->start.x == 10 && m->start.y == 20);
+      assert(fabs(m->cx - 19.5) < 1e-9 && fabs(m->cy - 49.5) < 1e-9);
+      assert(fabs(m->mxx - 20*20/12.0) < 1e-6 && fabs(m->myy - 60*60/12.0) < 1e-6 && fabs(m->mxy) < 1e-6);
+    } else {
+      assert(m->area == 20 && m->start.x == 50 && m->start.y == 50);
+      // spread along the diagonal
+      assert(m->mxy > 0 && fabs(m->mxx - m->myy) < 0.5);
+    }
+  }
+  darray_free(moments, true);
+  assert_mem_clean();
+  image8_free(im);
+  image1_free(binary);
+  image32_free(labeled);
+
+  fprintf(stderr, "PASS\n");
+}
+
 int main(void) {
   void (*(tests[]))(void) = {
     test_image8_new,
     test_image8_usage,
     test_image32_new,
     test_image32_usage,
+    test_image1_new,
+    test_image1_usage,
+    test_image1_run_end,
+    test_image8_binarize,
     test_point_new,
     test_point_rotate,
     test_region_new,
-    test_region_shallow_free,
+    test_boundary,
     test_region_free,
     test_union_find,
     test_image_label_regions,
     test_image_follow_contour,
-    test_image_extract_regions
+    test_image_extract_regions,
+    test_image1_label_regions,
+    test_image1_label_regions_polarity,
+    test_image_neighborhood,
+    test_neighborhood_follow_contour,
+    test_image1_extract_regions,
+    test_image1_extract_moments
   };
   int num = sizeof(tests) / sizeof(tests[0]);
   run_tests(num, tests);
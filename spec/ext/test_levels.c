@@ -0,0 +1,149 @@
+#include "spec_helper.h"
+
+static struct pairing_settings settings = {
+  .area_threshold = 100,
+  .rectangularity_threshold = 0.8,
+  .angle_variation_threshold = 0.314,
+  .area_variation_threshold = 0.5,
+  .width_variation_threshold = 0.4,
+  .height_variation_threshold = 0.3,
+  .guard_aspect_min = 3,
+  .guard_aspect_max = 50,
+  .barcode_aspect_min = 0,
+  .barcode_aspect_max = 10
+};
+
+static void fill_rect(struct image8 *im, int x, int y, int width, int height, unsigned char value) {
+  for (int j = y; j < y+height; j++) {
+    for (int i = x; i < x+width; i++) image8_set(im, i, j, value);
+  }
+}
+
+// A pair of guards, dark on a lighter background.
+static void draw_guards(struct image8 *im, int x, int y, unsigned char bar, unsigned char background) {
+  fill_rect(im, x-10, y-10, 140, 80, background);
+  fill_rect(im, x, y, 8, 60, bar);
+  fill_rect(im, x+110, y, 7, 60, bar);
+}
+
+static struct located_guards located_at(int x, int y, int width, int height, double score) {
+  return (struct located_guards) {
+    .corners = {{x, y}, {x+width, y}, {x, y+height}, {x+width, y+height}},
+    .score = score
+  };
+}
+
+void test_located_guards_overlap(void) {
+  fprintf(stderr, "Testing located_guards_overlap...");
+
+  struct located_guards a = located_at(10, 10, 100, 40, 1), b = located_at(20, 15, 100, 40, 1),
+                        c = located_at(200, 10, 100, 40, 1), d = located_at(40, 20, 10, 5, 1);
+  assert(located_guards_overlap(&a, &b) && located_guards_overlap(&b, &a));
+  assert(!located_guards_overlap(&a, &c) && !located_guards_overlap(&c, &a));
+  // containment either way
+  assert(located_guards_overlap(&a, &d) && located_guards_overlap(&d, &a));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_located_guards_merge(void) {
+  fprintf(stderr, "Testing located_guards_merge...");
+
+  struct located_guards all[] = {
+    located_at(10, 10, 100, 40, 0.5),
+    located_at(200, 10, 100, 40, 0.7),
+    located_at(12, 11, 100, 40, 0.9),
+    located_at(198, 12, 100, 40, 0.7),
+    located_at(10, 200, 100, 40, 0.1)
+  };
+  for (int i = 0; i < 5; i++) all[i].level = i;
+  struct darray *found;
+  while (!(found=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
+  for (int i = 0; i < 5; i++) {
+    while (!darray_push(found, &all[i]));
+  }
+
+  while (!located_guards_merge(found, 2));
+  assert(found->len == 3);
+  assert(((struct located_guards *) darray_index(found, 0))->level == 2);
+  assert(((struct located_guards *) darray_index(found, 1))->level == 1); // ties go to the earlier level
+  assert(((struct located_guards *) darray_index(found, 2))->level == 4);
+
+  darray_free(found, false);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_locate_guards_levels(void) {
+  fprintf(stderr, "Testing image8_locate_guards_levels...");
+
+  unsigned char one[] = {128}, both[] = {128, 190, 100};
+  struct darray *found, *threaded;
+  struct image8 *im;
+  while (!(im=image8_new(300, 200, xmalloc, xfree)));
+  memset(im->data, 255, im->width*im->height);
+  draw_guards(im, 20, 20, 40, 200); // high contrast
+  draw_guards(im, 160, 120, 150, 230); // low contrast
+
+  // failing part way through frees everything
+  for (int trial = 0; trial < 20; trial++) {
+    found = image8_locate_guards_levels(im, both, 3, NULL, 0, &settings, 1, xmalloc, xrealloc, xfree);
+    darray_free(found, true);
+  }
+  image8_free(im);
+  assert_mem_clean();
+
+  // the whole pipeline makes too many allocations to retry until none fail
+  set_allocation_success_chance(1);
+  while (!(im=image8_new(300, 200, xmalloc, xfree)));
+  memset(im->data, 255, im->width*im->height);
+  draw_guards(im, 20, 20, 40, 200);
+  draw_guards(im, 160, 120, 150, 230);
+
+  while (!(found=image8_locate_guards_levels(im, one, 1, NULL, 0, &settings, 1, xmalloc, xrealloc, xfree)));
+  assert(found->len == 1);
+  darray_free(found, true);
+
+  // found at every level, but reported once
+  while (!(found=image8_locate_guards_levels(im, both, 3, NULL, 0, &settings, 1, xmalloc, xrealloc, xfree)));
+  assert(found->len == 2);
+  struct located_guards *first = darray_index(found, 0), *second = darray_index(found, 1);
+  assert(first->score >= second->score);
+  assert((first->level == 1) != (second->level == 1));
+
+  // closing with a small kernel changes nothing here
+  struct morphology_kernel closings[] = {{3, 3, false}};
+  while (!(threaded=image8_locate_guards_levels(im, both, 3, closings, 1, &settings, 1, xmalloc, xrealloc, xfree)));
+  assert(threaded->len == 2);
+  darray_free(threaded, true);
+
+  // the same, whatever the number of threads
+  for (int threads = 2; threads <= 4; threads++) {
+    threaded = image8_locate_guards_levels(im, both, 3, NULL, 0, &settings, threads, malloc, realloc, free);
+    assert(threaded && threaded->len == found->len);
+    for (unsigned i = 0; i < found->len; i++) {
+      struct located_guards *a = darray_index(found, i), *b = darray_index(threaded, i);
+      assert(a->level == b->level && a->score == b->score);
+      assert(memcmp(&a->corners, &b->corners, sizeof(a->corners)) == 0);
+    }
+    darray_free(threaded, true);
+  }
+  set_allocation_success_chance(0.5);
+
+  darray_free(found, true);
+  image8_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_located_guards_overlap,
+    test_located_guards_merge,
+    test_image8_locate_guards_levels
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,144 @@
+#include "spec_helper.h"
+
+static struct image8 *random_image(int width, int height, bool binary) {
+  struct image8 *im;
+  while (!(im=image8_new(width, height, xmalloc, xfree)));
+  for (int i = 0; i < width*height; i++) {
+    im->data[i] = binary ? ((rand() & 3) ? 255 : 0) : rand() & 255;
+  }
+  return im;
+}
+
+static struct image8 *copy_image(struct image8 *im) {
+  struct image8 *copy;
+  while (!(copy=image8_new(im->width, im->height, xmalloc, xfree)));
+  memcpy(copy->data, im->data, im->width*im->height);
+  return copy;
+}
+
+// straightforward O(kw*kh) implementation to check against
+static void reference_morph(struct image8 *im, struct image8 *out, struct morphology_kernel *kernel, bool max) {
+  int lox = max ? kernel->width/2 : (kernel->width-1)/2,
+      loy = max ? kernel->height/2 : (kernel->height-1)/2;
+  for (int y = 0; y < im->height; y++) {
+    for (int x = 0; x < im->width; x++) {
+      int val = max ? 0 : 255;
+      for (int j = 0; j < kernel->height; j++) {
+        for (int i = 0; i < kernel->width; i++) {
+          if (kernel->hollow && i != 0 && i != kernel->width-1) continue;
+          int nx = x - lox + i, ny = y - loy + j;
+          if (nx < 0 || nx >= im->width || ny < 0 || ny >= im->height) continue;
+          int v = image8_get(im, nx, ny);
+          if (max ? v > val : v < val) val = v;
+        }
+      }
+      image8_set(out, x, y, val);
+    }
+  }
+}
+
+static void assert_morph_matches(int width, int height, bool binary, struct morphology_kernel kernel, bool max) {
+  struct image8 *im = random_image(width, height, binary),
+                *expected = copy_image(im);
+  reference_morph(im, expected, &kernel, max);
+  if (max) while (!image_dilate(im, &kernel, xmalloc, xfree));
+  else while (!image_erode(im, &kernel, xmalloc, xfree));
+  assert(memcmp(im->data, expected->data, width*height) == 0);
+  image8_free(im);
+  image8_free(expected);
+}
+
+void test_image8_is_binary(void) {
+  fprintf(stderr, "Testing image8_is_binary...");
+
+  struct image8 *im = random_image(13, 7, true);
+  assert(image8_is_binary(im));
+  image8_set(im, 3, 3, 1);
+  assert(!image8_is_binary(im));
+  image8_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image_erode(void) {
+  fprintf(stderr, "Testing image_erode...");
+
+  for (int i = 0; i < 2; i++) {
+    bool binary = i;
+    assert_morph_matches(1, 1, binary, (struct morphology_kernel) { 3, 3, false }, false);
+    assert_morph_matches(17, 9, binary, (struct morphology_kernel) { 1, 1, false }, false);
+    assert_morph_matches(17, 9, binary, (struct morphology_kernel) { 3, 3, false }, false);
+    assert_morph_matches(31, 23, binary, (struct morphology_kernel) { 4, 7, false }, false);
+    assert_morph_matches(130, 20, binary, (struct morphology_kernel) { 7, 7, false }, false);
+    assert_morph_matches(200, 11, binary, (struct morphology_kernel) { 70, 2, false }, false);
+    assert_morph_matches(70, 40, binary, (struct morphology_kernel) { 3, 6, true }, false);
+    assert_morph_matches(5, 5, binary, (struct morphology_kernel) { 9, 9, false }, false);
+  }
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image_dilate(void) {
+  fprintf(stderr, "Testing image_dilate...");
+
+  for (int i = 0; i < 2; i++) {
+    bool binary = i;
+    assert_morph_matches(1, 1, binary, (struct morphology_kernel) { 3, 3, false }, true);
+    assert_morph_matches(17, 9, binary, (struct morphology_kernel) { 1, 1, false }, true);
+    assert_morph_matches(17, 9, binary, (struct morphology_kernel) { 3, 3, false }, true);
+    assert_morph_matches(31, 23, binary, (struct morphology_kernel) { 4, 7, false }, true);
+    assert_morph_matches(130, 20, binary, (struct morphology_kernel) { 7, 7, false }, true);
+    assert_morph_matches(200, 11, binary, (struct morphology_kernel) { 70, 2, false }, true);
+    assert_morph_matches(70, 40, binary, (struct morphology_kernel) { 3, 6, true }, true);
+    assert_morph_matches(5, 5, binary, (struct morphology_kernel) { 9, 9, false }, true);
+  }
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image_morphology(void) {
+  fprintf(stderr, "Testing image_morphology...");
+
+  struct morphology_kernel kernel = { 3, 6, true };
+  struct image8 *im = random_image(64, 64, true), *opened, *closed, *expected;
+
+  // opening and closing are idempotent
+  do { opened = copy_image(im); } while (!image_morphology(opened, MORPHOLOGY_OPEN, &kernel, xmalloc, xfree) && (image8_free(opened), true));
+  expected = copy_image(opened);
+  while (!image_morphology(opened, MORPHOLOGY_OPEN, &kernel, xmalloc, xfree)) memcpy(opened->data, expected->data, 64*64);
+  assert(memcmp(opened->data, expected->data, 64*64) == 0);
+  image8_free(expected);
+
+  do { closed = copy_image(im); } while (!image_morphology(closed, MORPHOLOGY_CLOSE, &kernel, xmalloc, xfree) && (image8_free(closed), true));
+  expected = copy_image(closed);
+  while (!image_morphology(closed, MORPHOLOGY_CLOSE, &kernel, xmalloc, xfree)) memcpy(closed->data, expected->data, 64*64);
+  assert(memcmp(closed->data, expected->data, 64*64) == 0);
+  image8_free(expected);
+
+  // opening is anti-extensive and closing is extensive
+  for (int i = 0; i < 64*64; i++) {
+    assert(opened->data[i] <= im->data[i]);
+    assert(closed->data[i] >= im->data[i]);
+  }
+
+  image8_free(im);
+  image8_free(opened);
+  image8_free(closed);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_image8_is_binary,
+    test_image_erode,
+    test_image_dilate,
+    test_image_morphology
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -13,11 +13,12 @@ void test_boundary_convex_hull(void) {
   struct region *region = darray_index(regions, 0);
   assert(regions->len == 2);
   assert(region->area == 23932);
-  assert(region->boundary->len == 1135);
+  assert(region->boundary.len == 1135);
   struct darray *hull;
+  struct hull_storage storage = {0};
   set_allocation_success_chance(0.8);
   while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
-  while (!boundary_convex_hull(region->boundary, hull)) hull->len = 0;
+  while (!boundary_convex_hull(&region->boundary, hull, &storage)) hull->len = 0;
   set_allocation_success_chance(0.5);
   assert(hull->len == 5);
   struct point *p1 = darray_index(hull, 0),
@@ -34,22 +35,24 @@ void test_boundary_convex_hull(void) {
   image32_free(labeled);
   darray_free(regions, true);
   darray_free(hull, false);
+  xfree(storage.points);
   assert_mem_clean();
 
-  // with a small input
-  struct darray *boundary;
+  // with a small input, of points that aren't neighbors
+  struct boundary boundary;
+  storage = (struct hull_storage) {0};
+  boundary_init(&boundary, xrealloc, xfree);
   while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
-  while (!(boundary=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
-  while (!(p1=point_new(1, 2, xmalloc)));
-  while (!(p2=point_new(3, 5, xmalloc)));
-  while (!(p3=point_new(0, 10, xmalloc)));
-  while (!darray_push(boundary, p1));
-  while (!darray_push(boundary, p2));
-  while (!darray_push(boundary, p3));
-  while (!boundary_convex_hull(boundary, hull)) hull->len = 0;
+  while (!boundary_push(&boundary, 1, 2));
+  while (!boundary_push(&boundary, 3, 5));
+  while (!boundary_push(&boundary, 0, 10));
+  while (!boundary_convex_hull(&boundary, hull, &storage)) hull->len = 0;
   assert(hull->len == 3);
-  darray_free(boundary, true);
+  p3 = darray_index(hull, 2);
+  assert(p3->x == 0 && p3->y == 10);
+  boundary_release(&boundary);
   darray_free(hull, false);
+  xfree(storage.points);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
@@ -70,28 +73,29 @@ void test_hull_minimal_rectangle(void) {
   while (!(regions=image_extract_regions(im, labeled, xmalloc, xrealloc, xfree)));
   assert(regions->len == 4);
   struct darray *hull;
+  struct hull_storage storage = {0};
   struct region *region;
   struct rectangle rect;
   set_allocation_success_chance(0.9);
   while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
 
   region = darray_index(regions, 0);
-  do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+  do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
   hull_minimal_rectangle(hull, region->area, &rect);
   assert_rectangle(rect, 140, 205, 7011, 51, 161, 1.5708);
 
   region = darray_index(regions, 1);
-  do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+  do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
   hull_minimal_rectangle(hull, region->area, &rect);
   assert_rectangle(rect, 127, 128, 49270, 256, 256, 0.0);
 
   region = darray_index(regions, 2);
-  do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+  do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
   hull_minimal_rectangle(hull, region->area, &rect);
   assert_rectangle(rect, 151, 89, 7341, 118, 122, 2.97644);
 
   region = darray_index(regions, 3);
-  do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+  do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
   hull_minimal_rectangle(hull, region->area, &rect);
   assert_rectangle(rect, 60, 60, 1914, 31, 61, 0.78540);
 
@@ -99,6 +103,51 @@ void test_hull_minimal_rectangle(void) {
   image32_free(labeled);
   darray_free(regions, true);
   darray_free(hull, false);
+  xfree(storage.points);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+// the hull borrows the points, so simplification needn't free anything
+static struct darray *hull_from_points(int num, struct point *points) {
+  struct darray *hull;
+  while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
+  for (int i = 0; i < num; i++) while (!darray_push(hull, &points[i]));
+  return hull;
+}
+
+static void assert_hull(struct darray *hull, int num, struct point *points) {
+  assert(hull->len == (unsigned) num);
+  for (int i = 0; i < num; i++) {
+    struct point *p = darray_index(hull, i);
+    assert(p->x == points[i].x && p->y == points[i].y);
+  }
+}
+
+void test_hull_simplify(void) {
+  fprintf(stderr, "Testing hull_simplify...");
+
+  // collinear points go, and the point one pixel off its chord stays unless the
+  // tolerance covers it
+  struct point points[] = {{0, 0}, {10, 0}, {40, 0}, {40, 20}, {20, 21}, {0, 20}, {0, 10}};
+  struct darray *hull = hull_from_points(7, points);
+  hull_simplify(hull, 0.5);
+  assert_hull(hull, 5, (struct point[]) {{0, 0}, {40, 0}, {40, 20}, {20, 21}, {0, 20}});
+  hull_simplify(hull, 1.0);
+  assert_hull(hull, 4, (struct point[]) {{0, 0}, {40, 0}, {40, 20}, {0, 20}});
+
+  struct rectangle rect;
+  hull_minimal_rectangle(hull, 800, &rect);
+  assert_rectangle(rect, 20, 10, 800, 21, 41, 1.5708);
+  darray_free(hull, false);
+
+  // degenerate hulls are left alone
+  struct point line[] = {{0, 0}, {5, 0}, {10, 0}, {5, 0}};
+  hull = hull_from_points(4, line);
+  hull_simplify(hull, 0.5);
+  assert_hull(hull, 4, line);
+  darray_free(hull, false);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
@@ -116,12 +165,13 @@ void test_pair_aligned_rectangles(void) {
   set_allocation_success_chance(0.5);
   assert(regions->len == 13);
   struct darray *rects, *hull, *pairs;
+  struct hull_storage storage = {0};
   while (!(rects=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
   while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
   while (!(pairs=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
   for (unsigned i = 0; i < regions->len; i++) {
     struct region *region = darray_index(regions, i);
-    do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+    do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
     struct rectangle *rect;
     while (!(rect=xmalloc(sizeof(*rect))));
     hull_minimal_rectangle(hull, region->area, rect);
@@ -179,11 +229,74 @@ void test_pair_aligned_rectangles(void) {
   darray_free(rects, true);
   darray_free(regions, true);
   darray_free(hull, false);
+  xfree(storage.points);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
 }
 
+// A sheet of guard-like rectangles, rows of them side by side, in a scrambled
+// order, so that there are plenty of pairs.
+static struct darray *guard_sheet(int rows, int columns) {
+  struct darray *rects = darray_new(0, free, malloc, realloc, free);
+
+  for (int k = 0; k < rows*columns; k++) {
+    int i = (k*7919) % (rows*columns), row = i / columns, column = i % columns;
+    struct rectangle *rect = malloc(sizeof(*rect));
+    *rect = (struct rectangle) {
+      .cx = 20 + 60*column + row % 3, .cy = 30 + 70*row,
+      .width = 6 + column % 2, .height = 40 + (row + column) % 5,
+      .fill = 0, .orientation = 0
+    };
+    rect->fill = (long) rect->width*rect->height - (i % 11);
+    darray_push(rects, rect);
+  }
+
+  return rects;
+}
+
+void test_pair_aligned_rectangles_threaded(void) {
+  fprintf(stderr, "Testing pair_aligned_rectangles threaded...");
+
+  struct pairing_settings settings = {
+    .area_threshold = 100,
+    .rectangularity_threshold = 0.8,
+    .angle_variation_threshold = 0.314,
+    .area_variation_threshold = 0.5,
+    .width_variation_threshold = 0.4,
+    .height_variation_threshold = 0.3,
+    .guard_aspect_min = 3,
+    .guard_aspect_max = 50,
+    .barcode_aspect_min = 0,
+    .barcode_aspect_max = 10,
+    .threads = 1
+  };
+  struct darray *rects = guard_sheet(40, 16), *pairs = darray_new(0, free, malloc, realloc, free);
+  assert(pair_aligned_rectangles(&settings, rects, pairs));
+  assert(pairs->len > rects->len);
+
+  // the same pairs in the same order, however many threads find them
+  int threads[] = {2, 3, 5, 8};
+  for (int t = 0; t < 4; t++) {
+    settings.threads = threads[t];
+    struct darray *threaded_rects = guard_sheet(40, 16), *threaded = darray_new(0, free, malloc, realloc, free);
+    assert(pair_aligned_rectangles(&settings, threaded_rects, threaded));
+    assert(threaded->len == pairs->len);
+    for (unsigned i = 0; i < pairs->len; i++) {
+      struct rectangle_pair *a = darray_index(pairs, i), *b = darray_index(threaded, i);
+      assert(a->score == b->score);
+      assert(memcmp(a->one, b->one, sizeof(*a->one)) == 0 && memcmp(a->two, b->two, sizeof(*a->two)) == 0);
+    }
+    darray_free(threaded, true);
+    darray_free(threaded_rects, true);
+  }
+
+  darray_free(pairs, true);
+  darray_free(rects, true);
+
+  fprintf(stderr, "PASS\n");
+}
+
 void test_determine_barcode_corners(void) {
   fprintf(stderr, "Testing determine_barcode_corners...");
 
@@ -196,12 +309,13 @@ void test_determine_barcode_corners(void) {
   set_allocation_success_chance(0.5);
   assert(regions->len == 13);
   struct darray *rects, *hull, *pairs;
+  struct hull_storage storage = {0};
   while (!(rects=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
   while (!(hull=darray_new(0, NULL, xmalloc, xrealloc, xfree)));
   while (!(pairs=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
   for (unsigned i = 0; i < regions->len; i++) {
     struct region *region = darray_index(regions, i);
-    do { hull->len = 0; } while (!boundary_convex_hull(region->boundary, hull));
+    do { hull->len = 0; } while (!boundary_convex_hull(&region->boundary, hull, &storage));
     struct rectangle *rect;
     while (!(rect=xmalloc(sizeof(*rect))));
     hull_minimal_rectangle(hull, region->area, rect);
@@ -244,17 +358,98 @@ void test_determine_barcode_corners(void) {
   darray_free(rects, true);
   darray_free(regions, true);
   darray_free(hull, false);
+  xfree(storage.points);
   assert_mem_clean();
 
   fprintf(stderr, "PASS\n");
 }
 
+void test_moments_rectangle(void) {
+  fprintf(stderr, "Testing moments_rectangle...");
+
+  // a 10x40 rectangle, standing upright and turned a little
+  struct region_moments upright = {.area = 400, .cx = 50, .cy = 60, .mxx = 100/12.0, .myy = 1600/12.0, .mxy = 0};
+  struct rectangle rect;
+  moments_rectangle(&upright, &rect);
+  assert_rectangle(rect, 50, 60, 400, 10, 40, 0);
+
+  double angle = 0.3, c = cos(angle), s = sin(angle);
+  struct region_moments turned = {
+    .area = 400, .cx = 50, .cy = 60,
+    .mxx = c*c*100/12.0 + s*s*1600/12.0,
+    .myy = s*s*100/12.0 + c*c*1600/12.0,
+    .mxy = c*s*(100/12.0 - 1600/12.0)
+  };
+  moments_rectangle(&turned, &rect);
+  assert(rect.width == 10 && rect.height == 40 && rect.fill == 400);
+  assert(fabs(rect.orientation - angle) < 1e-9);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_locate_guards_fast_fit(void) {
+  fprintf(stderr, "Testing image1_locate_guards with fast fitting...");
+
+  struct pairing_settings settings = {
+    .area_threshold = 100,
+    .rectangularity_threshold = 0.8,
+    .angle_variation_threshold = 0.314,
+    .area_variation_threshold = 0.5,
+    .width_variation_threshold = 0.4,
+    .height_variation_threshold = 0.3,
+    .guard_aspect_min = 3,
+    .guard_aspect_max = 50,
+    .barcode_aspect_min = 0,
+    .barcode_aspect_max = 10
+  }, fast = settings;
+  fast.fast_fit = true;
+
+  struct image8 *im = load_image_fixture("256x256_assorted_rectangles.raw");
+  struct image1 *binary = image8_binarize(im, 128, malloc, free);
+  struct darray *rects = darray_new(0, free, malloc, realloc, free), *pairs = darray_new(0, free, malloc, realloc, free),
+                *fast_rects, *fast_pairs;
+  assert(image1_locate_guards(binary, &settings, rects, pairs));
+  assert(pairs->len > 0);
+
+  // the pairs the exact fit finds, from the rectangles fit exactly
+  set_allocation_success_chance(0.999);
+  while (true) {
+    while (!(fast_rects=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+    while (!(fast_pairs=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+    if (image1_locate_guards(binary, &fast, fast_rects, fast_pairs)) break;
+    darray_free(fast_rects, true);
+    darray_free(fast_pairs, true);
+  }
+  set_allocation_success_chance(0.5);
+  assert(fast_pairs->len == pairs->len);
+  assert(fast_rects->len < rects->len);
+  for (unsigned i = 0; i < pairs->len; i++) {
+    struct rectangle_pair *a = darray_index(pairs, i), *b = darray_index(fast_pairs, i);
+    assert(a->score == b->score);
+    assert(!memcmp(a->one, b->one, sizeof(*a->one)) && !memcmp(a->two, b->two, sizeof(*a->two)));
+  }
+  darray_free(fast_rects, true);
+  darray_free(fast_pairs, true);
+  assert_mem_clean();
+
+  darray_free(rects, true);
+  darray_free(pairs, true);
+  image1_free(binary);
+  image8_free(im);
+
+  fprintf(stderr, "PASS\n");
+}
+
 int main(void) {
   void (*(tests[]))(void) = {
     test_boundary_convex_hull,
     test_hull_minimal_rectangle,
+    test_hull_simplify,
     test_pair_aligned_rectangles,
-    test_determine_barcode_corners
+    test_pair_aligned_rectangles_threaded,
+    test_determine_barcode_corners,
+    test_moments_rectangle,
+    test_image1_locate_guards_fast_fit
   };
   int num = sizeof(tests) / sizeof(tests[0]);
   run_tests(num, tests);
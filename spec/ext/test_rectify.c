@@ -0,0 +1,176 @@
+#include "spec_helper.h"
+
+// Draws random modules, cells+2 symbol characters plus a final module wide and
+// rows*3 modules tall, rotated by angle about the image center. Fills in the
+// corners and guards the way the localizer would find them: around the wide
+// bars of the start and stop patterns.
+static struct image8 *draw_modules(unsigned char *modules, int rows, int cells, int module, double angle,
+                                   struct barcode_corners *corners, struct rectangle *guards) {
+  int symbol_width = SYMBOL_MODULES*(cells+2) + 1, symbol_height = 3*rows,
+      width = symbol_width*module*fabs(cos(angle)) + symbol_height*module*fabs(sin(angle)) + 60,
+      height = symbol_width*module*fabs(sin(angle)) + symbol_height*module*fabs(cos(angle)) + 60;
+  struct image8 *im;
+
+  for (int i = 0; i < symbol_width*symbol_height; i++) modules[i] = rand() & 1;
+  while (!(im=image8_new(width, height, xmalloc, xfree)));
+
+  double cx = width/2.0, cy = height/2.0, ox = cx - symbol_width*module/2.0, oy = cy - symbol_height*module/2.0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      double sx = cos(angle)*(x-cx) + sin(angle)*(y-cy) + cx - ox,
+             sy = -sin(angle)*(x-cx) + cos(angle)*(y-cy) + cy - oy;
+      int mx = (int) floor(sx/module), my = (int) floor(sy/module);
+      bool dark = sx >= 0 && sy >= 0 && mx < symbol_width && my < symbol_height && modules[my*symbol_width + mx];
+      image8_set(im, x, y, dark ? 0 : 255);
+    }
+  }
+
+  int stop_right = (SYMBOL_MODULES*(cells+1) + 7)*module - 1;
+  double points[4][2] = {{0, 0}, {0, symbol_height*module-1}, {stop_right, 0}, {stop_right, symbol_height*module-1}};
+  struct point mapped[4];
+  for (int i = 0; i < 4; i++) {
+    double px = points[i][0] + ox - cx, py = points[i][1] + oy - cy;
+    mapped[i].x = (int) floor(cos(angle)*px - sin(angle)*py + cx + 0.5);
+    mapped[i].y = (int) floor(sin(angle)*px + cos(angle)*py + cy + 0.5);
+  }
+  corners->upper_left = mapped[0];
+  corners->lower_left = mapped[1];
+  corners->upper_right = mapped[2];
+  corners->lower_right = mapped[3];
+  guards[0] = (struct rectangle) { .width = 8*module, .height = symbol_height*module };
+  guards[1] = (struct rectangle) { .width = 7*module, .height = symbol_height*module };
+
+  return im;
+}
+
+static void assert_rectifies(int rows, int cells, int module, double angle, int module_size) {
+  int symbol_width = SYMBOL_MODULES*(cells+2) + 1, symbol_height = 3*rows;
+  unsigned char *modules = malloc(symbol_width*symbol_height);
+  struct barcode_corners corners;
+  struct rectangle guards[2];
+  struct rectangle_pair pair = { &guards[0], &guards[1], 1.0 };
+  struct image8 *im = draw_modules(modules, rows, cells, module, angle, &corners, guards), *out;
+
+  while (!(out=image8_rectify(im, &pair, &corners, module_size, xmalloc, xfree)));
+  assert(out->width == (symbol_width + RECTIFY_SIDE_MODULES)*module_size);
+  assert(out->height == (symbol_height + 2*RECTIFY_QUIET_MODULES)*module_size);
+
+  // every module, including the rest of the stop pattern, at its center
+  for (int my = 0; my < symbol_height; my++) {
+    for (int mx = 0; mx < symbol_width; mx++) {
+      int x = (mx + RECTIFY_SIDE_MODULES)*module_size + module_size/2,
+          y = (my + RECTIFY_QUIET_MODULES)*module_size + module_size/2;
+      assert((image8_get(out, x, y) < 128) == modules[my*symbol_width + mx]);
+    }
+  }
+  // and the quiet zone is light
+  for (int x = 0; x < out->width; x++) assert(image8_get(out, x, 0) == 255);
+
+  free(modules);
+  image8_free(out);
+  image8_free(im);
+}
+
+void test_homography_from_corners(void) {
+  fprintf(stderr, "Testing homography_from_corners...");
+
+  struct barcode_corners corners[] = {
+    {{10, 20}, {110, 20}, {10, 70}, {110, 70}},
+    {{10, 20}, {110, 30}, {5, 70}, {120, 95}},
+    {{200, 150}, {40, 10}, {190, 170}, {30, 30}}
+  };
+  struct homography h;
+  double x, y;
+
+  for (int i = 0; i < 3; i++) {
+    struct barcode_corners *c = &corners[i];
+    assert(homography_from_corners(c, 50, 10, &h));
+    homography_apply(&h, 0, 0, &x, &y);
+    assert(fabs(x - c->upper_left.x) < 1e-9 && fabs(y - c->upper_left.y) < 1e-9);
+    homography_apply(&h, 50, 0, &x, &y);
+    assert(fabs(x - c->upper_right.x) < 1e-9 && fabs(y - c->upper_right.y) < 1e-9);
+    homography_apply(&h, 0, 10, &x, &y);
+    assert(fabs(x - c->lower_left.x) < 1e-9 && fabs(y - c->lower_left.y) < 1e-9);
+    homography_apply(&h, 50, 10, &x, &y);
+    assert(fabs(x - c->lower_right.x) < 1e-9 && fabs(y - c->lower_right.y) < 1e-9);
+  }
+
+  // straight lines stay straight: the middle of the top edge of a parallelogram
+  homography_apply(&h, 25, 0, &x, &y);
+  assert(fabs(x - 120) < 1e-9 && fabs(y - 80) < 1e-9);
+
+  // collapsed and self-intersecting quadrilaterals
+  struct barcode_corners point = {{5, 5}, {5, 5}, {5, 5}, {5, 5}},
+                         twisted = {{0, 0}, {100, 50}, {0, 50}, {100, 0}};
+  assert(!homography_from_corners(&point, 50, 10, &h));
+  assert(!homography_from_corners(&twisted, 50, 10, &h));
+  assert(!homography_from_corners(&corners[0], 0, 10, &h));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_warp(void) {
+  fprintf(stderr, "Testing image8_warp...");
+
+  struct image8 *im, *out;
+  while (!(im=image8_new(20, 20, xmalloc, xfree)));
+  while (!(out=image8_new(24, 10, xmalloc, xfree)));
+  for (int y = 0; y < 20; y++) {
+    for (int x = 0; x < 20; x++) image8_set(im, x, y, 2*x + 3*y);
+  }
+
+  // the identity, shifted by half a pixel, averages neighboring pixels; linear
+  // images interpolate exactly, and outside is light
+  struct homography identity = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+  while (!image8_warp(im, &identity, 0, 0, 1, out, xmalloc, xfree));
+  for (int y = 0; y < 10; y++) {
+    for (int x = 0; x < 19; x++) assert(fabs(image8_get(out, x, y) - (2*x + 3*y + 2.5)) <= 0.5);
+    for (int x = 20; x < 24; x++) assert(image8_get(out, x, y) == 255);
+  }
+
+  // and without the shift, samples land on pixels, right up to the edge
+  while (!image8_warp(im, &identity, -0.5, -0.5, 1, out, xmalloc, xfree));
+  for (int y = 0; y < 10; y++) {
+    for (int x = 0; x < 20; x++) assert(image8_get(out, x, y) == 2*x + 3*y);
+    for (int x = 20; x < 24; x++) assert(image8_get(out, x, y) == 255);
+  }
+
+  image8_free(out);
+  image8_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_rectify(void) {
+  fprintf(stderr, "Testing image8_rectify...");
+
+  assert_rectifies(6, 3, 4, 0, 3);
+  assert_rectifies(8, 5, 5, 0.15, 4);
+  assert_rectifies(5, 4, 5, -0.3, 2);
+  assert_mem_clean();
+
+  // nothing to map
+  struct barcode_corners corners = {{5, 5}, {5, 5}, {5, 5}, {5, 5}};
+  struct rectangle guard = { .width = 8, .height = 30 };
+  struct rectangle_pair pair = { &guard, &guard, 1.0 };
+  struct image8 *im, *out;
+  while (!(im=image8_new(20, 20, xmalloc, xfree)));
+  while (!(out=image8_rectify(im, &pair, &corners, 3, xmalloc, xfree)));
+  assert(out->width == 0 && out->height == 0);
+  image8_free(out);
+  image8_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_homography_from_corners,
+    test_image8_warp,
+    test_image8_rectify
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,115 @@
+#include "spec_helper.h"
+
+static void random_codewords(unsigned *codewords, int count, int num_ec) {
+  for (int i = 0; i < count-num_ec; i++) codewords[i] = rand() % GF929_SIZE;
+  assert(rs_encode(codewords, count-num_ec, num_ec, codewords+count-num_ec));
+}
+
+// damages distinct codewords, the first num_erasures of which are reported
+static void damage(unsigned *codewords, int count, int num_errors, int *erasures, int num_erasures) {
+  bool damaged[RS_MAX_CODEWORDS] = {false};
+
+  for (int i = 0; i < num_errors + num_erasures; i++) {
+    int position;
+    do { position = rand() % count; } while (damaged[position]);
+    damaged[position] = true;
+    codewords[position] = (codewords[position] + 1 + rand() % (GF929_SIZE-1)) % GF929_SIZE;
+    if (i < num_erasures) erasures[i] = position;
+  }
+}
+
+void test_gf929(void) {
+  fprintf(stderr, "Testing gf929...");
+
+  for (unsigned a = 1; a < GF929_SIZE; a++) {
+    assert(gf929_mul(a, gf929_inv(a)) == 1);
+    assert(gf929_mul(a, 0) == 0);
+    unsigned b = rand() % GF929_SIZE;
+    assert(gf929_mul(a, b) == a*b % GF929_SIZE);
+  }
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_rs_encode(void) {
+  fprintf(stderr, "Testing rs_encode...");
+
+  // the example from the PDF417 specification, at error correction level 1
+  unsigned data[] = {5, 453, 178, 121, 239}, ec[4], syndromes[RS_MAX_EC];
+  assert(rs_encode(data, 5, 4, ec));
+  assert(ec[0] == 452 && ec[1] == 327 && ec[2] == 657 && ec[3] == 619);
+
+  unsigned codewords[RS_MAX_CODEWORDS];
+  for (int num_ec = 2; num_ec <= RS_MAX_EC; num_ec *= 2) {
+    random_codewords(codewords, RS_MAX_CODEWORDS, num_ec);
+    rs_syndromes(codewords, RS_MAX_CODEWORDS, num_ec, syndromes);
+    for (int j = 0; j < num_ec; j++) assert(syndromes[j] == 0);
+  }
+
+  assert(!rs_encode(data, 5, 0, ec));
+  assert(!rs_encode(data, 5, RS_MAX_EC*2, ec));
+  assert(!rs_encode(data, RS_MAX_CODEWORDS, 2, ec));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_rs_correct(void) {
+  fprintf(stderr, "Testing rs_correct...");
+
+  unsigned codewords[RS_MAX_CODEWORDS], original[RS_MAX_CODEWORDS];
+  int erasures[RS_MAX_EC];
+
+  for (int level = 0; level <= 8; level++) {
+    int num_ec = 2 << level;
+
+    for (int trial = 0; trial < 20; trial++) {
+      int count = num_ec + 1 + rand() % (RS_MAX_CODEWORDS - num_ec),
+          num_erasures = rand() % (num_ec+1),
+          num_errors = rand() % ((num_ec - num_erasures)/2 + 1);
+      random_codewords(codewords, count, num_ec);
+      memcpy(original, codewords, sizeof(*codewords)*count);
+
+      damage(codewords, count, num_errors, erasures, num_erasures);
+      assert(rs_correct(codewords, count, num_ec, erasures, num_erasures) == num_errors + num_erasures);
+      assert(memcmp(codewords, original, sizeof(*codewords)*count) == 0);
+      assert(rs_correct(codewords, count, num_ec, NULL, 0) == 0);
+    }
+  }
+
+  // beyond the capacity, either correction fails and nothing changes, or the
+  // result is at least some valid set of codewords
+  unsigned damaged[RS_MAX_CODEWORDS], syndromes[RS_MAX_EC];
+  for (int trial = 0; trial < 20; trial++) {
+    random_codewords(codewords, 100, 16);
+    damage(codewords, 100, 9, erasures, 0);
+    memcpy(damaged, codewords, sizeof(*codewords)*100);
+    if (rs_correct(codewords, 100, 16, NULL, 0) < 0) {
+      assert(memcmp(codewords, damaged, sizeof(*codewords)*100) == 0);
+    } else {
+      rs_syndromes(codewords, 100, 16, syndromes);
+      for (int j = 0; j < 16; j++) assert(syndromes[j] == 0);
+    }
+  }
+
+  // bad arguments
+  random_codewords(codewords, 10, 4);
+  erasures[0] = 10;
+  assert(rs_correct(codewords, 10, 4, erasures, 1) == -1);
+  assert(rs_correct(codewords, 10, 4, erasures, 5) == -1);
+  assert(rs_correct(codewords, 4, 4, NULL, 0) == -1);
+  assert(rs_correct(codewords, 10, 0, NULL, 0) == -1);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  gf929_init();
+
+  void (*(tests[]))(void) = {
+    test_gf929,
+    test_rs_encode,
+    test_rs_correct
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,149 @@
+#include "spec_helper.h"
+
+static struct pairing_settings settings = {
+  .area_threshold = 100,
+  .rectangularity_threshold = 0.8,
+  .angle_variation_threshold = 0.314,
+  .area_variation_threshold = 0.5,
+  .width_variation_threshold = 0.4,
+  .height_variation_threshold = 0.3,
+  .guard_aspect_min = 3,
+  .guard_aspect_max = 50,
+  .barcode_aspect_min = 0,
+  .barcode_aspect_max = 10
+};
+
+static void fill_rect(struct image8 *im, int x, int y, int width, int height, unsigned char value) {
+  for (int j = y; j < y+height; j++) {
+    for (int i = x; i < x+width; i++) image8_set(im, i, j, value);
+  }
+}
+
+// A page with a pair of guards near the top and a paragraph of letters, too
+// small to be guards, at the bottom.
+static struct image1 *page(bool reversed) {
+  int width = 500, height = 512;
+  unsigned char paper = reversed ? 0 : 255, ink = reversed ? 255 : 0;
+  struct image8 *im = image8_new(width, height, malloc, free);
+  memset(im->data, paper, width*height);
+
+  fill_rect(im, 100, 60, 8, 60, ink);
+  fill_rect(im, 210, 60, 7, 60, ink);
+  for (int y = 300; y < 480; y += 12) {
+    for (int x = 20; x < 470; x += 6) fill_rect(im, x, y, 4, 7, ink);
+  }
+
+  struct image1 *binary = image8_binarize(im, 128, malloc, free);
+  image8_free(im);
+  return binary;
+}
+
+static struct darray *locate(struct image1 *im, struct pairing_settings *with) {
+  struct darray *rects = darray_new(0, free, malloc, realloc, free),
+                *pairs = darray_new(0, free, malloc, realloc, free);
+  assert(image1_locate_guards(im, with, rects, pairs));
+  darray_free(rects, true);
+  // the pairs point at the freed rectangles, so only their scores are kept
+  for (unsigned i = 0; i < pairs->len; i++) ((struct rectangle_pair *) darray_index(pairs, i))->one = NULL;
+  return pairs;
+}
+
+void test_image1_saliency(void) {
+  fprintf(stderr, "Testing image1_saliency...");
+
+  struct image1 *im = page(false);
+  struct saliency *s;
+  while (!(s=image1_saliency(im, LABEL_DARK, saliency_min_run(&settings), xmalloc, xfree)));
+  assert(s->tiles_x == 8 && s->tiles_y == 8);
+
+  // counts agree with the image
+  long dark = 0, transitions = 0;
+  for (int y = 0; y < im->height; y++) {
+    for (int x = 0; x < im->width; x++) {
+      dark += !image1_get(im, x, y);
+      transitions += x > 0 && image1_get(im, x, y) != image1_get(im, x-1, y);
+    }
+  }
+  assert(saliency_sum(s, s->dark, 0, 0, 8, 8) == dark);
+  assert(saliency_sum(s, s->transitions, -1, -1, 9, 9) == transitions);
+  assert(saliency_sum(s, s->dark, 1, 0, 2, 2) == 8*60);
+
+  // the guards and the tiles around them are kept, the letters, whose runs
+  // are all short, and the margins aren't
+  assert(saliency_sum(s, s->runs, 0, 4, 8, 8) == 0);
+  for (int ty = 0; ty < 8; ty++) {
+    for (int tx = 0; tx < 8; tx++) {
+      bool near_guards = tx <= 4 && ty <= 2;
+      assert(s->salient[ty*8 + tx] == near_guards);
+    }
+  }
+
+  // masking fills the rest with background
+  assert(image1_mask_unsalient(im, s, true) == 5*3);
+  for (int y = 300; y < 480; y++) {
+    for (int x = 0; x < im->width; x++) assert(image1_get(im, x, y));
+  }
+  assert(!image1_get(im, 100, 60));
+
+  saliency_free(s);
+  image1_free(im);
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_locate_guards_prefilter(void) {
+  fprintf(stderr, "Testing image1_locate_guards with the prefilter...");
+
+  struct pairing_settings prefiltered = settings;
+  prefiltered.prefilter = true;
+
+  // the same pairs either way, for either polarity
+  for (int reversed = 0; reversed < 2; reversed++) {
+    struct image1 *im = page(reversed);
+    settings.polarity = prefiltered.polarity = reversed ? LABEL_LIGHT : LABEL_DARK;
+    struct darray *all = locate(im, &settings), *filtered = locate(im, &prefiltered);
+    assert(all->len == 1 && filtered->len == 1);
+    assert(((struct rectangle_pair *) darray_index(all, 0))->score ==
+           ((struct rectangle_pair *) darray_index(filtered, 0))->score);
+    darray_free(all, true);
+    darray_free(filtered, true);
+    image1_free(im);
+  }
+  settings.polarity = prefiltered.polarity = LABEL_DARK;
+
+  // and on a sheet of assorted rectangles
+  struct image8 *fixture = load_image_fixture("256x256_assorted_rectangles.raw");
+  struct image1 *im = image8_binarize(fixture, 128, malloc, free);
+  struct darray *all = locate(im, &settings), *filtered = locate(im, &prefiltered);
+  assert(all->len == filtered->len && all->len > 0);
+  for (unsigned i = 0; i < all->len; i++) {
+    assert(((struct rectangle_pair *) darray_index(all, i))->score ==
+           ((struct rectangle_pair *) darray_index(filtered, i))->score);
+  }
+  darray_free(all, true);
+  darray_free(filtered, true);
+  image1_free(im);
+  image8_free(fixture);
+
+  // blank pages aren't labeled at all
+  struct image8 *blank = image8_new(300, 200, malloc, free);
+  memset(blank->data, 255, 300*200);
+  im = image8_binarize(blank, 128, malloc, free);
+  filtered = locate(im, &prefiltered);
+  assert(filtered->len == 0);
+  darray_free(filtered, true);
+  image1_free(im);
+  image8_free(blank);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_image1_saliency,
+    test_image1_locate_guards_prefilter
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,185 @@
+#include "spec_helper.h"
+
+// A symbol 120 modules long: the start pattern, five codewords and the stop
+// pattern, with 3 pixel modules and 30 rows of 3 pixels.
+static const int symbol[] = {
+  8, 1, 1, 1, 1, 1, 1, 3,
+  3, 1, 1, 2, 4, 1, 2, 3,
+  1, 2, 5, 1, 1, 3, 2, 2,
+  2, 3, 1, 1, 3, 2, 4, 1,
+  4, 1, 2, 2, 1, 1, 1, 5,
+  1, 1, 3, 4, 2, 2, 1, 3,
+  7, 1, 1, 3, 1, 1, 1, 2, 1
+};
+
+static bool symbol_bar(int module) {
+  bool bar = true;
+  for (unsigned i = 0; i < sizeof(symbol) / sizeof(symbol[0]); i++) {
+    if (module < symbol[i]) return bar;
+    module -= symbol[i];
+    bar = !bar;
+  }
+  return false;
+}
+
+// A page with the symbol centered on (cx, cy) and rotated by angle, and a
+// paragraph of letters below it.
+static struct image1 *page(double cx, double cy, double angle) {
+  int width = 500, height = 500;
+  struct image8 *im = image8_new(width, height, malloc, free);
+  memset(im->data, 255, width*height);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      double dx = x + 0.5 - cx, dy = y + 0.5 - cy,
+             u = dx*cos(angle) + dy*sin(angle) + 180, v = -dx*sin(angle) + dy*cos(angle);
+      if (u >= 0 && u < 360 && fabs(v) < 45 && symbol_bar((int) (u / 3))) image8_set(im, x, y, 0);
+    }
+  }
+  for (int y = 420; y < 490; y += 12) {
+    for (int x = 20; x < 470; x += 6) {
+      for (int j = y; j < y+7; j++) image8_set(im, x + (j % 3 == 0), j, 0);
+      image8_set(im, x+1, y+3, 0);
+      image8_set(im, x+2, y+3, 0);
+    }
+  }
+
+  struct image1 *binary = image8_binarize(im, 128, malloc, free);
+  image8_free(im);
+  return binary;
+}
+
+static bool near(struct point *p, double x, double y) {
+  return fabs(p->x - x) <= 10 && fabs(p->y - y) <= 10;
+}
+
+static void locate(struct image1 *im, struct scanline_settings *settings, struct barcode_corners *corners,
+                   unsigned *count) {
+  struct darray *rects = darray_new(0, free, malloc, realloc, free),
+                *pairs = darray_new(0, free, malloc, realloc, free);
+  assert(image1_locate_scanlines(im, settings, rects, pairs));
+  *count = pairs->len;
+  if (pairs->len) {
+    struct rectangle_pair *pair = darray_index(pairs, 0);
+    assert(pair->score > 0.5 && pair->score <= 1);
+    determine_barcode_corners(pair, corners);
+  }
+  darray_free(rects, true);
+  darray_free(pairs, true);
+}
+
+void test_runs_match(void) {
+  fprintf(stderr, "Testing runs_match...");
+
+  double module;
+
+  // the start pattern at 2 pixels a module, and a little ink spread
+  int start[] = {10, 27, 28, 31, 32, 35, 36, 39, 44};
+  assert(runs_match(start, 0, SCANLINE_START, false, &module));
+  assert(fabs(module - 2) < 0.1);
+  assert(!runs_match(start, 0, SCANLINE_START, true, &module));
+  assert(!runs_match(start, 0, SCANLINE_STOP, false, &module));
+
+  // backwards
+  int reversed[] = {0, 6, 8, 10, 12, 14, 16, 18, 34};
+  assert(runs_match(reversed, 0, SCANLINE_START, true, &module));
+  assert(!runs_match(reversed, 0, SCANLINE_START, false, &module));
+
+  // the stop pattern, without its final bar, and runs too short to tell apart
+  int stop[] = {0, 14, 16, 18, 24, 26, 28, 30, 34};
+  assert(runs_match(stop, 0, SCANLINE_STOP, false, &module));
+  assert(!runs_match(stop, 0, SCANLINE_STOP, true, &module));
+  int tiny[] = {0, 5, 6, 7, 8, 9, 10, 11, 13};
+  assert(!runs_match(tiny, 0, SCANLINE_START, false, &module));
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_scanline_runs(void) {
+  fprintf(stderr, "Testing scanline_runs...");
+
+  struct image1 *im = page(250, 100, 0);
+  int positions[501];
+  bool first_bar;
+
+  // rows, through the symbol
+  int runs = scanline_runs(im, false, 100, false, positions, &first_bar);
+  assert(!first_bar && runs == 1 + 57 + 1);
+  assert(positions[0] == 0 && positions[1] == 70 && positions[2] == 70 + 24 && positions[runs] == 500);
+
+  // and columns, through the start pattern's first bar
+  runs = scanline_runs(im, true, 72, false, positions, &first_bar);
+  assert(!first_bar && positions[1] == 55 && positions[2] == 145);
+  image1_free(im);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image1_locate_scanlines(void) {
+  fprintf(stderr, "Testing image1_locate_scanlines...");
+
+  struct scanline_settings settings = {.step = 8, .columns = true, .polarity = LABEL_DARK};
+  struct barcode_corners corners;
+  unsigned count;
+
+  // level
+  struct image1 *im = page(250, 200, 0);
+  struct darray *rects, *pairs;
+  set_allocation_success_chance(0.99);
+  while (!(rects=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+  while (!(pairs=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+  while (!image1_locate_scanlines(im, &settings, rects, pairs)) {
+    darray_free(rects, true);
+    darray_free(pairs, true);
+    while (!(rects=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+    while (!(pairs=darray_new(0, xfree, xmalloc, xrealloc, xfree)));
+  }
+  set_allocation_success_chance(0.5);
+  assert(pairs->len == 1);
+  darray_free(rects, true);
+  darray_free(pairs, true);
+  assert_mem_clean();
+
+  locate(im, &settings, &corners, &count);
+  assert(count == 1);
+  assert(near(&corners.upper_left, 70, 155));
+  assert(near(&corners.lower_right, 430, 245));
+  image1_free(im);
+
+  // at an angle, upside down, and upright, where only columns find it
+  double angles[] = {M_PI/8, M_PI, M_PI_2};
+  for (int i = 0; i < 3; i++) {
+    im = page(250, 220, angles[i]);
+    locate(im, &settings, &corners, &count);
+    assert(count == 1);
+    double ux = cos(angles[i])*180, uy = sin(angles[i])*180, vx = -sin(angles[i])*45, vy = cos(angles[i])*45;
+    struct point *ends[] = {&corners.upper_left, &corners.lower_right};
+    assert((near(ends[0], 250 - ux - vx, 220 - uy - vy) && near(ends[1], 250 + ux + vx, 220 + uy + vy)) ||
+           (near(ends[1], 250 - ux - vx, 220 - uy - vy) && near(ends[0], 250 + ux + vx, 220 + uy + vy)));
+    if (angles[i] == M_PI_2) {
+      struct scanline_settings rows = settings;
+      rows.columns = false;
+      locate(im, &rows, &corners, &count);
+      assert(count == 0);
+    }
+    image1_free(im);
+  }
+
+  // nothing in text alone
+  im = page(-1000, -1000, 0);
+  locate(im, &settings, &corners, &count);
+  assert(count == 0);
+  image1_free(im);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_runs_match,
+    test_scanline_runs,
+    test_image1_locate_scanlines
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,120 @@
+#include "spec_helper.h"
+
+// A dark bar on paper lit from the left, whose right side is in shadow.
+static struct image8 *shadowed_bars(int width, int height) {
+  struct image8 *im;
+  while (!(im=image8_new(width, height, xmalloc, xfree)));
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int paper = 240 - 160*x/width;
+      bool bar = (x/8) % 4 == 1 && y > 20 && y < height-20;
+      image8_set(im, x, y, bar ? paper/4 : paper);
+    }
+  }
+
+  return im;
+}
+
+void test_gaussian_boxes(void) {
+  fprintf(stderr, "Testing gaussian_boxes...");
+
+  int widths[3];
+  for (double sigma = 1; sigma < 40; sigma += 0.7) {
+    gaussian_boxes(sigma, 3, widths);
+    double variance = 0;
+    for (int i = 0; i < 3; i++) {
+      assert(widths[i] % 2 == 1);
+      assert(i == 0 || widths[i] >= widths[i-1]);
+      variance += (widths[i]*widths[i] - 1) / 12.0;
+    }
+    // the variances of the boxes add up to about the Gaussian's
+    assert(fabs(sqrt(variance) - sigma) < 0.5);
+  }
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_box_blur_line(void) {
+  fprintf(stderr, "Testing box_blur_line...");
+
+  unsigned src[] = {10, 10, 10, 40, 10, 10, 10}, dst[7];
+  box_blur_line(src, dst, 7, 1, 3);
+  unsigned expected[] = {10, 10, 20, 20, 20, 10, 10};
+  assert(memcmp(dst, expected, sizeof(dst)) == 0);
+
+  // edges repeat, even for boxes wider than the line
+  unsigned edges[] = {0, 90, 90}, wide[3];
+  box_blur_line(edges, wide, 3, 1, 5);
+  assert(wide[0] == 36 && wide[1] == 54 && wide[2] == 72);
+
+  // strided, as for columns
+  unsigned column[] = {10, 0, 10, 0, 40, 0, 10, 0, 10, 0}, blurred[10] = {0};
+  box_blur_line(column, blurred, 5, 2, 3);
+  assert(blurred[0] == 10 && blurred[2] == 20 && blurred[4] == 20 && blurred[6] == 20 && blurred[8] == 10);
+  assert(blurred[1] == 0 && blurred[3] == 0);
+
+  fprintf(stderr, "PASS\n");
+}
+
+void test_image8_remove_shadows(void) {
+  fprintf(stderr, "Testing image8_remove_shadows...");
+
+  int width = 203, height = 97;
+  struct image8 *im = shadowed_bars(width, height), *gray = shadowed_bars(width, height);
+
+  // a single threshold can't separate the bars in the light from the paper in
+  // the shadow, but after dividing by the background one can
+  assert(image8_get(im, 9, 50) < image8_get(im, width-10, 50));
+  while (!image8_remove_shadows(im, 128, xmalloc, xfree));
+  for (int y = 30; y < height-30; y++) {
+    for (int x = 0; x < width; x++) {
+      bool bar = (x/8) % 4 == 1;
+      assert(image8_get(im, x, y) == (bar ? 0 : 255));
+    }
+  }
+
+  // without a threshold, the quotient stays gray, and thresholding it agrees
+  while (!image8_remove_shadows(gray, -1, xmalloc, xfree));
+  for (long i = 0; i < (long) width*height; i++) {
+    assert((gray->data[i] >= 128 ? 255 : 0) == im->data[i] || abs(gray->data[i] - 128) <= 1);
+  }
+  // paper comes out near white
+  assert(image8_get(gray, 2, 50) > 200 && image8_get(gray, width-10, 50) > 200);
+
+  image8_free(im);
+  image8_free(gray);
+
+  // flat images stay flat, at any size, even smaller than a block
+  int sizes[][2] = {{1, 1}, {3, 2}, {4, 4}, {17, 5}, {64, 33}};
+  for (int s = 0; s < 5; s++) {
+    while (!(im=image8_new(sizes[s][0], sizes[s][1], xmalloc, xfree)));
+    memset(im->data, 90, sizes[s][0]*sizes[s][1]);
+    while (!image8_remove_shadows(im, -1, xmalloc, xfree));
+    for (int i = 0; i < sizes[s][0]*sizes[s][1]; i++) assert(im->data[i] == 255);
+    image8_free(im);
+  }
+
+  // and black ones don't divide by zero, staying black whether binarized or not
+  for (int threshold = -1; threshold <= 128; threshold += 129) {
+    while (!(im=image8_new(9, 9, xmalloc, xfree)));
+    memset(im->data, 0, 81);
+    while (!image8_remove_shadows(im, threshold, xmalloc, xfree));
+    for (int i = 0; i < 81; i++) assert(im->data[i] == 0);
+    image8_free(im);
+  }
+
+  assert_mem_clean();
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_gaussian_boxes,
+    test_box_blur_line,
+    test_image8_remove_shadows
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
@@ -0,0 +1,108 @@
+#include "spec_helper.h"
+
+static void fill_random(void *data, size_t size) {
+  for (size_t i = 0; i < size; i++) ((unsigned char *) data)[i] = rand();
+}
+
+void test_simd_init(void) {
+  fprintf(stderr, "Testing simd_init...");
+
+  enum simd_level supported = simd_supported_level();
+  assert(simd_init() == supported && simd_current == supported);
+
+  // a lower level can be forced, but not a higher one
+  setenv(SIMD_ENV, "none", 1);
+  assert(simd_init() == SIMD_NONE && simd.binarize_row == binarize_row_plain);
+  setenv(SIMD_ENV, "avx512", 1);
+  assert(simd_init() == supported);
+  setenv(SIMD_ENV, "bogus", 1);
+  assert(simd_init() == supported);
+  unsetenv(SIMD_ENV);
+  assert(!strcmp(simd_level_name(SIMD_AVX2), "avx2"));
+
+  fprintf(stderr, "PASS\n");
+}
+
+// Every level the processor supports gives the same results as plain C, for
+// rows of awkward lengths and thresholds at the ends of the range.
+void test_simd_kernels(void) {
+  fprintf(stderr, "Testing simd kernels...");
+
+  enum simd_level supported = simd_supported_level();
+  int widths[] = {1, 63, 64, 65, 200, 1000};
+  unsigned char thresholds[] = {0, 1, 128, 255};
+
+  for (enum simd_level level = SIMD_NONE; level <= supported; level++) {
+    for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+      int width = widths[w], words = (width + 63) / 64;
+      unsigned char src[4*1000], a[1000], b[1000], out[1000], expected[1000];
+      uint64_t bits[16], expected_bits[16], wa[16], wb[16];
+      fill_random(src, sizeof(src));
+      fill_random(a, sizeof(a));
+      fill_random(b, sizeof(b));
+      fill_random(wa, sizeof(wa));
+      fill_random(wb, sizeof(wb));
+
+      for (unsigned t = 0; t < sizeof(thresholds); t++) {
+        simd_select(SIMD_NONE);
+        simd.binarize_row(src, expected_bits, width, thresholds[t]);
+        simd_select(level);
+        simd.binarize_row(src, bits, width, thresholds[t]);
+        assert(!memcmp(bits, expected_bits, sizeof(*bits) * words));
+      }
+
+      for (enum pixel_format format = PIXEL_FORMAT_GRAY; format <= PIXEL_FORMAT_YUYV; format++) {
+        simd_select(SIMD_NONE);
+        simd.convert_row(src, expected, width, format);
+        simd_select(level);
+        simd.convert_row(src, out, width, format);
+        assert(!memcmp(out, expected, width));
+      }
+
+      for (int max = 0; max < 2; max++) {
+        simd_select(SIMD_NONE);
+        simd.morph_rows(expected, a, b, width, max);
+        simd.morph_words(expected_bits, wa, wb, words, max);
+        simd_select(level);
+        simd.morph_rows(out, a, b, width, max);
+        simd.morph_words(bits, wa, wb, words, max);
+        assert(!memcmp(out, expected, width));
+        assert(!memcmp(bits, expected_bits, sizeof(*bits) * words));
+      }
+
+      unsigned roots[256], labels[1000], expected_labels[1000];
+      for (int i = 0; i < 256; i++) roots[i] = rand() & 255;
+      for (int i = 0; i < width; i++) labels[i] = expected_labels[i] = rand() & 255;
+      simd_select(SIMD_NONE);
+      simd.relabel(expected_labels, width, roots);
+      simd_select(level);
+      simd.relabel(labels, width, roots);
+      assert(!memcmp(labels, expected_labels, sizeof(*labels) * width));
+    }
+
+    // neighborhood codes, over a whole image
+    struct image1 *im = image1_new(130, 7, malloc, free);
+    fill_random(im->data, sizeof(*im->data) * im->stride*im->height);
+    for (int y = 0; y < im->height; y++) {
+      unsigned char codes[130], expected_codes[130];
+      simd_select(SIMD_NONE);
+      simd.neighborhood_row(im, y, expected_codes);
+      simd_select(level);
+      simd.neighborhood_row(im, y, codes);
+      assert(!memcmp(codes, expected_codes, sizeof(codes)));
+    }
+    image1_free(im);
+  }
+  simd_select(SIMD_NONE);
+
+  fprintf(stderr, "PASS\n");
+}
+
+int main(void) {
+  void (*(tests[]))(void) = {
+    test_simd_init,
+    test_simd_kernels
+  };
+  int num = sizeof(tests) / sizeof(tests[0]);
+  run_tests(num, tests);
+}
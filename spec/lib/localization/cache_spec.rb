@@ -0,0 +1,87 @@
+require "spec_helper"
+require "tmpdir"
+
+include Localization
+
+RSpec.describe Cache do
+  let(:code) { LocatedBarcode.new(0.5, Point.new(1, 2), Point.new(3, 4), Point.new(5, 6), Point.new(7, 8)) }
+
+  describe "#fetch" do
+    it "only runs the block on a miss, and evicts the least recently used" do
+      cache = Cache.new(capacity: 2)
+      runs = 0
+
+      3.times { cache.fetch([1, 1]) { runs += 1; [code] } }
+      cache.fetch([2, 1]) { [] }
+      cache.fetch([1, 1]) { raise "cached" }
+      cache.fetch([3, 1]) { [] }
+
+      expect(runs).to eq(1)
+      expect(cache.size).to eq(2)
+      expect { cache.fetch([2, 1]) { raise "evicted" } }.to raise_error("evicted")
+      expect(cache.stats).to include(hits: 3, misses: 3)
+    end
+
+    it "isn't changed by changes to the barcodes it hands out" do
+      cache = Cache.new
+      symbols = [[1, 2, 3]]
+      located = LocatedBarcode.new(0.5, Point.new(1, 2), Point.new(3, 4), Point.new(5, 6), Point.new(7, 8), symbols)
+
+      cache.fetch([1, 1]) { [located] }
+      located.upper_left.x = 100
+      symbols.first[0] = 100
+      hit = cache.fetch([1, 1]) { raise "cached" }
+      hit.first.lower_right.y = 100
+      hit << code
+
+      again = cache.fetch([1, 1]) { raise "cached" }
+      expect(again.size).to eq(1)
+      expect(again.first.upper_left).to eq(Point.new(1, 2))
+      expect(again.first.lower_right).to eq(Point.new(5, 6))
+      expect(again.first.symbols).to eq([[1, 2, 3]])
+    end
+
+    it "shares located barcodes with other caches through a file" do
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "results")
+        Cache.new(path: path, disk_slots: 64).fetch([1, 2]) { [code] }
+        cache = Cache.new(path: path, disk_slots: 64)
+
+        barcodes = cache.fetch([1, 2]) { raise "cached" }
+        expect(barcodes.map(&:score)).to eq([0.5])
+        expect(barcodes.first.lower_right).to eq(Point.new(5, 6))
+        expect(cache.disk_hits).to eq(1)
+        expect(cache.fetch([1, 3], persist: false) { [] }).to be_empty
+        expect(cache.stats[:disk]).to include(hits: 1, stores: 1)
+        cache.close
+      end
+    end
+  end
+end
+
+RSpec.describe Guards do
+  describe "with a cache" do
+    let(:config) do
+      Configuration.new.tap do |c|
+        c.localization_preprocessing = :none
+        c.localization_guard_area_threshold = 100
+        c.localization_guard_aspect = 3..50
+        c.localization_barcode_aspect = 0..10
+      end
+    end
+    let(:pixels) { File.binread("spec/fixtures/256x256_assorted_rectangles.raw") }
+
+    it "reuses results for the same pixels and settings" do
+      cache = Cache.new
+      scanner = Guards.new(config, cache: cache)
+
+      expected = scanner.run_pixels(pixels, 256, 256).map(&:score)
+      expect(scanner.run_pixels(pixels.dup, 256, 256).map(&:score)).to eq(expected)
+      expect(cache.hits).to eq(1)
+
+      config.localization_strictness = :lax
+      scanner.run_pixels(pixels, 256, 256)
+      expect(cache.misses).to eq(2)
+    end
+  end
+end
@@ -0,0 +1,86 @@
+require "spec_helper"
+require "fileutils"
+
+include Localization
+
+RSpec.describe Client do
+  let(:dir) { Dir.mktmpdir }
+  let(:path) { File.join(dir, "ruby417.sock") }
+  let(:server) { UNIXServer.new(path) }
+  let(:pixels) { "\x80".b * 16 }
+
+  after { FileUtils.remove_entry(dir) }
+
+  # Answers each request on one connection with the given responses in turn,
+  # collecting the requests and the pixels they passed.
+  def fake_daemon(*responses)
+    requests = []
+    thread = Thread.new do
+      connection = server.accept
+      responses.each do |response|
+        shared = connection.recv_io
+        request = connection.read(88).unpack(Client::REQUEST)
+        requests << [request, shared.pread(request[2] * request[3], 0)]
+        shared.close
+        connection.write(response)
+      end
+      connection.close
+    end
+    [requests, thread]
+  end
+
+  it "passes the pixels and settings, and reads back the barcodes" do
+    barcode = [0.5, 1, 2, 3, 4, 5, 6, 7, 8].pack(Client::BARCODE)
+    requests, thread = fake_daemon([Client::MAGIC, 0, 1, 0].pack(Client::RESPONSE) + barcode,
+                                   [Client::MAGIC, 0, 0, 0].pack(Client::RESPONSE))
+    config = Configuration.new.tap { |c| c.localization_polarity = :light }
+    client = Client.new(path, config)
+
+    codes = client.run_pixels(pixels, 4, 4)
+    expect(codes.size).to eq(1)
+    expect(codes.first.score).to eq(0.5)
+    expect([codes.first.upper_left.x, codes.first.upper_left.y]).to eq([1, 2])
+    expect([codes.first.upper_right.x, codes.first.upper_right.y]).to eq([7, 8])
+    expect(client.run_pixels("\x10".b * 8, 4, 2)).to be_empty
+
+    thread.join
+    client.close
+    (first, first_pixels), (_, second_pixels) = requests
+    expect(first[0..5]).to eq([Client::MAGIC, 0, 4, 4, 2, 1])
+    expect(first[6]).to eq(config.localization_guard_area(4, 4))
+    expect(first_pixels).to eq(pixels)
+    expect(second_pixels).to eq("\x10".b * 8)
+  end
+
+  it "raises when the daemon refuses a request" do
+    _, thread = fake_daemon([Client::MAGIC, 1, 0, 0].pack(Client::RESPONSE))
+    expect { Client.new(path).run_pixels(pixels, 4, 4) }.to raise_error(Client::Error, /bad request/)
+    thread.join
+  end
+
+  it "reconnects when the daemon has closed an idle connection" do
+    thread = Thread.new do
+      2.times do
+        connection = server.accept
+        connection.recv_io.close
+        connection.read(88)
+        connection.write([Client::MAGIC, 0, 0, 0].pack(Client::RESPONSE))
+        connection.close
+      end
+    end
+    client = Client.new(path)
+    2.times { expect(client.run_pixels(pixels, 4, 4)).to be_empty }
+    thread.join
+    client.close
+  end
+
+  it "raises when a new connection is lost" do
+    thread = Thread.new { server.accept.close }
+    expect { Client.new(path).run_pixels(pixels, 4, 4) }.to raise_error(Client::Error, /lost the connection/)
+    thread.join
+  end
+
+  it "checks its arguments before connecting" do
+    expect { Client.new(path).run_pixels(pixels, 4, 4, format: :cmyk) }.to raise_error(ArgumentError)
+  end
+end
@@ -1,8 +1,55 @@
 require "spec_helper"
+require "tmpdir"
+require_relative "../../../ext/codeword_patterns"
 
 include Localization
 
 RSpec.describe Guards do
+  # PDF417 error correction codewords: the remainder of the data, times x to
+  # the count, divided by the generator with roots 3, 3**2 ... 3**count, negated
+  def error_correction(data, count)
+    generator = (1..count).reduce([1]) do |g, i|
+      root = 3.pow(i, 929)
+      (g + [0]).each_with_index.map { |c, j| (c - (j > 0 ? g[j - 1] * root : 0)) % 929 }
+    end
+    remainder = data.reduce([0] * count) do |r, d|
+      factor = (d + r.first) % 929
+      (r.drop(1) + [0]).each_with_index.map { |v, j| (v - factor * generator[j + 1]) % 929 }
+    end
+    remainder.map { |r| -r % 929 }
+  end
+
+  # The rows of a symbol, each codeword with the row indicators on either side.
+  def symbol_rows(codewords, columns, level)
+    rows = codewords.size / columns
+    codewords.each_slice(columns).each_with_index.map do |data, r|
+      left, right = [
+        [(rows - 1) / 3, columns - 1],
+        [3 * level + (rows - 1) % 3, (rows - 1) / 3],
+        [columns - 1, 3 * level + (rows - 1) % 3]
+      ][r % 3]
+      [30 * (r / 3) + left, *data, 30 * (r / 3) + right]
+    end
+  end
+
+  # A binary PGM of the symbol, rows 3 modules high, on paper lit from the left.
+  def symbol_image(rows, module_size, margin)
+    bars = ->(widths) { widths.each_with_index.flat_map { |w, i| [i.even?] * w } }
+    lines = rows.each_with_index.map do |row, r|
+      codewords = row.flat_map { |c| 16.downto(0).map { |bit| CODEWORD_PATTERNS[r % 3][c][bit] == 1 } }
+      bars[[8, 1, 1, 1, 1, 1, 1, 3]] + codewords + bars[[7, 1, 1, 3, 1, 1, 1, 2, 1]]
+    end
+    width, height = lines.first.size * module_size + 2 * margin, rows.size * 3 * module_size + 2 * margin
+    pixels = (0...height).flat_map do |y|
+      line = lines[(y - margin) / (3 * module_size)] if y >= margin
+      (0...width).map do |x|
+        paper = 235 - 80 * x / width
+        x >= margin && line && line[(x - margin) / module_size] ? paper / 6 : paper
+      end
+    end
+    "P5\n#{width} #{height}\n255\n".b + pixels.pack("C*")
+  end
+
   describe "#run" do
     it "locates a solitary barcode" do
       codes = Guards.new.run("spec/fixtures/sir_walter_scott_blurred_rotated.jpg")
@@ -11,5 +58,91 @@ RSpec.describe Guards do
       expect(codes.first.width).to be_within(3).of(609)
       expect(codes.first.height).to be_within(3).of(225)
     end
+
+    it "decodes a symbol whose narrowest bars full preprocessing closes over" do
+      data = [40] + (1...40).map { |i| i * 23 % 900 }
+      codewords = data + error_correction(data, 8)
+      rows = symbol_rows(codewords, 4, 2)
+
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "symbol.pgm")
+        File.binwrite(path, symbol_image(rows, 3, 40))
+        codes = Guards.new.run(path, decode: true)
+
+        expect(codes).to be_one
+        expect(codes.first.symbols).to eq(rows)
+        expect(Ruby417::Ext.correct_codewords(codes.first.symbols.flat_map { |r| r[1..-2] }, 8)).to eq(codewords)
+      end
+    end
+
+    it "rectifies from the gray image rather than the thresholded one" do
+      data = [40] + (1...40).map { |i| i * 23 % 900 }
+      rows = symbol_rows(data + error_correction(data, 8), 4, 2)
+
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "symbol.pgm")
+        File.binwrite(path, symbol_image(rows, 3, 40))
+        codes = Guards.new.run(path, decode: true, rectify: true)
+
+        expect(codes).to be_one
+        expect(codes.first.symbols).to eq(rows)
+        expect(codes.first.rectified.pixels.bytes.uniq.size).to be > 2
+      end
+    end
+  end
+
+  describe "#invert" do
+    it "inverts every level" do
+      levels = (0..255).to_a.pack("C*")
+      expect(Guards.new.invert(levels).bytes).to eq((0..255).to_a.reverse)
+    end
+  end
+
+  describe "#run_pixels" do
+    let(:config) do
+      Configuration.new.tap do |c|
+        c.localization_preprocessing = :none
+        c.localization_guard_area_threshold = 100
+        c.localization_guard_aspect = 3..50
+        c.localization_barcode_aspect = 0..10
+      end
+    end
+    let(:pixels) { File.binread("spec/fixtures/256x256_assorted_rectangles.raw") }
+    let(:reversed) { Guards.new.invert(pixels) }
+
+    it "only finds reversed barcodes with light polarity" do
+      expect(Guards.new(config).run_pixels(pixels, 256, 256)).not_to be_empty
+      expect(Guards.new(config).run_pixels(reversed, 256, 256)).to be_empty
+
+      config.localization_polarity = :light
+      expect(Guards.new(config).run_pixels(reversed, 256, 256)).not_to be_empty
+    end
+
+    it "finds the same barcodes in other Ractors, with a shared configuration" do
+      expected = Guards.new(config).run_pixels(pixels, 256, 256).map(&:score)
+      shared = Ractor.make_shareable(config)
+      ractors = 2.times.map do
+        Ractor.new(shared, pixels) { |c, px| Guards.new(c).run_pixels(px, 256, 256).map(&:score) }
+      end
+
+      expect(ractors.map(&:take)).to all(eq(expected))
+    end
+  end
+
+  describe "Ruby417.share_configuration" do
+    around do |example|
+      original = Ruby417.configuration
+      Ruby417.configuration = Configuration.new
+      example.run
+      Ruby417.configuration = original
+    end
+
+    it "makes the configuration usable from other Ractors" do
+      expect { Ractor.new { Ruby417.configuration }.take }.to raise_error(Ractor::RemoteError)
+
+      Ruby417.share_configuration
+      expect(Ruby417.configuration).to be_frozen
+      expect(Ractor.new { Ruby417.configuration.localization_guard_aspect }.take).to eq(3..40)
+    end
   end
 end
@@ -16,6 +16,20 @@ RSpec.describe LocatedBarcode do
       expect(code.height).to eq(Point.new(4, 1).distance(Point.new(5, 2)))
     end
   end
+
+  describe "#dup" do
+    it "should copy the corners, symbols and rectified image" do
+      rectified = RectifiedImage.new("\x00".b * 4, 2, 2)
+      code = LocatedBarcode.new(0, Point.new(0, 0), Point.new(0, 1), Point.new(5, 2), Point.new(4, 1), [[1, 2]], rectified)
+      copy = code.dup
+      copy.upper_right.x = 9
+      copy.symbols.first[0] = 9
+      copy.rectified.pixels.setbyte(0, 9)
+      expect(code.upper_right).to eq(Point.new(4, 1))
+      expect(code.symbols).to eq([[1, 2]])
+      expect(code.rectified.pixels).to eq("\x00".b * 4)
+    end
+  end
 end
 
 RSpec.describe Point do
@@ -0,0 +1,34 @@
+require "spec_helper"
+
+include Localization
+
+RSpec.describe Morphology do
+  describe "#run_pixels" do
+    # a 240x80 field of bars, from (80, 110) to (320, 190)
+    let(:bars) do
+      (0...300).flat_map do |y|
+        (0...400).map { |x| x >= 80 && x < 320 && y >= 110 && y < 190 && (x - 80) / 6 * 7 % 3 == 0 }
+      end
+    end
+    let(:pixels) { bars.map { |bar| bar ? 20 : 230 }.pack("C*") }
+    let(:reversed) { bars.map { |bar| bar ? 230 : 20 }.pack("C*") }
+    let(:config) do
+      Configuration.new.tap do |c|
+        c.localization_guard_area_threshold = 1000
+        c.localization_barcode_aspect = 1..10
+      end
+    end
+
+    it "locates a field of bars" do
+      codes = Morphology.new(config).run_pixels(pixels, 400, 300)
+
+      expect(codes).to be_one
+      expect(codes.first.width).to be_within(16).of(240)
+      expect(codes.first.height).to be_within(16).of(80)
+    end
+
+    it "finds reversed barcodes without inverting" do
+      expect(Morphology.new(config).run_pixels(reversed, 400, 300)).to be_one
+    end
+  end
+end
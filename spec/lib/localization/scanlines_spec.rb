@@ -0,0 +1,29 @@
+require "spec_helper"
+
+include Localization
+
+RSpec.describe Scanlines do
+  describe "#run_pixels" do
+    # the start pattern, five codewords and the stop pattern, 3 pixels a module
+    let(:elements) { [8, 1, 1, 1, 1, 1, 1, 3, 3, 1, 1, 2, 4, 1, 2, 3, 1, 2, 5, 1, 1, 3, 2, 2, 2, 3, 1, 1, 3, 2, 4, 1,
+                      4, 1, 2, 2, 1, 1, 1, 5, 1, 1, 3, 4, 2, 2, 1, 3, 7, 1, 1, 3, 1, 1, 1, 2, 1] }
+    let(:row) do
+      [255] * 70 + elements.each_with_index.flat_map { |e, i| [i.even? ? 0 : 255] * (3*e) } + [255] * 70
+    end
+    let(:pixels) { (0...200).flat_map { |y| y >= 55 && y < 145 ? row : [255] * 500 }.pack("C*") }
+    let(:config) { Configuration.new.tap { |c| c.localization_preprocessing = :half } }
+
+    it "locates a barcode without closing its patterns" do
+      config.localization_preprocessing = :full
+      codes = Scanlines.new(config).run_pixels(pixels, 500, 200)
+
+      expect(codes).to be_one
+      expect(codes.first.width).to be_within(8).of(360)
+      expect(codes.first.height).to be_within(8).of(90)
+    end
+
+    it "only locates" do
+      expect { Scanlines.new(config).run_pixels(pixels, 500, 200, decode: true) }.to raise_error(ArgumentError)
+    end
+  end
+end